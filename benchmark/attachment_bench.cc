@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+#include "benchmark_pb.srpc.h"
+
+using namespace srpc;
+
+#define READ_SIZE		(64 * 1024)
+#define ENCODE_IOV_MAX	1024
+#define GET_CURRENT_NS	std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+
+// what the network does between encode() and append()
+static bool transfer(SRPCStdRequest *req, SRPCStdRequest *peer, size_t *wire)
+{
+	struct iovec vectors[ENCODE_IOV_MAX];
+	int cnt = req->encode(vectors, ENCODE_IOV_MAX);
+	int ret = 0;
+
+	for (int i = 0; i < cnt && ret == 0; i++)
+	{
+		const char *p = (const char *)vectors[i].iov_base;
+		size_t left = vectors[i].iov_len;
+
+		*wire += left;
+		while (left > 0 && ret == 0)
+		{
+			size_t size = left > READ_SIZE ? READ_SIZE : left;
+
+			ret = peer->append(p, &size);
+			p += size;
+			left -= size;
+		}
+	}
+
+	return cnt > 0 && ret == 1;
+}
+
+static void prepare(SRPCStdRequest *req, RPCCompressType type)
+{
+	req->set_service_name("BenchmarkPB");
+	req->set_method_name("echo_pb");
+	req->set_data_type(RPCDataProtobuf);
+	req->set_compress_type(type);
+	// a client knows it from the replies of the server
+	req->set_peer_features(SRPC_FEATURE_KNOWN | SRPC_FEATURE_ATTACHMENT);
+}
+
+static bool receive(SRPCStdRequest *peer)
+{
+	return peer->deserialize_meta() && peer->decompress() == RPCStatusOK;
+}
+
+// the blob is copied into a bytes field, serialized and parsed on the peer
+static bool bytes_field(const std::string& blob, RPCCompressType type,
+						size_t *wire)
+{
+	SRPCStdRequest req;
+	SRPCStdRequest peer;
+	FixLengthPBMsg msg;
+	FixLengthPBMsg out;
+
+	prepare(&req, type);
+	msg.set_msg(blob);
+	if (req.serialize(&msg) != RPCStatusOK || req.compress() != RPCStatusOK ||
+		!req.serialize_meta() || !transfer(&req, &peer, wire) ||
+		!receive(&peer) || peer.deserialize(&out) != RPCStatusOK)
+	{
+		return false;
+	}
+
+	return out.msg().size() == blob.size();
+}
+
+// the blob goes as NOCOPY attachment next to an empty message
+static bool attachment(const std::string& blob, RPCCompressType type,
+					   size_t *wire)
+{
+	SRPCStdRequest req;
+	SRPCStdRequest peer;
+	EmptyPBMsg msg;
+	EmptyPBMsg out;
+	const char *att;
+	size_t len;
+
+	prepare(&req, type);
+	req.set_attachment_nocopy(blob.data(), blob.size());
+	req.set_attachment_compress_type(type);
+	if (req.serialize(&msg) != RPCStatusOK || req.compress() != RPCStatusOK ||
+		!req.serialize_meta() || !transfer(&req, &peer, wire) ||
+		!receive(&peer) || peer.deserialize(&out) != RPCStatusOK ||
+		!peer.get_attachment_nocopy(&att, &len))
+	{
+		return false;
+	}
+
+	return len == blob.size();
+}
+
+static void run(const char *name,
+				bool (*func)(const std::string&, RPCCompressType, size_t *),
+				const std::string& blob, RPCCompressType type, int loop)
+{
+	size_t wire = 0;
+	long long ns_st = GET_CURRENT_NS;
+
+	for (int i = 0; i < loop; i++)
+	{
+		if (!func(blob, type, &wire))
+		{
+			fprintf(stderr, "%s failed\n", name);
+			abort();
+		}
+	}
+
+	fprintf(stdout, "%-12s wire bytes/msg = %zu  us/msg = %.1lf\n", name,
+			wire / loop, (double)(GET_CURRENT_NS - ns_st) / loop / 1000);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 3 && argc != 4)
+	{
+		fprintf(stderr, "Usage: %s <BLOB_BYTES> <LOOP_TIMES> [COMPRESS_TYPE]\n",
+				argv[0]);
+		abort();
+	}
+
+	size_t blob_size = atoi(argv[1]);
+	int loop = atoi(argv[2]);
+	RPCCompressType type = RPCCompressNone;
+	std::string blob(blob_size, 0);
+
+	if (argc == 4)
+		type = (RPCCompressType)atoi(argv[3]);
+
+	// half random, so that compression has something to do
+	for (size_t i = 0; i < blob_size; i++)
+		blob[i] = (i & 1) ? 'b' : (char)rand();
+
+	run("bytes field", bytes_field, blob, type, loop);
+	run("attachment", attachment, blob, type, loop);
+	return 0;
+}
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_set>
+#include <chrono>
+#include "srpc/rpc_buffer.h"
+
+using namespace srpc;
+
+#define ENCODE_IOV_MAX	1024
+#define ENCODE_IOV_SHORT	8
+#define GET_CURRENT_NS	std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+
+static long long alloc_count = 0;
+static long long span_count = 0;
+
+#ifdef __GLIBC__
+// count every malloc()/realloc(), operator new is routed through malloc()
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+	alloc_count++;
+	return __libc_malloc(size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+	alloc_count++;
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+// same as RPCOutputStream: ask for the remaining size, back up the unused tail
+static void serialize_message(RPCBuffer *buf, const std::string& msg)
+{
+	size_t left = msg.size();
+	const char *p = msg.data();
+	void *out;
+	size_t sz;
+
+	while (left > 0)
+	{
+		sz = left;
+		if (!buf->acquire(&out, &sz))
+			abort();
+
+		if (sz > left)
+		{
+			memcpy(out, p, left);
+			buf->backup(sz - left);
+			break;
+		}
+
+		memcpy(out, p, sz);
+		p += sz;
+		left -= sz;
+	}
+}
+
+// same as SRPCMessage::append(): the body arrives in network sized reads,
+// and each piece is sized by the rest of the body
+static void receive_message(RPCBuffer *buf, const std::string& msg,
+							size_t read_size)
+{
+	for (size_t off = 0; off < msg.size(); off += read_size)
+	{
+		const char *p = msg.data() + off;
+		size_t len = msg.size() - off;
+
+		if (len > read_size)
+			len = read_size;
+
+		while (len > 0)
+		{
+			void *out;
+			size_t sz = msg.size() - buf->size();
+
+			if (!buf->acquire(&out, &sz))
+				abort();
+
+			if (sz > len)
+			{
+				memcpy(out, p, len);
+				buf->backup(sz - len);
+				break;
+			}
+
+			memcpy(out, p, sz);
+			p += sz;
+			len -= sz;
+		}
+	}
+}
+
+static size_t consume_message(RPCBuffer *buf)
+{
+	const void *p;
+	size_t len;
+	size_t total = 0;
+
+	while ((len = buf->fetch(&p)) > 0)
+	{
+		total += ((const char *)p)[len - 1] + len;
+		span_count++;
+	}
+
+	return total;
+}
+
+// a large message: each 256KB holds one big nocopy blob and
+// 64 small fields that are copied in
+static void build_message(RPCBuffer *buf, const std::string& msg)
+{
+	static const char field[16] = "field header";
+	size_t off = 0;
+
+	while (off < msg.size())
+	{
+		size_t len = msg.size() - off;
+
+		if (len > 256 * 1024 - 64 * 256)
+			len = 256 * 1024 - 64 * 256;
+
+		buf->append(msg.data() + off, len, BUFFER_MODE_NOCOPY);
+		off += len;
+		for (int i = 0; i < 64 && off < msg.size(); i++)
+		{
+			len = msg.size() - off;
+			if (len > 256 - sizeof field)
+				len = 256 - sizeof field;
+
+			buf->append(field, sizeof field, BUFFER_MODE_COPY);
+			buf->append(msg.data() + off, len, BUFFER_MODE_NOCOPY);
+			off += len;
+		}
+	}
+}
+
+// bytes in iovs that do not point to a piece that existed before encode()
+static size_t copied_bytes(const std::unordered_set<const void *>& pieces,
+						   const struct iovec *iov, int n)
+{
+	size_t copied = 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		if (pieces.count(iov[i].iov_base) == 0)
+			copied += iov[i].iov_len;
+	}
+
+	return copied;
+}
+
+static void report(const char *name, long long allocs, long long ns, int loop)
+{
+	fprintf(stdout, "%-24s allocations/msg = %.2lf  ns/msg = %.1lf\n",
+			name, (double)allocs / loop, (double)ns / loop);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "Usage: %s <MESSAGE_BYTES> <LOOP_TIMES>\n", argv[0]);
+		abort();
+	}
+
+	size_t msg_size = atoi(argv[1]);
+	int loop = atoi(argv[2]);
+	std::string msg(msg_size, 'm');
+	struct iovec iov[8];
+	size_t check = 0;
+	long long allocs;
+	long long ns_st;
+
+	allocs = alloc_count;
+	ns_st = GET_CURRENT_NS;
+	for (int i = 0; i < loop; i++)
+	{
+		RPCBuffer *buf = new RPCBuffer();
+
+		serialize_message(buf, msg);
+		check += buf->encode(iov, 8);
+		delete buf;
+	}
+
+	report("serialize+encode", alloc_count - allocs - loop,
+		   GET_CURRENT_NS - ns_st, loop);
+
+	allocs = alloc_count;
+	span_count = 0;
+	ns_st = GET_CURRENT_NS;
+	for (int i = 0; i < loop; i++)
+	{
+		RPCBuffer *buf = new RPCBuffer();
+
+		receive_message(buf, msg, 1460);
+		check += consume_message(buf);
+		delete buf;
+	}
+
+	report("receive+fetch", alloc_count - allocs - loop,
+		   GET_CURRENT_NS - ns_st, loop);
+	fprintf(stdout, "%-24s spans/msg = %.2lf\n", "receive+fetch",
+			(double)span_count / loop);
+
+	struct iovec *big_iov = new struct iovec[ENCODE_IOV_MAX];
+	long long ns_encode = 0;
+	long long ns_short = 0;
+	size_t copied_encode = 0;
+	size_t copied_short = 0;
+
+	for (int i = 0; i < loop; i++)
+	{
+		std::unordered_set<const void *> pieces;
+		RPCBuffer *buf = new RPCBuffer();
+		const void *p;
+		int n;
+
+		build_message(buf, msg);
+		while (buf->fetch(&p) > 0)
+			pieces.insert(p);
+
+		ns_st = GET_CURRENT_NS;
+		n = buf->encode(big_iov, ENCODE_IOV_MAX);
+		ns_encode += GET_CURRENT_NS - ns_st;
+		copied_encode += copied_bytes(pieces, big_iov, n);
+		check += n;
+
+		// fewer iov than pieces, runs of small pieces are merged
+		ns_st = GET_CURRENT_NS;
+		n = buf->encode(big_iov, ENCODE_IOV_SHORT);
+		ns_short += GET_CURRENT_NS - ns_st;
+		copied_short += copied_bytes(pieces, big_iov, n);
+		check += n;
+		delete buf;
+	}
+
+	fprintf(stdout, "%-24s bytes copied/msg = %.1lf  ns/msg = %.1lf\n",
+			"encode", (double)copied_encode / loop, (double)ns_encode / loop);
+	fprintf(stdout, "%-24s bytes copied/msg = %.1lf  ns/msg = %.1lf\n",
+			"encode short iov", (double)copied_short / loop,
+			(double)ns_short / loop);
+	delete []big_iov;
+
+	RPCBufferPoolStats stats;
+
+	RPCBufferPool::get_stats(&stats);
+	fprintf(stdout, "piece pool hit = %zu  miss = %zu  retained bytes = %zu\n",
+			stats.hit, stats.miss, stats.retained_bytes);
+
+	fprintf(stderr, "(check %zu, RPCBuffer object itself excluded)\n", check);
+	return 0;
+}
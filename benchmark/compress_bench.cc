@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+#include "srpc/rpc_buffer.h"
+#include "srpc/rpc_compress.h"
+
+using namespace srpc;
+
+#define GET_CURRENT_NS	std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+
+static long long alloc_count = 0;
+
+#ifdef __GLIBC__
+// count every malloc()/calloc(), operator new is routed through malloc()
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+	alloc_count++;
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+	alloc_count++;
+	return __libc_calloc(n, size);
+}
+#endif
+
+static const struct
+{
+	const char *name;
+	RPCCompressType type;
+} kTypes[] =
+{
+	{ "snappy",	RPCCompressSnappy	},
+	{ "gzip",	RPCCompressGzip		},
+	{ "zlib",	RPCCompressZlib		},
+	{ "lz4",	RPCCompressLz4		},
+	{ "zstd",	RPCCompressZstd		},
+};
+
+static const size_t kSizes[] = { 1024, 16 * 1024, 1024 * 1024 };
+
+// some words, so that every algorithm has something to do
+static std::string make_payload(size_t size)
+{
+	static const char *words[] = {
+		"srpc ", "workflow ", "message ", "compress ", "buffer ", "0123 ",
+	};
+	std::string payload;
+
+	while (payload.size() < size)
+		payload += words[rand() % 6];
+
+	payload.resize(size);
+	return payload;
+}
+
+static void run(const char *name, RPCCompressType type,
+				const std::string& payload, int loop)
+{
+	RPCCompressor *compressor = RPCCompressor::get_instance();
+	long long compress_ns = 0;
+	long long decompress_ns = 0;
+	long long allocs = alloc_count;
+	size_t compressed = 0;
+
+	// zstd is only there when srpc is built with it
+	if (!compressor->find_handler(type))
+		return;
+
+	for (int i = 0; i < loop; i++)
+	{
+		RPCBuffer src;
+		RPCBuffer dst;
+		RPCBuffer out;
+		long long ns_st;
+		int ret;
+
+		src.append(payload.data(), payload.size(), BUFFER_MODE_NOCOPY);
+		ns_st = GET_CURRENT_NS;
+		ret = compressor->serialize_to_compressed(&src, &dst, type);
+		compress_ns += GET_CURRENT_NS - ns_st;
+		if (ret <= 0)
+		{
+			fprintf(stderr, "%s compress failed\n", name);
+			abort();
+		}
+
+		compressed += ret;
+		ns_st = GET_CURRENT_NS;
+		ret = compressor->parse_from_compressed(&dst, &out, type);
+		decompress_ns += GET_CURRENT_NS - ns_st;
+		if (ret != (int)payload.size())
+		{
+			fprintf(stderr, "%s decompress failed\n", name);
+			abort();
+		}
+	}
+
+	fprintf(stdout, "%-8s %8zu bytes  ratio = %.2lf  compress us = %8.1lf  "
+			"decompress us = %8.1lf  allocations = %.1lf\n",
+			name, payload.size(), (double)compressed / loop / payload.size(),
+			(double)compress_ns / loop / 1000,
+			(double)decompress_ns / loop / 1000,
+			(double)(alloc_count - allocs) / loop);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 2)
+	{
+		fprintf(stderr, "Usage: %s <LOOP_TIMES_FOR_1KB>\n", argv[0]);
+		abort();
+	}
+
+	int loop = atoi(argv[1]);
+
+	for (int cached = 1; cached >= 0; cached--)
+	{
+		// 0 is what every call did before: create the context and free it
+		RPCCompressor::get_instance()->set_max_cached_contexts(cached);
+		fprintf(stdout, "%s contexts\n", cached ? "per-thread" : "per-call");
+
+		for (size_t size : kSizes)
+		{
+			std::string payload = make_payload(size);
+			int n = (int)(loop * 1024 / size);
+
+			if (n < 1)
+				n = 1;
+
+			for (const auto& t : kTypes)
+				run(t.name, t.type, payload, n);
+		}
+	}
+
+	return 0;
+}
+
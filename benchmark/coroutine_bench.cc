@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "coroutine/benchmark_pb.srpc.h"
+#include "workflow/WFFacilities.h"
+
+using namespace srpc;
+
+#define GET_CURRENT_US	std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+
+static BenchmarkPB::SRPCClient *downstream;
+static std::atomic<int> errors(0);
+
+// echo_pb replies at once, slow_pb is a proxy awaiting echo_pb downstream
+class CoroutineServiceImpl : public BenchmarkPB::Service
+{
+public:
+	RPCCoroutine echo_pb(FixLengthPBMsg *request, EmptyPBMsg *response,
+						 RPCContext *ctx) override
+	{
+		co_return;
+	}
+
+	RPCCoroutine slow_pb(FixLengthPBMsg *request, EmptyPBMsg *response,
+						 RPCContext *ctx) override
+	{
+		auto res = co_await downstream->echo_pb(request);
+
+		if (!res.second.success)
+			errors++;
+	}
+};
+
+static void report(const char *name, int count, long long us)
+{
+	fprintf(stdout, "%-20s QPS = %8.0lf  avg us = %8.1lf  errors = %d\n",
+			name, 1e6 * count / us, (double)us / count, errors.load());
+	errors = 0;
+}
+
+// a thread blocked on the future of each request
+static void run_future(BenchmarkPB::SRPCClient *client, bool proxy,
+					   const FixLengthPBMsg& req, int count, int parallel)
+{
+	std::vector<std::thread> threads;
+	long long us_st = GET_CURRENT_US;
+
+	for (int i = 0; i < parallel; i++)
+	{
+		threads.emplace_back([&, i]() {
+			for (int j = i; j < count; j += parallel)
+			{
+				auto res = proxy ? client->async_slow_pb(&req).get() :
+								   client->async_echo_pb(&req).get();
+
+				if (!res.second.success)
+					errors++;
+			}
+		});
+	}
+
+	for (auto& th : threads)
+		th.join();
+
+	report(proxy ? "future proxy" : "future", count, GET_CURRENT_US - us_st);
+}
+
+// a thread blocked on its own receiver, nothing allocated but the task
+static void run_sync(BenchmarkPB::SRPCClient *client, bool proxy,
+					 const FixLengthPBMsg& req, int count, int parallel)
+{
+	std::vector<std::thread> threads;
+	long long us_st = GET_CURRENT_US;
+
+	for (int i = 0; i < parallel; i++)
+	{
+		threads.emplace_back([&, i]() {
+			EmptyPBMsg resp;
+			RPCSyncContext sync_ctx;
+
+			for (int j = i; j < count; j += parallel)
+			{
+				if (proxy)
+					client->slow_pb(&req, &resp, &sync_ctx);
+				else
+					client->echo_pb(&req, &resp, &sync_ctx);
+
+				if (!sync_ctx.success)
+					errors++;
+			}
+		});
+	}
+
+	for (auto& th : threads)
+		th.join();
+
+	report(proxy ? "sync proxy" : "sync", count, GET_CURRENT_US - us_st);
+}
+
+static RPCCoroutine loop(BenchmarkPB::SRPCClient *client, bool proxy,
+						 const FixLengthPBMsg *req, int n,
+						 WFFacilities::WaitGroup *wait_group)
+{
+	for (int i = 0; i < n; i++)
+	{
+		auto res = proxy ? co_await client->slow_pb(req) :
+						   co_await client->echo_pb(req);
+
+		if (!res.second.success)
+			errors++;
+	}
+
+	wait_group->done();
+}
+
+// a coroutine for each request in flight, no thread is blocked
+static void run_coroutine(BenchmarkPB::SRPCClient *client, bool proxy,
+						  const FixLengthPBMsg& req, int count, int parallel)
+{
+	WFFacilities::WaitGroup wait_group(parallel);
+	long long us_st = GET_CURRENT_US;
+
+	for (int i = 0; i < parallel; i++)
+	{
+		int n = count / parallel + (i < count % parallel ? 1 : 0);
+
+		loop(client, proxy, &req, n, &wait_group).start();
+	}
+
+	wait_group.wait();
+	report(proxy ? "coroutine proxy" : "coroutine", count,
+		   GET_CURRENT_US - us_st);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 5)
+	{
+		fprintf(stderr, "Usage: %s <PORT> <REQUESTS> <PARALLEL> <REQ_SIZE>\n",
+				argv[0]);
+		abort();
+	}
+
+	unsigned short port = atoi(argv[1]);
+	int count = atoi(argv[2]);
+	int parallel = atoi(argv[3]);
+	int req_size = atoi(argv[4]);
+
+	if (parallel <= 0 || parallel > count)
+	{
+		fprintf(stderr, "PARALLEL must be in [1, REQUESTS]\n");
+		abort();
+	}
+
+	SRPCServer server;
+	CoroutineServiceImpl impl;
+	FixLengthPBMsg req;
+
+	server.add_service(&impl);
+	if (server.start(port) != 0)
+	{
+		perror("server start");
+		exit(1);
+	}
+
+	BenchmarkPB::SRPCClient client("127.0.0.1", port);
+
+	downstream = &client;
+	req.set_msg(std::string(req_size, 'x'));
+
+	run_future(&client, false, req, count, parallel);
+	run_sync(&client, false, req, count, parallel);
+	run_coroutine(&client, false, req, count, parallel);
+	run_future(&client, true, req, count, parallel);
+	run_sync(&client, true, req, count, parallel);
+	run_coroutine(&client, true, req, count, parallel);
+
+	server.stop();
+	return 0;
+}
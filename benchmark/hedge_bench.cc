@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "benchmark_pb.srpc.h"
+#include "workflow/WFFacilities.h"
+
+using namespace srpc;
+
+#define GET_CURRENT_US	std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+
+static int slow_percent;
+static int slow_ms;
+
+// a local server which is slow for some of the requests
+class SlowServiceImpl : public BenchmarkPB::Service
+{
+public:
+	void echo_pb(FixLengthPBMsg *request, EmptyPBMsg *response,
+				 RPCContext *ctx) override
+	{
+		if (rand() % 100 < slow_percent)
+		{
+			auto *task = WFTaskFactory::create_timer_task(slow_ms * 1000,
+														  nullptr);
+			ctx->get_series()->push_back(task);
+		}
+	}
+
+	void slow_pb(FixLengthPBMsg *request, EmptyPBMsg *response,
+				 RPCContext *ctx) override
+	{
+	}
+};
+
+static void run(const char *name, unsigned short port, int hedge_delay,
+				double percentile, int count, int parallel)
+{
+	RPCClientParams params = RPC_CLIENT_PARAMS_DEFAULT;
+	std::vector<long long> latencies;
+	std::atomic<int> hedges(0);
+	std::atomic<int> errors(0);
+	std::mutex mutex;
+	FixLengthPBMsg req;
+
+	params.endpoints = { { "127.0.0.1", port, 1 },
+						 { "127.0.0.1", (unsigned short)(port + 1), 1 } };
+	params.task_params.hedge_policy.delay = hedge_delay;
+	params.task_params.hedge_policy.percentile = percentile;
+	req.set_msg(std::string(100, 'x'));
+
+	BenchmarkPB::SRPCClient client(&params);
+
+	// parallel requests in flight, one more is sent when one is done
+	for (int i = 0; i < count; i += parallel)
+	{
+		int n = std::min(parallel, count - i);
+		WFFacilities::WaitGroup wait_group(n);
+
+		for (int j = 0; j < n; j++)
+		{
+			long long us_st = GET_CURRENT_US;
+
+			client.echo_pb(&req, [&, us_st](EmptyPBMsg *resp, RPCContext *ctx) {
+				if (ctx->success())
+				{
+					if (ctx->get_attempt() != 0)
+						hedges++;
+
+					mutex.lock();
+					latencies.push_back(GET_CURRENT_US - us_st);
+					mutex.unlock();
+				}
+				else
+					errors++;
+
+				wait_group.done();
+			});
+		}
+
+		wait_group.wait();
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	size_t n = latencies.size();
+
+	if (n == 0)
+	{
+		fprintf(stderr, "%s all failed\n", name);
+		abort();
+	}
+
+	fprintf(stdout, "%-16s p50 us = %6lld  p99 us = %6lld  p999 us = %6lld  "
+			"hedge wins = %5.2lf%%  errors = %d\n", name,
+			latencies[n / 2], latencies[n * 99 / 100], latencies[n * 999 / 1000],
+			100.0 * hedges / n, errors.load());
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 6)
+	{
+		fprintf(stderr, "Usage: %s <PORT> <REQUESTS> <PARALLEL> "
+				"<SLOW_PERCENT> <SLOW_MS>\n", argv[0]);
+		abort();
+	}
+
+	unsigned short port = atoi(argv[1]);
+	int count = atoi(argv[2]);
+	int parallel = atoi(argv[3]);
+
+	slow_percent = atoi(argv[4]);
+	slow_ms = atoi(argv[5]);
+
+	SRPCServer server1;
+	SRPCServer server2;
+	SlowServiceImpl impl;
+
+	server1.add_service(&impl);
+	server2.add_service(&impl);
+	if (server1.start(port) != 0 || server2.start(port + 1) != 0)
+	{
+		perror("server start");
+		exit(1);
+	}
+
+	run("no hedge", port, 0, 0, count, parallel);
+	run("hedge 2ms", port, 2, 0, count, parallel);
+	run("hedge p95", port, 2, 0.95, count, parallel);
+
+	server1.stop();
+	server2.stop();
+	return 0;
+}
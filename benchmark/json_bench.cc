@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+#include <google/protobuf/util/json_util.h>
+#include <google/protobuf/util/type_resolver_util.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include "benchmark_pb.srpc.h"
+#include "srpc/rpc_pb_json.h"
+
+using namespace srpc;
+using namespace google::protobuf;
+
+#define GET_CURRENT_NS	std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+
+static const char *kTypeUrlPrefix = "type.googleapis.com";
+static util::TypeResolver *resolver;
+
+static std::string type_url(const ProtobufIDLMessage *msg)
+{
+	return std::string(kTypeUrlPrefix) + "/" + msg->GetDescriptor()->full_name();
+}
+
+// what SRPCMessage did before: binary in the middle, json by TypeResolver
+static bool util_serialize(const ProtobufIDLMessage *msg, RPCBuffer *buf)
+{
+	std::string binary = msg->SerializeAsString();
+	io::ArrayInputStream input(binary.data(), (int)binary.size());
+	RPCOutputStream output(buf, msg->ByteSizeLong());
+	util::JsonPrintOptions options;
+
+	return util::BinaryToJsonStream(resolver, type_url(msg), &input,
+									&output, options).ok();
+}
+
+static bool util_deserialize(RPCBuffer *buf, ProtobufIDLMessage *msg)
+{
+	std::string binary;
+	io::StringOutputStream output(&binary);
+	RPCInputStream input(buf);
+	util::JsonParseOptions options;
+
+	options.ignore_unknown_fields = true;
+	if (!util::JsonToBinaryStream(resolver, type_url(msg), &input,
+								  &output, options).ok())
+	{
+		return false;
+	}
+
+	return msg->ParseFromString(binary);
+}
+
+static bool codec_serialize(const ProtobufIDLMessage *msg, RPCBuffer *buf)
+{
+	RPCOutputStream output(buf, msg->ByteSizeLong());
+
+	return ProtobufJsonCodec::serialize(msg, 0, &output);
+}
+
+static bool codec_deserialize(RPCBuffer *buf, ProtobufIDLMessage *msg)
+{
+	RPCInputStream input(buf);
+
+	return ProtobufJsonCodec::deserialize(&input, msg);
+}
+
+static void prepare(JsonPBMsg *msg, int items)
+{
+	msg->set_title("json benchmark \"title\"\n");
+	for (int i = 0; i < items; i++)
+	{
+		JsonItemPBMsg *item = msg->add_items();
+
+		item->set_id(i);
+		item->set_name("item_" + std::to_string(i));
+		item->set_score(i / 3.0);
+		item->add_tags(i * 1000000007LL);
+		item->add_tags(-i);
+		item->set_enabled(i & 1);
+		(*msg->mutable_labels())["label_" + std::to_string(i)] = "value";
+	}
+
+	msg->set_blob(std::string(items * 4, 'b'));
+}
+
+static void run(const char *name,
+				bool (*ser)(const ProtobufIDLMessage *, RPCBuffer *),
+				bool (*deser)(RPCBuffer *, ProtobufIDLMessage *),
+				const JsonPBMsg& msg, int loop)
+{
+	size_t bytes = 0;
+	long long ser_ns = 0;
+	long long deser_ns = 0;
+
+	for (int i = 0; i < loop; i++)
+	{
+		RPCBuffer buf;
+		JsonPBMsg out;
+		long long ns_st = GET_CURRENT_NS;
+
+		if (!ser(&msg, &buf))
+		{
+			fprintf(stderr, "%s serialize failed\n", name);
+			abort();
+		}
+
+		ser_ns += GET_CURRENT_NS - ns_st;
+		bytes += buf.size();
+		ns_st = GET_CURRENT_NS;
+		if (!deser(&buf, &out) || out.items_size() != msg.items_size())
+		{
+			fprintf(stderr, "%s deserialize failed\n", name);
+			abort();
+		}
+
+		deser_ns += GET_CURRENT_NS - ns_st;
+	}
+
+	fprintf(stdout, "%-8s json bytes/msg = %zu  serialize us/msg = %.1lf  "
+			"deserialize us/msg = %.1lf\n", name, bytes / loop,
+			(double)ser_ns / loop / 1000, (double)deser_ns / loop / 1000);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "Usage: %s <ITEMS> <LOOP_TIMES>\n", argv[0]);
+		abort();
+	}
+
+	int items = atoi(argv[1]);
+	int loop = atoi(argv[2]);
+	JsonPBMsg msg;
+
+	GOOGLE_PROTOBUF_VERIFY_VERSION;
+	resolver = util::NewTypeResolverForDescriptorPool(kTypeUrlPrefix,
+											DescriptorPool::generated_pool());
+	prepare(&msg, items);
+
+	run("util", util_serialize, util_deserialize, msg, loop);
+	run("codec", codec_serialize, codec_deserialize, msg, loop);
+
+	delete resolver;
+	google::protobuf::ShutdownProtobufLibrary();
+	return 0;
+}
+
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+#include "srpc/rpc_message_srpc.h"
+#include "srpc/rpc_module.h"
+
+using namespace srpc;
+
+#define GET_CURRENT_NS	std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+
+// what a client with the trace module sends for a 100 bytes payload
+static void prepare(SRPCStdRequest *req, int version, bool method_id_only)
+{
+	const char *service = "benchmark.BenchmarkPB";
+	const char *method = "echo_pb";
+	RPCModuleData data;
+
+	req->set_meta_version(version);
+	req->set_service_name(service);
+	req->set_method_name(method);
+	req->set_method_id(RPC_METHOD_ID(service, method));
+	req->set_method_id_only(method_id_only);
+	req->set_data_type(RPCDataProtobuf);
+	req->set_compress_type(RPCCompressLz4);
+	req->set_seqid(1);
+	data[SRPC_TRACE_ID] = std::string(SRPC_TRACEID_SIZE, 't');
+	data[SRPC_SPAN_ID] = std::string(SRPC_SPANID_SIZE, 's');
+	req->set_meta_module_data(data);
+}
+
+static void prepare(SRPCStdResponse *resp, int version)
+{
+	resp->set_meta_version(version);
+	resp->set_data_type(RPCDataProtobuf);
+	resp->set_compress_type(RPCCompressLz4);
+	resp->set_status_code(RPCStatusOK);
+	resp->set_seqid(1);
+}
+
+// received by append() as from the network, only the meta is timed
+template<class MSG, class PREPARE>
+static void run(const char *name, PREPARE prepare, int loop)
+{
+	long long encode_ns = 0;
+	long long decode_ns = 0;
+	size_t meta_len = 0;
+
+	for (int i = 0; i < loop; i++)
+	{
+		MSG msg;
+		MSG in;
+		struct iovec vectors[8];
+		std::string wire;
+		size_t size;
+		long long ns_st;
+
+		prepare(&msg);
+		ns_st = GET_CURRENT_NS;
+		if (!msg.serialize_meta())
+		{
+			fprintf(stderr, "%s serialize_meta failed\n", name);
+			abort();
+		}
+
+		encode_ns += GET_CURRENT_NS - ns_st;
+		int cnt = msg.encode(vectors, 8);
+
+		for (int j = 0; j < cnt; j++)
+			wire.append((const char *)vectors[j].iov_base, vectors[j].iov_len);
+
+		meta_len += wire.size() - SRPC_HEADER_SIZE;
+		size = wire.size();
+		if (in.append(wire.data(), &size) != 1)
+		{
+			fprintf(stderr, "%s append failed\n", name);
+			abort();
+		}
+
+		ns_st = GET_CURRENT_NS;
+		if (!in.deserialize_meta())
+		{
+			fprintf(stderr, "%s deserialize_meta failed\n", name);
+			abort();
+		}
+
+		decode_ns += GET_CURRENT_NS - ns_st;
+	}
+
+	fprintf(stdout, "%-20s meta bytes = %3zu  encode ns/msg = %6.1lf  "
+			"decode ns/msg = %6.1lf\n", name, meta_len / loop,
+			(double)encode_ns / loop, (double)decode_ns / loop);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 2)
+	{
+		fprintf(stderr, "Usage: %s <LOOP_TIMES>\n", argv[0]);
+		abort();
+	}
+
+	int loop = atoi(argv[1]);
+
+	run<SRPCStdRequest>("request v1", [](SRPCStdRequest *req) {
+		prepare(req, SRPC_META_V1, false);
+	}, loop);
+	run<SRPCStdRequest>("request v2", [](SRPCStdRequest *req) {
+		prepare(req, SRPC_META_V2, false);
+	}, loop);
+	run<SRPCStdRequest>("request v2 id only", [](SRPCStdRequest *req) {
+		prepare(req, SRPC_META_V2, true);
+	}, loop);
+	run<SRPCStdResponse>("response v1", [](SRPCStdResponse *resp) {
+		prepare(resp, SRPC_META_V1);
+	}, loop);
+	run<SRPCStdResponse>("response v2", [](SRPCStdResponse *resp) {
+		prepare(resp, SRPC_META_V2);
+	}, loop);
+
+	return 0;
+}
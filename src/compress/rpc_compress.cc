@@ -14,14 +14,27 @@
   limitations under the License.
 */
 
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <workflow/WFGlobal.h>
+#include <workflow/WFTaskFactory.h>
 #include "rpc_compress.h"
 #include "rpc_compress_gzip.h"
 #include "rpc_compress_snappy.h"
 #include "rpc_compress_lz4.h"
+#ifdef SRPC_WITH_ZSTD
+#include "rpc_compress_zstd.h"
+#endif
 
 namespace srpc
 {
 
+static constexpr const char *COMPRESS_BLOCK_QUEUE = "srpc_compress_block";
+
 int RPCCompressor::add(RPCCompressType type)
 {
 	if (type >= RPCCompressMax || type <= RPCCompressNone)
@@ -68,6 +81,15 @@ int RPCCompressor::add(RPCCompressType type)
 		this->handler[type].decompress_iovec = LZ4DecompressIOVec;
 		this->handler[type].lease_size = LZ4LeaseSize;
 		break;
+#ifdef SRPC_WITH_ZSTD
+	case RPCCompressZstd:
+		this->handler[type].compress = ZstdCompress;
+		this->handler[type].decompress = ZstdDecompress;
+		this->handler[type].compress_iovec = ZstdCompressIOVec;
+		this->handler[type].decompress_iovec = ZstdDecompressIOVec;
+		this->handler[type].lease_size = ZstdLeaseSize;
+		break;
+#endif
 	default:
 		ret = -2;
 		break;
@@ -76,5 +98,496 @@ int RPCCompressor::add(RPCCompressType type)
 	return ret;
 }
 
+RPCCompressor::~RPCCompressor()
+{
+#ifdef SRPC_WITH_ZSTD
+	for (auto& kv : this->dictionaries)
+		delete kv.second;
+#endif
+}
+
+int RPCCompressor::add_dictionary(int type, uint32_t dict_id,
+								  const void *dict, size_t size)
+{
+#ifdef SRPC_WITH_ZSTD
+	if (type != RPCCompressZstd || dict_id == 0 || !dict || size == 0)
+		return -2;
+
+	ZstdDictionary *zstd_dict = new ZstdDictionary();
+
+	if (!zstd_dict->init(dict, size))
+	{
+		delete zstd_dict;
+		return -2;
+	}
+
+	auto ret = this->dictionaries.emplace(dict_id, zstd_dict);
+
+	if (ret.second)
+		return 0;
+
+	delete ret.first->second;
+	ret.first->second = zstd_dict;
+	return 1;
+#else
+	return -2;
+#endif
+}
+
+int RPCCompressor::set_dictionary_id(int type, const std::string& service,
+									 const std::string& method,
+									 uint32_t dict_id)
+{
+	if (type != RPCCompressZstd)
+		return -2;
+
+	auto key = std::make_pair(service, method);
+
+	if (dict_id == 0)
+	{
+		this->dictionary_ids.erase(key);
+		return 0;
+	}
+
+	if (this->dictionaries.find(dict_id) == this->dictionaries.end())
+		return -2;
+
+	this->dictionary_ids[key] = dict_id;
+	return 0;
+}
+
+uint32_t RPCCompressor::get_dictionary_id(int type, const std::string& service,
+										  const std::string& method) const
+{
+	using DictionaryKey = std::pair<const std::string&, const std::string&>;
+	static const std::string whole_service;
+
+	if (type != RPCCompressZstd || this->dictionary_ids.empty())
+		return 0;
+
+	auto it = this->dictionary_ids.find(DictionaryKey(service, method));
+
+	if (it == this->dictionary_ids.end() && !method.empty())
+		it = this->dictionary_ids.find(DictionaryKey(service, whole_service));
+
+	return it == this->dictionary_ids.end() ? 0 : it->second;
+}
+
+int RPCCompressor::parse_from_compressed(RPCBuffer *src, RPCBuffer *dest,
+										 int type, uint32_t dict_id) const
+{
+	if (dict_id == 0)
+		return this->parse_from_compressed(src, dest, type);
+
+#ifdef SRPC_WITH_ZSTD
+	auto it = this->dictionaries.find(dict_id);
+
+	if (type == RPCCompressZstd && it != this->dictionaries.end())
+		return ZstdDecompressIOVecDict(src, dest, it->second);
+#endif
+
+	return -2;
+}
+
+int RPCCompressor::serialize_to_compressed(RPCBuffer *src, RPCBuffer *dest,
+										   int type, uint32_t dict_id) const
+{
+	if (dict_id == 0)
+		return this->serialize_to_compressed(src, dest, type);
+
+#ifdef SRPC_WITH_ZSTD
+	auto it = this->dictionaries.find(dict_id);
+
+	if (type == RPCCompressZstd && it != this->dictionaries.end())
+		return ZstdCompressIOVecDict(src, dest, it->second);
+#endif
+
+	return -2;
+}
+
+// blocks are taken by index, so the caller never waits for a busy queue
+struct BlockJob
+{
+	std::function<bool (size_t)> run;
+	size_t count;
+	std::atomic<size_t> next;
+	size_t done;
+	bool failed;
+	std::mutex mutex;
+	std::condition_variable cond;
+};
+
+static void __block_job_work(BlockJob *job)
+{
+	size_t i;
+
+	while ((i = job->next++) < job->count)
+	{
+		bool ret = job->run(i);
+		std::lock_guard<std::mutex> lock(job->mutex);
+
+		if (!ret)
+			job->failed = true;
+
+		if (++job->done == job->count)
+			job->cond.notify_one();
+	}
+}
+
+// false if any block fails
+static bool __run_blocks(size_t count, std::function<bool (size_t)>&& run)
+{
+	auto job = std::make_shared<BlockJob>();
+	long threads = WFGlobal::get_global_settings()->compute_threads;
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	job->run = std::move(run);
+	job->count = count;
+	job->next = 0;
+	job->done = 0;
+	job->failed = false;
+
+	// a late go task finds nothing left, job is kept alive for it
+	for (long i = 1; i < threads && (size_t)i < count; i++)
+	{
+		WFTaskFactory::create_go_task(COMPRESS_BLOCK_QUEUE,
+									  [job]() { __block_job_work(job.get()); }
+									  )->start();
+	}
+
+	__block_job_work(job.get());
+
+	std::unique_lock<std::mutex> lock(job->mutex);
+
+	while (job->done < job->count)
+		job->cond.wait(lock);
+
+	return !job->failed;
+}
+
+int RPCCompressor::serialize_to_compressed_blocks(RPCBuffer *src,
+												  RPCBuffer *dest, int type,
+												  size_t block_size) const
+{
+	if (type >= RPCCompressMax
+		|| type <= RPCCompressNone
+		|| !this->handler[type].compress_iovec)
+	{
+		return -2;
+	}
+
+	if (block_size == 0 || src->size() == 0)
+		return -1;
+
+	CompressIOVecFunction compress = this->handler[type].compress_iovec;
+	size_t count = (src->size() + block_size - 1) / block_size;
+	std::vector<RPCBuffer> in(count);
+	std::vector<RPCBuffer> out(count);
+	std::vector<int> sizes(count);
+	size_t total = 0;
+	uint32_t len;
+
+	for (size_t i = 0; i < count; i++)
+		src->share(i * block_size, block_size, &in[i]);
+
+	if (!__run_blocks(count, [&](size_t i) -> bool {
+			sizes[i] = compress(&in[i], &out[i]);
+			return sizes[i] > 0;
+		}))
+	{
+		return -1;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		len = htonl((uint32_t)sizes[i]);
+		if (!dest->write(&len, sizeof len) ||
+			out[i].share(0, sizes[i], dest) != (size_t)sizes[i])
+		{
+			return -1;
+		}
+
+		total += sizeof len + sizes[i];
+	}
+
+	if (total > 0x7FFFFFFF)
+		return -1;
+
+	return (int)total;
+}
+
+int RPCCompressor::parse_from_compressed_blocks(RPCBuffer *src,
+												RPCBuffer *dest, int type,
+												size_t block_size) const
+{
+	if (type >= RPCCompressMax
+		|| type <= RPCCompressNone
+		|| !this->handler[type].decompress_iovec)
+	{
+		return -2;
+	}
+
+	if (block_size == 0 || block_size > 0x7FFFFFFF)
+		return -1;
+
+	DempressIOVecFunction decompress = this->handler[type].decompress_iovec;
+	std::vector<std::pair<size_t, size_t>> blocks;
+	size_t offset = 0;
+	size_t total = 0;
+	uint32_t len;
+
+	src->rewind();
+	while (offset < src->size())
+	{
+		if (!src->read(&len, sizeof len))
+			return -1;
+
+		len = ntohl(len);
+		offset += sizeof len;
+		if (len == 0 || len > src->size() - offset)
+			return -1;
+
+		blocks.emplace_back(offset, len);
+		src->seek(len);
+		offset += len;
+	}
+
+	size_t count = blocks.size();
+	std::vector<RPCBuffer> in(count);
+	std::vector<RPCBuffer> out(count);
+	std::vector<int> sizes(count);
+
+	for (size_t i = 0; i < count; i++)
+		src->share(blocks[i].first, blocks[i].second, &in[i]);
+
+	// every block is full but the last one
+	if (!__run_blocks(count, [&](size_t i) -> bool {
+			// the built-in ones stop at block_size instead of inflating all
+			RPCDecompressStream *stream;
+
+			stream = this->new_decompress_stream(&in[i], type, 0);
+			if (stream)
+			{
+				sizes[i] = stream->read_all(&out[i], block_size);
+				delete stream;
+			}
+			else
+				sizes[i] = decompress(&in[i], &out[i]);
+
+			return i + 1 == count ? sizes[i] > 0 && (size_t)sizes[i] <= block_size
+								  : (size_t)sizes[i] == block_size;
+		}))
+	{
+		return -1;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (out[i].share(0, sizes[i], dest) != (size_t)sizes[i])
+			return -1;
+
+		total += sizes[i];
+	}
+
+	if (total > 0x7FFFFFFF)
+		return -1;
+
+	return (int)total;
+}
+
+RPCDecompressStream *RPCCompressor::new_decompress_stream(RPCBuffer *src,
+														  int type,
+														  uint32_t dict_id) const
+{
+	if (type >= RPCCompressMax || type <= RPCCompressNone)
+		return NULL;
+
+	DempressIOVecFunction decompress = this->handler[type].decompress_iovec;
+
+	// only the built-in ones know how to stop in the middle
+	if (dict_id != 0)
+	{
+#ifdef SRPC_WITH_ZSTD
+		auto it = this->dictionaries.find(dict_id);
+
+		if (type == RPCCompressZstd && it != this->dictionaries.end())
+			return new ZstdDecompressStream(src, it->second);
+#endif
+		return NULL;
+	}
+
+	if (decompress == CommonDecompressIOVec)
+		return new ZlibDecompressStream(src);
+
+	if (decompress == LZ4DecompressIOVec)
+		return new LZ4DecompressStream(src);
+
+#ifdef SRPC_WITH_ZSTD
+	if (decompress == ZstdDecompressIOVec)
+		return new ZstdDecompressStream(src, NULL);
+#endif
+
+	return NULL;
+}
+
+RPCDecompressStream::RPCDecompressStream(RPCBuffer *src) :
+	src(src),
+	in_buf(NULL),
+	in_len(0),
+	window(NULL),
+	window_size(0),
+	total_out(0),
+	error(false)
+{
+	src->rewind();
+}
+
+RPCDecompressStream::~RPCDecompressStream()
+{
+	if (this->window)
+		RPCBufferPool::put(this->window, this->window_size);
+}
+
+int RPCDecompressStream::next(const void **buf)
+{
+	// the context may be anywhere after an error
+	if (this->error)
+		return -1;
+
+	if (!this->window)
+	{
+		this->window_size = DECOMPRESS_STREAM_WINDOW;
+		this->window = RPCBufferPool::get(&this->window_size);
+		if (!this->window)
+			return -1;
+	}
+
+	int ret = this->decompress(this->window, this->window_size);
+
+	if (ret > 0)
+	{
+		*buf = this->window;
+		this->total_out += ret;
+	}
+	else if (ret < 0)
+		this->error = true;
+
+	return ret;
+}
+
+int RPCDecompressStream::read_all(RPCBuffer *dest, size_t max_size)
+{
+	size_t total = 0;
+	void *buf;
+	size_t size;
+	int ret;
+
+	if (this->error || max_size > 0x7FFFFFFF)
+		return -1;
+
+	do
+	{
+		// one byte more than max_size is enough to know it is too many
+		size = max_size + 1 - total;
+		if (!dest->acquire(&buf, &size))
+		{
+			this->error = true;
+			return -1;
+		}
+
+		ret = this->decompress(buf, size);
+		dest->backup(ret > 0 ? size - ret : size);
+		if (ret < 0)
+		{
+			this->error = true;
+			return -1;
+		}
+
+		total += ret;
+		this->total_out += ret;
+		if (total > max_size)
+		{
+			this->error = true;
+			return -1;
+		}
+	} while (ret > 0);
+
+	return (int)total;
+}
+
+bool RPCDecompressStream::fill_input()
+{
+	if (this->in_len == 0)
+		this->in_len = this->src->fetch(&this->in_buf);
+
+	return this->in_len != 0;
+}
+
+const char *RPCCompressEstimator::decision_string(int decision)
+{
+	switch (decision)
+	{
+	case RPCCompressDecisionCompress:
+		return "compress";
+	case RPCCompressDecisionSample:
+		return "sample";
+	case RPCCompressDecisionSkipSmall:
+		return "skip_small";
+	case RPCCompressDecisionSkipRatio:
+		return "skip_ratio";
+	default:
+		return "unknown";
+	}
+}
+
+int RPCCompressEstimator::decide(bool is_resp, uint32_t method_id,
+								 size_t origin_size)
+{
+	// no lock, every thread learns by itself
+	static thread_local std::unordered_map<uint64_t, stat_t> stats;
+
+	if (origin_size < this->policy->min_size)
+		return RPCCompressDecisionSkipSmall;
+
+	if (this->policy->max_ratio <= 0)
+		return RPCCompressDecisionCompress;
+
+	uint64_t key = ((uint64_t)method_id << 1) | (is_resp ? 1 : 0);
+	auto it = stats.emplace(key, stat_t{ -1.0, 0 }).first;
+
+	this->stat = &it->second;
+	if (this->stat->ratio <= this->policy->max_ratio)
+		return RPCCompressDecisionCompress;
+
+	if (this->policy->resample_interval > 0 &&
+		++this->stat->skipped >= this->policy->resample_interval)
+	{
+		this->stat->skipped = 0;
+		return RPCCompressDecisionSample;
+	}
+
+	return RPCCompressDecisionSkipRatio;
+}
+
+void RPCCompressEstimator::learn(int decision, size_t origin_size,
+								 size_t compressed_size)
+{
+	if (!this->stat || RPCCompressEstimator::skipped(decision) ||
+		origin_size == 0)
+	{
+		return;
+	}
+
+	double ratio = (double)compressed_size / origin_size;
+
+	// a sample is the only news about a skipped method, take it as it is
+	if (decision == RPCCompressDecisionSample || this->stat->ratio < 0)
+		this->stat->ratio = ratio;
+	else
+		this->stat->ratio += (ratio - this->stat->ratio) / 8;
+}
+
 } // namespace srpc
 
@@ -17,6 +17,12 @@
 #ifndef __RPC_COMPRESS_H__
 #define __RPC_COMPRESS_H__
 
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include "rpc_basic.h"
 #include "rpc_options.h"
 
@@ -29,6 +35,12 @@ using CompressIOVecFunction = int (*)(RPCBuffer *, RPCBuffer *);
 using DempressIOVecFunction = int (*)(RPCBuffer *, RPCBuffer *);
 using LeaseSizeFunction = int (*)(size_t);
 
+static constexpr size_t COMPRESS_CONTEXT_MAX_CACHED = 1;
+static constexpr size_t DECOMPRESS_STREAM_WINDOW = 64 * 1024;
+
+class ZstdDictionary;
+class RPCDecompressStream;
+
 class CompressHandler
 {
 public:
@@ -72,6 +84,36 @@ public:
 	int serialize_to_compressed(const char *msg, size_t msglen, char *buf, size_t buflen, int type) const;
 	int serialize_to_compressed(RPCBuffer *src, RPCBuffer *dest, int type) const;
 
+	// the same with a dictionary added by add_dictionary(), 0 for none
+	// 		-2, also for unknown dict_id
+	int parse_from_compressed(RPCBuffer *src, RPCBuffer *dest, int type,
+							  uint32_t dict_id) const;
+	int serialize_to_compressed(RPCBuffer *src, RPCBuffer *dest, int type,
+								uint32_t dict_id) const;
+
+	/*
+	 * Independent blocks of block_size bytes, the last one may be shorter.
+	 * Each block is the 4-byte compressed size in network order and then
+	 * the data, blocks are compressed and decompressed in parallel by the
+	 * caller and the compute threads of workflow. A block never inflates
+	 * beyond block_size while decompressing, except with a handler added
+	 * by add_handler(), which is checked after
+	 * ret: the same as above, the compressed size includes the 4-byte sizes
+	 */
+	int parse_from_compressed_blocks(RPCBuffer *src, RPCBuffer *dest, int type,
+									 size_t block_size) const;
+	int serialize_to_compressed_blocks(RPCBuffer *src, RPCBuffer *dest, int type,
+									   size_t block_size) const;
+
+	/*
+	 * Decompress src while it is parsed, see RPCDecompressStream.
+	 * src must be kept until the stream is deleted
+	 * ret: NULL if the type can not, such as snappy, a handler added by
+	 * 		add_handler() or an unknown dict_id. Use parse_from_compressed()
+	 */
+	RPCDecompressStream *new_decompress_stream(RPCBuffer *src, int type,
+											   uint32_t dict_id) const;
+
 	/*
 	 * ret: >0: the theoretically lease size of compressed data
 	 * 		-1: error
@@ -100,16 +142,211 @@ public:
 	// clear all the registed handler
 	void clear();
 
+	/*
+	 * Add a dictionary by id, only RPCCompressZstd takes one.
+	 * dict is the content of a trained zstd dictionary or raw samples,
+	 * both sides must add the same dictionary with the same id.
+	 * Not thread-safe, add them before any task starts, same as add()
+	 * ret:  0, success
+	 * 		 1, dictionary existed and update success
+	 * 		-2, invalid compress type, dict_id 0 or bad dictionary
+	 */
+	int add_dictionary(int type, uint32_t dict_id,
+					   const void *dict, size_t size);
+
+	/*
+	 * Use dictionary dict_id for the messages of a service, or only of
+	 * one method if method is not empty. 0 removes the binding.
+	 * The id goes with the message in meta, so the receiver decompresses
+	 * with the same dictionary no matter what it binds.
+	 * ret:  0, success
+	 * 		-2, invalid compress type or dict_id not added
+	 */
+	int set_dictionary_id(int type, const std::string& service,
+						  const std::string& method, uint32_t dict_id);
+
+	// method first, then service, 0 if none
+	uint32_t get_dictionary_id(int type, const std::string& service,
+							   const std::string& method) const;
+
+	/*
+	 * Contexts each thread keeps for every CompressContextCache,
+	 * 0 means a context is created and freed in every call
+	 * Default is COMPRESS_CONTEXT_MAX_CACHED
+	 */
+	void set_max_cached_contexts(size_t n) { this->max_cached_contexts = n; }
+	size_t get_max_cached_contexts() const { return this->max_cached_contexts; }
+
 private:
-	RPCCompressor()
+	RPCCompressor() : max_cached_contexts(COMPRESS_CONTEXT_MAX_CACHED)
 	{
 		this->add(RPCCompressGzip);
 		this->add(RPCCompressZlib);
 		this->add(RPCCompressSnappy);
 		this->add(RPCCompressLz4);
+		this->add(RPCCompressZstd);
 	}
 
+	~RPCCompressor();
+
 	CompressHandler handler[RPCCompressMax];
+	std::atomic<size_t> max_cached_contexts;
+	// also a pair of references, so that a lookup copies no name
+	struct DictionaryKeyLess
+	{
+		using is_transparent = void;
+
+		template<class A, class B>
+		bool operator() (const A& a, const B& b) const
+		{
+			return a.first < b.first ||
+				   (a.first == b.first && a.second < b.second);
+		}
+	};
+
+	std::unordered_map<uint32_t, ZstdDictionary *> dictionaries;
+	// {service, method}, method is empty for the whole service
+	std::map<std::pair<std::string, std::string>, uint32_t,
+			 DictionaryKeyLess> dictionary_ids;
+};
+
+/**
+ * @brief   Per-thread cache of one kind of compression context
+ * @details
+ * - CTX allocates the library state in init() and frees it in its
+ *   destructor, reset() makes a used context ready for the next message
+ * - The built-in handlers keep zlib streams, LZ4F and zstd contexts here,
+ *   a handler added by add_handler() may keep its own CTX the same way
+ * - get() returns NULL if init() fails
+ * - A context that failed in the middle of a message is deleted
+ *   instead of put() back
+ */
+template<class CTX>
+class CompressContextCache
+{
+public:
+	static CTX *get();
+	static void put(CTX *ctx);
+
+private:
+	struct cache_t
+	{
+		std::vector<CTX *> free_list;
+
+		~cache_t()
+		{
+			for (CTX *ctx : free_list)
+				delete ctx;
+		}
+	};
+
+	static cache_t *local_cache()
+	{
+		static thread_local cache_t cache;
+
+		return &cache;
+	}
+};
+
+enum RPCCompressDecision
+{
+	RPCCompressDecisionCompress		=	0,
+	RPCCompressDecisionSample		=	1,
+	RPCCompressDecisionSkipSmall	=	2,
+	RPCCompressDecisionSkipRatio	=	3,
+};
+
+/**
+ * @brief   Whether a message body is worth compressing, by RPCCompressPolicy
+ * @details
+ * - Bodies smaller than min_size are never compressed
+ * - With max_ratio, the compressed/origin ratio of every method is
+ *   learned per thread by its method ID, requests and responses apart. A method above
+ *   max_ratio is skipped, one of every resample_interval skipped bodies
+ *   is compressed again and its ratio replaces the learned one
+ * - One estimator for one message: decide(), compress if not skipped,
+ *   then learn() with the sizes
+ * - Bodies not smaller than block_min_size are compressed by blocks if
+ *   the protocol supports, see serialize_to_compressed_blocks()
+ */
+class RPCCompressEstimator
+{
+public:
+	RPCCompressEstimator(const RPCCompressPolicy *policy) :
+		policy(policy),
+		stat(NULL)
+	{
+	}
+
+	static bool enabled(const RPCCompressPolicy *policy)
+	{
+		return policy && (policy->min_size > 0 || policy->max_ratio > 0 ||
+						  policy->block_min_size > 0);
+	}
+
+	static bool skipped(int decision)
+	{
+		return decision == RPCCompressDecisionSkipSmall ||
+			   decision == RPCCompressDecisionSkipRatio;
+	}
+
+	static const char *decision_string(int decision);
+
+	// method_id is RPC_METHOD_ID() of the full service name
+	int decide(bool is_resp, uint32_t method_id, size_t origin_size);
+	void learn(int decision, size_t origin_size, size_t compressed_size);
+
+private:
+	struct stat_t
+	{
+		double ratio;	// < 0 before the first one
+		int skipped;
+	};
+
+	const RPCCompressPolicy *policy;
+	stat_t *stat;
+};
+
+/**
+ * @brief   Decompressed data of a RPCBuffer, one window after another
+ * @details
+ * - For parsing while decompressing, only one window is kept
+ *   instead of the whole decompressed data
+ * - next() gives the next window, valid until the next call.
+ *   ret: >0 size of the window, 0 at the end, -1 if the data is bad
+ * - read_all() decompresses the rest into dest instead of windows and
+ *   stops as soon as there are more than max_size bytes.
+ *   ret: the bytes read, -1 if bad or too many
+ * - Trailing bytes after the compressed data are bad
+ */
+class RPCDecompressStream
+{
+public:
+	virtual ~RPCDecompressStream();
+
+	int next(const void **buf);
+	int read_all(RPCBuffer *dest, size_t max_size);
+	size_t byte_count() const { return this->total_out; }
+	bool failed() const { return this->error; }
+
+protected:
+	RPCDecompressStream(RPCBuffer *src);
+
+	// at most out_len bytes, ret is the same as next()
+	virtual int decompress(void *out, size_t out_len) = 0;
+
+	// the next piece of src if the current one is used up, false if none
+	bool fill_input();
+
+	RPCBuffer *src;
+	const void *in_buf;
+	size_t in_len;
+
+private:
+	void *window;
+	size_t window_size;
+	size_t total_out;
+	bool error;
 };
 
 ////////
@@ -219,6 +456,44 @@ inline int RPCCompressor::lease_compressed_size(int type, size_t origin_size) co
 	return this->handler[type].lease_size(origin_size);
 }
 
+template<class CTX>
+inline CTX *CompressContextCache<CTX>::get()
+{
+	cache_t *cache = local_cache();
+	CTX *ctx;
+
+	if (!cache->free_list.empty())
+	{
+		ctx = cache->free_list.back();
+		cache->free_list.pop_back();
+		return ctx;
+	}
+
+	ctx = new CTX;
+	if (!ctx->init())
+	{
+		delete ctx;
+		return NULL;
+	}
+
+	return ctx;
+}
+
+template<class CTX>
+inline void CompressContextCache<CTX>::put(CTX *ctx)
+{
+	cache_t *cache = local_cache();
+	size_t max = RPCCompressor::get_instance()->get_max_cached_contexts();
+
+	if (cache->free_list.size() >= max || !ctx->reset())
+	{
+		delete ctx;
+		return;
+	}
+
+	cache->free_list.push_back(ctx);
+}
+
 inline void RPCCompressor::clear()
 {
 	for (int i = 0; i < RPCCompressMax; i++)
@@ -19,8 +19,10 @@
 
 //#include <google/protobuf/io/gzip_stream.h>
 //#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <string.h>
 #include <zlib.h>
 #include "rpc_basic.h"
+#include "rpc_compress.h"
 
 //#define COMPRESS_LEVEL	6
 //#define ZLIB_LEASE_HEADER	100
@@ -98,25 +100,91 @@ static int protobuf_stream_decompress(const char *buf, size_t buflen, ProtobufID
 }
 */
 
-static int CommonCompress(const char *msg, size_t msglen,
-						  char *buf, size_t buflen, int option_format)
+/*
+ * deflate stream kept by CompressContextCache,
+ * FORMAT is OPTION_FORMAT_GZIP or OPTION_FORMAT_ZLIB
+ */
+template<int FORMAT>
+class ZlibDeflateContext
 {
-	if (!msg)
-		return 0;
+public:
+	z_stream stream;
 
-	z_stream c_stream;
+	ZlibDeflateContext() : inited(false)
+	{
+		memset(&this->stream, 0, sizeof (z_stream));
+	}
 
-	c_stream.zalloc = (alloc_func)0;
-	c_stream.zfree = (free_func)0;
-	c_stream.opaque = (voidpf)0;
+	~ZlibDeflateContext()
+	{
+		if (this->inited)
+			deflateEnd(&this->stream);
+	}
 
-	if(deflateInit2(&c_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
-					WINDOW_BITS | option_format, 8,
-					Z_DEFAULT_STRATEGY) != Z_OK)
+	bool init()
 	{
-		return -1;
+		this->inited = (deflateInit2(&this->stream, Z_DEFAULT_COMPRESSION,
+									 Z_DEFLATED, WINDOW_BITS | FORMAT, 8,
+									 Z_DEFAULT_STRATEGY) == Z_OK);
+		return this->inited;
 	}
 
+	// keeps the window and hash tables allocated by init()
+	bool reset() { return deflateReset(&this->stream) == Z_OK; }
+
+private:
+	bool inited;
+};
+
+/*
+ * inflate stream kept by CompressContextCache, detects gzip or zlib
+ */
+class ZlibInflateContext
+{
+public:
+	z_stream stream;
+
+	ZlibInflateContext() : inited(false)
+	{
+		memset(&this->stream, 0, sizeof (z_stream));
+	}
+
+	~ZlibInflateContext()
+	{
+		if (this->inited)
+			inflateEnd(&this->stream);
+	}
+
+	bool init()
+	{
+		this->inited = (inflateInit2(&this->stream,
+									 WINDOW_BITS | OPTION_FORMAT_AUTO) == Z_OK);
+		return this->inited;
+	}
+
+	bool reset() { return inflateReset(&this->stream) == Z_OK; }
+
+private:
+	bool inited;
+};
+
+using ZlibInflateCache = CompressContextCache<ZlibInflateContext>;
+
+template<int FORMAT>
+static int CommonCompress(const char *msg, size_t msglen, char *buf, size_t buflen)
+{
+	if (!msg)
+		return 0;
+
+	using DeflateCache = CompressContextCache<ZlibDeflateContext<FORMAT>>;
+	ZlibDeflateContext<FORMAT> *ctx = DeflateCache::get();
+
+	if (!ctx)
+		return -1;
+
+	z_stream& c_stream = ctx->stream;
+	int ret;
+
 	c_stream.next_in = (Bytef *)msg;
 	c_stream.avail_in = msglen;
 	c_stream.next_out = (Bytef *)buf;
@@ -126,13 +194,17 @@ static int CommonCompress(const char *msg, size_t msglen,
 	{
 		if (deflate(&c_stream, Z_NO_FLUSH) != Z_OK)
 		{
-			deflateEnd(&c_stream);
+			delete ctx;
 			return -1;
 		}
 	}
 
 	if (c_stream.avail_in != 0)
-		return c_stream.avail_in;
+	{
+		ret = c_stream.avail_in;
+		DeflateCache::put(ctx);
+		return ret;
+	}
 
 	for (;;)
 	{
@@ -143,15 +215,14 @@ static int CommonCompress(const char *msg, size_t msglen,
 
 		if(err != Z_OK)
 		{
-			deflateEnd(&c_stream);
+			delete ctx;
 			return -1;
 		}
 	}
 
-	if (deflateEnd(&c_stream) != Z_OK)
-		return -1;
-
-	return c_stream.total_out;
+	ret = c_stream.total_out;
+	DeflateCache::put(ctx);
+	return ret;
 }
 
 /*
@@ -161,7 +232,7 @@ static int CommonCompress(const char *msg, size_t msglen,
  */
 static inline int GzipCompress(const char *msg, size_t msglen, char *buf, size_t buflen)
 {
-	return CommonCompress(msg, msglen, buf, buflen, OPTION_FORMAT_GZIP);
+	return CommonCompress<OPTION_FORMAT_GZIP>(msg, msglen, buf, buflen);
 }
 
 /*
@@ -171,7 +242,7 @@ static inline int GzipCompress(const char *msg, size_t msglen, char *buf, size_t
  */
 static inline int ZlibCompress(const char *msg, size_t msglen, char *buf, size_t buflen)
 {
-	return CommonCompress(msg, msglen, buf, buflen, OPTION_FORMAT_ZLIB);
+	return CommonCompress<OPTION_FORMAT_ZLIB>(msg, msglen, buf, buflen);
 }
 
 static constexpr unsigned char dummy_head[2] =
@@ -188,16 +259,17 @@ static constexpr unsigned char dummy_head[2] =
 static int CommonDecompress(const char *buf, size_t buflen, char *msg, size_t msglen)
 {
 	int err;
-	z_stream d_stream = {0}; /* decompression stream */
+	int ret;
+	ZlibInflateContext *ctx = ZlibInflateCache::get();
+
+	if (!ctx)
+		return -1;
+
+	z_stream& d_stream = ctx->stream; /* decompression stream */
 
-	d_stream.zalloc = (alloc_func)0;
-	d_stream.zfree = (free_func)0;
-	d_stream.opaque = (voidpf)0;
 	d_stream.next_in = (Bytef *)buf;
 	d_stream.avail_in = 0;
 	d_stream.next_out = (Bytef *)msg;
-	if (inflateInit2(&d_stream, WINDOW_BITS | OPTION_FORMAT_AUTO) != Z_OK)
-		return -1;
 
 	while (d_stream.total_out < msglen && d_stream.total_in < buflen)
 	{
@@ -210,7 +282,7 @@ static int CommonDecompress(const char *buf, size_t buflen, char *msg, size_t ms
 		{
 			if (err != Z_DATA_ERROR)
 			{
-				inflateEnd(&d_stream);
+				delete ctx;
 				return -1;
 			}
 
@@ -218,38 +290,34 @@ static int CommonDecompress(const char *buf, size_t buflen, char *msg, size_t ms
 			d_stream.avail_in = sizeof (dummy_head);
 			if (inflate(&d_stream, Z_NO_FLUSH) != Z_OK)
 			{
-				inflateEnd(&d_stream);
+				delete ctx;
 				return -1;
 			}
 		}
 	}
 
-	if (inflateEnd(&d_stream) != Z_OK)
-		return -1;
-
-	return d_stream.total_out;
+	ret = d_stream.total_out;
+	ZlibInflateCache::put(ctx);
+	return ret;
 }
 
-static int CommonCompressIOVec(RPCBuffer *src, RPCBuffer *dst, int option_format)
+template<int FORMAT>
+static int CommonCompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 {
-	z_stream c_stream;
+	using DeflateCache = CompressContextCache<ZlibDeflateContext<FORMAT>>;
+	ZlibDeflateContext<FORMAT> *ctx = DeflateCache::get();
 	int err;
+	int ret;
 	size_t total_alloc = 0;
 	const void *in;
 	void *out;
 	size_t buflen = src->size();
 	size_t out_len = buflen;
 
-	c_stream.zalloc = (alloc_func)0;
-	c_stream.zfree = (free_func)0;
-	c_stream.opaque = (voidpf)0;
-
-	if (deflateInit2(&c_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 
-					 WINDOW_BITS | option_format, 8,
-					 Z_DEFAULT_STRATEGY) != Z_OK)
-	{
+	if (!ctx)
 		return -1;
-	}
+
+	z_stream& c_stream = ctx->stream;
 
 	c_stream.avail_in = 0;
 	c_stream.avail_out = 0;
@@ -260,7 +328,7 @@ static int CommonCompressIOVec(RPCBuffer *src, RPCBuffer *dst, int option_format
 		{
 			if ((c_stream.avail_in = (uInt)src->fetch(&in)) == 0)
 			{
-				deflateEnd(&c_stream);
+				delete ctx;
 				return -1;
 			}
 
@@ -271,7 +339,7 @@ static int CommonCompressIOVec(RPCBuffer *src, RPCBuffer *dst, int option_format
 		{
 			if (dst->acquire(&out, &out_len) == false)
 			{
-				deflateEnd(&c_stream);
+				delete ctx;
 				return -1;
 			}
 
@@ -282,7 +350,7 @@ static int CommonCompressIOVec(RPCBuffer *src, RPCBuffer *dst, int option_format
 
 		if (deflate(&c_stream, Z_NO_FLUSH) != Z_OK)
 		{
-			deflateEnd(&c_stream);
+			delete ctx;
 			return -1;
 		}
 	}
@@ -295,7 +363,10 @@ static int CommonCompressIOVec(RPCBuffer *src, RPCBuffer *dst, int option_format
 		if (c_stream.avail_out == 0)
 		{
 			if (dst->acquire(&out, &out_len) == false)
+			{
+				delete ctx;
 				return -1;
+			}
 
 			total_alloc += out_len;
 			c_stream.next_out  = static_cast<Bytef *>(out);
@@ -308,16 +379,15 @@ static int CommonCompressIOVec(RPCBuffer *src, RPCBuffer *dst, int option_format
 
 		if(err != Z_OK)
 		{
-			deflateEnd(&c_stream);
+			delete ctx;
 			return -1;
 		}
 	}
 
-	if (deflateEnd(&c_stream) != Z_OK)
-		return -1;
-
-	dst->backup(total_alloc - c_stream.total_out);
-	return c_stream.total_out;
+	ret = c_stream.total_out;
+	DeflateCache::put(ctx);
+	dst->backup(total_alloc - ret);
+	return ret;
 }
 
 /*
@@ -327,7 +397,7 @@ static int CommonCompressIOVec(RPCBuffer *src, RPCBuffer *dst, int option_format
  */
 static int GzipCompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 {
-	return CommonCompressIOVec(src, dst, OPTION_FORMAT_GZIP);	
+	return CommonCompressIOVec<OPTION_FORMAT_GZIP>(src, dst);
 }
 
 /*
@@ -337,7 +407,7 @@ static int GzipCompressIOVec(RPCBuffer *src, RPCBuffer *dst)
  */
 static int ZlibCompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 {
-	return CommonCompressIOVec(src, dst, OPTION_FORMAT_ZLIB);	
+	return CommonCompressIOVec<OPTION_FORMAT_ZLIB>(src, dst);
 }
 
 /*
@@ -348,20 +418,19 @@ static int ZlibCompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 static int CommonDecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 {
 	int err;
-	z_stream d_stream = { 0 }; /* decompression stream */
+	int ret;
+	ZlibInflateContext *ctx = ZlibInflateCache::get();
 	size_t total_alloc = 0;
 	const void *in;
 	void *out;
 	size_t buflen = src->size();
 	size_t out_len = buflen;
 
-	d_stream.zalloc = (alloc_func)0;
-	d_stream.zfree = (free_func)0;
-	d_stream.opaque = (voidpf)0;
-
-	if (inflateInit2(&d_stream, WINDOW_BITS | OPTION_FORMAT_AUTO) != Z_OK)
+	if (!ctx)
 		return -1;
 
+	z_stream& d_stream = ctx->stream; /* decompression stream */
+
 	d_stream.avail_in = 0;
 	d_stream.avail_out = 0;
 
@@ -371,7 +440,7 @@ static int CommonDecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 		{
 			if ((d_stream.avail_in = (uInt)src->fetch(&in)) == 0)
 			{
-				inflateEnd(&d_stream);
+				delete ctx;
 				return -1;
 			}
 
@@ -382,7 +451,7 @@ static int CommonDecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 		{
 			if (dst->acquire(&out, &out_len) == false)
 			{
-				inflateEnd(&d_stream);
+				delete ctx;
 				return -1;
 			}
 
@@ -399,7 +468,7 @@ static int CommonDecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 		{
 			if (err != Z_DATA_ERROR)
 			{
-				inflateEnd(&d_stream);
+				delete ctx;
 				return -1;
 			}
 
@@ -407,19 +476,78 @@ static int CommonDecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 			d_stream.avail_in = sizeof (dummy_head);
 			if (inflate(&d_stream, Z_NO_FLUSH) != Z_OK)
 			{
-				inflateEnd(&d_stream);
+				delete ctx;
 				return -1;
 			}
 		}
 	}
 
-	if (inflateEnd(&d_stream) != Z_OK)
-		return -1;
-
-	dst->backup(total_alloc - d_stream.total_out);
-	return d_stream.total_out;
+	ret = d_stream.total_out;
+	ZlibInflateCache::put(ctx);
+	dst->backup(total_alloc - ret);
+	return ret;
 }
 
+/*
+ * gzip or zlib of RPCBuffer by RPCCompressor::new_decompress_stream(),
+ * the inflate stream is put back after the whole data
+ */
+class ZlibDecompressStream : public RPCDecompressStream
+{
+public:
+	ZlibDecompressStream(RPCBuffer *src) :
+		RPCDecompressStream(src),
+		ctx(ZlibInflateCache::get()),
+		finished(false)
+	{
+	}
+
+	~ZlibDecompressStream()
+	{
+		if (this->finished)
+			ZlibInflateCache::put(this->ctx);
+		else
+			delete this->ctx;
+	}
+
+protected:
+	int decompress(void *out, size_t out_len) override
+	{
+		if (!this->ctx)
+			return -1;
+
+		z_stream& d_stream = this->ctx->stream;
+		int err;
+
+		d_stream.next_out = static_cast<Bytef *>(out);
+		d_stream.avail_out = (uInt)out_len;
+		while (!this->finished && d_stream.avail_out == out_len)
+		{
+			// inflate() may still hold output without any input,
+			// if not it is Z_BUF_ERROR and the data is truncated
+			this->fill_input();
+			d_stream.next_in = static_cast<Bytef *>(const_cast<void *>(this->in_buf));
+			d_stream.avail_in = (uInt)this->in_len;
+			err = inflate(&d_stream, Z_NO_FLUSH);
+			this->in_buf = (const char *)this->in_buf + this->in_len - d_stream.avail_in;
+			this->in_len = d_stream.avail_in;
+			if (err == Z_STREAM_END)
+				this->finished = true;
+			else if (err != Z_OK)
+				return -1;
+		}
+
+		if (d_stream.avail_out == out_len)
+			return this->fill_input() ? -1 : 0;
+
+		return (int)(out_len - d_stream.avail_out);
+	}
+
+private:
+	ZlibInflateContext *ctx;
+	bool finished;
+};
+
 /*
  * lease size after compress origin_size data
  */
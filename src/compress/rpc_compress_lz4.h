@@ -20,12 +20,16 @@
 #include "lz4.h"
 #include "lz4frame.h"
 #include "rpc_basic.h"
+#include "rpc_compress.h"
 
 namespace srpc
 {
 
 //#define IN_CHUNK_SIZE  (16*1024)
 
+// enough for a frame header, an end mark, or a block of a few bytes
+static constexpr size_t LZ4_TAIL_SIZE = 64;
+
 static constexpr LZ4F_preferences_t kPrefs = {
 	{
 		LZ4F_max256KB,
@@ -37,7 +41,7 @@ static constexpr LZ4F_preferences_t kPrefs = {
 		LZ4F_noBlockChecksum
 	},
 	0,   /* compression level; 0 == default */
-	0,   /* autoflush */
+	1,   /* autoflush, so that nothing is buffered across acquire() */
 	0,   /* favor decompression speed */
 	{ 0, 0, 0 },  /* reserved, must be set to 0 */
 };
@@ -90,90 +94,201 @@ static int LZ4Decompress(const char *buf, size_t buflen, char *msg, size_t msgle
 }
 
 /*
- * compress RPCBuffer src into RPCBuffer dst
- * ret: -1: failed
- * 		>0: byte count of compressed data
+ * LZ4F_cctx kept by CompressContextCache,
+ * LZ4F_compressBegin() starts every frame from a clean state
  */
-static int LZ4CompressIOVec(RPCBuffer *src, RPCBuffer *dst)
+class LZ4CompressContext
+{
+public:
+	LZ4F_cctx *ctx;
+
+	LZ4CompressContext() : ctx(NULL) { }
+	~LZ4CompressContext() { LZ4F_freeCompressionContext(this->ctx); }
+
+	bool init()
+	{
+		return !LZ4F_isError(LZ4F_createCompressionContext(&this->ctx,
+														   LZ4F_VERSION));
+	}
+
+	bool reset() { return true; }
+};
+
+/*
+ * LZ4F_dctx kept by CompressContextCache,
+ * only put back after a whole frame is decoded, then it is ready for the next
+ */
+class LZ4DecompressContext
+{
+public:
+	LZ4F_dctx *dctx;
+
+	LZ4DecompressContext() : dctx(NULL) { }
+	~LZ4DecompressContext() { LZ4F_freeDecompressionContext(this->dctx); }
+
+	bool init()
+	{
+		return !LZ4F_isError(LZ4F_createDecompressionContext(&this->dctx,
+															 LZ4F_VERSION));
+	}
+
+	bool reset() { return true; }
+};
+
+using LZ4CompressCache = CompressContextCache<LZ4CompressContext>;
+using LZ4DecompressCache = CompressContextCache<LZ4DecompressContext>;
+
+/*
+ * LZ4F_compressUpdate() wants the whole bound in one buffer, but acquire()
+ * may return only the tail of the last piece, so shrink the input to fit it.
+ * with autoflush the bound of a piece is its size plus a few bytes
+ */
+static size_t LZ4FitInput(size_t in_len, size_t out_len)
+{
+	size_t bound;
+
+	// the bound is never less than the input, start from there
+	if (in_len > out_len)
+		in_len = out_len;
+
+	while (in_len > 0 &&
+		   (bound = LZ4F_compressBound(in_len, &kPrefs)) > out_len)
+	{
+		if (bound - out_len < in_len)
+			in_len -= bound - out_len;
+		else
+			in_len = 0;
+	}
+
+	return in_len;
+}
+
+/*
+ * acquire at least need bytes from dst, or the small tail buffer
+ * if only a few bytes are left in the last piece of dst
+ */
+static bool LZ4Acquire(RPCBuffer *dst, size_t need, char *tail,
+					   void **out_buf, size_t *out_len)
+{
+	*out_len = need;
+	if (dst->acquire(out_buf, out_len) == false)
+		return false;
+
+	if (*out_len < need)
+	{
+		dst->backup(*out_len);
+		*out_buf = tail;
+		*out_len = LZ4_TAIL_SIZE;
+	}
+
+	return true;
+}
+
+static bool LZ4Commit(RPCBuffer *dst, char *tail,
+					  void *out_buf, size_t out_len, size_t used)
 {
+	if (out_buf == tail)
+		return dst->write(tail, used);
+
+	dst->backup(out_len - used);
+	return true;
+}
+
+static int LZ4CompressFrame(LZ4F_cctx *ctx, RPCBuffer *src, RPCBuffer *dst)
+{
+	char tail[LZ4_TAIL_SIZE];
 	const void *in_buf;
 	size_t in_len;
 	void *out_buf;
 	size_t out_len;
+	size_t chunk;
 	size_t total_out;
-	size_t header_size;
 	size_t compressed_size;
-	LZ4F_cctx *ctx = NULL;
-	size_t const ctx_status = LZ4F_createCompressionContext(&ctx, LZ4F_VERSION);
-
-	if (LZ4F_isError(ctx_status))
-	{
-		LZ4F_freeCompressionContext(ctx);
-		return -1;
-	}
 
-	out_len = LZ4F_HEADER_SIZE_MAX;
-	if (dst->acquire(&out_buf, &out_len) == false)
-	{
-		LZ4F_freeCompressionContext(ctx);
+	// write frame header
+	if (!LZ4Acquire(dst, LZ4F_HEADER_SIZE_MAX, tail, &out_buf, &out_len))
 		return -1;
-	}
 
-	// write frame header
-	header_size = LZ4F_compressBegin(ctx, out_buf, out_len, &kPrefs);
-	if (LZ4F_isError(header_size))
+	compressed_size = LZ4F_compressBegin(ctx, out_buf, out_len, &kPrefs);
+	if (LZ4F_isError(compressed_size) ||
+		!LZ4Commit(dst, tail, out_buf, out_len, compressed_size))
 	{
-		LZ4F_freeCompressionContext(ctx);
 		return -1;
 	}
 
-	dst->backup(out_len - header_size);
-	total_out = header_size;
-	//int count = 0;
+	total_out = compressed_size;
 	// write every in_buf
 	while ((in_len = src->fetch(&in_buf)) != 0)
 	{
-		//count++;
-		out_len = LZ4F_compressBound(in_len, &kPrefs);
-		if (dst->acquire(&out_buf, &out_len) == false)
+		while (in_len > 0)
 		{
-			LZ4F_freeCompressionContext(ctx);
-			return -1;
-		}
+			out_len = LZ4F_compressBound(in_len, &kPrefs);
+			if (dst->acquire(&out_buf, &out_len) == false)
+				return -1;
 
-		compressed_size = LZ4F_compressUpdate(ctx, out_buf, out_len,
-												   in_buf, in_len, NULL);
-		if (LZ4F_isError(compressed_size))
-		{
-			LZ4F_freeCompressionContext(ctx);
-			return -1;
-		}
+			chunk = LZ4FitInput(in_len, out_len);
+			if (chunk == 0)
+			{
+				dst->backup(out_len);
+				out_buf = tail;
+				out_len = LZ4_TAIL_SIZE;
+				chunk = LZ4FitInput(in_len, out_len);
+			}
 
-		dst->backup(out_len - compressed_size);
-		total_out += compressed_size;
+			compressed_size = LZ4F_compressUpdate(ctx, out_buf, out_len,
+												  in_buf, chunk, NULL);
+			if (LZ4F_isError(compressed_size) ||
+				!LZ4Commit(dst, tail, out_buf, out_len, compressed_size))
+			{
+				return -1;
+			}
+
+			in_buf = (const char *)in_buf + chunk;
+			in_len -= chunk;
+			total_out += compressed_size;
+		}
 	}
 
-	// flush whatever remains within internal buffers
-	out_len = LZ4F_compressBound(0, &kPrefs);
-	if (dst->acquire(&out_buf, &out_len) == false)
+	// nothing is buffered with autoflush, only the end mark remains
+	if (!LZ4Acquire(dst, LZ4F_compressBound(0, &kPrefs), tail,
+					&out_buf, &out_len))
 	{
-		LZ4F_freeCompressionContext(ctx);
 		return -1;
 	}
 
 	compressed_size = LZ4F_compressEnd(ctx, out_buf, out_len, NULL);
-	if (LZ4F_isError(compressed_size))
+	if (LZ4F_isError(compressed_size) ||
+		!LZ4Commit(dst, tail, out_buf, out_len, compressed_size))
 	{
-		LZ4F_freeCompressionContext(ctx);
 		return -1;
 	}
 
-	dst->backup(out_len - compressed_size);
 	total_out += compressed_size;
-	LZ4F_freeCompressionContext(ctx);
 	return (int)total_out;
 }
 
+/*
+ * compress RPCBuffer src into RPCBuffer dst
+ * ret: -1: failed
+ * 		>0: byte count of compressed data
+ */
+static int LZ4CompressIOVec(RPCBuffer *src, RPCBuffer *dst)
+{
+	LZ4CompressContext *cctx = LZ4CompressCache::get();
+	int ret;
+
+	if (!cctx)
+		return -1;
+
+	ret = LZ4CompressFrame(cctx->ctx, src, dst);
+	if (ret < 0)
+		delete cctx;
+	else
+		LZ4CompressCache::put(cctx);
+
+	return ret;
+}
+
 /*
  * decompress RPCBuffer src into RPCBuffer dst
  * ret: -1: failed
@@ -188,14 +303,12 @@ static int LZ4DecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 	size_t consumed_len;
 	size_t decompressed_size;
 	size_t total_out = 0;
-	LZ4F_dctx *dctx = NULL;
-	size_t const dctx_status = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+	LZ4DecompressContext *ctx = LZ4DecompressCache::get();
 
-	if (LZ4F_isError(dctx_status))
-	{
-		LZ4F_freeDecompressionContext(dctx);
+	if (!ctx)
 		return -1;
-	}
+
+	LZ4F_dctx *dctx = ctx->dctx;
 
 	// get framed info
 	LZ4F_frameInfo_t info;
@@ -208,7 +321,7 @@ static int LZ4DecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 
 	if (LZ4F_isError(frame_info_ret))
 	{
-		LZ4F_freeDecompressionContext(dctx);
+		delete ctx;
 		return -1;
 	}
 
@@ -245,7 +358,7 @@ static int LZ4DecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 		{
 			if (dst->acquire(&out_buf, &out_len) == false)
 			{
-				LZ4F_freeDecompressionContext(dctx);
+				delete ctx;
 				return -1;
 			}
 
@@ -256,7 +369,7 @@ static int LZ4DecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 									   start, &consumed_len, NULL);
 			if (LZ4F_isError(ret))
 			{
-				LZ4F_freeDecompressionContext(dctx);
+				delete ctx;
 				return -1;
 			}
 
@@ -268,15 +381,78 @@ static int LZ4DecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 
 		if (start != end)
 		{
-			LZ4F_freeDecompressionContext(dctx);
+			delete ctx;
 			return -1;
 		}
 	}
 
-	LZ4F_freeDecompressionContext(dctx);
+	LZ4DecompressCache::put(ctx);
 	return (int)total_out;
 }
 
+/*
+ * LZ4 frame of RPCBuffer by RPCCompressor::new_decompress_stream(),
+ * the context is put back after the whole frame
+ */
+class LZ4DecompressStream : public RPCDecompressStream
+{
+public:
+	LZ4DecompressStream(RPCBuffer *src) :
+		RPCDecompressStream(src),
+		ctx(LZ4DecompressCache::get()),
+		finished(false)
+	{
+	}
+
+	~LZ4DecompressStream()
+	{
+		if (this->finished)
+			LZ4DecompressCache::put(this->ctx);
+		else
+			delete this->ctx;
+	}
+
+protected:
+	int decompress(void *out, size_t out_len) override
+	{
+		size_t decompressed_size = 0;
+		size_t consumed_len;
+		size_t ret;
+		bool has_input;
+
+		if (!this->ctx)
+			return -1;
+
+		while (!this->finished && decompressed_size == 0)
+		{
+			// LZ4F may still hold a block without any input
+			has_input = this->fill_input();
+			decompressed_size = out_len;
+			consumed_len = this->in_len;
+			ret = LZ4F_decompress(this->ctx->dctx, out, &decompressed_size,
+								  this->in_buf, &consumed_len, NULL);
+			if (LZ4F_isError(ret))
+				return -1;
+
+			this->in_buf = (const char *)this->in_buf + consumed_len;
+			this->in_len -= consumed_len;
+			if (ret == 0)
+				this->finished = true;
+			else if (!has_input && decompressed_size == 0)
+				return -1;
+		}
+
+		if (decompressed_size == 0)
+			return this->fill_input() ? -1 : 0;
+
+		return (int)decompressed_size;
+	}
+
+private:
+	LZ4DecompressContext *ctx;
+	bool finished;
+};
+
 /*
  * lease size after compress origin_size data
  */
@@ -0,0 +1,419 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+	  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __RPC_COMPRESS_ZSTD_H__
+#define __RPC_COMPRESS_ZSTD_H__
+
+#include "zstd.h"
+#include "rpc_basic.h"
+#include "rpc_compress.h"
+
+namespace srpc
+{
+
+// low levels are already better than gzip for both ratio and speed
+static constexpr int ZSTD_COMPRESS_LEVEL = 1;
+
+/*
+ * Digested dictionary of RPCCompressor::add_dictionary(),
+ * shared by every context without copying
+ */
+class ZstdDictionary
+{
+public:
+	ZSTD_CDict *cdict;
+	ZSTD_DDict *ddict;
+
+	ZstdDictionary() : cdict(NULL), ddict(NULL) { }
+
+	~ZstdDictionary()
+	{
+		ZSTD_freeCDict(this->cdict);
+		ZSTD_freeDDict(this->ddict);
+	}
+
+	bool init(const void *dict, size_t size)
+	{
+		this->cdict = ZSTD_createCDict(dict, size, ZSTD_COMPRESS_LEVEL);
+		this->ddict = ZSTD_createDDict(dict, size);
+		return this->cdict && this->ddict;
+	}
+};
+
+/*
+ * ZSTD_CCtx kept by CompressContextCache,
+ * reset() also drops the dictionary of the last message
+ */
+class ZstdCompressContext
+{
+public:
+	ZSTD_CCtx *cctx;
+
+	ZstdCompressContext() : cctx(NULL) { }
+	~ZstdCompressContext() { ZSTD_freeCCtx(this->cctx); }
+
+	bool init()
+	{
+		this->cctx = ZSTD_createCCtx();
+		return this->cctx && this->reset();
+	}
+
+	bool reset()
+	{
+		size_t ret = ZSTD_CCtx_reset(this->cctx,
+									 ZSTD_reset_session_and_parameters);
+
+		if (ZSTD_isError(ret))
+			return false;
+
+		ret = ZSTD_CCtx_setParameter(this->cctx, ZSTD_c_compressionLevel,
+									 ZSTD_COMPRESS_LEVEL);
+		return !ZSTD_isError(ret);
+	}
+};
+
+class ZstdDecompressContext
+{
+public:
+	ZSTD_DCtx *dctx;
+
+	ZstdDecompressContext() : dctx(NULL) { }
+	~ZstdDecompressContext() { ZSTD_freeDCtx(this->dctx); }
+
+	bool init()
+	{
+		this->dctx = ZSTD_createDCtx();
+		return this->dctx != NULL;
+	}
+
+	bool reset()
+	{
+		return !ZSTD_isError(ZSTD_DCtx_reset(this->dctx,
+									ZSTD_reset_session_and_parameters));
+	}
+};
+
+using ZstdCompressCache = CompressContextCache<ZstdCompressContext>;
+using ZstdDecompressCache = CompressContextCache<ZstdDecompressContext>;
+
+/*
+ * compress serialized msg into buf.
+ * ret: -1: failed
+ * 		>0: byte count of compressed data
+ */
+static int ZstdCompress(const char *msg, size_t msglen, char *buf, size_t buflen)
+{
+	ZstdCompressContext *ctx = ZstdCompressCache::get();
+	size_t ret;
+
+	if (!ctx)
+		return -1;
+
+	ret = ZSTD_compress2(ctx->cctx, buf, buflen, msg, msglen);
+	if (ZSTD_isError(ret))
+	{
+		delete ctx;
+		return -1;
+	}
+
+	ZstdCompressCache::put(ctx);
+	return (int)ret;
+}
+
+/*
+ * decompress and parse buf into msg
+ * ret: -1: failed
+ * 		>0: byte count of decompressed data
+ */
+static int ZstdDecompress(const char *buf, size_t buflen, char *msg, size_t msglen)
+{
+	ZstdDecompressContext *ctx = ZstdDecompressCache::get();
+	size_t ret;
+
+	if (!ctx)
+		return -1;
+
+	ret = ZSTD_decompressDCtx(ctx->dctx, msg, msglen, buf, buflen);
+	if (ZSTD_isError(ret))
+	{
+		delete ctx;
+		return -1;
+	}
+
+	ZstdDecompressCache::put(ctx);
+	return (int)ret;
+}
+
+static int ZstdCompressFrame(ZSTD_CCtx *cctx, RPCBuffer *src, RPCBuffer *dst)
+{
+	ZSTD_inBuffer input = { NULL, 0, 0 };
+	ZSTD_outBuffer output;
+	void *out_buf;
+	size_t out_len;
+	size_t total_out = 0;
+	size_t ret;
+
+	// src is always read from the beginning, the size lets zstd
+	// choose small tables for small messages
+	ret = ZSTD_CCtx_setPledgedSrcSize(cctx, src->size());
+	if (ZSTD_isError(ret))
+		return -1;
+
+	do
+	{
+		if (input.pos == input.size)
+		{
+			input.size = src->fetch(&input.src);
+			input.pos = 0;
+		}
+
+		out_len = ZSTD_compressBound(src->size());
+		if (dst->acquire(&out_buf, &out_len) == false)
+			return -1;
+
+		output.dst = out_buf;
+		output.size = out_len;
+		output.pos = 0;
+		// an empty input means all of src is given
+		ret = ZSTD_compressStream2(cctx, &output, &input,
+								   input.size ? ZSTD_e_continue : ZSTD_e_end);
+		dst->backup(out_len - output.pos);
+		if (ZSTD_isError(ret))
+			return -1;
+
+		total_out += output.pos;
+	} while (input.size != 0 || ret != 0);
+
+	return (int)total_out;
+}
+
+static int ZstdDecompressFrame(ZSTD_DCtx *dctx, RPCBuffer *src, RPCBuffer *dst)
+{
+	ZSTD_inBuffer input;
+	ZSTD_outBuffer output;
+	void *out_buf;
+	size_t out_len;
+	size_t total_out = 0;
+	size_t ret = 1;
+	unsigned long long content_size;
+
+	input.size = src->fetch(&input.src);
+	input.pos = 0;
+	// only a hint for the output size, a bad frame fails in decompressing
+	content_size = ZSTD_getFrameContentSize(input.src, input.size);
+	if (content_size == ZSTD_CONTENTSIZE_ERROR)
+		content_size = ZSTD_CONTENTSIZE_UNKNOWN;
+
+	while (input.size != 0)
+	{
+		while (input.pos < input.size)
+		{
+			// the frame is over but there are more bytes
+			if (ret == 0)
+				return -1;
+
+			if (content_size != ZSTD_CONTENTSIZE_UNKNOWN &&
+				content_size > total_out)
+			{
+				out_len = (size_t)(content_size - total_out);
+			}
+			else
+				out_len = ZSTD_DStreamOutSize();
+
+			if (dst->acquire(&out_buf, &out_len) == false)
+				return -1;
+
+			output.dst = out_buf;
+			output.size = out_len;
+			output.pos = 0;
+			ret = ZSTD_decompressStream(dctx, &output, &input);
+			dst->backup(out_len - output.pos);
+			if (ZSTD_isError(ret))
+				return -1;
+
+			total_out += output.pos;
+		}
+
+		input.size = src->fetch(&input.src);
+		input.pos = 0;
+	}
+
+	input.src = NULL;
+	// flush what is left in the window when the last input is consumed
+	while (ret != 0)
+	{
+		out_len = ZSTD_DStreamOutSize();
+		if (dst->acquire(&out_buf, &out_len) == false)
+			return -1;
+
+		output.dst = out_buf;
+		output.size = out_len;
+		output.pos = 0;
+		ret = ZSTD_decompressStream(dctx, &output, &input);
+		dst->backup(out_len - output.pos);
+		// no progress means the frame is truncated
+		if (ZSTD_isError(ret) || output.pos == 0)
+			return -1;
+
+		total_out += output.pos;
+	}
+
+	return (int)total_out;
+}
+
+/*
+ * compress RPCBuffer src into RPCBuffer dst, with dict if not NULL
+ * ret: -1: failed
+ * 		>0: byte count of compressed data
+ */
+static int ZstdCompressIOVecDict(RPCBuffer *src, RPCBuffer *dst,
+								 const ZstdDictionary *dict)
+{
+	ZstdCompressContext *ctx = ZstdCompressCache::get();
+	int ret = -1;
+
+	if (!ctx)
+		return -1;
+
+	if (!dict || !ZSTD_isError(ZSTD_CCtx_refCDict(ctx->cctx, dict->cdict)))
+		ret = ZstdCompressFrame(ctx->cctx, src, dst);
+
+	if (ret < 0)
+		delete ctx;
+	else
+		ZstdCompressCache::put(ctx);
+
+	return ret;
+}
+
+/*
+ * decompress RPCBuffer src into RPCBuffer dst, with dict if not NULL
+ * ret: -1: failed
+ * 		>0: byte count of decompressed data
+ */
+static int ZstdDecompressIOVecDict(RPCBuffer *src, RPCBuffer *dst,
+								   const ZstdDictionary *dict)
+{
+	ZstdDecompressContext *ctx = ZstdDecompressCache::get();
+	int ret = -1;
+
+	if (!ctx)
+		return -1;
+
+	if (!dict || !ZSTD_isError(ZSTD_DCtx_refDDict(ctx->dctx, dict->ddict)))
+		ret = ZstdDecompressFrame(ctx->dctx, src, dst);
+
+	if (ret < 0)
+		delete ctx;
+	else
+		ZstdDecompressCache::put(ctx);
+
+	return ret;
+}
+
+static int ZstdCompressIOVec(RPCBuffer *src, RPCBuffer *dst)
+{
+	return ZstdCompressIOVecDict(src, dst, NULL);
+}
+
+static int ZstdDecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
+{
+	return ZstdDecompressIOVecDict(src, dst, NULL);
+}
+
+/*
+ * zstd frame of RPCBuffer by RPCCompressor::new_decompress_stream(),
+ * with dict if not NULL. The context is put back after the whole frame
+ */
+class ZstdDecompressStream : public RPCDecompressStream
+{
+public:
+	ZstdDecompressStream(RPCBuffer *src, const ZstdDictionary *dict) :
+		RPCDecompressStream(src),
+		ctx(ZstdDecompressCache::get()),
+		finished(false)
+	{
+		if (this->ctx && dict &&
+			ZSTD_isError(ZSTD_DCtx_refDDict(this->ctx->dctx, dict->ddict)))
+		{
+			delete this->ctx;
+			this->ctx = NULL;
+		}
+	}
+
+	~ZstdDecompressStream()
+	{
+		if (this->finished)
+			ZstdDecompressCache::put(this->ctx);
+		else
+			delete this->ctx;
+	}
+
+protected:
+	int decompress(void *out, size_t out_len) override
+	{
+		ZSTD_outBuffer output = { out, out_len, 0 };
+		ZSTD_inBuffer input;
+		size_t ret;
+		bool has_input;
+
+		if (!this->ctx)
+			return -1;
+
+		while (!this->finished && output.pos == 0)
+		{
+			// zstd may still hold output without any input
+			has_input = this->fill_input();
+			input.src = this->in_buf;
+			input.size = this->in_len;
+			input.pos = 0;
+			ret = ZSTD_decompressStream(this->ctx->dctx, &output, &input);
+			if (ZSTD_isError(ret))
+				return -1;
+
+			this->in_buf = (const char *)this->in_buf + input.pos;
+			this->in_len -= input.pos;
+			if (ret == 0)
+				this->finished = true;
+			else if (!has_input && output.pos == 0)
+				return -1;
+		}
+
+		if (output.pos == 0)
+			return this->fill_input() ? -1 : 0;
+
+		return (int)output.pos;
+	}
+
+private:
+	ZstdDecompressContext *ctx;
+	bool finished;
+};
+
+static int ZstdLeaseSize(size_t origin_size)
+{
+	size_t bound = ZSTD_compressBound(origin_size);
+
+	if (ZSTD_isError(bound) || bound > 0x7FFFFFFF)
+		return -1;
+
+	return (int)bound;
+}
+
+} // namespace srpc
+
+#endif
+
@@ -60,6 +60,7 @@ Available options(linux):\n\
     -o, --output_dir    : Output directory.\n\
     -i, --input_dir     : Specify the directory in which to search for imports.\n\
     -s, --skip_skeleton : Skip generating skeleton file. (default: generate)\n\
+    -c, --coroutine     : Generate C++20 coroutine methods, see srpc/rpc_coroutine.h. (default: not)\n\
     -v, --version       : Show version.\n\
     -h, --help          : Show usage.\n";
 
@@ -172,10 +173,11 @@ int parse_getopt(int argc, char * const *argv,
 		{ "output_dir",    required_argument, NULL, 'o'},
 		{ "input_dir",     required_argument, NULL, 'i'},
 		{ "skip_skeleton", no_argument,       NULL, 's'},
+		{ "coroutine",     no_argument,       NULL, 'c'},
 		{ "help",          no_argument,       NULL, 'h'}
 	};
 
-	while ((ch = getopt_long(argc, argv, "vf:o:i:sh", longopts, NULL)) != -1)
+	while ((ch = getopt_long(argc, argv, "vf:o:i:sch", longopts, NULL)) != -1)
 	{
 		switch (ch)
 		{
@@ -208,6 +210,9 @@ int parse_getopt(int argc, char * const *argv,
 		case 's':
 			params.generate_skeleton = false;
 			break;
+		case 'c':
+			params.generate_coroutine = true;
+			break;
 		case 'h':
 			break;
 		default:
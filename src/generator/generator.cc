@@ -77,6 +77,7 @@ bool Generator::init_file_names(const std::string& idl_file, const char *out_dir
 bool Generator::generate(struct GeneratorParams& params)
 {
 	this->info.input_dir = params.input_dir;
+	this->printer.set_coroutine(params.generate_coroutine);
 
 	if (this->parser.parse(params.idl_file, this->info) == false)
 	{
@@ -315,6 +316,7 @@ bool Generator::generate_srpc_file(const idl_info& cur_info)
 			continue;
 
 		this->printer.print_service_namespace(desc.block_name);
+		this->printer.print_method_ids(package + desc.block_name, desc.rpcs);
 		this->printer.print_server_comment();
 
 		if (this->is_thrift)
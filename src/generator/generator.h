@@ -33,10 +33,12 @@ struct GeneratorParams
 {
 	const char *out_dir;
 	bool generate_skeleton;
+	bool generate_coroutine;
 	std::string idl_file;
 	std::string input_dir;
 
-	GeneratorParams() : out_dir(NULL), generate_skeleton(true) { }
+	GeneratorParams() :
+		out_dir(NULL), generate_skeleton(true), generate_coroutine(false) { }
 };
 
 class Generator
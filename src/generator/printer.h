@@ -87,6 +87,13 @@ static inline std::string make_srpc_service_prefix(const std::vector<std::string
 	return name;
 }
 
+// the method name and its constant for RPCClient::create_rpc_client_task()
+static inline std::string make_method_args(const std::string& name,
+										   const std::string& method)
+{
+	return "\"" + name + "\", METHOD_ID_" + method;
+}
+
 static inline std::string make_trpc_service_prefix(const std::vector<std::string>& package,
 												   const std::string& service)
 {
@@ -422,6 +429,9 @@ public:
 		fprintf(this->out_file, this->srpc_include_format.c_str(), prefix.c_str(),
 				this->is_thrift ? "thrift" : "pb");
 
+		if (this->is_coroutine)
+			fprintf(this->out_file, "#include \"srpc/rpc_coroutine.h\"\n");
+
 		for (size_t i = 0; i < package.size(); i++)
 			fprintf(this->out_file, this->namespace_package_start_format.c_str(),
 					package[i].c_str());
@@ -512,7 +522,10 @@ public:
 			resp = make_package_prefix(package, response);
 		}
 
-		fprintf(this->out_file, this->server_impl_method_format.c_str(),
+		// thrift servers keep the methods of the callbacks
+		fprintf(this->out_file, this->is_coroutine && !this->is_thrift ?
+				this->server_impl_method_coroutine_format.c_str() :
+				this->server_impl_method_format.c_str(),
 				method.c_str(), req.c_str(), resp.c_str());
 	}
 
@@ -615,7 +628,9 @@ public:
 			std::string req = change_include_prefix(rpc.request_name);
 			std::string resp = change_include_prefix(rpc.response_name);
 
-			fprintf(this->out_file, this->server_class_method_format.c_str(),
+			fprintf(this->out_file, this->is_coroutine ?
+					this->server_class_method_coroutine_format.c_str() :
+					this->server_class_method_format.c_str(),
 					rpc.method_name.c_str(), req.c_str(),
 					resp.c_str());
 		}
@@ -679,6 +694,14 @@ public:
 					rpc.method_name.c_str(), req.c_str(), rpc.method_name.c_str(),
 					rpc.method_name.c_str(), req.c_str(), resp.c_str(),
 					resp.c_str(), rpc.method_name.c_str(), req.c_str());
+
+			if (this->is_coroutine)
+			{
+				fprintf(this->out_file,
+						this->client_class_construct_methods_coroutine_format.c_str(),
+						resp.c_str(), type.c_str(), rpc.method_name.c_str(),
+						req.c_str());
+			}
 		}
 
 		fprintf(this->out_file, this->client_class_constructor_format.c_str(),
@@ -752,6 +775,31 @@ public:
 				method_params, type.c_str());
 	}
 
+	void print_client_method_coroutine(const std::string& type,
+									   const std::string& service,
+									   const rpc_descriptor& rpc,
+									   const std::vector<std::string>& package)
+	{
+		std::string req = change_include_prefix(rpc.request_name);
+		std::string resp = change_include_prefix(rpc.response_name);
+		std::string method = rpc.method_name;
+		const char *format = this->client_method_coroutine_format.c_str();
+
+		if (type == "TRPC" || type == "TRPCHttp")
+			format = this->client_method_coroutine_trpc_format.c_str();
+
+		if (type == "TRPC")
+			method = make_trpc_method_prefix(package, service, rpc.method_name);
+
+		std::string args = make_method_args(method, rpc.method_name);
+
+		fprintf(this->out_file, format,
+				resp.c_str(), type.c_str(), type.c_str(),
+				rpc.method_name.c_str(), req.c_str(),
+				resp.c_str(), type.c_str(),
+				resp.c_str(), args.c_str());
+	}
+
 	void print_client_methods(const std::string& type,
 							  const std::string& service,
 							  const std::vector<rpc_descriptor>& rpcs,
@@ -761,24 +809,30 @@ public:
 		{
 			std::string req = change_include_prefix(rpc.request_name);
 			std::string resp = change_include_prefix(rpc.response_name);
+			std::string args = make_method_args(rpc.method_name, rpc.method_name);
+
+			if (this->is_coroutine)
+				this->print_client_method_coroutine(type, service, rpc, package);
 
 			if (type == "TRPC")
 			{
 				std::string full_method = make_trpc_method_prefix(package,
 																  service,
 																  rpc.method_name);
+				std::string args = make_method_args(full_method, rpc.method_name);
 
 				fprintf(this->out_file, this->client_method_trpc_format.c_str(),
 						type.c_str(), rpc.method_name.c_str(),
 						req.c_str(), rpc.method_name.c_str(),
-						full_method.c_str(),
+						args.c_str(),
 
 						type.c_str(), rpc.method_name.c_str(),
-						req.c_str(), resp.c_str(), rpc.method_name.c_str(),
+						req.c_str(), resp.c_str(),
+						resp.c_str(), args.c_str(),
 
 						resp.c_str(), type.c_str(),
 						rpc.method_name.c_str(), req.c_str(),
-						resp.c_str(), resp.c_str(), full_method.c_str(),
+						resp.c_str(), resp.c_str(), args.c_str(),
 						resp.c_str());
 			}
 			else if (type == "TRPCHttp")
@@ -786,14 +840,15 @@ public:
 				fprintf(this->out_file, this->client_method_trpc_format.c_str(),
 						type.c_str(), rpc.method_name.c_str(),
 						req.c_str(), rpc.method_name.c_str(),
-						rpc.method_name.c_str(),
+						args.c_str(),
 
 						type.c_str(), rpc.method_name.c_str(),
-						req.c_str(), resp.c_str(), rpc.method_name.c_str(),
+						req.c_str(), resp.c_str(),
+						resp.c_str(), args.c_str(),
 
 						resp.c_str(), type.c_str(),
 						rpc.method_name.c_str(), req.c_str(),
-						resp.c_str(), resp.c_str(), rpc.method_name.c_str(),
+						resp.c_str(), resp.c_str(), args.c_str(),
 						resp.c_str());
 			}
 			else
@@ -801,14 +856,15 @@ public:
 				fprintf(this->out_file, this->client_method_format.c_str(),
 						type.c_str(), rpc.method_name.c_str(),
 						req.c_str(), rpc.method_name.c_str(),
-						rpc.method_name.c_str(),
+						args.c_str(),
 
 						type.c_str(), rpc.method_name.c_str(),
-						req.c_str(), resp.c_str(), rpc.method_name.c_str(),
+						req.c_str(), resp.c_str(),
+						resp.c_str(), args.c_str(),
 
 						resp.c_str(), type.c_str(),
 						rpc.method_name.c_str(), req.c_str(),
-						resp.c_str(), resp.c_str(), rpc.method_name.c_str(),
+						resp.c_str(), resp.c_str(), args.c_str(),
 						resp.c_str());
 			}
 		}
@@ -866,9 +922,11 @@ public:
 					recv_params.clear();
 				}
 
+				std::string args = make_method_args(rpc.method_name, rpc.method_name);
+
 				fprintf(this->out_file,
 						this->cilent_method_thrift_send_end_format.c_str(),
-						resp.c_str(), rpc.method_name.c_str(), resp.c_str(), rpc.method_name.c_str(),
+						resp.c_str(), args.c_str(), resp.c_str(), rpc.method_name.c_str(),
 
 						return_type.c_str(), type.c_str(), rpc.method_name.c_str(), recv_params.c_str(),
 						rpc.method_name.c_str(), last_return.c_str());
@@ -885,27 +943,30 @@ public:
 	{
 		for (const auto& rpc : rpcs)
 		{
+			std::string args = make_method_args(rpc.method_name, rpc.method_name);
+
 			if (type == "TRPC")
 			{
 				std::string full_method = make_trpc_method_prefix(package,
 																  service,
 																  rpc.method_name);
+				std::string args = make_method_args(full_method, rpc.method_name);
 
 				fprintf(this->out_file, this->client_create_task_trpc_format.c_str(),
 						type.c_str(), type.c_str(), rpc.method_name.c_str(),
-				rpc.method_name.c_str(), full_method.c_str());
+				rpc.method_name.c_str(), args.c_str());
 			}
 			else if (type == "TRPCHttp")
 			{
 				fprintf(this->out_file, this->client_create_task_trpc_format.c_str(),
 						type.c_str(), type.c_str(), rpc.method_name.c_str(),
-						rpc.method_name.c_str(), rpc.method_name.c_str());
+						rpc.method_name.c_str(), args.c_str());
 			}
 			else
 			{
 				fprintf(this->out_file, this->client_create_task_format.c_str(),
 						type.c_str(), type.c_str(), rpc.method_name.c_str(),
-						rpc.method_name.c_str(), rpc.method_name.c_str());
+						rpc.method_name.c_str(), args.c_str());
 			}
 		}
 	}
@@ -916,6 +977,19 @@ public:
 				service.c_str());
 	}
 
+	void print_method_ids(const std::string& service,
+						  const std::vector<rpc_descriptor>& rpcs)
+	{
+		fprintf(this->out_file, "%s", this->method_ids_comment_format.c_str());
+
+		for (const auto& rpc : rpcs)
+		{
+			fprintf(this->out_file, this->method_id_format.c_str(),
+					rpc.method_name.c_str(), service.c_str(),
+					rpc.method_name.c_str());
+		}
+	}
+
 	void print_service_namespace_end(const std::string& service)
 	{
 		fprintf(this->out_file, this->namespace_service_end_format.c_str(),
@@ -1052,11 +1126,18 @@ public:
 		fprintf(this->out_file, "\n");
 	}
 
-	Printer(bool is_thrift) { this->is_thrift = is_thrift; }
+	Printer(bool is_thrift)
+	{
+		this->is_thrift = is_thrift;
+		this->is_coroutine = false;
+	}
+
+	void set_coroutine(bool is_coroutine) { this->is_coroutine = is_coroutine; }
 
 protected:
 	FILE *out_file;
 	bool is_thrift;
+	bool is_coroutine;
 
 private:
 	std::string thrift_include_format = R"(#pragma once
@@ -1110,6 +1191,16 @@ namespace %s
 
 	std::string namespace_package_end_format = R"(} // end namespace %s
 
+)";
+
+	std::string method_ids_comment_format = R"(
+/*
+ * Method IDs, srpc::RPC_METHOD_ID() of the service and the method
+ * Generated by SRPC
+ */
+)";
+
+	std::string method_id_format = R"(static constexpr uint32_t METHOD_ID_%s = srpc::RPC_METHOD_ID("%s", "%s");
 )";
 
 	std::string server_comment_format = R"(
@@ -1211,6 +1302,11 @@ public:
 					srpc::RPCContext *ctx) = 0;
 )";
 
+	std::string server_class_method_coroutine_format = R"(
+	virtual srpc::RPCCoroutine %s(%s *request, %s *response,
+								  srpc::RPCContext *ctx) = 0;
+)";
+
 	std::string server_class_method_declaration_thrift_format = R"(
 	virtual void %s(%s *request, %s *response,
 					srpc::RPCContext *ctx);
@@ -1350,6 +1446,9 @@ private:
 	WFFuture<std::pair<%s, srpc::RPCSyncContext>> async_%s(const %s *req);
 )";
 
+	std::string client_class_construct_methods_coroutine_format = R"(	srpc::RPCClientAwaiter<%s, srpc::%sClientTask> %s(const %s *req);
+)";
+
 	std::string client_class_constructor_format = R"(
 public:
 	%sClient(const char *host, unsigned short port);
@@ -1368,7 +1467,7 @@ public:
 	std::string client_method_format = R"(
 inline void %sClient::%s(const %s *req, %sDone done)
 {
-	auto *task = this->create_rpc_client_task("%s", std::move(done));
+	auto *task = this->create_rpc_client_task(%s, std::move(done));
 
 	task->serialize_input(req);
 	task->start();
@@ -1376,13 +1475,11 @@ inline void %sClient::%s(const %s *req, %sDone done)
 
 inline void %sClient::%s(const %s *req, %s *resp, srpc::RPCSyncContext *sync_ctx)
 {
-	auto res = this->async_%s(req).get();
-
-	if (resp && res.second.success)
-		*resp = std::move(res.first);
+	auto *receiver = srpc::RPCSyncReceiver::get_thread_receiver();
+	auto *task = this->create_rpc_sync_task<%s>(%s, receiver);
 
-	if (sync_ctx)
-		*sync_ctx = std::move(res.second);
+	task->serialize_input(req);
+	receiver->call(task, resp, sync_ctx);
 }
 
 inline WFFuture<std::pair<%s, srpc::RPCSyncContext>> %sClient::async_%s(const %s *req)
@@ -1390,19 +1487,45 @@ inline WFFuture<std::pair<%s, srpc::RPCSyncContext>> %sClient::async_%s(const %s
 	using RESULT = std::pair<%s, srpc::RPCSyncContext>;
 	auto *pr = new WFPromise<RESULT>();
 	auto fr = pr->get_future();
-	auto *task = this->create_rpc_client_task<%s>("%s", srpc::RPCAsyncFutureCallback<%s>);
+	auto *task = this->create_rpc_client_task<%s>(%s, srpc::RPCAsyncFutureCallback<%s>);
 
 	task->serialize_input(req);
 	task->user_data = pr;
 	task->start();
 	return fr;
 }
+)";
+
+	std::string client_method_coroutine_format = R"(
+inline srpc::RPCClientAwaiter<%s, srpc::%sClientTask> %sClient::%s(const %s *req)
+{
+	using AWAITER = srpc::RPCClientAwaiter<%s, srpc::%sClientTask>;
+	auto *task = this->create_rpc_client_task<%s>(%s, AWAITER::callback);
+
+	task->serialize_input(req);
+	return AWAITER(task);
+}
+)";
+
+	std::string client_method_coroutine_trpc_format = R"(
+inline srpc::RPCClientAwaiter<%s, srpc::%sClientTask> %sClient::%s(const %s *req)
+{
+	using AWAITER = srpc::RPCClientAwaiter<%s, srpc::%sClientTask>;
+	auto *task = this->create_rpc_client_task<%s>(%s, AWAITER::callback);
+
+	if (this->params.callee_timeout >= 0)
+		task->get_req()->set_callee_timeout(this->params.callee_timeout);
+	if (!this->params.caller.empty())
+		task->get_req()->set_caller_name(this->params.caller);
+	task->serialize_input(req);
+	return AWAITER(task);
+}
 )";
 
 	std::string client_method_trpc_format = R"(
 inline void %sClient::%s(const %s *req, %sDone done)
 {
-	auto *task = this->create_rpc_client_task("%s", std::move(done));
+	auto *task = this->create_rpc_client_task(%s, std::move(done));
 
 	if (this->params.callee_timeout >= 0)
 		task->get_req()->set_callee_timeout(this->params.callee_timeout);
@@ -1414,13 +1537,15 @@ inline void %sClient::%s(const %s *req, %sDone done)
 
 inline void %sClient::%s(const %s *req, %s *resp, srpc::RPCSyncContext *sync_ctx)
 {
-	auto res = this->async_%s(req).get();
+	auto *receiver = srpc::RPCSyncReceiver::get_thread_receiver();
+	auto *task = this->create_rpc_sync_task<%s>(%s, receiver);
 
-	if (resp && res.second.success)
-		*resp = std::move(res.first);
-
-	if (sync_ctx)
-		*sync_ctx = std::move(res.second);
+	if (this->params.callee_timeout >= 0)
+		task->get_req()->set_callee_timeout(this->params.callee_timeout);
+	if (!this->params.caller.empty())
+		task->get_req()->set_caller_name(this->params.caller);
+	task->serialize_input(req);
+	receiver->call(task, resp, sync_ctx);
 }
 
 inline WFFuture<std::pair<%s, srpc::RPCSyncContext>> %sClient::async_%s(const %s *req)
@@ -1428,7 +1553,7 @@ inline WFFuture<std::pair<%s, srpc::RPCSyncContext>> %sClient::async_%s(const %s
 	using RESULT = std::pair<%s, srpc::RPCSyncContext>;
 	auto *pr = new WFPromise<RESULT>();
 	auto fr = pr->get_future();
-	auto *task = this->create_rpc_client_task<%s>("%s", srpc::RPCAsyncFutureCallback<%s>);
+	auto *task = this->create_rpc_client_task<%s>(%s, srpc::RPCAsyncFutureCallback<%s>);
 
 	if (this->params.callee_timeout >= 0)
 		task->get_req()->set_callee_timeout(this->params.callee_timeout);
@@ -1465,7 +1590,7 @@ inline void %sClient::send_%s(%s)
 )";
 
 	std::string cilent_method_thrift_send_end_format = R"(
-	auto *task = this->create_rpc_client_task<%s>("%s", srpc::ThriftSendCallback<%s>);
+	auto *task = this->create_rpc_client_task<%s>(%s, srpc::ThriftSendCallback<%s>);
 
 	task->serialize_input(&__thrift__sync__req);
 	task->user_data = get_thread_sync_receiver_%s();
@@ -1517,14 +1642,14 @@ inline const srpc::RPCSyncContext& %sClient::thrift_last_sync_ctx() const
 	std::string client_create_task_format = R"(
 inline srpc::%sClientTask *%sClient::create_%s_task(%sDone done)
 {
-	return this->create_rpc_client_task("%s", std::move(done));
+	return this->create_rpc_client_task(%s, std::move(done));
 }
 )";
 
 	std::string client_create_task_trpc_format = R"(
 inline srpc::%sClientTask *%sClient::create_%s_task(%sDone done)
 {
-	auto *task = this->create_rpc_client_task("%s", std::move(done));
+	auto *task = this->create_rpc_client_task(%s, std::move(done));
 
 	if (!this->params.caller.empty())
 		task->get_req()->set_caller_name(this->params.caller);
@@ -1586,6 +1711,14 @@ public:
 	}
 )";
 
+	std::string server_impl_method_coroutine_format = R"(
+	srpc::RPCCoroutine %s(%s *request, %s *response, srpc::RPCContext *ctx) override
+	{
+		// TODO: fill server logic here, co_await the clients if any
+		co_return;
+	}
+)";
+
 	std::string server_main_begin_format = R"(
 
 int main()
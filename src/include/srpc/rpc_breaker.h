@@ -0,0 +1 @@
+../../rpc_breaker.h
\ No newline at end of file
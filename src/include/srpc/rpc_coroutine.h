@@ -0,0 +1 @@
+../../rpc_coroutine.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../rpc_hedge.h
\ No newline at end of file
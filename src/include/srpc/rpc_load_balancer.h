@@ -0,0 +1 @@
+../../rpc_load_balancer.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../message/rpc_pb_json.h
\ No newline at end of file
@@ -44,6 +44,15 @@ public:
 
 	virtual void set_seqid(long long seqid) {}
 
+	// the ID the client sent in place of the names, 0 if none
+	virtual uint32_t get_method_id() const { return 0; }
+	// RPC_METHOD_ID() of the names, on the wire only with method_id_only
+	virtual void set_method_id(uint32_t method_id) {}
+	// the ID goes instead of the names, only for a server that knows it
+	virtual void set_method_id_only(bool on) {}
+	// SRPC_META_V2 for the compact meta, only SRPC has versions
+	virtual void set_meta_version(int version) {}
+
 public:
 	virtual ~RPCRequest() { }
 };
@@ -82,6 +91,18 @@ public:
 	virtual bool get_meta_module_data(RPCModuleData& data) const = 0;
 	virtual bool set_meta_module_data(const RPCModuleData& data) = 0;
 
+	// body length, before any attachment. 0 if unknown
+	virtual size_t get_message_len() const { return 0; }
+
+	// compress() by blocks in parallel, false if the protocol can not
+	virtual bool set_compress_block_size(size_t block_size) { return false; }
+
+	// what the peer can receive, of a received message it is what the peer
+	// told. 0 if unknown, only SRPC tells them
+	virtual uint32_t get_peer_features() const { return 0; }
+	// false if the message needs what the peer can not receive
+	virtual bool set_peer_features(uint32_t features) { return true; }
+
 	virtual bool set_http_header(const std::string& name,
 								 const std::string& value)
 	{
@@ -48,6 +48,26 @@ BRPCMessage::BRPCMessage()
 	this->attachment = NULL;
 }
 
+BRPCMessage& BRPCMessage::operator= (BRPCMessage&& msg)
+{
+	if (&msg != this)
+	{
+		// the ones of this are freed with msg
+		memcpy(this->header, msg.header, BRPC_HEADER_SIZE);
+		std::swap(this->meta_buf, msg.meta_buf);
+		std::swap(this->message, msg.message);
+		std::swap(this->attachment, msg.attachment);
+		std::swap(this->meta, msg.meta);
+		this->nreceived = msg.nreceived;
+		this->meta_len = msg.meta_len;
+		this->message_len = msg.message_len;
+		this->attachment_len = msg.attachment_len;
+		this->flags = msg.flags;
+	}
+
+	return *this;
+}
+
 bool BRPCRequest::deserialize_meta()
 {
 	BrpcMeta *meta = static_cast<BrpcMeta *>(this->meta);
@@ -258,6 +278,45 @@ void BRPCMessage::set_attachment_nocopy(const char *attachment, size_t len)
 	this->attachment->append(attachment, len, BUFFER_MODE_NOCOPY);
 }
 
+bool BRPCMessage::share_to(BRPCMessage *msg)
+{
+	size_t size = this->message->size();
+
+	delete []msg->meta_buf;
+	msg->meta_buf = new char[this->meta_len];
+	memcpy(msg->meta_buf, this->meta_buf, this->meta_len);
+	msg->meta_len = this->meta_len;
+	msg->message_len = this->message_len;
+
+	msg->message->clear();
+	if (this->message->share(0, size, msg->message) != size)
+		return false;
+
+	msg->attachment_len = 0;
+	if (msg->attachment)
+		msg->attachment->clear();
+
+	if (this->attachment_len == 0)
+		return true;
+
+	// a late attempt may be sent after the callback of the user
+	const void *piece;
+	size_t len;
+
+	if (!msg->attachment)
+		msg->attachment = new RPCBuffer();
+
+	this->attachment->rewind();
+	while (len = this->attachment->fetch(&piece), piece && len > 0)
+	{
+		if (!msg->attachment->write(piece, len))
+			return false;
+	}
+
+	msg->attachment_len = this->attachment_len;
+	return true;
+}
+
 bool BRPCMessage::get_attachment_nocopy(const char **attachment, size_t *len) const
 {
 	size_t tmp_len = (size_t)-1;
@@ -387,6 +446,10 @@ const char *BRPCResponse::get_errmsg() const
 		return "URI Invalid";
 	case RPCStatusUpstreamFailed:
 		return "Upstream Failed";
+	case RPCStatusCircuitBreakerOpen:
+		return "Circuit Breaker Open";
+	case RPCStatusAttachmentNotSupported:
+		return "Attachment Not Supported by Server";
 	case RPCStatusSystemError:
 		return "System Error. Use get_error() to get errno";
 	case RPCStatusSSLError:
@@ -36,6 +36,8 @@ class BRPCMessage : public RPCMessage
 public:
 	BRPCMessage();
 	virtual ~BRPCMessage();
+	// the reply of a hedge is moved into the task
+	BRPCMessage& operator= (BRPCMessage&& msg);
 
 	int encode(struct iovec vectors[], int max, size_t size_limit);
 	int append(const void *buf, size_t *size, size_t size_limit);
@@ -45,6 +47,7 @@ public:
 
 	bool get_attachment_nocopy(const char **attachment, size_t *len) const;
 	void set_attachment_nocopy(const char *attachment, size_t len);
+	void set_attachment_compress_type(int type) { }
 
 	int get_data_type() const override { return RPCDataProtobuf; }
 	void set_data_type(int type) override { }
@@ -61,6 +64,11 @@ public:
 	int compress() override;
 	int decompress() override;
 
+	size_t get_message_len() const override { return this->message_len; }
+	// after serialize_meta(), msg encodes the same bytes with the body shared.
+	// The attachment is copied, it is the memory of the user
+	bool share_to(BRPCMessage *msg);
+
 protected:
 	// "PRPC" + PAYLOAD_SIZE + META_SIZE
 	char header[BRPC_HEADER_SIZE];
@@ -168,6 +176,12 @@ public:
 		return this->BRPCMessage::get_meta_module_data(data);
 	}
 
+	// the features are of SRPC only
+	bool share_to(BRPCStdRequest *req, uint32_t peer_features)
+	{
+		return this->BRPCRequest::share_to(req);
+	}
+
 public:
 	BRPCStdRequest() { this->size_limit = RPC_BODY_SIZE_LIMIT; }
 };
@@ -19,7 +19,6 @@
 #include <string>
 #include <google/protobuf/stubs/common.h>
 #include <google/protobuf/util/json_util.h>
-#include <google/protobuf/util/type_resolver_util.h>
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include <workflow/HttpUtil.h>
 #include <workflow/StringUtil.h>
@@ -28,6 +27,7 @@
 #include "rpc_meta.pb.h"
 #include "rpc_message_srpc.h"
 #include "rpc_zero_copy_stream.h"
+#include "rpc_pb_json.h"
 #include "rpc_module.h"
 #include "rpc_trace_module.h"
 
@@ -42,6 +42,7 @@ struct SRPCHttpHeadersString
 	const std::string DataType			=	"Content-Type";
 	const std::string SRPCStatus		=	"SRPC-Status";
 	const std::string SRPCError			=	"SRPC-Error";
+	const std::string CompressDictId	=	"Compress-Dict-Id";
 };
 
 struct CaseCmp
@@ -61,7 +62,8 @@ static const std::map<const std::string, int, CaseCmp> SRPCHttpHeadersCode =
 	{SRPCHttpHeaders.CompressdSize,		3},
 	{SRPCHttpHeaders.DataType,			4},
 	{SRPCHttpHeaders.SRPCStatus,		5},
-	{SRPCHttpHeaders.SRPCError,			6}
+	{SRPCHttpHeaders.SRPCError,			6},
+	{SRPCHttpHeaders.CompressDictId,	7}
 };
 
 static const std::vector<std::string> RPCDataTypeString =
@@ -77,33 +79,12 @@ static const std::vector<std::string> RPCRPCCompressTypeString =
 	"x-snappy",
 	"gzip",
 	"deflate",
-	"x-lz4"
+	"x-lz4",
+	"zstd"
 };
 
 static constexpr const char *kTypePrefix = "type.googleapis.com";
 
-class ResolverInstance
-{
-public:
-	static google::protobuf::util::TypeResolver *get_resolver()
-	{
-		static ResolverInstance kInstance;
-
-		return kInstance.resolver_;
-	}
-
-private:
-	ResolverInstance()
-	{
-		resolver_ = google::protobuf::util::NewTypeResolverForDescriptorPool(
-			kTypePrefix, google::protobuf::DescriptorPool::generated_pool());
-	}
-
-	~ResolverInstance() { delete resolver_; }
-
-	google::protobuf::util::TypeResolver *resolver_;
-};
-
 static inline std::string GetTypeUrl(const ProtobufIDLMessage *pb_msg)
 {
 	return std::string(kTypePrefix) + "/" + pb_msg->GetDescriptor()->full_name();
@@ -115,11 +96,120 @@ SRPCMessage::SRPCMessage()
 	this->meta_buf = NULL;
 	this->meta_len = 0;
 	this->message_len = 0;
+	this->attachment_len = 0;
+	this->attachment = NULL;
+	this->stream = NULL;
+	this->meta_version = SRPC_META_V1;
+	this->seqid = 0;
+	this->peer_features = 0;
+	this->dict_service = NULL;
+	this->dict_method = NULL;
 	memset(this->header, 0, sizeof (this->header));
 	this->meta = new RPCMeta();
+	static_cast<RPCMeta *>(this->meta)->set_features(SRPC_FEATURE_ATTACHMENT |
+													 SRPC_FEATURE_META_V2);
 	this->buf = new RPCBuffer();
 }
 
+SRPCMessage& SRPCMessage::operator= (SRPCMessage&& msg)
+{
+	if (&msg != this)
+	{
+		// the ones of this are freed with msg
+		memcpy(this->header, msg.header, SRPC_HEADER_SIZE);
+		std::swap(this->buf, msg.buf);
+		std::swap(this->meta_buf, msg.meta_buf);
+		std::swap(this->attachment, msg.attachment);
+		std::swap(this->meta, msg.meta);
+		std::swap(this->stream, msg.stream);
+		this->nreceived = msg.nreceived;
+		this->meta_len = msg.meta_len;
+		this->message_len = msg.message_len;
+		this->attachment_len = msg.attachment_len;
+		this->meta_version = msg.meta_version;
+		this->seqid = msg.seqid;
+		this->peer_features = msg.peer_features;
+		this->dict_service = msg.dict_service;
+		this->dict_method = msg.dict_method;
+		this->flags = msg.flags;
+	}
+
+	return *this;
+}
+
+// the rest of the section is known, so each piece is as large as possible,
+// a section no larger than piece_max_size is received into one piece
+static bool __receive_section(RPCBuffer *section, size_t section_len,
+							  const void *buf, size_t size)
+{
+	while (size > 0)
+	{
+		void *p;
+		size_t sz = section_len - section->size();
+
+		if (!section->acquire(&p, &sz))
+			return false;
+
+		if (sz > size)
+		{
+			memcpy(p, buf, size);
+			section->backup(sz - size);
+			break;
+		}
+
+		memcpy(p, buf, sz);
+		buf = (const char *)buf + sz;
+		size -= sz;
+	}
+
+	return true;
+}
+
+// meta, message and attachment follow the header one by one
+bool SRPCMessage::receive_body(const void *buf, size_t size)
+{
+	size_t body_received = this->nreceived - SRPC_HEADER_SIZE;
+	size_t n;
+
+	if (body_received < this->meta_len)
+	{
+		n = this->meta_len - body_received;
+		if (n > size)
+			n = size;
+
+		memcpy(this->meta_buf + body_received, buf, n);
+		buf = (const char *)buf + n;
+		size -= n;
+		body_received += n;
+	}
+
+	if (size > 0 && body_received < this->meta_len + this->message_len)
+	{
+		n = this->meta_len + this->message_len - body_received;
+		if (n > size)
+			n = size;
+
+		if (!__receive_section(this->buf, this->message_len, buf, n))
+			return false;
+
+		buf = (const char *)buf + n;
+		size -= n;
+	}
+
+	if (size > 0)
+	{
+		// pieces no larger than BUFFER_PIECE_MAX_SIZE as the body, never
+		// allocated by the length in the header before the bytes come
+		if (!this->attachment)
+			this->attachment = new RPCBuffer();
+
+		if (!__receive_section(this->attachment, this->attachment_len, buf, size))
+			return false;
+	}
+
+	return true;
+}
+
 int SRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 {
 	uint32_t *p;
@@ -134,11 +224,17 @@ int SRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 			//receive the whole header and ready to recieve body
 			memcpy(this->header + this->nreceived, buf, header_left);
 			this->nreceived += header_left;
+			// the magic is not checked, as before versions were there
+			if (memcmp(this->header, "SRP2", 4) == 0)
+				this->meta_version = SRPC_META_V2;
+
 			p = (uint32_t *)this->header + 1;
 			this->meta_len = ntohl(*p);
 			p = (uint32_t *)this->header + 2;
 			this->message_len = ntohl(*p);
-			buf_len = this->meta_len + this->message_len;
+			p = (uint32_t *)this->header + 3;
+			this->attachment_len = ntohl(*p);
+			buf_len = this->meta_len + this->message_len + this->attachment_len;
 
 			if (buf_len >= size_limit)
 			{
@@ -151,18 +247,11 @@ int SRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 					*size = header_left + buf_len;
 
 				this->meta_buf = new char[this->meta_len];
-
-				if (*size - header_left <= this->meta_len)
+				if (!this->receive_body((const char *)buf + header_left,
+										*size - header_left))
 				{
-					memcpy(this->meta_buf, (const char *)buf + header_left,
-						   *size - header_left);
-				} else {
-					memcpy(this->meta_buf, (const char *)buf + header_left,
-						   this->meta_len);
-
-					this->buf->append((const char *)buf + header_left + this->meta_len,
-									  *size - header_left - this->meta_len,
-									  BUFFER_MODE_COPY);
+					errno = ENOMEM;
+					return -1;
 				}
 
 				this->nreceived += *size - header_left;
@@ -194,27 +283,14 @@ int SRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 	{
 		// have already received the header and now is for body only
 		body_received = this->nreceived - SRPC_HEADER_SIZE;
-		buf_len = this->meta_len + this->message_len;
+		buf_len = this->meta_len + this->message_len + this->attachment_len;
 		if (body_received + *size > buf_len)
 			*size = buf_len - body_received;
 
-		if (body_received + *size <= this->meta_len)
+		if (!this->receive_body(buf, *size))
 		{
-			// 100 + 3 <= 106
-			memcpy(this->meta_buf + body_received, buf, *size);
-		} else if (body_received < this->meta_len) {
-			// 100 + ? > 106, 100 < 106
-			memcpy(this->meta_buf + body_received, buf,
-				   this->meta_len - body_received);
-
-			if (body_received + *size > this->meta_len)// useless. always true
-				// 100 + 10 > 106
-				this->buf->append((const char *)buf + this->meta_len - body_received,
-								  *size - this->meta_len + body_received,
-								  BUFFER_MODE_COPY);
-		} else {
-			// 110 > 106
-			this->buf->append((const char *)buf, *size, BUFFER_MODE_COPY);
+			errno = ENOMEM;
+			return -1;
 		}
 
 		this->nreceived += *size;
@@ -252,13 +328,134 @@ void SRPCMessage::set_data_type(int type)
 
 void SRPCMessage::set_attachment_nocopy(const char *attachment, size_t len)
 {
-	//TODO:
+	if (!this->attachment)
+		this->attachment = new RPCBuffer();
+
+	this->attachment->append(attachment, len, BUFFER_MODE_NOCOPY);
+	this->attachment_len += len;
 }
 
 bool SRPCMessage::get_attachment_nocopy(const char **attachment, size_t *len) const
 {
-	//TODO:
-	return false;
+	size_t tmp_len = (size_t)-1;
+	const void *tmp_buf;
+
+	if (this->attachment_len == 0)
+		return false;
+
+	// set by several calls, received or decompressed into several pieces
+	if (this->attachment->get_piece_num() > 1)
+	{
+		struct iovec iov;
+
+		if (this->attachment->merge_all(iov) < 0)
+			return false;
+
+		tmp_buf = iov.iov_base;
+		tmp_len = iov.iov_len;
+	}
+	else
+	{
+		this->attachment->rewind();
+		if (this->attachment->fetch(&tmp_buf, &tmp_len) == false)
+			return false;
+	}
+
+	*attachment = (const char *)tmp_buf;
+	*len = tmp_len;
+	return true;
+}
+
+bool SRPCMessage::deserialize_meta()
+{
+	if (this->meta_version == SRPC_META_V2)
+	{
+		if (!this->deserialize_meta_v2())
+			return false;
+	}
+	else if (!this->meta->ParseFromArray(this->meta_buf, (int)this->meta_len))
+		return false;
+
+	// none from an old peer
+	this->peer_features = SRPC_FEATURE_KNOWN |
+						  static_cast<RPCMeta *>(this->meta)->features();
+	return true;
+}
+
+bool SRPCMessage::set_peer_features(uint32_t features)
+{
+	this->peer_features = features;
+	return this->attachment_len == 0 ||
+		   (features & SRPC_FEATURE_ATTACHMENT);
+}
+
+bool SRPCMessage::share_to(SRPCMessage *msg, uint32_t peer_features)
+{
+	size_t size = this->buf->size();
+
+	delete []msg->meta_buf;
+	msg->meta_buf = new char[this->meta_len];
+	memcpy(msg->meta_buf, this->meta_buf, this->meta_len);
+	msg->meta_len = this->meta_len;
+	msg->message_len = this->message_len;
+	msg->meta_version = this->meta_version;
+	msg->seqid = this->seqid;
+
+	msg->buf->clear();
+	if (this->buf->share(0, size, msg->buf) != size)
+		return false;
+
+	msg->attachment_len = 0;
+	if (msg->attachment)
+		msg->attachment->clear();
+
+	if (this->attachment_len == 0)
+		return msg->set_peer_features(peer_features);
+
+	// a late attempt may be sent after the callback of the user
+	const void *piece;
+	size_t len;
+
+	if (!msg->attachment)
+		msg->attachment = new RPCBuffer();
+
+	this->attachment->rewind();
+	while (len = this->attachment->fetch(&piece), piece && len > 0)
+	{
+		if (!msg->attachment->write(piece, len))
+			return false;
+	}
+
+	msg->attachment_len = this->attachment_len;
+	return msg->set_peer_features(peer_features);
+}
+
+void SRPCMessage::set_attachment_compress_type(int type)
+{
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+
+	meta->set_attachment_compress_type(type);
+}
+
+void SRPCMessage::set_compress_dict_id(uint32_t dict_id)
+{
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+
+	if (dict_id)
+		meta->set_compress_dict_id(dict_id);
+	else
+		meta->clear_compress_dict_id();
+}
+
+bool SRPCMessage::set_compress_block_size(size_t block_size)
+{
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+
+	if (block_size == 0 || block_size > 0x7FFFFFFF)
+		return false;
+
+	meta->set_compress_block_size((uint32_t)block_size);
+	return true;
 }
 
 bool SRPCMessage::set_meta_module_data(const RPCModuleData& data)
@@ -311,6 +508,253 @@ bool SRPCMessage::get_meta_module_data(RPCModuleData& data) const
 	return true;
 }
 
+/*
+ * SRPC_META_V2 has the hot fields of RPCMeta at fixed offsets,
+ * all in network byte order:
+ *
+ *   0 flags           1 data_type       2 compress_type   3 attachment_compress_type
+ *   4 seqid           8 method_id      12 status_code    16 error
+ *  20 origin_size    24 compressed_size                  28 attachment_origin_size
+ *  32 compress_dict_id                 36 compress_block_size
+ *  40 length of service_name (16 bits) 42 length of method_name (16 bits)
+ *
+ * Then the trace id and the span id if flagged, the names, and the rest
+ * of RPCMeta as protobuf, if there is any. A size, method_id or dictionary
+ * of 0 is the same as none. It is only sent to a peer that has shown
+ * SRPC_FEATURE_META_V2. Flags are less than 8, so the first byte is never
+ * a valid protobuf tag, and a peer without SRPC_META_V2 fails instead of
+ * misreading it anyway.
+ */
+static constexpr uint8_t SRPC_META_V2_REQUEST	= 1;
+static constexpr uint8_t SRPC_META_V2_TRACE_ID	= 2;
+static constexpr uint8_t SRPC_META_V2_SPAN_ID	= 4;
+
+static inline char *__write_u32(char *p, uint32_t n)
+{
+	*(uint32_t *)p = htonl(n);
+	return p + 4;
+}
+
+static inline uint32_t __read_u32(const char *p)
+{
+	return ntohl(*(const uint32_t *)p);
+}
+
+bool SRPCMessage::serialize_meta_v2(bool with_names)
+{
+	const RPCMeta *meta = static_cast<const RPCMeta *>(this->meta);
+	const RPCRequestMeta& req_meta = meta->request();
+	const std::string *trace_id = NULL;
+	const std::string *span_id = NULL;
+	size_t service_len = 0;
+	size_t method_len = 0;
+	uint8_t flags = 0;
+	size_t ext_len;
+	RPCMeta ext;
+	char *p;
+
+	if (meta->has_request())
+	{
+		flags |= SRPC_META_V2_REQUEST;
+		if (with_names)
+		{
+			service_len = req_meta.service_name().size();
+			method_len = req_meta.method_name().size();
+			if (service_len > 0xFFFF || method_len > 0xFFFF)
+				return false;
+		}
+
+		if (req_meta.has_log_id())
+			ext.mutable_request()->set_log_id(req_meta.log_id());
+	}
+
+	if (meta->has_srpc_version())
+		ext.set_srpc_version(meta->srpc_version());
+
+	if (meta->has_features())
+		ext.set_features(meta->features());
+
+	for (const auto& kv : meta->trans_info())
+	{
+		if (!trace_id && kv.key() == SRPC_TRACE_ID &&
+			kv.bytes_value().size() == SRPC_TRACEID_SIZE)
+		{
+			flags |= SRPC_META_V2_TRACE_ID;
+			trace_id = &kv.bytes_value();
+		}
+		else if (!span_id && kv.key() == SRPC_SPAN_ID &&
+				 kv.bytes_value().size() == SRPC_SPANID_SIZE)
+		{
+			flags |= SRPC_META_V2_SPAN_ID;
+			span_id = &kv.bytes_value();
+		}
+		else
+			*ext.add_trans_info() = kv;
+	}
+
+	ext_len = ext.ByteSizeLong();
+	this->meta_len = SRPC_META_V2_SIZE + service_len + method_len + ext_len;
+	if (trace_id)
+		this->meta_len += SRPC_TRACEID_SIZE;
+
+	if (span_id)
+		this->meta_len += SRPC_SPANID_SIZE;
+
+	delete []this->meta_buf;
+	this->meta_buf = new char[this->meta_len];
+	p = this->meta_buf;
+	p[0] = (char)flags;
+	p[1] = (char)meta->data_type();
+	p[2] = (char)meta->compress_type();
+	p[3] = (char)meta->attachment_compress_type();
+	p = __write_u32(p + 4, this->seqid);
+	p = __write_u32(p, req_meta.method_id());
+	p = __write_u32(p, (uint32_t)meta->response().status_code());
+	p = __write_u32(p, (uint32_t)meta->response().error());
+	p = __write_u32(p, (uint32_t)meta->origin_size());
+	p = __write_u32(p, (uint32_t)meta->compressed_size());
+	p = __write_u32(p, (uint32_t)meta->attachment_origin_size());
+	p = __write_u32(p, meta->compress_dict_id());
+	p = __write_u32(p, meta->compress_block_size());
+	*(uint16_t *)p = htons((uint16_t)service_len);
+	*(uint16_t *)(p + 2) = htons((uint16_t)method_len);
+	p += 4;
+
+	if (trace_id)
+	{
+		memcpy(p, trace_id->data(), SRPC_TRACEID_SIZE);
+		p += SRPC_TRACEID_SIZE;
+	}
+
+	if (span_id)
+	{
+		memcpy(p, span_id->data(), SRPC_SPANID_SIZE);
+		p += SRPC_SPANID_SIZE;
+	}
+
+	memcpy(p, req_meta.service_name().data(), service_len);
+	p += service_len;
+	memcpy(p, req_meta.method_name().data(), method_len);
+	p += method_len;
+
+	return ext_len == 0 || ext.SerializeToArray(p, (int)ext_len);
+}
+
+bool SRPCMessage::deserialize_meta_v2()
+{
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+	const char *buf = this->meta_buf;
+	const char *p = buf + SRPC_META_V2_SIZE;
+	const char *trace_id = NULL;
+	const char *span_id = NULL;
+	size_t service_len;
+	size_t method_len;
+	const char *ext;
+	size_t len;
+	uint8_t flags;
+	uint32_t n;
+
+	if (this->meta_len < SRPC_META_V2_SIZE)
+		return false;
+
+	flags = (uint8_t)buf[0];
+	service_len = ntohs(*(const uint16_t *)(buf + 40));
+	method_len = ntohs(*(const uint16_t *)(buf + 42));
+	len = service_len + method_len;
+	if (flags & SRPC_META_V2_TRACE_ID)
+		len += SRPC_TRACEID_SIZE;
+
+	if (flags & SRPC_META_V2_SPAN_ID)
+		len += SRPC_SPANID_SIZE;
+
+	if (flags >= 8 || len > this->meta_len - SRPC_META_V2_SIZE)
+		return false;
+
+	if (flags & SRPC_META_V2_TRACE_ID)
+	{
+		trace_id = p;
+		p += SRPC_TRACEID_SIZE;
+	}
+
+	if (flags & SRPC_META_V2_SPAN_ID)
+	{
+		span_id = p;
+		p += SRPC_SPANID_SIZE;
+	}
+
+	// the rest goes first, as parsing clears the meta
+	ext = p + service_len + method_len;
+	if (ext == buf + this->meta_len)
+		meta->Clear();
+	else if (!meta->ParseFromArray(ext, (int)(buf + this->meta_len - ext)))
+		return false;
+
+	meta->set_data_type((int8_t)buf[1]);
+	meta->set_compress_type((uint8_t)buf[2]);
+	meta->set_attachment_compress_type((uint8_t)buf[3]);
+	this->seqid = __read_u32(buf + 4);
+
+	if (flags & SRPC_META_V2_REQUEST)
+	{
+		RPCRequestMeta *req_meta = meta->mutable_request();
+
+		n = __read_u32(buf + 8);
+		if (n != 0)
+			req_meta->set_method_id(n);
+
+		if (service_len != 0)
+			req_meta->set_service_name(p, service_len);
+
+		if (method_len != 0)
+			req_meta->set_method_name(p + service_len, method_len);
+	}
+	else
+	{
+		RPCResponseMeta *resp_meta = meta->mutable_response();
+
+		resp_meta->set_status_code((int32_t)__read_u32(buf + 12));
+		resp_meta->set_error((int32_t)__read_u32(buf + 16));
+	}
+
+	n = __read_u32(buf + 20);
+	if (n != 0)
+		meta->set_origin_size((int32_t)n);
+
+	n = __read_u32(buf + 24);
+	if (n != 0)
+		meta->set_compressed_size((int32_t)n);
+
+	n = __read_u32(buf + 28);
+	if (n != 0)
+		meta->set_attachment_origin_size((int32_t)n);
+
+	n = __read_u32(buf + 32);
+	if (n != 0)
+		meta->set_compress_dict_id(n);
+
+	n = __read_u32(buf + 36);
+	if (n != 0)
+		meta->set_compress_block_size(n);
+
+	if (trace_id)
+	{
+		RPCMetaKeyValue *meta_kv = meta->add_trans_info();
+
+		meta_kv->set_key(SRPC_TRACE_ID);
+		meta_kv->set_bytes_value(trace_id, SRPC_TRACEID_SIZE);
+	}
+
+	if (span_id)
+	{
+		RPCMetaKeyValue *meta_kv = meta->add_trans_info();
+
+		meta_kv->set_key(SRPC_SPAN_ID);
+		meta_kv->set_bytes_value(span_id, SRPC_SPANID_SIZE);
+	}
+
+	return true;
+}
+
 const std::string& SRPCRequest::get_service_name() const
 {
 	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
@@ -339,6 +783,66 @@ void SRPCRequest::set_method_name(const std::string& method_name)
 	meta->mutable_request()->set_method_name(method_name);
 }
 
+uint32_t SRPCRequest::get_method_id() const
+{
+	const RPCMeta *meta = static_cast<const RPCMeta *>(this->meta);
+
+	return meta->request().method_id();
+}
+
+void SRPCRequest::set_method_id(uint32_t method_id)
+{
+	this->method_id = method_id;
+}
+
+// the ID goes in place of the names, which stay for this side
+bool SRPCRequest::serialize_meta()
+{
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+	RPCRequestMeta *req_meta = meta->mutable_request();
+
+	if (!this->method_id_only || this->method_id == 0)
+		return this->SRPCMessage::serialize_meta();
+
+	bool ret;
+
+	req_meta->set_method_id(this->method_id);
+	if (this->send_meta_v2())
+		ret = this->serialize_meta_v2(false);
+	else
+	{
+		std::string service_name;
+		std::string method_name;
+
+		service_name.swap(*req_meta->mutable_service_name());
+		method_name.swap(*req_meta->mutable_method_name());
+		req_meta->clear_service_name();
+		req_meta->clear_method_name();
+
+		ret = this->SRPCMessage::serialize_meta();
+
+		req_meta->set_service_name(std::move(service_name));
+		req_meta->set_method_name(std::move(method_name));
+	}
+
+	req_meta->clear_method_id();
+	return ret;
+}
+
+bool SRPCRequest::share_to(SRPCRequest *req, uint32_t peer_features)
+{
+	if (!this->SRPCMessage::share_to(req, peer_features))
+		return false;
+
+	if (req->send_meta_v2() == this->send_meta_v2())
+		return true;
+
+	req->meta->CopyFrom(*this->meta);
+	req->method_id = this->method_id;
+	req->method_id_only = this->method_id_only;
+	return req->serialize_meta();
+}
+
 int SRPCResponse::get_status_code() const
 {
 	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
@@ -416,6 +920,10 @@ const char *SRPCResponse::get_errmsg() const
 		return "URI Invalid";
 	case RPCStatusUpstreamFailed:
 		return "Upstream Failed";
+	case RPCStatusCircuitBreakerOpen:
+		return "Circuit Breaker Open";
+	case RPCStatusAttachmentNotSupported:
+		return "Attachment Not Supported by Server";
 	case RPCStatusSystemError:
 		return "System Error. Use get_error() to get errno";
 	case RPCStatusSSLError:
@@ -454,15 +962,20 @@ int SRPCMessage::serialize(const ProtobufIDLMessage *pb_msg)
 		ret = pb_msg->SerializeToZeroCopyStream(&output_stream) ? 0 : -1;
 		this->message_len = this->buf->size();
 	}
+	else if (data_type == RPCDataJson &&
+			 ProtobufJsonCodec::supported(pb_msg, this->flags))
+	{
+		ret = ProtobufJsonCodec::serialize(pb_msg, this->flags,
+										   &output_stream) ? 0 : -1;
+		this->message_len = this->buf->size();
+	}
 	else if (data_type == RPCDataJson)
 	{
 		std::string binary_input = pb_msg->SerializeAsString();
 		io::ArrayInputStream input_stream(binary_input.data(),
 											  (int)binary_input.size());
 		const auto *pool = pb_msg->GetDescriptor()->file()->pool();
-		auto *resolver = (pool == DescriptorPool::generated_pool() ? 
-					ResolverInstance::get_resolver() :
-					util::NewTypeResolverForDescriptorPool(kTypePrefix, pool));
+		auto resolver = ProtobufResolverCache::get(pool);
 
 		util::JsonPrintOptions options;
 		options.add_whitespace = this->get_json_add_whitespace();
@@ -474,10 +987,8 @@ int SRPCMessage::serialize(const ProtobufIDLMessage *pb_msg)
 		options.always_print_primitive_fields = this->get_json_fields_no_presence();
 #endif
 
-		ret = BinaryToJsonStream(resolver, GetTypeUrl(pb_msg), &input_stream,
+		ret = BinaryToJsonStream(resolver.get(), GetTypeUrl(pb_msg), &input_stream,
 								 &output_stream, options).ok() ? 0 : -1;
-		if (pool != DescriptorPool::generated_pool())
-			delete resolver;
 
 		this->message_len = this->buf->size();
 	}
@@ -498,40 +1009,46 @@ int SRPCMessage::deserialize(ProtobufIDLMessage *pb_msg)
 	bool is_resp = !meta->has_request();
 	int data_type = meta->data_type();
 	int ret;
-	RPCInputStream input_stream(this->buf);
+	RPCInputStream buffer_stream(this->buf);
+	RPCDecompressInputStream decompress_stream(this->stream);
+	io::ZeroCopyInputStream& input_stream = this->stream ?
+		static_cast<io::ZeroCopyInputStream&>(decompress_stream) :
+		static_cast<io::ZeroCopyInputStream&>(buffer_stream);
 
 	if (data_type == RPCDataProtobuf)
 		ret = pb_msg->ParseFromZeroCopyStream(&input_stream) ? 0 : -1;
+	else if (data_type == RPCDataJson && ProtobufJsonCodec::supported(pb_msg))
+		ret = ProtobufJsonCodec::deserialize(&input_stream, pb_msg) ? 0 : -1;
 	else if (data_type == RPCDataJson)
 	{
 		std::string binary_output;
 		io::StringOutputStream output_stream(&binary_output);
 		const auto *pool = pb_msg->GetDescriptor()->file()->pool();
-		auto *resolver = (pool == DescriptorPool::generated_pool() ?
-					ResolverInstance::get_resolver() :
-					util::NewTypeResolverForDescriptorPool(kTypePrefix, pool));
+		auto resolver = ProtobufResolverCache::get(pool);
 
 		util::JsonParseOptions options;
 		options.ignore_unknown_fields = true;
-		if (JsonToBinaryStream(resolver, GetTypeUrl(pb_msg), &input_stream,
+		if (JsonToBinaryStream(resolver.get(), GetTypeUrl(pb_msg), &input_stream,
 							   &output_stream, options).ok())
 		{
 			ret = pb_msg->ParseFromString(binary_output) ? 0 : -1;
 		}
 		else
 			ret = -1;
-
-		if (pool != DescriptorPool::generated_pool())
-			delete resolver;
 	}
 	else
 		ret = -1;
 
 	if (ret < 0)
-		return is_resp ? RPCStatusRespDeserializeError :
-						 RPCStatusReqDeserializeError;
+		ret = is_resp ? RPCStatusRespDeserializeError :
+						RPCStatusReqDeserializeError;
+	else
+		ret = RPCStatusOK;
 
-	return RPCStatusOK;
+	if (this->stream)
+		ret = this->end_decompress_stream(ret);
+
+	return ret;
 }
 
 int SRPCMessage::serialize(const ThriftIDLMessage *thrift_msg)
@@ -574,6 +1091,7 @@ int SRPCMessage::deserialize(ThriftIDLMessage *thrift_msg)
 
 	ThriftBuffer thrift_buffer(this->buf);
 
+	thrift_buffer.stream = this->stream;
 	if (data_type == RPCDataThrift)
 		ret = thrift_msg->descriptor->reader(&thrift_buffer, thrift_msg) ? 0 : 1;
 	else if (data_type == RPCDataJson)
@@ -582,10 +1100,137 @@ int SRPCMessage::deserialize(ThriftIDLMessage *thrift_msg)
 		ret = -1;
 
 	if (ret < 0)
-		return is_resp ? RPCStatusRespDeserializeError
-					   : RPCStatusReqDeserializeError;
+		ret = is_resp ? RPCStatusRespDeserializeError
+					  : RPCStatusReqDeserializeError;
+	else
+		ret = RPCStatusOK;
 
-	return RPCStatusOK;
+	if (this->stream)
+		ret = this->end_decompress_stream(ret);
+
+	return ret;
+}
+
+// the rest of the body is still checked after a successful parsing
+int SRPCMessage::end_decompress_stream(int status_code)
+{
+	const RPCMeta *meta = static_cast<const RPCMeta *>(this->meta);
+	bool is_resp = !meta->has_request();
+	const void *buf;
+
+	if (status_code == RPCStatusOK)
+	{
+		while (this->stream->next(&buf) > 0)
+			;
+	}
+
+	if (this->stream->failed())
+	{
+		status_code = is_resp ? RPCStatusRespDecompressError
+							  : RPCStatusReqDecompressError;
+	}
+	else if (status_code == RPCStatusOK && meta->has_origin_size() &&
+			 this->stream->byte_count() != (size_t)meta->origin_size())
+	{
+		status_code = is_resp ? RPCStatusRespDecompressSizeInvalid
+							  : RPCStatusReqDecompressSizeInvalid;
+	}
+
+	delete this->stream;
+	this->stream = NULL;
+	return status_code;
+}
+
+int SRPCMessage::compress_attachment()
+{
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+	bool is_resp = !meta->has_request();
+	int type = meta->attachment_compress_type();
+	int status_code = RPCStatusOK;
+
+	if (this->attachment_len == 0 || type == RPCCompressNone)
+		return status_code;
+
+	if (this->attachment_len > 0x7FFFFFFF)
+	{
+		return is_resp ? RPCStatusRespCompressSizeInvalid
+					   : RPCStatusReqCompressSizeInvalid;
+	}
+
+	RPCBuffer *dst_buf = new RPCBuffer();
+	static RPCCompressor *compressor = RPCCompressor::get_instance();
+	int ret = compressor->serialize_to_compressed(this->attachment, dst_buf, type);
+
+	if (ret == -2)
+	{
+		status_code = is_resp ? RPCStatusRespCompressNotSupported
+							  : RPCStatusReqCompressNotSupported;
+	}
+	else if (ret == -1)
+	{
+		status_code = is_resp ? RPCStatusRespCompressError
+							  : RPCStatusReqCompressError;
+	}
+	else if (ret <= 0)
+	{
+		status_code = is_resp ? RPCStatusRespCompressSizeInvalid
+							  : RPCStatusReqCompressSizeInvalid;
+	}
+
+	if (status_code == RPCStatusOK)
+	{
+		meta->set_attachment_origin_size((int)this->attachment_len);
+		delete this->attachment;
+		this->attachment = dst_buf;
+		this->attachment_len = ret;
+	}
+	else
+		delete dst_buf;
+
+	return status_code;
+}
+
+int SRPCMessage::decompress_attachment()
+{
+	const RPCMeta *meta = static_cast<const RPCMeta *>(this->meta);
+	bool is_resp = !meta->has_request();
+	int type = meta->attachment_compress_type();
+	int status_code = RPCStatusOK;
+
+	if (this->attachment_len == 0 || type == RPCCompressNone)
+		return status_code;
+
+	RPCBuffer *dst_buf = new RPCBuffer();
+	static RPCCompressor *compressor = RPCCompressor::get_instance();
+	int ret = compressor->parse_from_compressed(this->attachment, dst_buf, type);
+
+	if (ret == -2)
+	{
+		status_code = is_resp ? RPCStatusRespDecompressNotSupported
+							  : RPCStatusReqDecompressNotSupported;
+	}
+	else if (ret == -1)
+	{
+		status_code = is_resp ? RPCStatusRespDecompressError
+							  : RPCStatusReqDecompressError;
+	}
+	else if (ret <= 0 || (meta->has_attachment_origin_size() &&
+						  ret != meta->attachment_origin_size()))
+	{
+		status_code = is_resp ? RPCStatusRespDecompressSizeInvalid
+							  : RPCStatusReqDecompressSizeInvalid;
+	}
+
+	if (status_code == RPCStatusOK)
+	{
+		delete this->attachment;
+		this->attachment = dst_buf;
+		this->attachment_len = ret;
+	}
+	else
+		delete dst_buf;
+
+	return status_code;
 }
 
 int SRPCMessage::compress()
@@ -595,7 +1240,10 @@ int SRPCMessage::compress()
 	int type = meta->compress_type();
 	size_t buflen = this->message_len;
 	int origin_size;
-	int status_code = RPCStatusOK;
+	int status_code = this->compress_attachment();
+
+	if (status_code != RPCStatusOK)
+		return status_code;
 
 	if (buflen == 0)
 	{
@@ -635,8 +1283,46 @@ int SRPCMessage::compress()
 	if (this->buf->size() != this->message_len)
 		return is_resp ? RPCStatusRespCompressError : RPCStatusReqCompressError;
 
+	// a response by the names of its request, see server_reply_init()
+	if (!meta->has_compress_dict_id())
+	{
+		const auto& req_meta = meta->request();
+
+		if (!is_resp)
+		{
+			this->set_compress_dict_id(compressor->get_dictionary_id(type,
+													req_meta.service_name(),
+													req_meta.method_name()));
+		}
+		else if (this->dict_service)
+		{
+			this->set_compress_dict_id(compressor->get_dictionary_id(type,
+													*this->dict_service,
+													*this->dict_method));
+		}
+	}
+
+	if (type != RPCCompressZstd)
+		meta->clear_compress_dict_id();
+
+	if (meta->compress_dict_id() != 0 ||
+		this->message_len <= meta->compress_block_size())
+	{
+		meta->clear_compress_block_size();
+	}
+
 	RPCBuffer *dst_buf = new RPCBuffer();
-	ret = compressor->serialize_to_compressed(this->buf, dst_buf, type);
+
+	if (meta->has_compress_block_size())
+	{
+		ret = compressor->serialize_to_compressed_blocks(this->buf, dst_buf, type,
+												meta->compress_block_size());
+	}
+	else
+	{
+		ret = compressor->serialize_to_compressed(this->buf, dst_buf, type,
+												  meta->compress_dict_id());
+	}
 
 	if (ret == -2)
 	{
@@ -677,7 +1363,10 @@ int SRPCMessage::decompress()
 	const RPCMeta *meta = static_cast<const RPCMeta *>(this->meta);
 	bool is_resp = !meta->has_request();
 	int type = meta->compress_type();
-	int status_code = RPCStatusOK;
+	int status_code = this->decompress_attachment();
+
+	if (status_code != RPCStatusOK)
+		return status_code;
 
 	if (this->message_len == 0 || type == RPCCompressNone)
 		return status_code;
@@ -691,9 +1380,37 @@ int SRPCMessage::decompress()
 	if (this->buf->size() != (size_t)meta->compressed_size())
 		return is_resp ? RPCStatusRespCompressError : RPCStatusReqCompressError;
 
-	RPCBuffer *dst_buf = new RPCBuffer();
 	static RPCCompressor *compressor = RPCCompressor::get_instance();
-	int ret = compressor->parse_from_compressed(this->buf, dst_buf, type);
+
+	// a large body is inflated while deserializing, not into a whole copy
+	if (!meta->has_compress_block_size() &&
+		(!meta->has_origin_size() ||
+		 (size_t)meta->origin_size() > DECOMPRESS_STREAM_WINDOW))
+	{
+		this->stream = compressor->new_decompress_stream(this->buf, type,
+													meta->compress_dict_id());
+		if (this->stream)
+		{
+			if (meta->has_origin_size())
+				this->message_len = meta->origin_size();
+
+			return status_code;
+		}
+	}
+
+	RPCBuffer *dst_buf = new RPCBuffer();
+	int ret;
+
+	if (meta->has_compress_block_size())
+	{
+		ret = compressor->parse_from_compressed_blocks(this->buf, dst_buf, type,
+												meta->compress_block_size());
+	}
+	else
+	{
+		ret = compressor->parse_from_compressed(this->buf, dst_buf, type,
+												meta->compress_dict_id());
+	}
 
 	if (ret == -2)
 	{
@@ -767,6 +1484,9 @@ static bool __deserialize_meta_http(const char *request_uri,
 					}
 				}
 
+				break;
+			case 7:
+				meta->set_compress_dict_id(strtoul(value.c_str(), NULL, 10));
 				break;
 			default:
 				continue;
@@ -866,6 +1586,12 @@ bool SRPCHttpRequest::serialize_meta()
 
 		set_header_pair(SRPCHttpHeaders.OriginSize,
 						std::to_string(meta->origin_size()));
+
+		if (meta->has_compress_dict_id())
+		{
+			set_header_pair(SRPCHttpHeaders.CompressDictId,
+							std::to_string(meta->compress_dict_id()));
+		}
 	} else {
 		set_header_pair("Content-Length", std::to_string(this->message_len));
 	}
@@ -882,6 +1608,24 @@ bool SRPCHttpRequest::serialize_meta()
 	return true;
 }
 
+bool SRPCHttpRequest::share_to(SRPCHttpRequest *req, uint32_t peer_features)
+{
+	const void *buffer;
+	size_t buflen;
+
+	if (!this->SRPCRequest::share_to(req, peer_features) ||
+		!http_copy_request_header(this, req))
+	{
+		return false;
+	}
+
+	// out of the pieces of req, they live as long as it
+	while (buflen = req->buf->fetch(&buffer), buffer && buflen > 0)
+		req->append_output_body_nocopy(buffer, buflen);
+
+	return true;
+}
+
 bool SRPCHttpRequest::deserialize_meta()
 {
 	const char *request_uri = this->get_request_uri();
@@ -952,6 +1696,12 @@ bool SRPCHttpResponse::serialize_meta()
 
 		set_header_pair(SRPCHttpHeaders.OriginSize,
 						std::to_string(meta->origin_size()));
+
+		if (meta->has_compress_dict_id())
+		{
+			set_header_pair(SRPCHttpHeaders.CompressDictId,
+							std::to_string(meta->compress_dict_id()));
+		}
 	} else {
 		set_header_pair("Content-Length", std::to_string(this->message_len));
 	}
@@ -28,11 +28,20 @@
 #include "rpc_basic.h"
 #include "rpc_thrift_idl.h"
 #include "rpc_buffer.h"
+#include "rpc_compress.h"
 
 namespace srpc
 {
 
 static constexpr int SRPC_HEADER_SIZE = 16;
+// fixed fields of SRPC_META_V2, see serialize_meta_v2()
+static constexpr int SRPC_META_V2_SIZE = 44;
+
+// RPCMeta::features, what an SRPC peer can receive
+static constexpr uint32_t SRPC_FEATURE_ATTACHMENT	= 1;
+static constexpr uint32_t SRPC_FEATURE_META_V2		= 2;
+// never on the wire, the features of the peer are known, may be none
+static constexpr uint32_t SRPC_FEATURE_KNOWN		= 0x80000000;
 
 // define srpc protocol
 class SRPCMessage : public RPCMessage
@@ -40,6 +49,8 @@ class SRPCMessage : public RPCMessage
 public:
 	SRPCMessage();
 	virtual ~SRPCMessage();
+	// the reply of a hedge is moved into the task
+	SRPCMessage& operator= (SRPCMessage&& msg);
 
 	int encode(struct iovec vectors[], int max, size_t size_limit);
 	int append(const void *buf, size_t *size, size_t size_limit);
@@ -53,12 +64,28 @@ public:
 	void set_compress_type(int type) override;
 	void set_data_type(int type) override;
 
+	// only sent if the peer can receive it, see set_peer_features()
 	void set_attachment_nocopy(const char *attachment, size_t len);
 	bool get_attachment_nocopy(const char **attachment, size_t *len) const;
+	void set_attachment_compress_type(int type);
+	uint32_t get_peer_features() const override { return this->peer_features; }
+	bool set_peer_features(uint32_t features) override;
+	// dictionary of RPCCompressor::add_dictionary(), 0 for none
+	void set_compress_dict_id(uint32_t dict_id);
+	// not for a body with a dictionary or not larger than block_size
+	bool set_compress_block_size(size_t block_size) override;
 
 	bool set_meta_module_data(const RPCModuleData& data) override;
 	bool get_meta_module_data(RPCModuleData& data) const override;
 
+	// SRPC_META_V1 or SRPC_META_V2, of a received message it is by the magic.
+	// SRPC_META_V2 is sent only if the peer has SRPC_FEATURE_META_V2
+	int get_meta_version() const { return this->meta_version; }
+	void set_meta_version(int version) { this->meta_version = version; }
+	// only SRPC_META_V2 carries it, a response gets the one of its request
+	uint32_t get_seqid() const { return this->seqid; }
+	void set_seqid(uint32_t seqid) { this->seqid = seqid; }
+
 public:
 	using RPCMessage::serialize;
 	using RPCMessage::deserialize;
@@ -72,30 +99,68 @@ public:
 
 public:
 	RPCBuffer *get_buffer() const { return this->buf; }
-	size_t get_message_len() const { return this->message_len; }
+	size_t get_message_len() const override { return this->message_len; }
 	void set_message_len(size_t len) { this->message_len = len; }
+	// after serialize_meta(), msg encodes the same bytes with the body shared.
+	// The attachment is copied, it is the memory of the user. False if msg
+	// has an attachment the peer of peer_features can not receive
+	bool share_to(SRPCMessage *msg, uint32_t peer_features);
 
 protected:
 	void init_meta();
+	bool receive_body(const void *buf, size_t size);
+	int compress_attachment();
+	int decompress_attachment();
+	int end_decompress_stream(int status_code);
+	bool serialize_meta_v2(bool with_names);
+	bool deserialize_meta_v2();
+	bool send_meta_v2() const
+	{
+		return this->meta_version == SRPC_META_V2 &&
+			   (this->peer_features & SRPC_FEATURE_META_V2);
+	}
 
-	// "SRPC" + META_LEN + MESSAGE_LEN + RESERVED
+	// "SRPC" + META_LEN + MESSAGE_LEN + ATTACHMENT_LEN, "SRP2" for SRPC_META_V2
 	char header[SRPC_HEADER_SIZE];
 	RPCBuffer *buf;
 	char *meta_buf;
 	size_t nreceived;
 	size_t meta_len;
 	size_t message_len;
+	size_t attachment_len;
+	RPCBuffer *attachment;
 	ProtobufIDLMessage *meta;
+	// body is inflated while deserializing if not NULL
+	RPCDecompressStream *stream;
+	int meta_version;
+	uint32_t seqid;
+	uint32_t peer_features;
+	// names of the request of a response, for its dictionary
+	const std::string *dict_service;
+	const std::string *dict_method;
 };
 
 class SRPCRequest : public SRPCMessage
 {
 public:
+	bool serialize_meta();
+
 	const std::string& get_service_name() const;
 	const std::string& get_method_name() const;
 
 	void set_service_name(const std::string& service_name);
 	void set_method_name(const std::string& method_name);
+
+	uint32_t get_method_id() const;
+	void set_method_id(uint32_t method_id);
+	void set_method_id_only(bool on) { this->method_id_only = on; }
+
+	// the meta is serialized again if the peer takes another version of it
+	bool share_to(SRPCRequest *req, uint32_t peer_features);
+
+private:
+	uint32_t method_id = 0;
+	bool method_id_only = false;
 };
 
 class SRPCResponse : public SRPCMessage
@@ -107,6 +172,15 @@ public:
 
 	void set_status_code(int code);
 	void set_error(int error);
+
+	// the dictionary is looked up by them only for RPCCompressZstd,
+	// they must live as long as this, as the request of a server task does
+	void set_dictionary_names(const std::string *service,
+							  const std::string *method)
+	{
+		this->dict_service = service;
+		this->dict_method = method;
+	}
 };
 
 class SRPCStdRequest : public protocol::ProtocolMessage, public RPCRequest, public SRPCRequest
@@ -154,6 +228,36 @@ public:
 		return this->SRPCRequest::set_method_name(method_name);
 	}
 
+	uint32_t get_method_id() const override
+	{
+		return this->SRPCRequest::get_method_id();
+	}
+
+	void set_method_id(uint32_t method_id) override
+	{
+		return this->SRPCRequest::set_method_id(method_id);
+	}
+
+	void set_method_id_only(bool on) override
+	{
+		return this->SRPCRequest::set_method_id_only(on);
+	}
+
+	void set_meta_version(int version) override
+	{
+		return this->SRPCRequest::set_meta_version(version);
+	}
+
+	void set_seqid(long long seqid) override
+	{
+		return this->SRPCRequest::set_seqid((uint32_t)seqid);
+	}
+
+	bool share_to(SRPCStdRequest *req, uint32_t peer_features)
+	{
+		return this->SRPCRequest::share_to(req, peer_features);
+	}
+
 	bool set_meta_module_data(const RPCModuleData& data) override
 	{
 		return this->SRPCMessage::set_meta_module_data(data);
@@ -259,6 +363,24 @@ public:
 		return this->SRPCRequest::set_method_name(method_name);
 	}
 
+	uint32_t get_method_id() const override
+	{
+		return this->SRPCRequest::get_method_id();
+	}
+
+	void set_method_id(uint32_t method_id) override
+	{
+		return this->SRPCRequest::set_method_id(method_id);
+	}
+
+	// HTTP has its own headers instead of the meta
+	void set_method_id_only(bool on) override { }
+	void set_meta_version(int version) override { }
+	void set_seqid(long long seqid) override { }
+
+	// also the start line and the headers
+	bool share_to(SRPCHttpRequest *req, uint32_t peer_features);
+
 	bool set_meta_module_data(const RPCModuleData& data) override;
 	bool get_meta_module_data(RPCModuleData& data) const override;
 
@@ -269,6 +391,11 @@ public:
 	bool get_http_header(const std::string& name,
 						 std::string& value) const override;
 
+	// Content-Encoding of HTTP has no blocks
+	bool set_compress_block_size(size_t block_size) override { return false; }
+	// HTTP never carries the attachment
+	bool set_peer_features(uint32_t features) override { return true; }
+
 public:
 	SRPCHttpRequest() { this->size_limit = RPC_BODY_SIZE_LIMIT; }
 };
@@ -320,6 +447,11 @@ public:
 	bool get_http_header(const std::string& name,
 						 std::string& value) const override;
 
+	// Content-Encoding of HTTP has no blocks
+	bool set_compress_block_size(size_t block_size) override { return false; }
+	// HTTP never carries the attachment
+	bool set_peer_features(uint32_t features) override { return true; }
+
 public:
 	SRPCHttpResponse() { this->size_limit = RPC_BODY_SIZE_LIMIT; }
 };
@@ -332,48 +464,91 @@ inline SRPCMessage::~SRPCMessage()
 	delete []this->meta_buf;
 	delete this->meta;
 	delete this->buf;
+	delete this->attachment;
+	delete this->stream;
 }
 
 inline int SRPCMessage::encode(struct iovec vectors[], int max, size_t size_limit)
 {
-	if (this->message_len > 0x7FFFFFFF)
+	// an old peer takes it for the next message
+	size_t attachment_len = (this->peer_features & SRPC_FEATURE_ATTACHMENT) ?
+							this->attachment_len : 0;
+
+	if (this->message_len + attachment_len > 0x7FFFFFFF)
 	{
 		errno = EOVERFLOW;
 		return -1;
 	}
 
+	int body_max = max - 2;
+	int ret;
+	int total;
 	char *p = this->header;
 
-	memcpy(p, "SRPC", 4);
+	memcpy(p, this->send_meta_v2() ? "SRP2" : "SRPC", 4);
 	p += 4;
 
 	*(uint32_t *)(p) = htonl((uint32_t)this->meta_len);
 	p += 4;
 
 	*(uint32_t *)(p) = htonl((uint32_t)this->message_len);
+	p += 4;
+
+	*(uint32_t *)(p) = htonl((uint32_t)attachment_len);
 
 	vectors[0].iov_base = this->header;
 	vectors[0].iov_len = SRPC_HEADER_SIZE;
 	vectors[1].iov_base = this->meta_buf;
 	vectors[1].iov_len = this->meta_len;
 
-	int ret = this->buf->encode(vectors + 2, max - 2);
+	if (attachment_len)
+	{
+		size_t body_pieces = this->buf->get_piece_num();
+		size_t attachment_pieces = this->attachment->get_piece_num();
+
+		// if not enough, split the vectors by pieces, one at least for each
+		if (body_pieces + attachment_pieces <= (size_t)body_max)
+			body_max -= (int)attachment_pieces;
+		else
+		{
+			body_max = (int)(body_max * body_pieces /
+							 (body_pieces + attachment_pieces));
+			if (body_max < 1)
+				body_max = 1;
+			else if (body_max > max - 3)
+				body_max = max - 3;
+		}
+	}
+
+	ret = this->buf->encode(vectors + 2, body_max);
+	if (ret < 0)
+		return ret;
+
+	total = ret;
+	if (attachment_len)
+	{
+		// usually NOCOPY pieces from the user, never merged with the message
+		ret = this->attachment->encode(vectors + 2 + total, max - 2 - total);
+		if (ret < 0)
+			return ret;
+
+		total += ret;
+	}
 
-	return ret < 0 ? ret : ret + 2;
+	return 2 + total;
 }
 
 inline bool SRPCMessage::serialize_meta()
 {
+	if (this->send_meta_v2())
+		return this->serialize_meta_v2(true);
+
+	delete []this->meta_buf;
 	this->meta_len = this->meta->ByteSizeLong();
 	this->meta_buf = new char[this->meta_len];
 	return this->meta->SerializeToArray(this->meta_buf, (int)this->meta_len);
 }
 
-inline bool SRPCMessage::deserialize_meta()
-{
-	return this->meta->ParseFromArray(this->meta_buf, (int)this->meta_len);
-}
-
 } // namespace srpc
 
 #endif
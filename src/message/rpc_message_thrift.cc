@@ -17,6 +17,7 @@
 #include <errno.h>
 #include <workflow/HttpUtil.h>
 #include "rpc_message_thrift.h"
+#include "rpc_module.h"
 
 namespace srpc
 {
@@ -104,6 +105,39 @@ static int thrift_parser_append_message(const void *buf, size_t *size,
 	return -1;
 }
 
+ThriftMessage& ThriftMessage::operator= (ThriftMessage&& msg)
+{
+	if (&msg != this)
+	{
+		ThriftMeta *meta = &TBuffer_.meta;
+
+		// TBuffer_.buffer keeps pointing to buf_, the pieces are moved
+		buf_.clear();
+		msg.buf_.cut(0, &buf_);
+		meta->writebuf = std::move(msg.TBuffer_.meta.writebuf);
+		meta->method_name = std::move(msg.TBuffer_.meta.method_name);
+		meta->seqid = msg.TBuffer_.meta.seqid;
+		meta->message_type = msg.TBuffer_.meta.message_type;
+		meta->is_strict = msg.TBuffer_.meta.is_strict;
+		TBuffer_.readbuf_size = msg.TBuffer_.readbuf_size;
+		TBuffer_.framesize_read_byte = msg.TBuffer_.framesize_read_byte;
+		TBuffer_.framesize = msg.TBuffer_.framesize;
+		TBuffer_.status = msg.TBuffer_.status;
+		this->flags = msg.flags;
+	}
+
+	return *this;
+}
+
+bool ThriftMessage::share_to(ThriftMessage *msg)
+{
+	size_t size = buf_.size();
+
+	msg->TBuffer_.meta.writebuf = TBuffer_.meta.writebuf;
+	msg->buf_.clear();
+	return buf_.share(0, size, &msg->buf_) == size;
+}
+
 int ThriftMessage::append(const void *buf, size_t *size, size_t size_limit)
 {
 	return thrift_parser_append_message(buf, size, &TBuffer_);
@@ -224,6 +258,27 @@ bool ThriftHttpRequest::serialize_meta()
 	return true;
 }
 
+bool ThriftHttpRequest::share_to(ThriftHttpRequest *req,
+								 uint32_t peer_features)
+{
+	const void *buf;
+	size_t buflen;
+
+	if (!this->ThriftRequest::share_to(req) ||
+		!http_copy_request_header(this, req))
+	{
+		return false;
+	}
+
+	req->append_output_body_nocopy(req->TBuffer_.meta.writebuf.c_str(),
+								   req->TBuffer_.meta.writebuf.size());
+	// out of the pieces of req, they live as long as it
+	while (buflen = req->buf_.fetch(&buf), buf && buflen > 0)
+		req->append_output_body_nocopy(buf, buflen);
+
+	return true;
+}
+
 bool ThriftHttpRequest::deserialize_meta()
 {
 	const void *body;
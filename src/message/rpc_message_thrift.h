@@ -72,8 +72,8 @@ public:
 	ThriftMessage& operator= (const ThriftMessage&) = delete;
 	//move constructor
 	ThriftMessage(ThriftMessage&&) = delete;
-	//move operator
-	ThriftMessage& operator= (ThriftMessage&&) = delete;
+	//move operator, the reply of a hedge is moved into the task
+	ThriftMessage& operator= (ThriftMessage&& msg);
 
 public:
 	int get_compress_type() const override { return RPCCompressNone; }
@@ -83,6 +83,7 @@ public:
 	void set_data_type(int type) override {}
 
 	void set_attachment_nocopy(const char *attachment, size_t len) { }
+	void set_attachment_compress_type(int type) { }
 	bool get_attachment_nocopy(const char **attachment, size_t *len) const
 	{
 		return false;
@@ -95,12 +96,16 @@ public:
 	int compress() override { return RPCStatusOK; }
 	int decompress() override { return RPCStatusOK; }
 
+	size_t get_message_len() const override { return this->buf_.size(); }
+
 	bool get_meta_module_data(RPCModuleData& data) const override { return false; }
 	bool set_meta_module_data(const RPCModuleData& data) override { return false; }
 
 public:
 	const ThriftMeta *get_meta() const { return &TBuffer_.meta; }
 	ThriftMeta *get_meta() { return &TBuffer_.meta; }
+	// after serialize_meta(), msg encodes the same bytes with the body shared
+	bool share_to(ThriftMessage *msg);
 
 protected:
 	int encode(struct iovec vectors[], int max, size_t size_limit);
@@ -216,6 +221,12 @@ public:
 		return this->ThriftMessage::get_meta_module_data(data);
 	}
 
+	// the features are of SRPC only
+	bool share_to(ThriftStdRequest *req, uint32_t peer_features)
+	{
+		return this->ThriftRequest::share_to(req);
+	}
+
 public:
 	ThriftStdRequest() { this->size_limit = RPC_BODY_SIZE_LIMIT; }
 };
@@ -335,6 +346,9 @@ public:
 	bool get_http_header(const std::string& name,
 						 std::string& value) const override;
 
+	// also the start line and the headers, the features are of SRPC only
+	bool share_to(ThriftHttpRequest *req, uint32_t peer_features);
+
 public:
 	ThriftHttpRequest() { this->size_limit = RPC_BODY_SIZE_LIMIT; }
 };
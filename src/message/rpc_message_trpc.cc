@@ -19,7 +19,6 @@
 #include <string>
 #include <google/protobuf/stubs/common.h>
 #include <google/protobuf/util/json_util.h>
-#include <google/protobuf/util/type_resolver_util.h>
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include <workflow/HttpUtil.h>
 #include <workflow/StringUtil.h>
@@ -29,6 +28,7 @@
 #include "rpc_basic.h"
 #include "rpc_compress.h"
 #include "rpc_zero_copy_stream.h"
+#include "rpc_pb_json.h"
 #include "rpc_module.h"
 
 namespace srpc
@@ -145,7 +145,8 @@ static int GetHttpCompressType(const std::string &type)
 		{"x-snappy",	RPCCompressSnappy},
 		{"gzip",		RPCCompressGzip},
 		{"deflate",		RPCCompressZlib},
-		{"x-lz4",		RPCCompressLz4}
+		{"x-lz4",		RPCCompressLz4},
+		{"zstd",		RPCCompressZstd}
 	};
 	auto it = M.find(type);
 	return it == M.end() ? RPCCompressNone : it->second;
@@ -165,6 +166,8 @@ static std::string GetHttpCompressTypeStr(int type)
 			return "deflate";
 		case RPCCompressLz4:
 			return "x-lz4";
+		case RPCCompressZstd:
+			return "zstd";
 	}
 
 	return "";
@@ -321,27 +324,6 @@ static std::string EncodeTransInfo(const TransInfoMap& map)
 
 static constexpr const char *kTypePrefix = "type.googleapis.com";
 
-class ResolverInstance
-{
-public:
-	static google::protobuf::util::TypeResolver *get_resolver()
-	{
-		static ResolverInstance kInstance;
-		return kInstance.resolver_;
-	}
-
-private:
-	ResolverInstance()
-	{
-		resolver_ = google::protobuf::util::NewTypeResolverForDescriptorPool(
-			kTypePrefix, google::protobuf::DescriptorPool::generated_pool());
-	}
-
-	~ResolverInstance() { delete resolver_; }
-
-	google::protobuf::util::TypeResolver *resolver_;
-};
-
 static inline std::string GetTypeUrl(const ProtobufIDLMessage *pb_msg)
 {
 	return std::string(kTypePrefix) + "/" + pb_msg->GetDescriptor()->full_name();
@@ -364,6 +346,38 @@ TRPCMessage::~TRPCMessage()
 	delete this->meta;
 }
 
+TRPCMessage& TRPCMessage::operator= (TRPCMessage&& msg)
+{
+	if (&msg != this)
+	{
+		// the ones of this are freed with msg
+		memcpy(this->header, msg.header, TRPC_HEADER_SIZE);
+		std::swap(this->meta_buf, msg.meta_buf);
+		std::swap(this->message, msg.message);
+		std::swap(this->meta, msg.meta);
+		this->nreceived = msg.nreceived;
+		this->meta_len = msg.meta_len;
+		this->message_len = msg.message_len;
+		this->flags = msg.flags;
+	}
+
+	return *this;
+}
+
+bool TRPCMessage::share_to(TRPCMessage *msg)
+{
+	size_t size = this->message->size();
+
+	delete []msg->meta_buf;
+	msg->meta_buf = new char[this->meta_len];
+	memcpy(msg->meta_buf, this->meta_buf, this->meta_len);
+	msg->meta_len = this->meta_len;
+	msg->message_len = this->message_len;
+
+	msg->message->clear();
+	return this->message->share(0, size, msg->message) == size;
+}
+
 TRPCRequest::TRPCRequest()
 {
 	this->meta = new RequestProtocol();
@@ -899,15 +913,19 @@ int TRPCMessage::serialize(const ProtobufIDLMessage *pb_msg)
 
 	if (data_type == RPCDataProtobuf)
 		ret = pb_msg->SerializeToZeroCopyStream(&output_stream) ? 0 : -1;
+	else if (data_type == RPCDataJson &&
+			 ProtobufJsonCodec::supported(pb_msg, this->flags))
+	{
+		ret = ProtobufJsonCodec::serialize(pb_msg, this->flags,
+										   &output_stream) ? 0 : -1;
+	}
 	else if (data_type == RPCDataJson)
 	{
 		std::string binary_input = pb_msg->SerializeAsString();
 		io::ArrayInputStream input_stream(binary_input.data(),
 										  (int)binary_input.size());
 		const auto *pool = pb_msg->GetDescriptor()->file()->pool();
-		auto *resolver = (pool == DescriptorPool::generated_pool() ?
-					ResolverInstance::get_resolver() :
-					util::NewTypeResolverForDescriptorPool(kTypePrefix, pool));
+		auto resolver = ProtobufResolverCache::get(pool);
 
 		util::JsonPrintOptions options;
 		options.add_whitespace = this->get_json_add_whitespace();
@@ -919,10 +937,8 @@ int TRPCMessage::serialize(const ProtobufIDLMessage *pb_msg)
 		options.always_print_primitive_fields = this->get_json_fields_no_presence();
 #endif
 
-		ret = BinaryToJsonStream(resolver, GetTypeUrl(pb_msg), &input_stream,
+		ret = BinaryToJsonStream(resolver.get(), GetTypeUrl(pb_msg), &input_stream,
 								 &output_stream, options).ok() ? 0 : -1;
-		if (pool != DescriptorPool::generated_pool())
-			delete resolver;
 	}
 	else
 		ret = -1;
@@ -948,27 +964,24 @@ int TRPCMessage::deserialize(ProtobufIDLMessage *pb_msg)
 
 	if (data_type == RPCDataProtobuf)
 		ret = pb_msg->ParseFromZeroCopyStream(&input_stream) ? 0 : -1;
+	else if (data_type == RPCDataJson && ProtobufJsonCodec::supported(pb_msg))
+		ret = ProtobufJsonCodec::deserialize(&input_stream, pb_msg) ? 0 : -1;
 	else if (data_type == RPCDataJson)
 	{
 		std::string binary_output;
 		io::StringOutputStream output_stream(&binary_output);
 		const auto *pool = pb_msg->GetDescriptor()->file()->pool();
-		auto *resolver = (pool == DescriptorPool::generated_pool() ?
-					ResolverInstance::get_resolver() :
-					util::NewTypeResolverForDescriptorPool(kTypePrefix, pool));
+		auto resolver = ProtobufResolverCache::get(pool);
 
 		util::JsonParseOptions options;
 		options.ignore_unknown_fields = true;
-		if (JsonToBinaryStream(resolver, GetTypeUrl(pb_msg), &input_stream,
+		if (JsonToBinaryStream(resolver.get(), GetTypeUrl(pb_msg), &input_stream,
 							   &output_stream, options).ok())
 		{
 			ret = pb_msg->ParseFromString(binary_output) ? 0 : -1;
 		}
 		else
 			ret = -1;
-
-		if (pool != DescriptorPool::generated_pool())
-			delete resolver;
 	}
 	else
 		ret = -1;
@@ -1274,6 +1287,24 @@ bool TRPCHttpRequest::serialize_meta()
 	return true;
 }
 
+bool TRPCHttpRequest::share_to(TRPCHttpRequest *req, uint32_t peer_features)
+{
+	const void *buffer;
+	size_t buflen;
+
+	if (!this->TRPCRequest::share_to(req) ||
+		!http_copy_request_header(this, req))
+	{
+		return false;
+	}
+
+	// out of the pieces of req, they live as long as it
+	while (buflen = req->message->fetch(&buffer), buffer && buflen > 0)
+		req->append_output_body_nocopy(buffer, buflen);
+
+	return true;
+}
+
 bool TRPCHttpRequest::deserialize_meta()
 {
 	const char *request_uri = this->get_request_uri();
@@ -37,11 +37,14 @@ class TRPCMessage : public RPCMessage
 public:
 	TRPCMessage();
 	virtual ~TRPCMessage();
+	// the reply of a hedge is moved into the task
+	TRPCMessage& operator= (TRPCMessage&& msg);
 
 	int encode(struct iovec vectors[], int max, size_t size_limit);
 	int append(const void *buf, size_t *size, size_t size_limit);
 
 	void set_attachment_nocopy(const char *attachment, size_t len) { }
+	void set_attachment_compress_type(int type) { }
 	bool get_attachment_nocopy(const char **attachment, size_t *len) const
 	{
 		return false;
@@ -55,6 +58,10 @@ public:
 	int compress() override;
 	int decompress() override;
 
+	size_t get_message_len() const override { return this->message_len; }
+	// after serialize_meta(), msg encodes the same bytes with the body shared
+	bool share_to(TRPCMessage *msg);
+
 protected:
 	char header[TRPC_HEADER_SIZE];
 	size_t nreceived;
@@ -201,6 +208,12 @@ public:
 		return this->TRPCRequest::set_caller_name(caller_name);
 	}
 
+	// the features are of SRPC only
+	bool share_to(TRPCStdRequest *req, uint32_t peer_features)
+	{
+		return this->TRPCRequest::share_to(req);
+	}
+
 public:
 	TRPCStdRequest() { this->size_limit = RPC_BODY_SIZE_LIMIT; }
 };
@@ -319,6 +332,8 @@ public:
 						 std::string& value) const override;
 
 	bool trim_method_prefix();
+	// also the start line and the headers, the features are of SRPC only
+	bool share_to(TRPCHttpRequest *req, uint32_t peer_features);
 
 public:
 	TRPCHttpRequest() { this->size_limit = RPC_BODY_SIZE_LIMIT; }
@@ -0,0 +1,1764 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <errno.h>
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/util/type_resolver_util.h>
+#include "rpc_pb_json.h"
+
+namespace srpc
+{
+
+using google::protobuf::Descriptor;
+using google::protobuf::FieldDescriptor;
+using google::protobuf::EnumValueDescriptor;
+using google::protobuf::Reflection;
+using google::protobuf::io::ZeroCopyOutputStream;
+using google::protobuf::io::ZeroCopyInputStream;
+
+static constexpr int JSON_MAX_DEPTH = 100;
+
+struct JsonType;
+
+struct JsonField
+{
+	const FieldDescriptor *field;
+	// quoted json_name and quoted proto name
+	std::string key[2];
+	// the message, or the map value message
+	const JsonType *message;
+};
+
+struct JsonType
+{
+	const Descriptor *desc;
+	// ordered by field number
+	std::vector<JsonField> fields;
+	// both names to the field
+	std::unordered_map<std::string, const JsonField *> names;
+	bool supported;
+};
+
+class JsonTypeCache
+{
+public:
+	static const JsonType *get(const Descriptor *desc)
+	{
+		static JsonTypeCache kInstance;
+		static thread_local std::unordered_map<const Descriptor *,
+											   const JsonType *> local;
+		auto it = local.find(desc);
+
+		if (it != local.end())
+			return it->second;
+
+		kInstance.mutex_.lock();
+		const JsonType *type = kInstance.build(desc);
+		kInstance.check_supported();
+		kInstance.mutex_.unlock();
+
+		local.emplace(desc, type);
+		return type;
+	}
+
+private:
+	JsonType *build(const Descriptor *desc);
+	void check_supported();
+
+	~JsonTypeCache()
+	{
+		for (auto& kv : types_)
+			delete kv.second;
+	}
+
+	std::mutex mutex_;
+	std::unordered_map<const Descriptor *, JsonType *> types_;
+};
+
+static bool __is_wellknown(const Descriptor *desc)
+{
+	const std::string& name = desc->full_name();
+
+	// google.protobuf.Empty prints as an ordinary message
+	return name.compare(0, 16, "google.protobuf.") == 0 &&
+		   name != "google.protobuf.Empty";
+}
+
+static std::string __quote_key(const std::string& name)
+{
+	return "\"" + name + "\"";
+}
+
+JsonType *JsonTypeCache::build(const Descriptor *desc)
+{
+	auto it = types_.find(desc);
+
+	if (it != types_.end())
+		return it->second;
+
+	// insert before the fields, so that recursive types end here
+	JsonType *type = new JsonType;
+
+	types_.emplace(desc, type);
+	type->desc = desc;
+	type->supported = !__is_wellknown(desc);
+	type->fields.resize(desc->field_count());
+
+	for (int i = 0; i < desc->field_count(); i++)
+	{
+		const FieldDescriptor *field = desc->field(i);
+		JsonField *jf = &type->fields[i];
+
+		jf->field = field;
+		jf->key[0] = __quote_key(field->json_name());
+		jf->key[1] = __quote_key(field->name());
+		jf->message = NULL;
+
+		if (field->type() == FieldDescriptor::TYPE_GROUP)
+			type->supported = false;
+		else if (field->is_map())
+		{
+			const FieldDescriptor *value = field->message_type()->map_value();
+
+			if (value->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE)
+				jf->message = this->build(value->message_type());
+			else if (value->cpp_type() == FieldDescriptor::CPPTYPE_ENUM &&
+					 value->enum_type()->full_name() == "google.protobuf.NullValue")
+				type->supported = false;
+		}
+		else if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE)
+			jf->message = this->build(field->message_type());
+		else if (field->cpp_type() == FieldDescriptor::CPPTYPE_ENUM &&
+				 field->enum_type()->full_name() == "google.protobuf.NullValue")
+			type->supported = false;
+	}
+
+	std::sort(type->fields.begin(), type->fields.end(),
+			  [](const JsonField& a, const JsonField& b) {
+				  return a.field->number() < b.field->number();
+			  });
+
+	for (const JsonField& jf : type->fields)
+	{
+		type->names.emplace(jf.key[0].substr(1, jf.key[0].size() - 2), &jf);
+		type->names.emplace(jf.field->name(), &jf);
+	}
+
+	return type;
+}
+
+// a type is supported only if every type it reaches is
+void JsonTypeCache::check_supported()
+{
+	bool changed;
+
+	do
+	{
+		changed = false;
+		for (auto& kv : types_)
+		{
+			JsonType *type = kv.second;
+
+			if (!type->supported)
+				continue;
+
+			for (const JsonField& jf : type->fields)
+			{
+				if (jf.message && !jf.message->supported)
+				{
+					type->supported = false;
+					changed = true;
+					break;
+				}
+			}
+		}
+	} while (changed);
+}
+
+////////
+// print
+
+static const char *kBase64Chars =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+class JsonWriter
+{
+public:
+	JsonWriter(ZeroCopyOutputStream *stream) :
+		stream_(stream),
+		ptr_(NULL),
+		left_(0),
+		failed_(false)
+	{
+	}
+
+	// give back the unused tail of the last chunk
+	bool finish()
+	{
+		if (left_ > 0)
+			stream_->BackUp((int)left_);
+
+		left_ = 0;
+		return !failed_;
+	}
+
+	void put(char c)
+	{
+		if (left_ == 0 && !this->next())
+			return;
+
+		*ptr_++ = c;
+		left_--;
+	}
+
+	void write(const char *s, size_t n)
+	{
+		while (n > left_)
+		{
+			if (left_ > 0)
+				memcpy(ptr_, s, left_);
+
+			s += left_;
+			n -= left_;
+			left_ = 0;
+			if (!this->next())
+				return;
+		}
+
+		memcpy(ptr_, s, n);
+		ptr_ += n;
+		left_ -= n;
+	}
+
+	void write(const std::string& s) { this->write(s.data(), s.size()); }
+
+private:
+	bool next()
+	{
+		void *data;
+		int size;
+
+		do
+		{
+			if (failed_ || !stream_->Next(&data, &size))
+			{
+				failed_ = true;
+				left_ = 0;
+				return false;
+			}
+		} while (size <= 0);
+
+		ptr_ = (char *)data;
+		left_ = size;
+		return true;
+	}
+
+	ZeroCopyOutputStream *stream_;
+	char *ptr_;
+	size_t left_;
+	bool failed_;
+};
+
+class JsonPrinter
+{
+public:
+	JsonPrinter(ZeroCopyOutputStream *stream, uint32_t options) :
+		writer_(stream),
+		depth_(0)
+	{
+		whitespace_ = options & SRPC_JSON_OPTION_ADD_WHITESPACE;
+		enums_as_ints_ = options & SRPC_JSON_OPTION_ENUM_AS_INITS;
+		name_index_ = (options & SRPC_JSON_OPTION_PRESERVE_NAMES) ? 1 : 0;
+	}
+
+	bool print(const ProtobufIDLMessage& msg, const JsonType *type)
+	{
+		this->print_message(msg, type);
+		if (whitespace_)
+			writer_.put('\n');
+
+		return writer_.finish();
+	}
+
+private:
+	void print_message(const ProtobufIDLMessage& msg, const JsonType *type);
+	void print_map(const ProtobufIDLMessage& msg, const Reflection *refl,
+				   const JsonField& jf);
+	void print_value(const ProtobufIDLMessage& msg, const Reflection *refl,
+					 const FieldDescriptor *field, int index,
+					 const JsonType *type);
+	void print_string(const std::string& str);
+	void print_bytes(const std::string& str);
+	void print_int(int64_t v, bool quoted);
+	void print_uint(uint64_t v, bool quoted);
+	void print_double(double v, bool is_float);
+
+	// "," and the line break before a member or an element
+	void begin_item(bool *first)
+	{
+		if (*first)
+			*first = false;
+		else
+			writer_.put(',');
+
+		this->newline();
+	}
+
+	void newline()
+	{
+		if (whitespace_)
+		{
+			writer_.put('\n');
+			for (int i = 0; i < depth_; i++)
+				writer_.put(' ');
+		}
+	}
+
+	void print_key(const std::string& quoted)
+	{
+		writer_.write(quoted);
+		if (whitespace_)
+			writer_.write(": ", 2);
+		else
+			writer_.put(':');
+	}
+
+	JsonWriter writer_;
+	int depth_;
+	int name_index_;
+	bool whitespace_;
+	bool enums_as_ints_;
+};
+
+void JsonPrinter::print_message(const ProtobufIDLMessage& msg,
+								const JsonType *type)
+{
+	const Reflection *refl = msg.GetReflection();
+	bool first = true;
+
+	writer_.put('{');
+	depth_++;
+
+	for (const JsonField& jf : type->fields)
+	{
+		const FieldDescriptor *field = jf.field;
+
+		if (field->is_repeated())
+		{
+			int size = refl->FieldSize(msg, field);
+
+			if (size == 0)
+				continue;
+
+			this->begin_item(&first);
+			this->print_key(jf.key[name_index_]);
+
+			if (field->is_map())
+			{
+				this->print_map(msg, refl, jf);
+				continue;
+			}
+
+			bool first_ele = true;
+
+			writer_.put('[');
+			depth_++;
+			for (int i = 0; i < size; i++)
+			{
+				this->begin_item(&first_ele);
+				this->print_value(msg, refl, field, i, jf.message);
+			}
+
+			depth_--;
+			if (size > 0)
+				this->newline();
+
+			writer_.put(']');
+		}
+		else
+		{
+			if (!refl->HasField(msg, field))
+				continue;
+
+			this->begin_item(&first);
+			this->print_key(jf.key[name_index_]);
+			this->print_value(msg, refl, field, -1, jf.message);
+		}
+	}
+
+	depth_--;
+	if (!first)
+		this->newline();
+
+	writer_.put('}');
+}
+
+void JsonPrinter::print_map(const ProtobufIDLMessage& msg,
+							const Reflection *refl, const JsonField& jf)
+{
+	const FieldDescriptor *field = jf.field;
+	const FieldDescriptor *key = field->message_type()->map_key();
+	const FieldDescriptor *value = field->message_type()->map_value();
+	int size = refl->FieldSize(msg, field);
+	bool first = true;
+	std::string scratch;
+
+	writer_.put('{');
+	depth_++;
+	for (int i = 0; i < size; i++)
+	{
+		const auto& entry = refl->GetRepeatedMessage(msg, field, i);
+		const Reflection *entry_refl = entry.GetReflection();
+
+		this->begin_item(&first);
+		switch (key->cpp_type())
+		{
+		case FieldDescriptor::CPPTYPE_STRING:
+			this->print_string(entry_refl->GetStringReference(entry, key,
+															  &scratch));
+			break;
+		case FieldDescriptor::CPPTYPE_INT32:
+			this->print_int(entry_refl->GetInt32(entry, key), true);
+			break;
+		case FieldDescriptor::CPPTYPE_INT64:
+			this->print_int(entry_refl->GetInt64(entry, key), true);
+			break;
+		case FieldDescriptor::CPPTYPE_UINT32:
+			this->print_uint(entry_refl->GetUInt32(entry, key), true);
+			break;
+		case FieldDescriptor::CPPTYPE_UINT64:
+			this->print_uint(entry_refl->GetUInt64(entry, key), true);
+			break;
+		case FieldDescriptor::CPPTYPE_BOOL:
+			writer_.write(entry_refl->GetBool(entry, key) ? "\"true\"" : "\"false\"");
+			break;
+		default:
+			break;
+		}
+
+		if (whitespace_)
+			writer_.write(": ", 2);
+		else
+			writer_.put(':');
+
+		this->print_value(entry, entry_refl, value, -1, jf.message);
+	}
+
+	depth_--;
+	if (!first)
+		this->newline();
+
+	writer_.put('}');
+}
+
+// index < 0 for a singular field
+void JsonPrinter::print_value(const ProtobufIDLMessage& msg,
+							  const Reflection *refl,
+							  const FieldDescriptor *field, int index,
+							  const JsonType *type)
+{
+	bool rep = (index >= 0);
+
+	switch (field->cpp_type())
+	{
+	case FieldDescriptor::CPPTYPE_INT32:
+		this->print_int(rep ? refl->GetRepeatedInt32(msg, field, index) :
+							  refl->GetInt32(msg, field), false);
+		break;
+	case FieldDescriptor::CPPTYPE_INT64:
+		this->print_int(rep ? refl->GetRepeatedInt64(msg, field, index) :
+							  refl->GetInt64(msg, field), true);
+		break;
+	case FieldDescriptor::CPPTYPE_UINT32:
+		this->print_uint(rep ? refl->GetRepeatedUInt32(msg, field, index) :
+							   refl->GetUInt32(msg, field), false);
+		break;
+	case FieldDescriptor::CPPTYPE_UINT64:
+		this->print_uint(rep ? refl->GetRepeatedUInt64(msg, field, index) :
+							   refl->GetUInt64(msg, field), true);
+		break;
+	case FieldDescriptor::CPPTYPE_DOUBLE:
+		this->print_double(rep ? refl->GetRepeatedDouble(msg, field, index) :
+								 refl->GetDouble(msg, field), false);
+		break;
+	case FieldDescriptor::CPPTYPE_FLOAT:
+		this->print_double(rep ? refl->GetRepeatedFloat(msg, field, index) :
+								 refl->GetFloat(msg, field), true);
+		break;
+	case FieldDescriptor::CPPTYPE_BOOL:
+		if (rep ? refl->GetRepeatedBool(msg, field, index) :
+				  refl->GetBool(msg, field))
+			writer_.write("true", 4);
+		else
+			writer_.write("false", 5);
+		break;
+	case FieldDescriptor::CPPTYPE_ENUM:
+	{
+		int v = rep ? refl->GetRepeatedEnumValue(msg, field, index) :
+					  refl->GetEnumValue(msg, field);
+		const EnumValueDescriptor *ev = NULL;
+
+		if (!enums_as_ints_)
+			ev = field->enum_type()->FindValueByNumber(v);
+
+		if (ev)
+			this->print_string(ev->name());
+		else
+			this->print_int(v, false);
+
+		break;
+	}
+	case FieldDescriptor::CPPTYPE_STRING:
+	{
+		std::string scratch;
+		const std::string& str = rep ?
+			refl->GetRepeatedStringReference(msg, field, index, &scratch) :
+			refl->GetStringReference(msg, field, &scratch);
+
+		if (field->type() == FieldDescriptor::TYPE_BYTES)
+			this->print_bytes(str);
+		else
+			this->print_string(str);
+
+		break;
+	}
+	case FieldDescriptor::CPPTYPE_MESSAGE:
+		this->print_message(rep ? refl->GetRepeatedMessage(msg, field, index) :
+								  refl->GetMessage(msg, field), type);
+		break;
+	}
+}
+
+void JsonPrinter::print_int(int64_t v, bool quoted)
+{
+	uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+	char buf[24];
+	char *p = buf + sizeof buf;
+
+	if (quoted)
+		*--p = '"';
+
+	do
+	{
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u > 0);
+
+	if (v < 0)
+		*--p = '-';
+
+	if (quoted)
+		*--p = '"';
+
+	writer_.write(p, buf + sizeof buf - p);
+}
+
+void JsonPrinter::print_uint(uint64_t v, bool quoted)
+{
+	char buf[24];
+	char *p = buf + sizeof buf;
+
+	if (quoted)
+		*--p = '"';
+
+	do
+	{
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v > 0);
+
+	if (quoted)
+		*--p = '"';
+
+	writer_.write(p, buf + sizeof buf - p);
+}
+
+// the shortest of %.15g / %.17g (%.6g / %.9g for float) that reads back
+void JsonPrinter::print_double(double v, bool is_float)
+{
+	char buf[32];
+	int n;
+
+	if (isnan(v))
+		return writer_.write("\"NaN\"", 5);
+
+	if (isinf(v))
+	{
+		if (v > 0)
+			return writer_.write("\"Infinity\"", 10);
+
+		return writer_.write("\"-Infinity\"", 11);
+	}
+
+	if (is_float)
+	{
+		// a subnormal float sets ERANGE and takes the long form, as protobuf
+		errno = 0;
+		n = snprintf(buf, sizeof buf, "%.*g", FLT_DIG, v);
+		if (strtof(buf, NULL) != (float)v || errno == ERANGE)
+			n = snprintf(buf, sizeof buf, "%.*g", FLT_DIG + 3, v);
+	}
+	else
+	{
+		n = snprintf(buf, sizeof buf, "%.*g", DBL_DIG, v);
+		if (strtod(buf, NULL) != v)
+			n = snprintf(buf, sizeof buf, "%.*g", DBL_DIG + 2, v);
+	}
+
+	writer_.write(buf, n);
+}
+
+// code points that are escaped even though JSON allows them raw
+static bool __need_escape(uint32_t cp)
+{
+	return (cp >= 0x7f && cp <= 0x9f) || cp == 0xad ||
+		   (cp >= 0x600 && cp <= 0x603) || cp == 0x6dd || cp == 0x70f ||
+		   cp == 0x17b4 || cp == 0x17b5 ||
+		   (cp >= 0x200b && cp <= 0x200f) || (cp >= 0x2028 && cp <= 0x202e) ||
+		   (cp >= 0x2060 && cp <= 0x2064) || (cp >= 0x206a && cp <= 0x206f) ||
+		   cp == 0xfeff || (cp >= 0xfff9 && cp <= 0xfffb) ||
+		   (cp >= 0x1d173 && cp <= 0x1d17a) || cp == 0xe0001 ||
+		   (cp >= 0xe0020 && cp <= 0xe007f);
+}
+
+// length of the UTF-8 sequence at p, 0 if invalid
+static int __utf8_decode(const unsigned char *p, size_t left, uint32_t *cp)
+{
+	int len;
+	uint32_t min;
+
+	if (p[0] < 0xc0)
+		return 0;
+	else if (p[0] < 0xe0)
+	{
+		len = 2;
+		*cp = p[0] & 0x1f;
+		min = 0x80;
+	}
+	else if (p[0] < 0xf0)
+	{
+		len = 3;
+		*cp = p[0] & 0x0f;
+		min = 0x800;
+	}
+	else if (p[0] < 0xf5)
+	{
+		len = 4;
+		*cp = p[0] & 0x07;
+		min = 0x10000;
+	}
+	else
+		return 0;
+
+	if ((size_t)len > left)
+		return 0;
+
+	for (int i = 1; i < len; i++)
+	{
+		if ((p[i] & 0xc0) != 0x80)
+			return 0;
+
+		*cp = (*cp << 6) | (p[i] & 0x3f);
+	}
+
+	if (*cp < min || *cp > 0x10ffff || (*cp >= 0xd800 && *cp < 0xe000))
+		return 0;
+
+	return len;
+}
+
+void JsonPrinter::print_string(const std::string& str)
+{
+	static const char *hex = "0123456789abcdef";
+	const unsigned char *p = (const unsigned char *)str.data();
+	const unsigned char *end = p + str.size();
+	const unsigned char *run = p;
+	char esc[12];
+
+	writer_.put('"');
+	while (p < end)
+	{
+		unsigned char c = *p;
+		uint32_t cp;
+		int len = 1;
+		int n = 0;
+
+		if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\' && c != '<' && c != '>')
+		{
+			p++;
+			continue;
+		}
+
+		if (c < 0x80)
+		{
+			cp = c;
+			switch (c)
+			{
+			case '"':	n = 2; esc[1] = '"';	break;
+			case '\\':	n = 2; esc[1] = '\\';	break;
+			case '\b':	n = 2; esc[1] = 'b';	break;
+			case '\f':	n = 2; esc[1] = 'f';	break;
+			case '\n':	n = 2; esc[1] = 'n';	break;
+			case '\r':	n = 2; esc[1] = 'r';	break;
+			case '\t':	n = 2; esc[1] = 't';	break;
+			default:	break;
+			}
+
+			esc[0] = '\\';
+		}
+		else
+		{
+			len = __utf8_decode(p, end - p, &cp);
+			if (len > 0 && !__need_escape(cp))
+			{
+				p += len;
+				continue;
+			}
+		}
+
+		writer_.write((const char *)run, p - run);
+		if (len == 0)
+		{
+			// invalid UTF-8 is dropped
+			len = 1;
+		}
+		else if (n == 0)
+		{
+			uint32_t units[2];
+			int count = 1;
+
+			units[0] = cp;
+			if (cp >= 0x10000)
+			{
+				units[0] = 0xd800 + ((cp - 0x10000) >> 10);
+				units[1] = 0xdc00 + ((cp - 0x10000) & 0x3ff);
+				count = 2;
+			}
+
+			for (int i = 0; i < count; i++)
+			{
+				esc[n++] = '\\';
+				esc[n++] = 'u';
+				esc[n++] = hex[(units[i] >> 12) & 0xf];
+				esc[n++] = hex[(units[i] >> 8) & 0xf];
+				esc[n++] = hex[(units[i] >> 4) & 0xf];
+				esc[n++] = hex[units[i] & 0xf];
+			}
+
+			writer_.write(esc, n);
+		}
+		else
+			writer_.write(esc, n);
+
+		p += len;
+		run = p;
+	}
+
+	writer_.write((const char *)run, p - run);
+	writer_.put('"');
+}
+
+void JsonPrinter::print_bytes(const std::string& str)
+{
+	const unsigned char *p = (const unsigned char *)str.data();
+	size_t len = str.size();
+	char out[4];
+
+	writer_.put('"');
+	while (len >= 3)
+	{
+		out[0] = kBase64Chars[p[0] >> 2];
+		out[1] = kBase64Chars[((p[0] & 0x03) << 4) | (p[1] >> 4)];
+		out[2] = kBase64Chars[((p[1] & 0x0f) << 2) | (p[2] >> 6)];
+		out[3] = kBase64Chars[p[2] & 0x3f];
+		writer_.write(out, 4);
+		p += 3;
+		len -= 3;
+	}
+
+	if (len > 0)
+	{
+		out[0] = kBase64Chars[p[0] >> 2];
+		if (len == 1)
+		{
+			out[1] = kBase64Chars[(p[0] & 0x03) << 4];
+			out[2] = '=';
+		}
+		else
+		{
+			out[1] = kBase64Chars[((p[0] & 0x03) << 4) | (p[1] >> 4)];
+			out[2] = kBase64Chars[(p[1] & 0x0f) << 2];
+		}
+
+		out[3] = '=';
+		writer_.write(out, 4);
+	}
+
+	writer_.put('"');
+}
+
+////////
+// parse
+
+class JsonReader
+{
+public:
+	JsonReader(ZeroCopyInputStream *stream) :
+		stream_(stream),
+		ptr_(NULL),
+		end_(NULL)
+	{
+	}
+
+	// -1 at the end
+	int peek()
+	{
+		if (ptr_ == end_ && !this->next())
+			return -1;
+
+		return (unsigned char)*ptr_;
+	}
+
+	int get()
+	{
+		if (ptr_ == end_ && !this->next())
+			return -1;
+
+		return (unsigned char)*ptr_++;
+	}
+
+	int skip_space()
+	{
+		int c;
+
+		while ((c = this->peek()) == ' ' || c == '\n' || c == '\r' || c == '\t')
+			ptr_++;
+
+		return c;
+	}
+
+	// after an item, 1 if the container is closed, 0 if another item follows
+	int end_item(char close)
+	{
+		int c = this->skip_space();
+
+		this->get();
+		if (c == ',')
+		{
+			// a trailing comma is accepted, as google::protobuf::util does
+			if (this->skip_space() != (unsigned char)close)
+				return 0;
+
+			c = this->get();
+		}
+
+		return c == (unsigned char)close ? 1 : -1;
+	}
+
+	bool expect(char ch)
+	{
+		if (this->skip_space() != (unsigned char)ch)
+			return false;
+
+		ptr_++;
+		return true;
+	}
+
+	// the opening quote is not read yet
+	bool read_string(std::string *str);
+	// number, true, false or null
+	bool read_literal(std::string *str);
+
+private:
+	bool read_hex4(uint32_t *unit);
+
+	bool next()
+	{
+		const void *data;
+		int size;
+
+		do
+		{
+			if (!stream_->Next(&data, &size))
+				return false;
+		} while (size <= 0);
+
+		ptr_ = (const char *)data;
+		end_ = ptr_ + size;
+		return true;
+	}
+
+	ZeroCopyInputStream *stream_;
+	const char *ptr_;
+	const char *end_;
+};
+
+bool JsonReader::read_hex4(uint32_t *unit)
+{
+	*unit = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		int c = this->get();
+
+		if (c >= '0' && c <= '9')
+			c -= '0';
+		else if (c >= 'a' && c <= 'f')
+			c -= 'a' - 10;
+		else if (c >= 'A' && c <= 'F')
+			c -= 'A' - 10;
+		else
+			return false;
+
+		*unit = (*unit << 4) | c;
+	}
+
+	return true;
+}
+
+static void __utf8_append(uint32_t cp, std::string *str)
+{
+	if (cp < 0x80)
+		str->push_back((char)cp);
+	else if (cp < 0x800)
+	{
+		str->push_back((char)(0xc0 | (cp >> 6)));
+		str->push_back((char)(0x80 | (cp & 0x3f)));
+	}
+	else if (cp < 0x10000)
+	{
+		str->push_back((char)(0xe0 | (cp >> 12)));
+		str->push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+		str->push_back((char)(0x80 | (cp & 0x3f)));
+	}
+	else
+	{
+		str->push_back((char)(0xf0 | (cp >> 18)));
+		str->push_back((char)(0x80 | ((cp >> 12) & 0x3f)));
+		str->push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+		str->push_back((char)(0x80 | (cp & 0x3f)));
+	}
+}
+
+bool JsonReader::read_string(std::string *str)
+{
+	str->clear();
+	if (!this->expect('"'))
+		return false;
+
+	while (true)
+	{
+		const char *run = ptr_;
+
+		// copy the plain part of this chunk at once
+		while (ptr_ < end_ && *ptr_ != '"' && *ptr_ != '\\' &&
+			   (unsigned char)*ptr_ >= 0x20)
+		{
+			ptr_++;
+		}
+
+		str->append(run, ptr_ - run);
+
+		int c = this->get();
+
+		if (c == '"')
+			return true;
+
+		if (c != '\\')
+		{
+			if (c < 0)
+				return false;
+
+			// a chunk ended, or a raw control character
+			if (c < 0x20)
+				return false;
+
+			str->push_back((char)c);
+			continue;
+		}
+
+		uint32_t cp;
+
+		switch (c = this->get())
+		{
+		case '"':
+		case '\\':
+		case '/':
+			str->push_back((char)c);
+			break;
+		case 'b':	str->push_back('\b');	break;
+		case 'f':	str->push_back('\f');	break;
+		case 'n':	str->push_back('\n');	break;
+		case 'r':	str->push_back('\r');	break;
+		case 't':	str->push_back('\t');	break;
+		case 'u':
+			if (!this->read_hex4(&cp))
+				return false;
+
+			if (cp >= 0xd800 && cp < 0xdc00)
+			{
+				uint32_t low;
+
+				if (this->get() != '\\' || this->get() != 'u' ||
+					!this->read_hex4(&low) || low < 0xdc00 || low >= 0xe000)
+				{
+					return false;
+				}
+
+				cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+			}
+			else if (cp >= 0xdc00 && cp < 0xe000)
+				return false;
+
+			__utf8_append(cp, str);
+			break;
+		default:
+			return false;
+		}
+	}
+}
+
+bool JsonReader::read_literal(std::string *str)
+{
+	int c = this->skip_space();
+
+	str->clear();
+	while ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+		   (c >= 'A' && c <= 'Z') || c == '-' || c == '+' || c == '.')
+	{
+		str->push_back((char)c);
+		ptr_++;
+		c = this->peek();
+	}
+
+	return !str->empty();
+}
+
+class JsonParser
+{
+public:
+	JsonParser(ZeroCopyInputStream *stream) : reader_(stream) { }
+
+	bool parse(ProtobufIDLMessage *msg, const JsonType *type)
+	{
+		return this->parse_message(msg, type, 0) && reader_.skip_space() < 0;
+	}
+
+private:
+	bool parse_message(ProtobufIDLMessage *msg, const JsonType *type, int depth);
+	bool parse_field(ProtobufIDLMessage *msg, const Reflection *refl,
+					 const JsonField& jf, int depth);
+	bool parse_map(ProtobufIDLMessage *msg, const Reflection *refl,
+				   const JsonField& jf, int depth);
+	bool parse_value(ProtobufIDLMessage *msg, const Reflection *refl,
+					 const FieldDescriptor *field, bool rep,
+					 const JsonType *type, int depth);
+	bool parse_scalar(ProtobufIDLMessage *msg, const Reflection *refl,
+					  const FieldDescriptor *field, bool rep,
+					  const std::string& token, bool quoted);
+	bool skip_value(int depth);
+	bool is_null();
+
+	JsonReader reader_;
+	std::string key_;
+	std::string token_;
+};
+
+// (double)max may round up to 2^63 or 2^64, hence max + 1.0 as the bound
+static bool __parse_int(const std::string& token, bool quoted,
+						int64_t min, int64_t max, int64_t *v)
+{
+	const char *s = token.c_str();
+	char *end;
+
+	if (token.empty())
+		return false;
+
+	errno = 0;
+	*v = strtoll(s, &end, 10);
+	if (*end != '\0' || errno == ERANGE)
+	{
+		// 1e3 or 1.0 are fine as long as they are exact, but not in quotes
+		if (quoted)
+			return false;
+
+		double d = strtod(s, &end);
+
+		if (*end != '\0' || d != floor(d) ||
+			d < (double)min || d >= (double)max + 1.0)
+			return false;
+
+		*v = (int64_t)d;
+	}
+
+	return *v >= min && *v <= max;
+}
+
+static bool __parse_uint(const std::string& token, bool quoted,
+						 uint64_t max, uint64_t *v)
+{
+	const char *s = token.c_str();
+	char *end;
+
+	if (token.empty() || token[0] == '-')
+		return false;
+
+	errno = 0;
+	*v = strtoull(s, &end, 10);
+	if (*end != '\0' || errno == ERANGE)
+	{
+		if (quoted)
+			return false;
+
+		double d = strtod(s, &end);
+
+		if (*end != '\0' || d != floor(d) || d < 0 || d >= (double)max + 1.0)
+			return false;
+
+		*v = (uint64_t)d;
+	}
+
+	return *v <= max;
+}
+
+static bool __parse_double(const std::string& token, bool quoted, double *v)
+{
+	char *end;
+
+	if (quoted)
+	{
+		if (token == "NaN")
+		{
+			*v = NAN;
+			return true;
+		}
+		else if (token == "Infinity")
+		{
+			*v = INFINITY;
+			return true;
+		}
+		else if (token == "-Infinity")
+		{
+			*v = -INFINITY;
+			return true;
+		}
+	}
+
+	if (token.empty() || !((token[0] >= '0' && token[0] <= '9') || token[0] == '-'))
+		return false;
+
+	*v = strtod(token.c_str(), &end);
+	return *end == '\0' && !isinf(*v) && !isnan(*v);
+}
+
+static int __base64_value(char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	else if (c >= 'a' && c <= 'z')
+		return c - 'a' + 26;
+	else if (c >= '0' && c <= '9')
+		return c - '0' + 52;
+	else if (c == '+' || c == '-')
+		return 62;
+	else if (c == '/' || c == '_')
+		return 63;
+
+	return -1;
+}
+
+// standard or URL safe alphabet, padding is optional
+static bool __base64_decode(const std::string& in, std::string *out)
+{
+	uint32_t bits = 0;
+	int count = 0;
+	size_t len = in.size();
+
+	while (len > 0 && in[len - 1] == '=')
+		len--;
+
+	out->clear();
+	out->reserve(len * 3 / 4);
+	for (size_t i = 0; i < len; i++)
+	{
+		int v = __base64_value(in[i]);
+
+		if (v < 0)
+			return false;
+
+		bits = (bits << 6) | v;
+		if (++count == 4)
+		{
+			out->push_back((char)(bits >> 16));
+			out->push_back((char)(bits >> 8));
+			out->push_back((char)bits);
+			bits = 0;
+			count = 0;
+		}
+	}
+
+	if (count == 1)
+		return false;
+	else if (count == 2)
+		out->push_back((char)(bits >> 4));
+	else if (count == 3)
+	{
+		out->push_back((char)(bits >> 10));
+		out->push_back((char)(bits >> 2));
+	}
+
+	return true;
+}
+
+bool JsonParser::is_null()
+{
+	if (reader_.skip_space() != 'n')
+		return false;
+
+	return reader_.read_literal(&token_) && token_ == "null";
+}
+
+bool JsonParser::parse_message(ProtobufIDLMessage *msg, const JsonType *type,
+							   int depth)
+{
+	const Reflection *refl = msg->GetReflection();
+
+	if (depth > JSON_MAX_DEPTH || !reader_.expect('{'))
+		return false;
+
+	if (reader_.skip_space() == '}')
+		return reader_.get() == '}';
+
+	while (true)
+	{
+		if (!reader_.read_string(&key_) || !reader_.expect(':'))
+			return false;
+
+		auto it = type->names.find(key_);
+
+		if (it == type->names.end())
+		{
+			// JsonParseOptions::ignore_unknown_fields
+			if (!this->skip_value(depth + 1))
+				return false;
+		}
+		else if (!this->parse_field(msg, refl, *it->second, depth))
+			return false;
+
+		int ret = reader_.end_item('}');
+
+		if (ret != 0)
+			return ret > 0;
+	}
+}
+
+bool JsonParser::parse_field(ProtobufIDLMessage *msg, const Reflection *refl,
+							 const JsonField& jf, int depth)
+{
+	const FieldDescriptor *field = jf.field;
+
+	// null leaves the field as it is
+	if (reader_.skip_space() == 'n')
+		return this->is_null();
+
+	if (field->is_map())
+		return this->parse_map(msg, refl, jf, depth);
+
+	if (!field->is_repeated())
+		return this->parse_value(msg, refl, field, false, jf.message, depth);
+
+	if (!reader_.expect('['))
+		return false;
+
+	if (reader_.skip_space() == ']')
+		return reader_.get() == ']';
+
+	while (true)
+	{
+		if (!this->parse_value(msg, refl, field, true, jf.message, depth))
+			return false;
+
+		int ret = reader_.end_item(']');
+
+		if (ret != 0)
+			return ret > 0;
+	}
+}
+
+bool JsonParser::parse_map(ProtobufIDLMessage *msg, const Reflection *refl,
+						   const JsonField& jf, int depth)
+{
+	const FieldDescriptor *field = jf.field;
+	const FieldDescriptor *key = field->message_type()->map_key();
+	const FieldDescriptor *value = field->message_type()->map_value();
+
+	if (!reader_.expect('{'))
+		return false;
+
+	if (reader_.skip_space() == '}')
+		return reader_.get() == '}';
+
+	while (true)
+	{
+		ProtobufIDLMessage *entry = refl->AddMessage(msg, field);
+		const Reflection *entry_refl = entry->GetReflection();
+
+		if (!reader_.read_string(&key_) || !reader_.expect(':'))
+			return false;
+
+		if (key->cpp_type() == FieldDescriptor::CPPTYPE_STRING)
+			entry_refl->SetString(entry, key, key_);
+		else if (key->cpp_type() == FieldDescriptor::CPPTYPE_BOOL)
+		{
+			if (key_ != "true" && key_ != "false")
+				return false;
+
+			entry_refl->SetBool(entry, key, key_ == "true");
+		}
+		else if (!this->parse_scalar(entry, entry_refl, key, false, key_, true))
+			return false;
+
+		if (reader_.skip_space() == 'n')
+		{
+			if (!this->is_null())
+				return false;
+		}
+		else if (!this->parse_value(entry, entry_refl, value, false,
+									jf.message, depth))
+		{
+			return false;
+		}
+
+		int ret = reader_.end_item('}');
+
+		if (ret != 0)
+			return ret > 0;
+	}
+}
+
+bool JsonParser::parse_value(ProtobufIDLMessage *msg, const Reflection *refl,
+							 const FieldDescriptor *field, bool rep,
+							 const JsonType *type, int depth)
+{
+	if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE)
+	{
+		ProtobufIDLMessage *sub = rep ? refl->AddMessage(msg, field) :
+										refl->MutableMessage(msg, field);
+
+		return this->parse_message(sub, type, depth + 1);
+	}
+
+	bool quoted = (reader_.skip_space() == '"');
+
+	if (quoted)
+	{
+		if (!reader_.read_string(&token_))
+			return false;
+	}
+	else if (!reader_.read_literal(&token_))
+		return false;
+
+	return this->parse_scalar(msg, refl, field, rep, token_, quoted);
+}
+
+bool JsonParser::parse_scalar(ProtobufIDLMessage *msg, const Reflection *refl,
+							  const FieldDescriptor *field, bool rep,
+							  const std::string& token, bool quoted)
+{
+	int64_t i;
+	uint64_t u;
+	double d;
+
+	switch (field->cpp_type())
+	{
+	case FieldDescriptor::CPPTYPE_INT32:
+		if (!__parse_int(token, quoted, INT32_MIN, INT32_MAX, &i))
+			return false;
+
+		if (rep)
+			refl->AddInt32(msg, field, (int32_t)i);
+		else
+			refl->SetInt32(msg, field, (int32_t)i);
+
+		return true;
+
+	case FieldDescriptor::CPPTYPE_INT64:
+		if (!__parse_int(token, quoted, INT64_MIN, INT64_MAX, &i))
+			return false;
+
+		if (rep)
+			refl->AddInt64(msg, field, i);
+		else
+			refl->SetInt64(msg, field, i);
+
+		return true;
+
+	case FieldDescriptor::CPPTYPE_UINT32:
+		if (!__parse_uint(token, quoted, UINT32_MAX, &u))
+			return false;
+
+		if (rep)
+			refl->AddUInt32(msg, field, (uint32_t)u);
+		else
+			refl->SetUInt32(msg, field, (uint32_t)u);
+
+		return true;
+
+	case FieldDescriptor::CPPTYPE_UINT64:
+		if (!__parse_uint(token, quoted, UINT64_MAX, &u))
+			return false;
+
+		if (rep)
+			refl->AddUInt64(msg, field, u);
+		else
+			refl->SetUInt64(msg, field, u);
+
+		return true;
+
+	case FieldDescriptor::CPPTYPE_DOUBLE:
+		if (!__parse_double(token, quoted, &d))
+			return false;
+
+		if (rep)
+			refl->AddDouble(msg, field, d);
+		else
+			refl->SetDouble(msg, field, d);
+
+		return true;
+
+	case FieldDescriptor::CPPTYPE_FLOAT:
+		if (!__parse_double(token, quoted, &d))
+			return false;
+
+		if (!isnan(d) && !isinf(d) && (d > FLT_MAX || d < -FLT_MAX))
+			return false;
+
+		if (rep)
+			refl->AddFloat(msg, field, (float)d);
+		else
+			refl->SetFloat(msg, field, (float)d);
+
+		return true;
+
+	case FieldDescriptor::CPPTYPE_BOOL:
+		if (token != "true" && token != "false")
+			return false;
+
+		if (rep)
+			refl->AddBool(msg, field, token == "true");
+		else
+			refl->SetBool(msg, field, token == "true");
+
+		return true;
+
+	case FieldDescriptor::CPPTYPE_ENUM:
+		if (quoted)
+		{
+			const EnumValueDescriptor *ev;
+
+			ev = field->enum_type()->FindValueByName(token);
+			// an unknown name is ignored like an unknown field
+			if (!ev)
+				return true;
+
+			i = ev->number();
+		}
+		else if (!__parse_int(token, quoted, INT32_MIN, INT32_MAX, &i))
+			return false;
+
+		if (rep)
+			refl->AddEnumValue(msg, field, (int)i);
+		else
+			refl->SetEnumValue(msg, field, (int)i);
+
+		return true;
+
+	case FieldDescriptor::CPPTYPE_STRING:
+		if (!quoted)
+			return false;
+
+		if (field->type() == FieldDescriptor::TYPE_BYTES)
+		{
+			std::string bytes;
+
+			if (!__base64_decode(token, &bytes))
+				return false;
+
+			if (rep)
+				refl->AddString(msg, field, std::move(bytes));
+			else
+				refl->SetString(msg, field, std::move(bytes));
+		}
+		else if (rep)
+			refl->AddString(msg, field, token);
+		else
+			refl->SetString(msg, field, token);
+
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+bool JsonParser::skip_value(int depth)
+{
+	int c = reader_.skip_space();
+
+	if (depth > JSON_MAX_DEPTH)
+		return false;
+
+	if (c == '"')
+		return reader_.read_string(&token_);
+
+	if (c != '{' && c != '[')
+		return reader_.read_literal(&token_);
+
+	char close = (c == '{') ? '}' : ']';
+
+	reader_.get();
+	if (reader_.skip_space() == close)
+		return reader_.get() == close;
+
+	while (true)
+	{
+		if (close == '}' &&
+			(!reader_.read_string(&token_) || !reader_.expect(':')))
+		{
+			return false;
+		}
+
+		if (!this->skip_value(depth + 1))
+			return false;
+
+		int ret = reader_.end_item(close);
+
+		if (ret != 0)
+			return ret > 0;
+	}
+}
+
+////////
+// codec
+
+bool ProtobufJsonCodec::supported(const ProtobufIDLMessage *msg,
+								  uint32_t options)
+{
+	const Descriptor *desc = msg->GetDescriptor();
+
+	// where protobuf puts the fields without presence depends on its version
+	if (options & SRPC_JSON_OPTION_FIELDS_NO_PRECENCE)
+		return false;
+
+	// descriptors of other pools may go away, never cache them
+	if (desc->file()->pool() != google::protobuf::DescriptorPool::generated_pool())
+		return false;
+
+	return JsonTypeCache::get(desc)->supported;
+}
+
+bool ProtobufJsonCodec::serialize(const ProtobufIDLMessage *msg,
+								  uint32_t options, ZeroCopyOutputStream *out)
+{
+	JsonPrinter printer(out, options);
+
+	return printer.print(*msg, JsonTypeCache::get(msg->GetDescriptor()));
+}
+
+bool ProtobufJsonCodec::deserialize(ZeroCopyInputStream *in,
+									ProtobufIDLMessage *msg)
+{
+	JsonParser parser(in);
+
+	msg->Clear();
+	if (!parser.parse(msg, JsonTypeCache::get(msg->GetDescriptor())))
+		return false;
+
+	return msg->IsInitialized();
+}
+
+////////
+// resolver
+
+static constexpr const char *kTypePrefix = "type.googleapis.com";
+
+class ResolverCache
+{
+public:
+	using TypeResolver = google::protobuf::util::TypeResolver;
+	using DescriptorPool = google::protobuf::DescriptorPool;
+
+	static ResolverCache *get_instance()
+	{
+		static ResolverCache kInstance;
+		return &kInstance;
+	}
+
+	std::shared_ptr<TypeResolver> get(const DescriptorPool *pool);
+	void add_pool(const DescriptorPool *pool);
+	void remove_pool(const DescriptorPool *pool);
+	void set_max_size(size_t max_size);
+
+	std::atomic<size_t> hits;
+	std::atomic<size_t> misses;
+
+private:
+	ResolverCache();
+	void shrink();
+
+	using Entry = std::pair<const DescriptorPool *, std::shared_ptr<TypeResolver>>;
+
+	std::shared_ptr<TypeResolver> generated_;
+	std::mutex mutex_;
+	// most recently used first
+	std::list<Entry> lru_;
+	std::unordered_map<const DescriptorPool *, std::list<Entry>::iterator> map_;
+	// registrations of each pool
+	std::unordered_map<const DescriptorPool *, size_t> pools_;
+	size_t max_size_;
+};
+
+ResolverCache::ResolverCache() :
+	hits(0),
+	misses(0),
+	max_size_(64)
+{
+	const DescriptorPool *pool = DescriptorPool::generated_pool();
+
+	generated_.reset(google::protobuf::util::NewTypeResolverForDescriptorPool(
+															kTypePrefix, pool));
+}
+
+std::shared_ptr<ResolverCache::TypeResolver>
+ResolverCache::get(const DescriptorPool *pool)
+{
+	if (pool == DescriptorPool::generated_pool())
+		return generated_;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = map_.find(pool);
+
+	if (it != map_.end())
+	{
+		this->hits++;
+		lru_.splice(lru_.begin(), lru_, it->second);
+		return it->second->second;
+	}
+
+	std::shared_ptr<TypeResolver> resolver(
+		google::protobuf::util::NewTypeResolverForDescriptorPool(kTypePrefix,
+																 pool));
+
+	this->misses++;
+	if (max_size_ > 0 && pools_.count(pool))
+	{
+		lru_.emplace_front(pool, resolver);
+		map_.emplace(pool, lru_.begin());
+		this->shrink();
+	}
+
+	return resolver;
+}
+
+void ResolverCache::add_pool(const DescriptorPool *pool)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	pools_[pool]++;
+}
+
+void ResolverCache::remove_pool(const DescriptorPool *pool)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto pool_it = pools_.find(pool);
+
+	if (pool_it == pools_.end() || --pool_it->second > 0)
+		return;
+
+	pools_.erase(pool_it);
+
+	auto it = map_.find(pool);
+
+	if (it != map_.end())
+	{
+		lru_.erase(it->second);
+		map_.erase(it);
+	}
+}
+
+void ResolverCache::set_max_size(size_t max_size)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	max_size_ = max_size;
+	this->shrink();
+}
+
+void ResolverCache::shrink()
+{
+	while (lru_.size() > max_size_)
+	{
+		map_.erase(lru_.back().first);
+		lru_.pop_back();
+	}
+}
+
+std::shared_ptr<ProtobufResolverCache::TypeResolver>
+ProtobufResolverCache::get(const DescriptorPool *pool)
+{
+	return ResolverCache::get_instance()->get(pool);
+}
+
+ProtobufResolverCache::Registration::Registration(const DescriptorPool *pool) :
+	pool(pool)
+{
+	ResolverCache::get_instance()->add_pool(pool);
+}
+
+ProtobufResolverCache::Registration::~Registration()
+{
+	ResolverCache::get_instance()->remove_pool(this->pool);
+}
+
+void ProtobufResolverCache::set_max_size(size_t max_size)
+{
+	ResolverCache::get_instance()->set_max_size(max_size);
+}
+
+size_t ProtobufResolverCache::get_hits()
+{
+	return ResolverCache::get_instance()->hits;
+}
+
+size_t ProtobufResolverCache::get_misses()
+{
+	return ResolverCache::get_instance()->misses;
+}
+
+} // namespace srpc
+
@@ -0,0 +1,94 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __RPC_PB_JSON_H__
+#define __RPC_PB_JSON_H__
+
+#include <stdint.h>
+#include <memory>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/io/zero_copy_stream.h>
+#include <google/protobuf/util/type_resolver.h>
+#include "rpc_basic.h"
+
+namespace srpc
+{
+
+/**
+ * @brief   Protobuf <-> JSON by reflection, without the binary round trip
+ * @details
+ * - Follows the proto3 JSON mapping and JsonPrintOptions, the options
+ *   are the SRPC_JSON_OPTION_* bits of RPCMessage
+ * - Unknown JSON fields are ignored, same as JsonParseOptions used by srpc
+ * - Field tables are built once per message type and cached
+ * - Only messages of the generated pool without well-known types
+ *   are supported, others go to google::protobuf::util
+ * - SRPC_JSON_OPTION_FIELDS_NO_PRECENCE also goes to google::protobuf::util,
+ *   the order of the fields it adds differs by protobuf version
+ */
+class ProtobufJsonCodec
+{
+public:
+	// options of serialize(), 0 for deserialize()
+	static bool supported(const ProtobufIDLMessage *msg, uint32_t options = 0);
+
+	static bool serialize(const ProtobufIDLMessage *msg, uint32_t options,
+						  google::protobuf::io::ZeroCopyOutputStream *out);
+
+	static bool deserialize(google::protobuf::io::ZeroCopyInputStream *in,
+							ProtobufIDLMessage *msg);
+};
+
+/**
+ * @brief   TypeResolvers for the JSON paths, one per DescriptorPool
+ * @details
+ * - The generated pool is always kept, a pool is kept only while it has
+ *   a Registration, in LRU order up to max_size (default 64)
+ * - Other pools get a new resolver on each get(), so the address of a
+ *   destroyed pool never finds one of its resolvers
+ * - A resolver taken before stays usable until released
+ */
+class ProtobufResolverCache
+{
+public:
+	using TypeResolver = google::protobuf::util::TypeResolver;
+	using DescriptorPool = google::protobuf::DescriptorPool;
+
+	// destroy it before the pool
+	class Registration
+	{
+	public:
+		Registration(const DescriptorPool *pool);
+		~Registration();
+
+		Registration(const Registration&) = delete;
+		Registration& operator=(const Registration&) = delete;
+
+	private:
+		const DescriptorPool *pool;
+	};
+
+	static std::shared_ptr<TypeResolver> get(const DescriptorPool *pool);
+
+	static void set_max_size(size_t max_size);
+	static size_t get_hits();
+	static size_t get_misses();
+};
+
+} // namespace srpc
+
+#endif
+
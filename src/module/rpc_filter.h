@@ -40,6 +40,10 @@ static constexpr const char	   *OTLP_SERVICE_NAME			= "rpc.service";
 static constexpr const char	   *OTLP_METHOD_NAME			= "rpc.method";
 static constexpr const char	   *SRPC_HTTP_METHOD			= "http.method";
 static constexpr const char	   *SRPC_HTTP_STATUS_CODE		= "http.status_code";
+static constexpr const char	   *SRPC_COMPRESS_DECISION		= "srpc.compress_decision";
+static constexpr const char	   *SRPC_COMPRESS_SAVED_BYTES	= "srpc.compress_saved_bytes";
+static constexpr const char	   *SRPC_BREAKER_STATE			= "srpc.breaker_state";
+static constexpr const char	   *SRPC_BREAKER_ENDPOINT		= "srpc.breaker_endpoint";
 
 static constexpr size_t			RPC_REPORT_THREHOLD_DEFAULT	= 100;
 static constexpr size_t			RPC_REPORT_INTERVAL_DEFAULT	= 1000; /* msec */
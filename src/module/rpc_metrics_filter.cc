@@ -40,6 +40,9 @@ static constexpr const char	*OTLP_METRICS_PATH			= "/v1/metrics";
 static constexpr const char *METRICS_REQUEST_COUNT		= "total_request_count";
 static constexpr const char *METRICS_REQUEST_METHOD		= "total_request_method";
 static constexpr const char *METRICS_REQUEST_LATENCY	= "total_request_latency";
+static constexpr const char *METRICS_COMPRESS_DECISION	= "total_compress_decision";
+static constexpr const char *METRICS_COMPRESS_SAVED		= "total_compress_saved_bytes";
+static constexpr const char *METRICS_BREAKER_TRANSITION	= "total_breaker_transition";
 //static constexpr const char *METRICS_REQUEST_SIZE		= "total_request_size";
 //static constexpr const char *METRICS_RESPONSE_SIZE	= "total_response_size";
 
@@ -59,6 +62,10 @@ RPCMetricsFilter::RPCMetricsFilter() :
 //						   {256, 512, 1024, 16384});
 	this->create_summary(METRICS_REQUEST_LATENCY, "request latency nano seconds",
 						 {{0.5, 0.05}, {0.9, 0.01}});
+	this->create_counter(METRICS_COMPRESS_DECISION, "compress policy decisions");
+	this->create_counter(METRICS_COMPRESS_SAVED, "bytes saved by compressing");
+	this->create_counter(METRICS_BREAKER_TRANSITION,
+						 "circuit breaker state transitions");
 }
 
 RPCMetricsFilter::RPCMetricsFilter(const std::string &name) :
@@ -68,6 +75,49 @@ RPCMetricsFilter::RPCMetricsFilter(const std::string &name) :
 	this->create_counter(METRICS_REQUEST_METHOD, "request method statistics");
 	this->create_summary(METRICS_REQUEST_LATENCY, "request latency nano seconds",
 						 {{0.5, 0.05}, {0.9, 0.01}});
+	this->create_counter(METRICS_COMPRESS_DECISION, "compress policy decisions");
+	this->create_counter(METRICS_COMPRESS_SAVED, "bytes saved by compressing");
+	this->create_counter(METRICS_BREAKER_TRANSITION,
+						 "circuit breaker state transitions");
+}
+
+// only there if the task has a RPCCompressPolicy
+void RPCMetricsFilter::compress_end(RPCModuleData& data)
+{
+	auto it = data.find(SRPC_COMPRESS_DECISION);
+
+	if (it == data.end())
+		return;
+
+	this->counter(METRICS_COMPRESS_DECISION)->increase(
+				{{"service",  data[OTLP_SERVICE_NAME]},
+				 {"method",   data[OTLP_METHOD_NAME] },
+				 {"decision", it->second             }});
+
+	long long saved = atoll(data[SRPC_COMPRESS_SAVED_BYTES].data());
+
+	// a sample of a skipped method may be larger than it was
+	if (saved > 0)
+	{
+		this->counter(METRICS_COMPRESS_SAVED)->increase(
+				{{"service", data[OTLP_SERVICE_NAME]},
+				 {"method",  data[OTLP_METHOD_NAME] }}, (double)saved);
+	}
+}
+
+// only there if the task changed the state of a circuit breaker
+void RPCMetricsFilter::breaker_end(RPCModuleData& data)
+{
+	auto it = data.find(SRPC_BREAKER_STATE);
+
+	if (it == data.end())
+		return;
+
+	this->counter(METRICS_BREAKER_TRANSITION)->increase(
+				{{"service",  data[OTLP_SERVICE_NAME]    },
+				 {"method",   data[OTLP_METHOD_NAME]     },
+				 {"endpoint", data[SRPC_BREAKER_ENDPOINT]},
+				 {"state",    it->second                 }});
 }
 
 bool RPCMetricsFilter::client_end(SubTask *task, RPCModuleData& data)
@@ -77,6 +127,8 @@ bool RPCMetricsFilter::client_end(SubTask *task, RPCModuleData& data)
 				{{"service", data[OTLP_SERVICE_NAME]},
 				 {"method",  data[OTLP_METHOD_NAME] }});
 	this->summary(METRICS_REQUEST_LATENCY)->observe(atoll(data[SRPC_DURATION].data()));
+	this->compress_end(data);
+	this->breaker_end(data);
 
 	return true;
 }
@@ -88,6 +140,7 @@ bool RPCMetricsFilter::server_end(SubTask *task, RPCModuleData& data)
 				{{"service", data[OTLP_SERVICE_NAME]},
 				 {"method",  data[OTLP_METHOD_NAME] }});
 	this->summary(METRICS_REQUEST_LATENCY)->observe(atoll(data[SRPC_DURATION].data()));
+	this->compress_end(data);
 
 	return true;
 }
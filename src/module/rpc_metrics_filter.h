@@ -79,6 +79,8 @@ public:
 protected:
 	void reduce(std::unordered_map<std::string, RPCVar *>& out);
 	void reset();
+	void compress_end(RPCModuleData& data);
+	void breaker_end(RPCModuleData& data);
 
 protected:
 	std::mutex mutex;
@@ -220,5 +220,28 @@ bool http_get_header_module_data(const protocol::HttpMessage *msg,
 	return true;
 }
 
+bool http_copy_request_header(const protocol::HttpRequest *src,
+							  protocol::HttpRequest *dst)
+{
+	protocol::HttpHeaderCursor cursor(src);
+	std::string name;
+	std::string value;
+
+	if (!dst->set_method(src->get_method()) ||
+		!dst->set_request_uri(src->get_request_uri()) ||
+		!dst->set_http_version(src->get_http_version()))
+	{
+		return false;
+	}
+
+	while (cursor.next(name, value))
+	{
+		if (!dst->add_header_pair(name, value))
+			return false;
+	}
+
+	return true;
+}
+
 } // end namespace srpc
 
@@ -139,6 +139,10 @@ bool http_get_header_module_data(const protocol::HttpMessage *msg,
 bool http_set_header_module_data(const RPCModuleData& data,
 								 protocol::HttpMessage *msg);
 
+// the start line and the headers, not the body
+bool http_copy_request_header(const protocol::HttpRequest *src,
+							  protocol::HttpRequest *dst);
+
 } // end namespace srpc
 
 #endif
@@ -43,6 +43,8 @@ static constexpr size_t			RPC_BODY_SIZE_LIMIT		= 2LL * 1024 * 1024 * 1024;
 static constexpr int			SRPC_MODULE_MAX			= 5;
 static constexpr size_t			SRPC_SPANID_SIZE		= 8;
 static constexpr size_t			SRPC_TRACEID_SIZE		= 16;
+static constexpr int			SRPC_META_V1			= 1;
+static constexpr int			SRPC_META_V2			= 2;
 
 #ifndef htonll
 
@@ -122,6 +124,8 @@ enum RPCStatusCode
 
 	RPCStatusURIInvalid					=	30,
 	RPCStatusUpstreamFailed				=	31,
+	RPCStatusCircuitBreakerOpen			=	32,
+	RPCStatusAttachmentNotSupported		=	33,
 	RPCStatusSystemError				=	100,
 	RPCStatusSSLError					=	101,
 	RPCStatusDNSError					=	102,
@@ -135,7 +139,8 @@ enum RPCCompressType
 	RPCCompressGzip		=	2,
 	RPCCompressZlib		=	3,
 	RPCCompressLz4		=	4,
-	RPCCompressMax		=	5,
+	RPCCompressZstd		=	5,
+	RPCCompressMax		=	6,
 };
 
 enum RPCModuleType
@@ -168,12 +173,37 @@ static inline long long GET_CURRENT_MS_STEADY()
 			std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+static inline long long GET_CURRENT_US_STEADY()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 static inline unsigned long long GET_CURRENT_NS()
 {
 	return std::chrono::duration_cast<std::chrono::nanoseconds>(
 		std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
+// recursive, so that it is constexpr for C++11 users as well
+static inline constexpr uint32_t __fnv1a(const char *s, uint32_t hash)
+{
+	return *s ? __fnv1a(s + 1, (hash ^ (uint8_t)*s) * 16777619U) : hash;
+}
+
+static inline constexpr uint32_t __method_id(uint32_t hash)
+{
+	return hash ? hash : 1;
+}
+
+// FNV-1a of "service.method", the same on client and server. 0 is for none
+static inline constexpr uint32_t RPC_METHOD_ID(const char *service,
+											   const char *method)
+{
+	return __method_id(__fnv1a(method,
+		(__fnv1a(service, 2166136261U) ^ (uint8_t)'.') * 16777619U));
+}
+
 static inline void TRACE_ID_BIN_TO_HEX(const uint64_t trace_id[2],
 									   char hex[SRPC_TRACEID_SIZE * 2 + 1])
 {
@@ -0,0 +1,258 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <utility>
+#include "rpc_breaker.h"
+
+namespace srpc
+{
+
+RPCCircuitBreaker::RPCCircuitBreaker(const RPCBreakerPolicy& policy,
+									 const std::string& endpoint,
+									 uint32_t method_id,
+									 const std::string& method_name) :
+	policy(policy),
+	endpoint(endpoint),
+	method_id(method_id),
+	method_name(method_name),
+	state(RPCBreakerClosed),
+	window_start(0),
+	requests(0),
+	failures(0),
+	open_until(0)
+{
+}
+
+bool RPCCircuitBreaker::allow(long long now_us, int *changed)
+{
+	int state = this->state.load(std::memory_order_acquire);
+	long long until;
+
+	*changed = -1;
+	if (state == RPCBreakerClosed)
+		return true;
+
+	until = this->open_until.load(std::memory_order_relaxed);
+	if (now_us < until)
+		return false;
+
+	// this call is the probe, until it ends or is gone for open_ms
+	if (!this->open_until.compare_exchange_strong(until,
+							now_us + this->policy.open_ms * 1000LL))
+	{
+		return false;
+	}
+
+	if (state == RPCBreakerOpen &&
+		this->state.compare_exchange_strong(state, RPCBreakerHalfOpen))
+	{
+		*changed = RPCBreakerHalfOpen;
+	}
+
+	return true;
+}
+
+int RPCCircuitBreaker::end(long long start_us, long long now_us, bool failed)
+{
+	long long window_us = this->policy.window_ms * 1000LL;
+	int state = this->state.load(std::memory_order_acquire);
+	long long start;
+	int requests;
+	int failures;
+
+	if (this->policy.slow_ms > 0 &&
+		now_us - start_us > this->policy.slow_ms * 1000LL)
+	{
+		failed = true;
+	}
+
+	if (state == RPCBreakerHalfOpen)
+	{
+		if (failed)
+		{
+			this->open_until.store(now_us + this->policy.open_ms * 1000LL,
+								   std::memory_order_relaxed);
+		}
+		else
+		{
+			this->window_start.store(now_us, std::memory_order_relaxed);
+			this->requests.store(0, std::memory_order_relaxed);
+			this->failures.store(0, std::memory_order_relaxed);
+		}
+
+		if (this->state.compare_exchange_strong(state, failed ? RPCBreakerOpen
+															  : RPCBreakerClosed))
+		{
+			return failed ? RPCBreakerOpen : RPCBreakerClosed;
+		}
+
+		return -1;
+	}
+
+	// the replies of the calls before it was open
+	if (state == RPCBreakerOpen)
+		return -1;
+
+	start = this->window_start.load(std::memory_order_relaxed);
+	if (now_us - start >= window_us &&
+		this->window_start.compare_exchange_strong(start, now_us))
+	{
+		this->requests.store(0, std::memory_order_relaxed);
+		this->failures.store(0, std::memory_order_relaxed);
+	}
+
+	requests = this->requests.fetch_add(1, std::memory_order_relaxed) + 1;
+	if (!failed)
+		return -1;
+
+	failures = this->failures.fetch_add(1, std::memory_order_relaxed) + 1;
+	if (requests < this->policy.min_requests ||
+		failures <= this->policy.error_ratio * requests)
+	{
+		return -1;
+	}
+
+	this->open_until.store(now_us + this->policy.open_ms * 1000LL,
+						   std::memory_order_relaxed);
+	if (this->state.compare_exchange_strong(state, RPCBreakerOpen))
+		return RPCBreakerOpen;
+
+	return -1;
+}
+
+const char *RPCCircuitBreaker::state_string(int state)
+{
+	switch (state)
+	{
+	case RPCBreakerClosed:
+		return "closed";
+	case RPCBreakerOpen:
+		return "open";
+	case RPCBreakerHalfOpen:
+		return "half_open";
+	default:
+		return "unknown";
+	}
+}
+
+RPCBreaker::RPCBreaker(const RPCBreakerPolicy& policy,
+					   std::vector<std::string>&& endpoints) :
+	policy(policy),
+	endpoints(std::move(endpoints)),
+	slots(this->endpoints.size() * RPC_BREAKER_METHODS)
+{
+	for (auto& slot : this->slots)
+		slot.store(NULL, std::memory_order_relaxed);
+
+	for (const std::string& endpoint : this->endpoints)
+	{
+		this->shared.push_back(new RPCCircuitBreaker(this->policy, endpoint,
+													 0, ""));
+	}
+}
+
+RPCBreaker::~RPCBreaker()
+{
+	for (auto& slot : this->slots)
+		delete slot.load(std::memory_order_relaxed);
+
+	for (RPCCircuitBreaker *breaker : this->shared)
+		delete breaker;
+}
+
+RPCCircuitBreaker *RPCBreaker::get(size_t endpoint, uint32_t method_id,
+								   const std::string& method_name)
+{
+	std::atomic<RPCCircuitBreaker *> *slots;
+	RPCCircuitBreaker *created = NULL;
+	RPCCircuitBreaker *breaker;
+
+	slots = &this->slots[endpoint * RPC_BREAKER_METHODS];
+	for (size_t i = 0; i < RPC_BREAKER_METHODS; i++)
+	{
+		auto& slot = slots[(method_id + i) % RPC_BREAKER_METHODS];
+
+		breaker = slot.load(std::memory_order_acquire);
+		if (!breaker)
+		{
+			if (!created)
+			{
+				created = new RPCCircuitBreaker(this->policy,
+												this->endpoints[endpoint],
+												method_id, method_name);
+			}
+
+			// or breaker is the one of another call now
+			if (slot.compare_exchange_strong(breaker, created,
+											 std::memory_order_acq_rel))
+			{
+				return created;
+			}
+		}
+
+		if (breaker->get_method_id() == method_id &&
+			breaker->get_method_name() == method_name)
+		{
+			delete created;
+			return breaker;
+		}
+	}
+
+	delete created;
+	return this->shared[endpoint];
+}
+
+RPCRetryBudget::RPCRetryBudget(double ratio) :
+	ratio((long long)(ratio * 1000)),
+	budget(RPC_RETRY_BURST * 1000)
+{
+}
+
+void RPCRetryBudget::earn()
+{
+	long long budget = this->budget.load(std::memory_order_relaxed);
+	long long next;
+
+	do
+	{
+		next = budget + this->ratio;
+		if (next > RPC_RETRY_BURST * 1000)
+			next = RPC_RETRY_BURST * 1000;
+
+		if (next == budget)
+			return;
+
+	} while (!this->budget.compare_exchange_weak(budget, next,
+												 std::memory_order_relaxed));
+}
+
+bool RPCRetryBudget::spend()
+{
+	long long budget = this->budget.load(std::memory_order_relaxed);
+
+	do
+	{
+		if (budget < 1000)
+			return false;
+
+	} while (!this->budget.compare_exchange_weak(budget, budget - 1000,
+												 std::memory_order_relaxed));
+
+	return true;
+}
+
+} // namespace srpc
+
@@ -0,0 +1,142 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __RPC_BREAKER_H__
+#define __RPC_BREAKER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace srpc
+{
+
+struct RPCBreakerPolicy
+{
+	double error_ratio;	//failures of a window above it open the breaker, 0 for no breaker
+	int slow_ms;		//replies slower than it are failures too, 0 for none
+	int min_requests;	//requests of a window before error_ratio is checked
+	int window_ms;		//failures are counted in windows of this long
+	int open_ms;		//calls fail fast this long, then one probe at a time
+};
+
+enum RPCBreakerState
+{
+	RPCBreakerClosed	=	0,
+	RPCBreakerOpen		=	1,
+	RPCBreakerHalfOpen	=	2,
+};
+
+// retries the budget saves at most, also what it starts with
+static constexpr long long	RPC_RETRY_BURST		=	10;
+// methods of an endpoint with their own breakers, the others share one
+static constexpr size_t		RPC_BREAKER_METHODS	=	64;
+
+/**
+ * @brief   Breaker of an endpoint and a method, by RPCBreakerPolicy
+ * @details
+ * - Closed: the failures of each window are counted
+ * - Open: calls fail fast until open_ms is over
+ * - HalfOpen: one probe at a time, closed by a success, open by a failure.
+ *   Another probe is let through if the last one is gone for open_ms
+ * - Atomics without any lock, a lost count at the end of a window does no harm
+ */
+class RPCCircuitBreaker
+{
+public:
+	RPCCircuitBreaker(const RPCBreakerPolicy& policy,
+					  const std::string& endpoint,
+					  uint32_t method_id, const std::string& method_name);
+
+	// false to fail fast, *changed is as the return value of end()
+	bool allow(long long now_us, int *changed);
+	// the new RPCBreakerState if this call changed it, otherwise -1.
+	// A reply slower than slow_ms is a failure too
+	int end(long long start_us, long long now_us, bool failed);
+
+	int get_state() const { return this->state.load(std::memory_order_relaxed); }
+	const std::string& get_endpoint() const { return this->endpoint; }
+	uint32_t get_method_id() const { return this->method_id; }
+	const std::string& get_method_name() const { return this->method_name; }
+
+	static const char *state_string(int state);
+
+private:
+	const RPCBreakerPolicy& policy;
+	std::string endpoint;
+	uint32_t method_id;
+	std::string method_name;
+	std::atomic<int> state;
+	std::atomic<long long> window_start;
+	std::atomic<int> requests;
+	std::atomic<int> failures;
+	// end of the open state, or the time to give up the probe
+	std::atomic<long long> open_until;
+};
+
+/**
+ * @brief   Breakers of a client, by the index of RPCClientParams::endpoints
+ *          and the method. Kept until the client is gone
+ * @details
+ * - The slots of all endpoints are made up front, get() takes no lock
+ * - The breaker of a method is made by its first call, by RPC_METHOD_ID().
+ *   Methods beyond RPC_BREAKER_METHODS of an endpoint share one
+ */
+class RPCBreaker
+{
+public:
+	// the names of the endpoints for metrics, such as host:port
+	RPCBreaker(const RPCBreakerPolicy& policy,
+			   std::vector<std::string>&& endpoints);
+	~RPCBreaker();
+
+	RPCCircuitBreaker *get(size_t endpoint, uint32_t method_id,
+						   const std::string& method_name);
+
+private:
+	RPCBreakerPolicy policy;
+	std::vector<std::string> endpoints;
+	// RPC_BREAKER_METHODS for each endpoint, by open addressing
+	std::vector<std::atomic<RPCCircuitBreaker *>> slots;
+	std::vector<RPCCircuitBreaker *> shared;
+};
+
+/**
+ * @brief   What the retries of the tasks of a client share
+ * @details Every request earns ratio of a retry, and a retry is only sent
+ *          when a whole one is saved. So retries stay below ratio of the
+ *          requests when the servers fail, instead of retry_max times more
+ */
+class RPCRetryBudget
+{
+public:
+	RPCRetryBudget(double ratio);
+
+	void earn();
+	bool spend();
+
+private:
+	// thousandths of a retry
+	long long ratio;
+	std::atomic<long long> budget;
+};
+
+} // namespace srpc
+
+#endif
+
@@ -16,29 +16,445 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
 #include "rpc_buffer.h"
 
 namespace srpc
 {
 
+struct __PoolFreePiece
+{
+	__PoolFreePiece *next;
+};
+
+struct __PoolThreadCache
+{
+	__PoolFreePiece *head[BUFFER_POOL_CLASS_NUM];
+	// only written by the owner thread, read by get_stats()
+	std::atomic<size_t> hit;
+	std::atomic<size_t> miss;
+	std::atomic<size_t> retained;
+};
+
+struct __PoolGlobal
+{
+	__PoolGlobal() :
+		enabled(true),
+		max_retained(BUFFER_POOL_MAX_RETAINED),
+		max_retained_total(BUFFER_POOL_MAX_RETAINED_TOTAL),
+		retained_total(0)
+	{ }
+
+	std::mutex mutex;
+	std::vector<__PoolThreadCache *> caches;
+	size_t exited_hit = 0;
+	size_t exited_miss = 0;
+	std::atomic<bool> enabled;
+	std::atomic<size_t> max_retained;
+	std::atomic<size_t> max_retained_total;
+	// bytes kept by all threads, bounds pieces freed on another thread
+	std::atomic<size_t> retained_total;
+};
+
+static __PoolGlobal *__pool_global()
+{
+	// never destructed, threads may exit after static destruction
+	static __PoolGlobal *kInstance = new __PoolGlobal();
+
+	return kInstance;
+}
+
+static thread_local __PoolThreadCache *__pool_tls = NULL;
+static thread_local bool __pool_tls_exited = false;
+
+static inline size_t __pool_class_size(int cls)
+{
+	return (size_t)BUFFER_PIECE_MIN_SIZE << cls;
+}
+
+// the smallest class can hold size, -1 if too large
+static inline int __pool_round_class(size_t size)
+{
+	int cls = 0;
+
+	while (__pool_class_size(cls) < size)
+	{
+		if (++cls == BUFFER_POOL_CLASS_NUM)
+			return -1;
+	}
+
+	return cls;
+}
+
+// the class of exactly this size, -1 if none
+static inline int __pool_class(size_t size)
+{
+	int cls = __pool_round_class(size);
+
+	if (cls >= 0 && __pool_class_size(cls) != size)
+		return -1;
+
+	return cls;
+}
+
+static inline void __pool_inc(std::atomic<size_t>& counter, size_t n)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + n,
+				  std::memory_order_relaxed);
+}
+
+// give back all pieces kept by this thread
+static void __pool_drain(__PoolThreadCache *cache)
+{
+	size_t retained = cache->retained.load(std::memory_order_relaxed);
+
+	if (retained == 0)
+		return;
+
+	for (int i = 0; i < BUFFER_POOL_CLASS_NUM; i++)
+	{
+		while (cache->head[i])
+		{
+			__PoolFreePiece *piece = cache->head[i];
+
+			cache->head[i] = piece->next;
+			free(piece);
+		}
+	}
+
+	cache->retained.store(0, std::memory_order_relaxed);
+	__pool_global()->retained_total.fetch_sub(retained,
+											  std::memory_order_relaxed);
+}
+
+class __PoolThreadHolder
+{
+public:
+	__PoolThreadHolder()
+	{
+		__PoolGlobal *global = __pool_global();
+
+		for (int i = 0; i < BUFFER_POOL_CLASS_NUM; i++)
+			cache.head[i] = NULL;
+
+		cache.hit = 0;
+		cache.miss = 0;
+		cache.retained = 0;
+
+		global->mutex.lock();
+		global->caches.push_back(&cache);
+		global->mutex.unlock();
+		__pool_tls = &cache;
+	}
+
+	~__PoolThreadHolder()
+	{
+		__PoolGlobal *global = __pool_global();
+
+		__pool_tls = NULL;
+		__pool_tls_exited = true;
+		__pool_drain(&cache);
+
+		global->mutex.lock();
+		for (auto it = global->caches.begin(); it != global->caches.end(); ++it)
+		{
+			if (*it == &cache)
+			{
+				global->caches.erase(it);
+				break;
+			}
+		}
+
+		global->exited_hit += cache.hit;
+		global->exited_miss += cache.miss;
+		global->mutex.unlock();
+	}
+
+	__PoolThreadCache cache;
+};
+
+static inline __PoolThreadCache *__pool_thread_cache()
+{
+	if (__pool_tls || __pool_tls_exited)
+		return __pool_tls;
+
+	static thread_local __PoolThreadHolder holder;
+
+	return __pool_tls;
+}
+
+static void *__pool_get(int cls)
+{
+	__PoolGlobal *global = __pool_global();
+	__PoolThreadCache *cache = __pool_thread_cache();
+	size_t size = __pool_class_size(cls);
+	__PoolFreePiece *piece;
+
+	if (!cache)
+		return malloc(size);
+
+	if (!global->enabled.load(std::memory_order_relaxed))
+	{
+		__pool_drain(cache);
+		return malloc(size);
+	}
+
+	piece = cache->head[cls];
+	if (piece)
+	{
+		cache->head[cls] = piece->next;
+		__pool_inc(cache->hit, 1);
+		cache->retained.store(cache->retained.load(std::memory_order_relaxed) -
+							  size, std::memory_order_relaxed);
+		global->retained_total.fetch_sub(size, std::memory_order_relaxed);
+		return piece;
+	}
+
+	__pool_inc(cache->miss, 1);
+	return malloc(size);
+}
+
+static void __pool_put(void *buf, int cls)
+{
+	__PoolGlobal *global = __pool_global();
+	__PoolThreadCache *cache = __pool_thread_cache();
+	size_t size = __pool_class_size(cls);
+
+	if (!cache)
+	{
+		free(buf);
+		return;
+	}
+
+	if (!global->enabled.load(std::memory_order_relaxed))
+	{
+		__pool_drain(cache);
+		free(buf);
+		return;
+	}
+
+	if (cache->retained.load(std::memory_order_relaxed) + size >
+		global->max_retained.load(std::memory_order_relaxed))
+	{
+		free(buf);
+		return;
+	}
+
+	if (global->retained_total.fetch_add(size, std::memory_order_relaxed) + size >
+		global->max_retained_total.load(std::memory_order_relaxed))
+	{
+		global->retained_total.fetch_sub(size, std::memory_order_relaxed);
+		free(buf);
+		return;
+	}
+
+	__PoolFreePiece *piece = (__PoolFreePiece *)buf;
+
+	piece->next = cache->head[cls];
+	cache->head[cls] = piece;
+	__pool_inc(cache->retained, size);
+}
+
+void *RPCBufferPool::get(size_t *size)
+{
+	int cls = __pool_round_class(*size);
+
+	if (cls < 0)
+		return malloc(*size);
+
+	*size = __pool_class_size(cls);
+	return __pool_get(cls);
+}
+
+void RPCBufferPool::put(void *buf, size_t size)
+{
+	int cls = __pool_class(size);
+
+	if (cls < 0)
+		free(buf);
+	else
+		__pool_put(buf, cls);
+}
+
+void RPCBufferPool::set_max_retained(size_t bytes)
+{
+	__pool_global()->max_retained = bytes;
+}
+
+size_t RPCBufferPool::get_max_retained()
+{
+	return __pool_global()->max_retained;
+}
+
+void RPCBufferPool::set_max_retained_total(size_t bytes)
+{
+	__pool_global()->max_retained_total = bytes;
+}
+
+size_t RPCBufferPool::get_max_retained_total()
+{
+	return __pool_global()->max_retained_total;
+}
+
+void RPCBufferPool::set_enabled(bool enabled)
+{
+	__pool_global()->enabled = enabled;
+}
+
+bool RPCBufferPool::get_enabled()
+{
+	return __pool_global()->enabled;
+}
+
+void RPCBufferPool::get_stats(RPCBufferPoolStats *stats)
+{
+	__PoolGlobal *global = __pool_global();
+
+	global->mutex.lock();
+	stats->hit = global->exited_hit;
+	stats->miss = global->exited_miss;
+	stats->retained_bytes = 0;
+	for (const auto *cache : global->caches)
+	{
+		stats->hit += cache->hit.load(std::memory_order_relaxed);
+		stats->miss += cache->miss.load(std::memory_order_relaxed);
+		stats->retained_bytes += cache->retained.load(std::memory_order_relaxed);
+	}
+
+	global->mutex.unlock();
+}
+
+struct RPCBuffer::shared_t
+{
+	std::atomic<size_t> ref;
+	void *base;
+	bool is_new;
+	signed char pool_class;
+};
+
+static inline void __free_piece(void *buf, bool is_new, int pool_class)
+{
+	if (pool_class >= 0)
+		__pool_put(buf, pool_class);
+	else if (is_new)
+		delete []((char *)buf);
+	else
+		free(buf);
+}
+
+void RPCBuffer::free_piece(const buffer_t& piece)
+{
+	shared_t *shared = piece.shared;
+
+	if (shared)
+	{
+		if (shared->ref.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			__free_piece(shared->base, shared->is_new, shared->pool_class);
+			delete shared;
+		}
+	}
+	else if (!piece.is_nocopy)
+		__free_piece(piece.buf, piece.is_new, piece.pool_class);
+}
+
+// one more owner of this piece, the first time moves the ownership to a refcount
+void RPCBuffer::ref_piece(buffer_t *piece)
+{
+	if (piece->shared)
+		piece->shared->ref.fetch_add(1, std::memory_order_relaxed);
+	else if (!piece->is_nocopy)
+	{
+		shared_t *shared = new shared_t;
+
+		shared->ref = 2;
+		shared->base = piece->buf;
+		shared->is_new = piece->is_new;
+		shared->pool_class = piece->pool_class;
+		piece->shared = shared;
+	}
+}
+
 void RPCBuffer::clear_list_buffer()
 {
-	for (const auto& ele: buffer_list_)
+	for (size_t i = 0; i < list_size_; i++)
+		free_piece(buffer_list_[i]);
+}
+
+RPCBuffer::buffer_t *RPCBuffer::add_piece()
+{
+	if (list_size_ == list_capacity_)
 	{
-		if (!ele.is_nocopy)
+		size_t capacity = list_capacity_ * 2;
+		buffer_t *list;
+
+		if (buffer_list_ == inline_list_)
 		{
-			if (ele.is_new)
-				delete []((char *)ele.buf);
-			else
-				free(ele.buf);
+			list = (buffer_t *)malloc(capacity * sizeof (buffer_t));
+			if (list)
+				memcpy(list, inline_list_, list_size_ * sizeof (buffer_t));
 		}
+		else
+			list = (buffer_t *)realloc(buffer_list_, capacity * sizeof (buffer_t));
+
+		if (!list)
+			return NULL;
+
+		buffer_list_ = list;
+		list_capacity_ = capacity;
+	}
+
+	return &buffer_list_[list_size_++];
+}
+
+void *RPCBuffer::add_pool_piece(size_t *size)
+{
+	void *buf = RPCBufferPool::get(size);
+	buffer_t *ele;
+
+	if (!buf)
+		return NULL;
+
+	ele = add_piece();
+	if (!ele)
+	{
+		RPCBufferPool::put(buf, *size);
+		return NULL;
 	}
+
+	ele->buf = buf;
+	ele->buflen = 0;
+	ele->is_nocopy = false;
+	ele->is_new = false;
+	ele->pool_class = __pool_class(*size);
+	ele->shared = NULL;
+	return buf;
+}
+
+// the caller decides the ownership of piece
+bool RPCBuffer::append_piece(const buffer_t& piece, size_t offset, size_t len)
+{
+	buffer_t *ele = add_piece();
+
+	if (!ele)
+		return false;
+
+	*ele = piece;
+	ele->buf = (char *)piece.buf + offset;
+	ele->buflen = len;
+	size_ += len;
+	// never acquire() into the tail of a piece which is not ours
+	last_piece_left_ = 0;
+	return true;
 }
 
 void RPCBuffer::clear()
 {
 	clear_list_buffer();
-	buffer_list_.clear();
+	// keep the piece table for the next message
+	list_size_ = 0;
 	size_ = 0;
 	piece_min_size_ = BUFFER_PIECE_MIN_SIZE;
 	piece_max_size_ = BUFFER_PIECE_MAX_SIZE;
@@ -51,30 +467,38 @@ bool RPCBuffer::append(void *buf, size_t buflen, int mode)
 	if (mode == BUFFER_MODE_COPY)
 		return write(buf, buflen);
 
-	buffer_t ele;
-	void *left_buf;
+	buffer_t *ele;
+	size_t left_pos = list_size_ - 1;
 
-	if (last_piece_left_ > 0)
-	{
-		const auto it = buffer_list_.rbegin();
+	ele = add_piece();
+	if (!ele)
+		return false;
 
-		left_buf = (char *)it->buf + it->buflen;
-	}
-
-	ele.buflen = buflen;
-	ele.buf = buf;
-	ele.is_nocopy = (mode == BUFFER_MODE_NOCOPY);
-	ele.is_new = (mode == BUFFER_MODE_GIFT_NEW);
-	buffer_list_.emplace_back(std::move(ele));
+	ele->buflen = buflen;
+	ele->buf = buf;
+	ele->is_nocopy = (mode == BUFFER_MODE_NOCOPY);
+	ele->is_new = (mode == BUFFER_MODE_GIFT_NEW);
+	ele->pool_class = -1;
+	ele->shared = NULL;
 	size_ += buflen;
 
 	if (last_piece_left_ > 0)
 	{
-		ele.buflen = 0;
-		ele.buf = left_buf;
-		ele.is_nocopy = true;
-		ele.is_new = false;
-		buffer_list_.emplace_back(std::move(ele));
+		ele = add_piece();
+		if (!ele)
+		{
+			last_piece_left_ = 0;
+			return true;
+		}
+
+		// the left part is a view of the previous piece, keep it alive
+		// in case only one of them is cut or shared to another buffer
+		buffer_t *left = &buffer_list_[left_pos];
+
+		ref_piece(left);
+		*ele = *left;
+		ele->buf = (char *)left->buf + left->buflen;
+		ele->buflen = 0;
 	}
 
 	return true;
@@ -90,21 +514,21 @@ bool RPCBuffer::append(const void *buf, size_t buflen, int mode)
 
 size_t RPCBuffer::backup(size_t count)
 {
-	if (count == 0 || buffer_list_.empty())
+	if (count == 0 || list_size_ == 0)
 		return 0;
 
-	const auto it = buffer_list_.rbegin();
+	buffer_t *last = &buffer_list_[list_size_ - 1];
 	size_t sz = 0;
 
-	if (it->buflen > count)
+	if (last->buflen > count)
 	{
 		sz = count;
-		it->buflen -= count;
+		last->buflen -= count;
 	}
 	else
 	{
-		sz = it->buflen;
-		it->buflen = 0;
+		sz = last->buflen;
+		last->buflen = 0;
 	}
 
 	last_piece_left_ += sz;
@@ -150,7 +574,7 @@ bool RPCBuffer::write(const void *buf, size_t buflen)
 
 void RPCBuffer::rewind()
 {
-	cur_.first = buffer_list_.begin();
+	cur_.first = 0;
 	cur_.second = 0;
 	init_read_over_ = true;
 }
@@ -178,28 +602,33 @@ size_t RPCBuffer::fetch(const void **buf)
 RPCBuffer::~RPCBuffer()
 {
 	clear_list_buffer();
+	if (buffer_list_ != inline_list_)
+		free(buffer_list_);
 }
 
 size_t RPCBuffer::acquire(void **buf)
 {
 	if (last_piece_left_ > 0)
 	{
-		const auto it = buffer_list_.rbegin();
+		buffer_t *last = &buffer_list_[list_size_ - 1];
 		size_t sz = last_piece_left_;
 
-		*buf = (char *)it->buf + it->buflen;
-		it->buflen += last_piece_left_;
+		*buf = (char *)last->buf + last->buflen;
+		last->buflen += last_piece_left_;
 		size_ += last_piece_left_;
 		last_piece_left_ = 0;
 		return sz;
 	}
 
-	*buf = malloc(piece_min_size_);
+	size_t sz = piece_min_size_;
+
+	*buf = add_pool_piece(&sz);
 	if (*buf == NULL)
 		return 0;
 
-	append(*buf, piece_min_size_, BUFFER_MODE_GIFT_MALLOC);
-	return piece_min_size_;
+	buffer_list_[list_size_ - 1].buflen = sz;
+	size_ += sz;
+	return sz;
 }
 
 bool RPCBuffer::acquire(void **buf, size_t *size)
@@ -214,20 +643,19 @@ bool RPCBuffer::acquire(void **buf, size_t *size)
 		if (sz < piece_min_size_)
 			sz = piece_min_size_;
 
-		*buf = malloc(sz);
+		*buf = add_pool_piece(&sz);
 		if (*buf == NULL)
 		{
 			*size = 0;
 			return false;
 		}
 
-		append(*buf, 0, BUFFER_MODE_GIFT_MALLOC);
 		last_piece_left_ = sz;
 	}
 
-	const auto it = buffer_list_.rbegin();
+	buffer_t *last = &buffer_list_[list_size_ - 1];
 
-	*buf = (char *)it->buf + it->buflen;
+	*buf = (char *)last->buf + last->buflen;
 	if (last_piece_left_ <= *size)
 	{
 		*size = last_piece_left_;
@@ -236,7 +664,7 @@ bool RPCBuffer::acquire(void **buf, size_t *size)
 	else
 		last_piece_left_ -= *size;
 
-	it->buflen += *size;
+	last->buflen += *size;
 	size_ += *size;
 	return true;
 }
@@ -244,105 +672,185 @@ bool RPCBuffer::acquire(void **buf, size_t *size)
 int RPCBuffer::merge_all(struct iovec& iov)
 {
 	size_t sz = 0;
-	void *new_base = malloc(size_);
+	size_t cap = size_ > 0 ? size_ : 1;
+	void *new_base = RPCBufferPool::get(&cap);
 
 	if (!new_base)
 		return -1;
 
-	for (const auto& ele : buffer_list_)
+	for (size_t i = 0; i < list_size_; i++)
 	{
-		memcpy((char *)new_base + sz, ele.buf, ele.buflen);
-		sz += ele.buflen;
-		if (!ele.is_nocopy)
-		{
-			if (ele.is_new)
-				delete []((char *)ele.buf);
-			else
-				free(ele.buf);
-		}
+		memcpy((char *)new_base + sz, buffer_list_[i].buf, buffer_list_[i].buflen);
+		sz += buffer_list_[i].buflen;
 	}
 
+	// free after copying, a piece may still point into a previous one
+	clear_list_buffer();
+
 	iov.iov_base = new_base;
 	iov.iov_len = sz;
-	buffer_list_.resize(1);
-	auto head = buffer_list_.begin();
+	list_size_ = 1;
+	buffer_t *head = &buffer_list_[0];
 
 	head->buf = new_base;
 	head->buflen = sz;
 	head->is_nocopy = false;
 	head->is_new = false;
-	return 1;
+	head->pool_class = __pool_class(cap);
+	head->shared = NULL;
+	last_piece_left_ = 0;
+	init_read_over_ = false;
+	return 0;
 }
 
-int RPCBuffer::encode(struct iovec *iov, int count)
+bool RPCBuffer::merge_run(size_t first, size_t last, size_t bytes)
 {
-	if (count <= 0)
+	size_t cap = bytes;
+	size_t sz = 0;
+	void *new_base = RPCBufferPool::get(&cap);
+
+	if (!new_base)
+		return false;
+
+	for (size_t i = first; i <= last; i++)
 	{
-		errno = EINVAL;
-		return -1;
+		memcpy((char *)new_base + sz, buffer_list_[i].buf, buffer_list_[i].buflen);
+		sz += buffer_list_[i].buflen;
 	}
 
-	if (count == 1)
-		return merge_all(iov[0]) == 0 ? 1 : -1;
+	// the old pieces are retired with zero length instead of freed,
+	// a later piece may still point into them. freed in clear().
+	if (!buffer_list_[first].is_nocopy)
+	{
+		buffer_t *retired = add_piece();
+
+		if (!retired)
+		{
+			RPCBufferPool::put(new_base, cap);
+			return false;
+		}
+
+		*retired = buffer_list_[first];
+		retired->buflen = 0;
+	}
+
+	for (size_t i = first + 1; i <= last; i++)
+		buffer_list_[i].buflen = 0;
 
-	//if (buffer_list_.size() > count)
-	//{
-	//	// todo try merge all Adjacent copyed
-	//	// nocopy copy nocopy copy copy nocopy ...
-	//	// 0      1    0      1    1    0      ...
-	//	// merge same, test if <= count
-	//}
+	buffer_t *head = &buffer_list_[first];
 
-	while (buffer_list_.size() > (size_t)count)
+	head->buf = new_base;
+	head->buflen = sz;
+	head->is_nocopy = false;
+	head->is_new = false;
+	head->pool_class = __pool_class(cap);
+	head->shared = NULL;
+	return true;
+}
+
+// Pieces shorter than threshold are gathered into runs, a run is closed as
+// soon as it reaches threshold. Return how many pieces would be left.
+long RPCBuffer::coalesce(size_t threshold, bool merge)
+{
+	size_t end = list_size_;
+	size_t first = end;
+	size_t last = end;
+	size_t run_bytes = 0;
+	size_t run_pieces = 0;
+	long n = 0;
+
+	for (size_t i = 0; i <= end; i++)
 	{
-		//merge half
-		auto next = buffer_list_.begin();
-		auto cur = next;
+		size_t buflen = i < end ? buffer_list_[i].buflen : 0;
+		bool close_run = (i == end);
 
-		++next;
-		while (next != buffer_list_.end())
+		if (i < end && buflen == 0)
+			continue;
+
+		if (i < end && buflen < threshold)
 		{
-			size_t sz = cur->buflen + next->buflen;
-			void *new_base = malloc(sz);
+			if (run_pieces++ == 0)
+				first = i;
+
+			last = i;
+			run_bytes += buflen;
+			close_run = (run_bytes >= threshold);
+		}
+		else if (i < end)
+		{
+			if (run_pieces > 0)
+			{
+				if (merge && run_pieces > 1 && !merge_run(first, last, run_bytes))
+					return -1;
+
+				n++;
+				run_bytes = 0;
+				run_pieces = 0;
+			}
+
+			n++;
+		}
 
-			if (!new_base)
+		if (close_run && run_pieces > 0)
+		{
+			if (merge && run_pieces > 1 && !merge_run(first, last, run_bytes))
 				return -1;
 
-			memcpy(new_base, cur->buf, cur->buflen);
-			memcpy((char *)new_base + cur->buflen, next->buf, next->buflen);
+			n++;
+			run_bytes = 0;
+			run_pieces = 0;
+		}
+	}
 
-			if (!cur->is_nocopy)
-			{
-				if (cur->is_new)
-					delete []((char *)cur->buf);
-				else
-					free(cur->buf);
-			}
+	return n;
+}
 
-			if (!next->is_nocopy)
-			{
-				if (next->is_new)
-					delete []((char *)next->buf);
-				else
-					free(next->buf);
-			}
+int RPCBuffer::encode(struct iovec *iov, int count)
+{
+	if (count <= 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
 
-			cur->buf = new_base;
-			cur->buflen = sz;
-			cur->is_nocopy = false;
-			cur->is_new = false;
+	if (count == 1)
+		return merge_all(iov[0]) == 0 ? 1 : -1;
+
+	size_t n = 0;
+
+	for (size_t i = 0; i < list_size_; i++)
+	{
+		if (buffer_list_[i].buflen > 0)
+			n++;
+	}
+
+	if (n > (size_t)count)
+	{
+		// find the smallest threshold that fits, so the least bytes merged
+		size_t low = 1;
+		size_t high = size_ + 1;
 
-			buffer_list_.erase(next);
-			++cur;
-			next = cur;
-			++next;
+		while (low < high)
+		{
+			size_t mid = low + (high - low) / 2;
+
+			if (coalesce(mid, false) <= count)
+				high = mid;
+			else
+				low = mid + 1;
 		}
+
+		if (coalesce(low, true) < 0)
+			return -1;
 	}
 
-	int n = 0;
+	last_piece_left_ = 0;
+	n = 0;
 
-	for (const auto& ele : buffer_list_)
+	for (size_t i = 0; i < list_size_; i++)
 	{
+		const buffer_t& ele = buffer_list_[i];
+
 		if (ele.buflen > 0)
 		{
 			iov[n].iov_base = ele.buf;
@@ -351,7 +859,7 @@ int RPCBuffer::encode(struct iovec *iov, int count)
 		}
 	}
 
-	return n;
+	return (int)n;
 }
 
 bool RPCBuffer::fetch(const void **buf, size_t *size)
@@ -359,17 +867,19 @@ bool RPCBuffer::fetch(const void **buf, size_t *size)
 	if (!init_read_over_)
 		rewind();
 
-	while (cur_.first != buffer_list_.end() && cur_.second >= cur_.first->buflen)
+	while (cur_.first < list_size_ &&
+		   cur_.second >= buffer_list_[cur_.first].buflen)
 	{
 		++cur_.first;
 		cur_.second = 0;
 	}
 
-	if (cur_.first != buffer_list_.end())
+	if (cur_.first < list_size_)
 	{
-		size_t n = cur_.first->buflen - cur_.second;
+		const buffer_t& ele = buffer_list_[cur_.first];
+		size_t n = ele.buflen - cur_.second;
 
-		*buf = (char *)cur_.first->buf + cur_.second;
+		*buf = (char *)ele.buf + cur_.second;
 		if (*size < n)
 			cur_.second += *size;
 		else
@@ -394,18 +904,21 @@ size_t RPCBuffer::internal_fetch(const void **buf, bool move_or_stay)
 	if (!init_read_over_)
 		rewind();
 
-	while (cur_.first != buffer_list_.end() && cur_.second >= cur_.first->buflen)
+	while (cur_.first < list_size_ &&
+		   cur_.second >= buffer_list_[cur_.first].buflen)
 	{
 		++cur_.first;
 		cur_.second = 0;
 	}
 
-	if (cur_.first == buffer_list_.end())
+	if (cur_.first >= list_size_)
 		*buf = nullptr;
 	else
 	{
-		*buf = (char *)cur_.first->buf + cur_.second;
-		sz = cur_.first->buflen - cur_.second;
+		const buffer_t& ele = buffer_list_[cur_.first];
+
+		*buf = (char *)ele.buf + cur_.second;
+		sz = ele.buflen - cur_.second;
 
 		if (move_or_stay)
 		{
@@ -424,11 +937,13 @@ long RPCBuffer::read_skip(long offset)
 	if (!init_read_over_)
 		rewind();
 
-	while (offset > 0 && cur_.first != buffer_list_.end())
+	while (offset > 0 && cur_.first < list_size_)
 	{
-		if (cur_.second < cur_.first->buflen)
+		size_t buflen = buffer_list_[cur_.first].buflen;
+
+		if (cur_.second < buflen)
 		{
-			long n = cur_.first->buflen - cur_.second;
+			long n = buflen - cur_.second;
 
 			if (offset < n)
 			{
@@ -454,14 +969,14 @@ long RPCBuffer::read_back(long offset)
 	if (!init_read_over_)
 		rewind();
 
-	if (cur_.first == buffer_list_.end())
+	if (cur_.first >= list_size_)
 	{
-		if (buffer_list_.empty())
+		if (list_size_ == 0)
 			return 0;
 		else
 		{
-			--cur_.first;
-			cur_.second = cur_.first->buflen;
+			cur_.first = list_size_ - 1;
+			cur_.second = buffer_list_[cur_.first].buflen;
 		}
 	}
 
@@ -481,14 +996,14 @@ long RPCBuffer::read_back(long offset)
 			offset += n;
 		}
 
- 		if (cur_.first == buffer_list_.begin())
+		if (cur_.first == 0)
 		{
 			cur_.second = 0;
 			break;
 		}
 
 		--cur_.first;
-		cur_.second = cur_.first->buflen;
+		cur_.second = buffer_list_[cur_.first].buflen;
 	}
 
 	return origin - offset;
@@ -506,47 +1021,72 @@ size_t RPCBuffer::cut(size_t offset, RPCBuffer *out)
 
 	if (sz > 0)
 	{
-		out->last_piece_left_ = 0; // drop
+		size_t erase_pos = list_size_;
 
-		auto erase_it = buffer_list_.end();
-
-		while (cur_.first != buffer_list_.end())
+		while (cur_.first < list_size_)
 		{
-			auto it = cur_.first;
-			size_t cur_len = it->buflen - cur_.second;
+			buffer_t *ele = &buffer_list_[cur_.first];
+			size_t cur_len = ele->buflen - cur_.second;
 
-			if (it->is_nocopy || cur_.second != 0)
-			{
-				out->append((char *)it->buf + cur_.second, cur_len,
-							BUFFER_MODE_NOCOPY);
-			}
+			// a whole piece is moved, the one across offset is shared
+			if (cur_.second != 0)
+				ref_piece(ele);
+
+			// OOM: drop the extra ref, or the whole piece leaving this list
+			if (out->append_piece(*ele, cur_.second, cur_len))
+				cutsize += cur_len;
 			else
-			{
-				out->append((char *)it->buf + cur_.second, cur_len,
-							it->is_new ? BUFFER_MODE_GIFT_NEW
-									   : BUFFER_MODE_GIFT_MALLOC);
-			}
+				free_piece(*ele);
 
-			if (erase_it == buffer_list_.end() && cur_.second == 0)
-				erase_it = it;
+			if (erase_pos == list_size_ && cur_.second == 0)
+				erase_pos = cur_.first;
 			else
-				cur_.first->buflen = cur_.second;
+				ele->buflen = cur_.second;
 
-			cutsize += cur_len;
 			++cur_.first;
 			cur_.second = 0;
 		}
 
-		if (last_piece_left_ > 0)
-			out->last_piece_left_ = last_piece_left_;
-
-		if (erase_it != buffer_list_.end())
-			buffer_list_.erase(erase_it, buffer_list_.end());
+		// the unused tail may be inside a piece of the other side, drop it
+		last_piece_left_ = 0;
+		list_size_ = erase_pos;
 	}
 
 	rewind();
 	return cutsize;
 }
 
-} // namespace srpc
+size_t RPCBuffer::share(size_t offset, size_t len, RPCBuffer *out)
+{
+	size_t sharesize = 0;
+
+	for (size_t i = 0; i < list_size_ && sharesize < len; i++)
+	{
+		buffer_t *ele = &buffer_list_[i];
 
+		if (offset >= ele->buflen)
+		{
+			offset -= ele->buflen;
+			continue;
+		}
+
+		size_t n = ele->buflen - offset;
+
+		if (n > len - sharesize)
+			n = len - sharesize;
+
+		ref_piece(ele);
+		if (!out->append_piece(*ele, offset, n))
+		{
+			free_piece(*ele);
+			break;
+		}
+
+		sharesize += n;
+		offset = 0;
+	}
+
+	return sharesize;
+}
+
+} // namespace srpc
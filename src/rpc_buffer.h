@@ -24,13 +24,19 @@
 #endif
 #include <stddef.h>
 #include <string.h>
-#include <list>
+#include <utility>
 
 namespace srpc
 {
 
 static constexpr int	BUFFER_PIECE_MIN_SIZE		= 2 * 1024;
 static constexpr int	BUFFER_PIECE_MAX_SIZE		= 256 * 1024;
+static constexpr int	BUFFER_PIECE_INLINE_NUM		= 4;
+
+// pieces of 2KB, 4KB ... 256KB are recycled by RPCBufferPool
+static constexpr int	BUFFER_POOL_CLASS_NUM		= 8;
+static constexpr size_t	BUFFER_POOL_MAX_RETAINED	= 4 * 1024 * 1024;
+static constexpr size_t	BUFFER_POOL_MAX_RETAINED_TOTAL	= 64 * 1024 * 1024;
 
 static constexpr int	BUFFER_MODE_COPY			= 0;
 static constexpr int	BUFFER_MODE_NOCOPY			= 1;
@@ -40,13 +46,84 @@ static constexpr int	BUFFER_MODE_GIFT_MALLOC		= 3;
 static constexpr bool	BUFFER_FETCH_MOVE			= true;
 static constexpr bool	BUFFER_FETCH_STAY			= false;
 
+struct RPCBufferPoolStats
+{
+	size_t hit;
+	size_t miss;
+	size_t retained_bytes;
+};
+
+/**
+ * @brief   Thread-local freelist of buffer pieces
+ * @details
+ * - Thread Safety : YES
+ * - Sizes are rounded up to a power of two within
+ *   [BUFFER_PIECE_MIN_SIZE, BUFFER_PIECE_MAX_SIZE], others go to malloc
+ * - A piece may be put back by another thread than the one got it,
+ *   and then it is kept by the thread put it back
+ * - Each thread retains at most get_max_retained() bytes,
+ *   all threads together at most get_max_retained_total() bytes
+ * - set_enabled(false) turns the pool into plain malloc() and free()
+ */
+class RPCBufferPool
+{
+public:
+	/**
+	 * @brief      Get one piece at least *size bytes
+	 * @param[in,out]  size         expect size, return the actual size
+	 * @return     NULL if OOM
+	 */
+	static void *get(size_t *size);
+
+	/**
+	 * @brief      Give back one piece got from get()
+	 * @param[in]  buf              the piece
+	 * @param[in]  size             the actual size returned by get()
+	 */
+	static void put(void *buf, size_t size);
+
+	/**
+	 * @brief      Max bytes each thread keeps. 0 means never keep any.
+	 * @note       Default is BUFFER_POOL_MAX_RETAINED
+	 */
+	static void set_max_retained(size_t bytes);
+	static size_t get_max_retained();
+
+	/**
+	 * @brief      Max bytes all threads keep together. 0 means never keep any.
+	 * @note       Default is BUFFER_POOL_MAX_RETAINED_TOTAL.
+	 *             Bounds the pieces piled up on threads that only free,
+	 *             such as a thread getting pieces and others putting back.
+	 */
+	static void set_max_retained_total(size_t bytes);
+	static size_t get_max_retained_total();
+
+	/**
+	 * @brief      Turn the pool on or off. Default is on.
+	 * @note       When off, pieces are from malloc() and back to free(),
+	 *             each thread frees what it keeps on its next get() or put().
+	 */
+	static void set_enabled(bool enabled);
+	static bool get_enabled();
+
+	/**
+	 * @brief      Counters summed over all threads.
+	 *             A miss is a poolable size served by malloc.
+	 */
+	static void get_stats(RPCBufferPoolStats *stats);
+};
+
 /**
  * @brief   Buffer Class
  * @details
  * - Thread Safety : NO
  * - All buffer should allocated by new char[...] or malloc
+ * - Pieces allocated by RPCBuffer itself come from RPCBufferPool
  * - Gather buffer piece by piece
  * - Get buffer one by one
+ * - Pieces are kept in a contiguous table, the first few inside the object
+ * - A piece may be shared by several RPCBuffer after share() or cut(),
+ *   its memory is freed when the last of them is cleared
  */
 class RPCBuffer
 {
@@ -62,16 +139,36 @@ public:
 	 */
 	size_t size() const { return size_; }
 
+	/**
+	 * @brief      Get how many pieces, encode() with as many iov copies nothing
+	 */
+	size_t get_piece_num() const { return list_size_; }
+
 	/**
 	 * @brief      Cut current buffer at absolutely offset. Current buffer keeps
 	 * 				the first part and gives the second part to the out buffer.
 	 * @param[in]  offset           where to cut
 	 * @param[in]  out              points to out buffer
-	 * @return     actual give how many bytes to out
+	 * @return     actual give how many bytes to out, bytes can not be
+	 *             given for OOM are dropped
 	 * @note       this will cause current buffer rewind()
+	 * @note       no data is copied, a piece across offset is shared
 	 */
 	size_t cut(size_t offset, RPCBuffer *out);
 
+	/**
+	 * @brief      Append [offset, offset + len) of current buffer to the out
+	 * 				buffer without copy. Both buffers refer to the same pieces.
+	 * @param[in]  offset           absolutely offset to start
+	 * @param[in]  len              how many bytes to share
+	 * @param[in]  out              points to out buffer
+	 * @return     actual share how many bytes to out
+	 * @note       Shared bytes should not be modified any more, by either side
+	 * @note       out may be released in another thread
+	 * @note       NOCOPY pieces are shared as NOCOPY
+	 */
+	size_t share(size_t offset, size_t len, RPCBuffer *out);
+
 public:
 	/**
 	 * @brief      For write. Add one buffer allocated by RPCBuffer
@@ -128,6 +225,8 @@ public:
 	 * @param[in]  count            iov vector count
 	 * @return     use how many iov
 	 * @retval     -1               when count <=0, and set errno EINVAL
+	 * @note       If there are more pieces than count, only runs of adjacent
+	 *             small pieces are merged. Large pieces are never copied.
 	 */
 	int encode(struct iovec *iov, int count);
 
@@ -198,21 +297,38 @@ public:
 	RPCBuffer& operator=(RPCBuffer&&) = delete;
 
 private:
+	struct shared_t;
+
 	struct buffer_t
 	{
 		void *buf;
 		size_t buflen;
 		bool is_nocopy;
 		bool is_new;
+		// size class of RPCBufferPool, -1 if not from pool
+		signed char pool_class;
+		// not NULL if the memory is owned by a refcount instead
+		shared_t *shared;
 	};
 
+	static void free_piece(const buffer_t& piece);
+	static void ref_piece(buffer_t *piece);
 	void clear_list_buffer();
+	buffer_t *add_piece();
+	void *add_pool_piece(size_t *size);
+	bool append_piece(const buffer_t& piece, size_t offset, size_t len);
+	bool merge_run(size_t first, size_t last, size_t bytes);
+	long coalesce(size_t threshold, bool merge);
 	size_t internal_fetch(const void **buf, bool move_or_stay);
 	long read_skip(long offset);
 	long read_back(long offset);
 
-	std::list<buffer_t> buffer_list_;
-	std::pair<std::list<buffer_t>::iterator, size_t> cur_;
+	buffer_t inline_list_[BUFFER_PIECE_INLINE_NUM];
+	buffer_t *buffer_list_ = inline_list_;
+	size_t list_size_ = 0;
+	size_t list_capacity_ = BUFFER_PIECE_INLINE_NUM;
+	// index of current piece and offset inside it
+	std::pair<size_t, size_t> cur_;
 	size_t size_ = 0;
 	size_t piece_min_size_ = BUFFER_PIECE_MIN_SIZE;
 	size_t piece_max_size_ = BUFFER_PIECE_MAX_SIZE;
@@ -39,21 +39,64 @@ protected:
 
 public:
 	RPCClient(const std::string& service_name);
-	virtual ~RPCClient() { };
+	virtual ~RPCClient()
+	{
+		delete this->load_balancer;
+		delete this->hedge;
+		delete this->breaker;
+		delete this->retry_budget;
+	};
 
 	const RPCTaskParams *get_task_params() const;
 	const std::string& get_service_name() const;
 
-	void task_init(COMPLEXTASK *task) const;
+	void task_init(TASK *task) const;
 
 	void set_keep_alive(int timeout);
 	void set_watch_timeout(int timeout);
 	void add_filter(RPCFilter *filter);
 
 protected:
+	// method_id is the constant of the generated code, 0 for none
+	template<class OUTPUT>
+	TASK *create_rpc_client_task(const std::string& method_name,
+								 uint32_t method_id,
+								 std::function<void (OUTPUT *, RPCContext *)>&& done)
+	{
+		return this->create_rpc_task(method_name, method_id,
+							[done](int status_code, RPCWorker& worker) -> int {
+				return ClientRPCDoneImpl(status_code, worker, done);
+			});
+	}
+
 	template<class OUTPUT>
 	TASK *create_rpc_client_task(const std::string& method_name,
 								 std::function<void (OUTPUT *, RPCContext *)>&& done)
+	{
+		return this->create_rpc_client_task(method_name, 0, std::move(done));
+	}
+
+	// for the sync methods, the receiver is the only state of the callback
+	template<class OUTPUT>
+	TASK *create_rpc_sync_task(const std::string& method_name,
+							   uint32_t method_id,
+							   RPCSyncReceiver *receiver)
+	{
+		return this->create_rpc_task(method_name, method_id,
+							[receiver](int status_code, RPCWorker& worker) -> int {
+				return ClientRPCSyncDoneImpl<OUTPUT>(status_code, worker, receiver);
+			});
+	}
+
+	template<class OUTPUT>
+	TASK *create_rpc_sync_task(const std::string& method_name,
+							   RPCSyncReceiver *receiver)
+	{
+		return this->create_rpc_sync_task<OUTPUT>(method_name, 0, receiver);
+	}
+
+	TASK *create_rpc_task(const std::string& method_name, uint32_t method_id,
+						  std::function<int (int, RPCWorker&)>&& done)
 	{
 		std::list<RPCModule *> module;
 		for (int i = 0; i < SRPC_MODULE_MAX; i++)
@@ -64,31 +107,49 @@ protected:
 
 		auto *task = new TASK(this->service_name,
 							  method_name,
+							  method_id,
 							  &this->params.task_params,
 							  std::move(module),
-							  [done](int status_code, RPCWorker& worker) -> int {
-				return ClientRPCDoneImpl(status_code, worker, done);
-			});
+							  std::move(done));
 
 		this->task_init(task);
 
 		return task;
 	}
 
+	// tasks of an earlier call must be done, the targets are rebuilt
 	void init(const RPCClientParams *params);
 	std::string service_name;
 
 private:
-	void __task_init(COMPLEXTASK *task) const;
+	// host + port, url, or one of the endpoints
+	struct Target
+	{
+		ParsedURI uri;
+		struct sockaddr_storage ss;
+		socklen_t ss_len = 0;
+		bool has_addr_info = false;
+		std::string host;	// Host of HTTP if it has addr info
+		std::atomic<uint32_t> *features = NULL;
+	};
+
+	void add_target(RPCClientParams& params);
+	// with the endpoint of index, or the only target
+	void task_init(TASK *task, size_t index) const;
+	// a task, or an attempt of a hedged one
+	template<class T>
+	const Target *init_target(T *task, size_t index) const;
 
 protected:
 	RPCClientParams params;
-	ParsedURI uri;
 
 private:
-	struct sockaddr_storage ss;
-	socklen_t ss_len;
-	bool has_addr_info;
+	// one target without init(), so that tasks fail with the URI
+	std::vector<Target> targets = std::vector<Target>(1);
+	RPCLoadBalancer *load_balancer = NULL;
+	RPCHedge *hedge = NULL;
+	RPCBreaker *breaker = NULL;
+	RPCRetryBudget *retry_budget = NULL;
 	std::mutex mutex;
 	RPCModule *modules[SRPC_MODULE_MAX] = { 0 };
 };
@@ -98,8 +159,7 @@ private:
 
 template<class RPCTYPE>
 inline RPCClient<RPCTYPE>::RPCClient(const std::string& service_name):
-	params(RPC_CLIENT_PARAMS_DEFAULT),
-	has_addr_info(false)
+	params(RPC_CLIENT_PARAMS_DEFAULT)
 {
 	SRPCGlobal::get_instance();
 	this->service_name = service_name;
@@ -179,10 +239,20 @@ inline void RPCClient<RPCTYPE>::init(const RPCClientParams *params)
 	if (this->params.task_params.data_type == RPCDataUndefined)
 		this->params.task_params.data_type = RPCTYPE::default_data_type;
 
-	this->has_addr_info = SRPCGlobal::get_instance()->task_init(this->params,
-																this->uri,
-																&this->ss,
-																&this->ss_len);
+	this->targets.clear();
+	if (this->params.endpoints.empty())
+		this->add_target(this->params);
+	else
+	{
+		for (const RPCEndpoint& endpoint : this->params.endpoints)
+		{
+			RPCClientParams endpoint_params = this->params;
+
+			endpoint_params.host = endpoint.host;
+			endpoint_params.port = endpoint.port;
+			this->add_target(endpoint_params);
+		}
+	}
 
 	if (this->params.is_ssl)
 	{
@@ -196,27 +266,116 @@ inline void RPCClient<RPCTYPE>::init(const RPCClientParams *params)
 	{
 		this->params.is_ssl = true;
 	}
+
+	// all by the targets and the params of this call
+	delete this->load_balancer;
+	delete this->hedge;
+	delete this->breaker;
+	delete this->retry_budget;
+	this->load_balancer = NULL;
+	this->hedge = NULL;
+	this->breaker = NULL;
+	this->retry_budget = NULL;
+
+	if (!this->params.endpoints.empty())
+	{
+		this->load_balancer = new RPCLoadBalancer(this->params.load_balance,
+												  this->params.endpoints);
+	}
+
+	const RPCHedgePolicy& hedge_policy = this->params.task_params.hedge_policy;
+
+	if (hedge_policy.delay > 0 && hedge_policy.max_ratio > 0)
+		this->hedge = new RPCHedge(hedge_policy.max_ratio);
+
+	if (this->params.breaker_policy.error_ratio > 0)
+	{
+		std::vector<std::string> names;
+
+		for (const Target& target : this->targets)
+		{
+			if (target.has_addr_info || this->params.url.empty())
+				names.push_back(target.host);
+			else
+				names.push_back(this->params.url);
+		}
+
+		this->breaker = new RPCBreaker(this->params.breaker_policy,
+									   std::move(names));
+	}
+
+	if (this->params.retry_ratio > 0)
+		this->retry_budget = new RPCRetryBudget(this->params.retry_ratio);
+}
+
+template<class RPCTYPE>
+inline void RPCClient<RPCTYPE>::add_target(RPCClientParams& params)
+{
+	Target target;
+
+	target.has_addr_info = SRPCGlobal::get_instance()->task_init(params,
+																 target.uri,
+																 &target.ss,
+																 &target.ss_len);
+	target.host = params.host + ":" + std::to_string(params.port);
+	target.features = SRPCGlobal::get_instance()->get_peer_features(
+			target.has_addr_info || params.url.empty() ? target.host : params.url);
+	this->targets.push_back(std::move(target));
 }
 
 template<class RPCTYPE>
-inline void RPCClient<RPCTYPE>::__task_init(COMPLEXTASK *task) const
+inline void RPCClient<RPCTYPE>::task_init(TASK *task) const
 {
-	if (this->has_addr_info)
+	size_t index = 0;
+
+	if (this->load_balancer)
+	{
+		index = this->load_balancer->select();
+		task->set_load_balancer(this->load_balancer, index,
+			[this](TASK *task, size_t index) { this->task_init(task, index); });
+	}
+
+	if (this->breaker || this->retry_budget)
+		task->set_breaker(this->breaker, this->retry_budget);
+
+	if (this->hedge)
+		task->set_hedge(this->hedge);
+
+	task->set_attempt_init(
+		[this](typename TASK::attempt_task_t *attempt, size_t index) {
+			return this->init_target(attempt, index)->features;
+		});
+
+	this->task_init(task, index);
+}
+
+template<class RPCTYPE>
+template<class T>
+inline const typename RPCClient<RPCTYPE>::Target *
+RPCClient<RPCTYPE>::init_target(T *task, size_t index) const
+{
+	const Target *target = &this->targets[index];
+
+	if (target->has_addr_info)
 	{
 		task->init(this->params.transport_type,
-				   (const struct sockaddr *)&this->ss, this->ss_len, "");
+				   (const struct sockaddr *)&target->ss, target->ss_len, "");
 	}
 	else
 	{
-		task->init(this->uri);
+		task->init(target->uri);
 		task->set_transport_type(this->params.transport_type);
 	}
+
+	return target;
 }
 
 template<class RPCTYPE>
-inline void RPCClient<RPCTYPE>::task_init(COMPLEXTASK *task) const
+inline void RPCClient<RPCTYPE>::task_init(TASK *task, size_t index) const
 {
-	__task_init(task);
+	const Target *target = this->init_target(task, index);
+
+	task->set_peer_features(target->features);
 }
 
 static inline void __set_host_by_uri(const ParsedURI *uri, bool is_ssl,
@@ -249,13 +408,13 @@ static inline void __set_host_by_uri(const ParsedURI *uri, bool is_ssl,
 }
 
 template<>
-inline void RPCClient<RPCTYPESRPCHttp>::task_init(COMPLEXTASK *task) const
+inline void RPCClient<RPCTYPESRPCHttp>::task_init(TASK *task, size_t index) const
 {
-	__task_init(task);
+	const Target *target = this->init_target(task, index);
 	std::string header_host;
 
-	if (this->has_addr_info)
-		header_host += this->params.host + ":" + std::to_string(this->params.port);
+	if (target->has_addr_info)
+		header_host += target->host;
 	else
 		__set_host_by_uri(task->get_current_uri(), this->params.is_ssl, header_host);
 
@@ -263,13 +422,13 @@ inline void RPCClient<RPCTYPESRPCHttp>::task_init(COMPLEXTASK *task) const
 }
 
 template<>
-inline void RPCClient<RPCTYPEThriftHttp>::task_init(COMPLEXTASK *task) const
+inline void RPCClient<RPCTYPEThriftHttp>::task_init(TASK *task, size_t index) const
 {
-	__task_init(task);
+	const Target *target = this->init_target(task, index);
 	std::string header_host;
 
-	if (this->has_addr_info)
-		header_host += this->params.host + ":" + std::to_string(this->params.port);
+	if (target->has_addr_info)
+		header_host += target->host;
 	else
 		__set_host_by_uri(task->get_current_uri(), this->params.is_ssl, header_host);
 
@@ -33,6 +33,7 @@ struct RPCSyncContext
 	int error;
 	bool success;
 	int timeout_reason;
+	int attempt;	//1 if the reply is from the hedge of RPCHedgePolicy
 };
 
 class RPCContext
@@ -56,12 +57,16 @@ public:
 	virtual int get_error() const = 0;
 	virtual void *get_user_data() const = 0;
 	virtual int get_timeout_reason() const = 0;
+	// 0 if the reply is from the first request, 1 if from the hedge
+	virtual int get_attempt() const = 0;
 
 public:
 	// for server-process
 	virtual void set_data_type(RPCDataType type) = 0;//enum RPCDataType
 	virtual void set_compress_type(RPCCompressType type) = 0;//enum RPCCompressType
 	virtual void set_attachment_nocopy(const char *attachment, size_t len) = 0;
+	// SRPC only. Default : RPCCompressNone
+	virtual void set_attachment_compress_type(RPCCompressType type) = 0;
 	virtual bool get_attachment(const char **attachment, size_t *len) const = 0;
 
 	virtual void set_reply_callback(std::function<void (RPCContext *ctx)> cb) = 0;
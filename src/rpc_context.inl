@@ -14,6 +14,8 @@
   limitations under the License.
 */
 
+#include <errno.h>
+#include <string.h>
 #include <mutex>
 #include <condition_variable>
 #include <workflow/WFTask.h>
@@ -33,6 +35,63 @@ struct ThriftReceiver
 	bool is_done = false;
 };
 
+// what the sync calls of a thread wait on, one call at a time
+class RPCSyncReceiver
+{
+public:
+	static RPCSyncReceiver *get_thread_receiver()
+	{
+		static thread_local RPCSyncReceiver receiver;
+		return &receiver;
+	}
+
+	// the output is deserialized into by the task, ctx is filled if not NULL
+	template<class TASK>
+	void call(TASK *task, void *output, RPCSyncContext *ctx)
+	{
+		this->output = output;
+		this->ctx = ctx;
+		this->is_done = false;
+		task->start();
+
+		std::unique_lock<std::mutex> lock(this->mutex);
+
+		while (!this->is_done)
+			this->cond.wait(lock);
+	}
+
+	void *get_output() const { return this->output; }
+	void done(RPCContext *ctx);
+
+private:
+	std::mutex mutex;
+	std::condition_variable cond;
+	void *output;
+	RPCSyncContext *ctx;
+	bool is_done;
+};
+
+// the caller may be gone once it is notified, nothing is touched after
+inline void RPCSyncReceiver::done(RPCContext *ctx)
+{
+	if (this->ctx)
+	{
+		this->ctx->seqid = ctx->get_seqid();
+		this->ctx->errmsg = ctx->get_errmsg();
+		this->ctx->remote_ip = ctx->get_remote_ip();
+		this->ctx->status_code = ctx->get_status_code();
+		this->ctx->error = ctx->get_error();
+		this->ctx->success = ctx->success();
+		this->ctx->timeout_reason = ctx->get_timeout_reason();
+		this->ctx->attempt = ctx->get_attempt();
+	}
+
+	this->mutex.lock();
+	this->is_done = true;
+	this->cond.notify_one();
+	this->mutex.unlock();
+}
+
 template<class RPCREQ, class RPCRESP>
 class RPCContextImpl : public RPCContext
 {
@@ -69,7 +128,18 @@ public:
 
 	int get_peer_addr(struct sockaddr *addr, socklen_t *addrlen) const override
 	{
-		return task_->get_peer_addr(addr, addrlen);
+		if (!peer_addr_)
+			return task_->get_peer_addr(addr, addrlen);
+
+		if (*addrlen < peer_addrlen_)
+		{
+			errno = ENOBUFS;
+			return -1;
+		}
+
+		memcpy(addr, peer_addr_, peer_addrlen_);
+		*addrlen = peer_addrlen_;
+		return 0;
 	}
 
 	const std::string& get_service_name() const override
@@ -155,6 +225,11 @@ public:
 		return task_->get_timeout_reason();
 	}
 
+	int get_attempt() const override
+	{
+		return attempt_;
+	}
+
 public:
 	// for server-process
 	void set_attachment_nocopy(const char *attachment, size_t len) override
@@ -162,6 +237,11 @@ public:
 		task_->get_resp()->set_attachment_nocopy(attachment, len);
 	}
 
+	void set_attachment_compress_type(RPCCompressType type) override
+	{
+		task_->get_resp()->set_attachment_compress_type(type);
+	}
+
 	void set_reply_callback(std::function<void (RPCContext *ctx)> cb) override
 	{
 		if (this->is_server_task())
@@ -274,8 +354,20 @@ public:
 	RPCContextImpl(WFNetworkTask<RPCREQ, RPCRESP> *task,
 				   RPCModuleData *module_data) :
 		task_(task),
-		module_data_(module_data)
+		module_data_(module_data),
+		attempt_(0),
+		peer_addr_(NULL),
+		peer_addrlen_(0)
+	{
+	}
+
+	// the reply of a hedged client task is from one of its attempts
+	void set_attempt(int attempt, const struct sockaddr *addr,
+					 socklen_t addrlen)
 	{
+		attempt_ = attempt;
+		peer_addr_ = addr;
+		peer_addrlen_ = addrlen;
 	}
 
 protected:
@@ -290,6 +382,9 @@ protected:
 
 private:
 	RPCModuleData *module_data_;
+	int attempt_;
+	const struct sockaddr *peer_addr_;
+	socklen_t peer_addrlen_;
 };
 
 } // namespace srpc
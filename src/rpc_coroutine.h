@@ -0,0 +1,255 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __RPC_COROUTINE_H__
+#define __RPC_COROUTINE_H__
+
+#if !defined(__cpp_impl_coroutine)
+#error "rpc_coroutine.h needs C++20 coroutines, such as -std=c++20"
+#endif
+
+#include <stdlib.h>
+#include <coroutine>
+#include <utility>
+#include <workflow/Workflow.h>
+#include "rpc_context.h"
+#include "rpc_service.h"
+
+namespace srpc
+{
+
+/**
+ * @brief   Coroutine of a server method or of the code calling a client
+ * @details
+ * - Lazy, runs from start() or from co_await in another RPCCoroutine
+ * - With a series, the client tasks it awaits are pushed to the series,
+ *   so a server replies after the whole coroutine is done
+ * - Destroyed by itself when done if started by start()
+ */
+class RPCCoroutine
+{
+public:
+	struct promise_type
+	{
+		SeriesWork *series = NULL;
+		std::coroutine_handle<> continuation;
+
+		RPCCoroutine get_return_object()
+		{
+			return RPCCoroutine(handle_t::from_promise(*this));
+		}
+
+		std::suspend_always initial_suspend() noexcept { return { }; }
+
+		struct final_awaiter
+		{
+			bool await_ready() noexcept { return false; }
+			void await_resume() noexcept { }
+
+			std::coroutine_handle<>
+			await_suspend(std::coroutine_handle<promise_type> h) noexcept
+			{
+				std::coroutine_handle<> next = h.promise().continuation;
+
+				if (next)
+					return next;
+
+				h.destroy();
+				return std::noop_coroutine();
+			}
+		};
+
+		final_awaiter final_suspend() noexcept { return { }; }
+		void return_void() { }
+		void unhandled_exception() { abort(); }
+	};
+
+	using handle_t = std::coroutine_handle<promise_type>;
+
+	RPCCoroutine(RPCCoroutine&& move) : handle(move.handle)
+	{
+		move.handle = nullptr;
+	}
+
+	RPCCoroutine& operator=(RPCCoroutine&& move)
+	{
+		if (this != &move)
+		{
+			if (this->handle)
+				this->handle.destroy();
+
+			this->handle = move.handle;
+			move.handle = nullptr;
+		}
+
+		return *this;
+	}
+
+	RPCCoroutine(const RPCCoroutine&) = delete;
+	RPCCoroutine& operator=(const RPCCoroutine&) = delete;
+
+	~RPCCoroutine()
+	{
+		if (this->handle)
+			this->handle.destroy();
+	}
+
+	// runs until the first co_await, then this object owns nothing
+	void start(SeriesWork *series = NULL)
+	{
+		handle_t h = this->handle;
+
+		this->handle = nullptr;
+		h.promise().series = series;
+		h.resume();
+	}
+
+	// co_await in another RPCCoroutine, in the series of that one
+	bool await_ready() const noexcept { return false; }
+	void await_resume() const noexcept { }
+
+	std::coroutine_handle<>
+	await_suspend(std::coroutine_handle<promise_type> caller) noexcept
+	{
+		promise_type& promise = this->handle.promise();
+
+		promise.series = caller.promise().series;
+		promise.continuation = caller;
+		return this->handle;
+	}
+
+private:
+	explicit RPCCoroutine(handle_t h) : handle(h) { }
+
+	handle_t handle;
+};
+
+/**
+ * @brief   What co_await client.Method(&req) waits on
+ * @details
+ * - The task is started when awaited, and dismissed if never awaited
+ * - Resumed in the callback of the task, with the same result as async_
+ * - Lives in the frame of the coroutine, so nothing is allocated but the task
+ * - In an RPCCoroutine, the task is pushed to the series of it, or starts
+ *   one which the later tasks of the coroutine are pushed to
+ */
+template<class OUTPUT, class TASK>
+class RPCClientAwaiter
+{
+public:
+	using RESULT = std::pair<OUTPUT, RPCSyncContext>;
+
+	explicit RPCClientAwaiter(TASK *task) : task_(task) { }
+
+	RPCClientAwaiter(RPCClientAwaiter&& move) :
+		task_(move.task_),
+		series_(move.series_),
+		result_(std::move(move.result_))
+	{
+		move.task_ = NULL;
+	}
+
+	RPCClientAwaiter(const RPCClientAwaiter&) = delete;
+	RPCClientAwaiter& operator=(const RPCClientAwaiter&) = delete;
+
+	~RPCClientAwaiter()
+	{
+		if (task_)
+			task_->dismiss();
+	}
+
+	bool await_ready() const noexcept { return false; }
+	RESULT await_resume() { return std::move(result_); }
+
+	void await_suspend(std::coroutine_handle<RPCCoroutine::promise_type> h)
+	{
+		series_ = &h.promise().series;
+		suspend(h);
+	}
+
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		suspend(h);
+	}
+
+	static void callback(OUTPUT *output, RPCContext *ctx)
+	{
+		auto *awaiter = static_cast<RPCClientAwaiter *>(ctx->get_user_data());
+		RPCSyncContext& sync_ctx = awaiter->result_.second;
+
+		sync_ctx.seqid = ctx->get_seqid();
+		sync_ctx.errmsg = ctx->get_errmsg();
+		sync_ctx.remote_ip = ctx->get_remote_ip();
+		sync_ctx.status_code = ctx->get_status_code();
+		sync_ctx.error = ctx->get_error();
+		sync_ctx.success = ctx->success();
+		sync_ctx.timeout_reason = ctx->get_timeout_reason();
+		sync_ctx.attempt = ctx->get_attempt();
+		if (sync_ctx.success)
+			awaiter->result_.first = std::move(*output);
+
+		if (awaiter->series_ && !*awaiter->series_)
+			*awaiter->series_ = ctx->get_series();
+
+		awaiter->handle_.resume();
+	}
+
+private:
+	void suspend(std::coroutine_handle<> h)
+	{
+		TASK *task = task_;
+
+		task_ = NULL;
+		handle_ = h;
+		task->user_data = this;
+		if (series_ && *series_)
+			(*series_)->push_back(task);
+		else
+			task->start();
+	}
+
+	TASK *task_;
+	SeriesWork **series_ = NULL;
+	std::coroutine_handle<> handle_;
+	RESULT result_;
+};
+
+// a server method written as an RPCCoroutine runs in the series of the task
+template<class INPUT, class OUTPUT, class SERVICE>
+static inline int
+ServiceRPCCallImpl(SERVICE *service,
+				   RPCWorker& worker,
+				   RPCCoroutine (SERVICE::*rpc)(INPUT *, OUTPUT *, RPCContext *))
+{
+	auto *in = __new_server_input<INPUT>(worker,
+						std::is_base_of<ProtobufIDLMessage, INPUT>());
+	int status_code = worker.req->deserialize(in);
+
+	if (status_code == RPCStatusOK)
+	{
+		auto *out = __new_server_output<OUTPUT>(worker,
+						std::is_base_of<ProtobufIDLMessage, OUTPUT>());
+
+		(service->*rpc)(in, out, worker.ctx).start(worker.ctx->get_series());
+	}
+
+	return status_code;
+}
+
+} // namespace srpc
+
+#endif
+
@@ -22,6 +22,7 @@
 #include <netdb.h>
 #endif
 
+#include <tuple>
 #include <workflow/WFGlobal.h>
 #include <workflow/URIParser.h>
 #include "rpc_basic.h"
@@ -119,6 +120,21 @@ unsigned long long SRPCGlobal::get_random()
 	return id;
 }
 
+std::atomic<uint32_t> *SRPCGlobal::get_peer_features(const std::string& target)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto it = this->peer_features.find(target);
+
+	if (it == this->peer_features.end())
+	{
+		it = this->peer_features.emplace(std::piecewise_construct,
+										 std::forward_as_tuple(target),
+										 std::forward_as_tuple(0)).first;
+	}
+
+	return &it->second;
+}
+
 static const SRPCGlobal *srpc_global = SRPCGlobal::get_instance();
 
 } // namespace srpc
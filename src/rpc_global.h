@@ -18,6 +18,10 @@
 #define __RPC_GLOBAL_H__
 
 #include <random>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <workflow/URIParser.h>
 #include "rpc_options.h"
 #include "rpc_module.h"
@@ -42,6 +46,10 @@ public:
 				   struct sockaddr_storage *ss, socklen_t *ss_len) const;
 
 	unsigned long long get_random();
+
+	// what a target can receive, learned from its replies. 0 if unknown yet.
+	// One for each target, shared by all clients and never freed
+	std::atomic<uint32_t> *get_peer_features(const std::string& target);
 	void set_group_id(unsigned short id) { this->group_id = id; }
 	void set_machine_id(unsigned short id) { this->machine_id = id; }
 
@@ -52,6 +60,8 @@ private:
 	std::mt19937 gen;
 	unsigned short group_id;
 	unsigned short machine_id;
+	std::unordered_map<std::string, std::atomic<uint32_t>> peer_features;
+	std::mutex mutex;
 };
 
 } // namespace srpc
@@ -0,0 +1,177 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "rpc_hedge.h"
+
+namespace srpc
+{
+
+static inline int __bucket(long long latency_us)
+{
+	unsigned long long v = latency_us > 0 ? latency_us : 1;
+	int msb = 0;
+	int sub;
+
+	while ((v >> msb) > 1)
+		msb++;
+
+	sub = msb >= 2 ? (int)(v >> (msb - 2)) & 3 : (int)(v << (2 - msb)) & 3;
+	if (msb * 4 + sub >= RPC_HEDGE_BUCKETS)
+		return RPC_HEDGE_BUCKETS - 1;
+
+	return msb * 4 + sub;
+}
+
+// the upper bound, so that the delay is never below the percentile
+static inline long long __bucket_latency(int index)
+{
+	return ((4LL + index % 4 + 1) << (index / 4)) / 4;
+}
+
+RPCHedgeStats::RPCHedgeStats(uint32_t method_id,
+							 const std::string& method_name) :
+	method_id(method_id),
+	method_name(method_name),
+	count(0)
+{
+	for (auto& bucket : this->buckets)
+		bucket = 0;
+}
+
+void RPCHedgeStats::add(long long latency_us)
+{
+	this->buckets[__bucket(latency_us)].fetch_add(1, std::memory_order_relaxed);
+	if (this->count.fetch_add(1, std::memory_order_relaxed) + 1 != RPC_HEDGE_WINDOW)
+		return;
+
+	for (auto& bucket : this->buckets)
+		bucket.store(bucket.load(std::memory_order_relaxed) / 2,
+					 std::memory_order_relaxed);
+
+	this->count.fetch_sub(RPC_HEDGE_WINDOW / 2, std::memory_order_relaxed);
+}
+
+long long RPCHedgeStats::percentile(double p) const
+{
+	unsigned int counts[RPC_HEDGE_BUCKETS];
+	unsigned long long total = 0;
+	unsigned long long sum = 0;
+
+	for (int i = 0; i < RPC_HEDGE_BUCKETS; i++)
+	{
+		counts[i] = this->buckets[i].load(std::memory_order_relaxed);
+		total += counts[i];
+	}
+
+	if (total < RPC_HEDGE_MIN_SAMPLES)
+		return -1;
+
+	for (int i = 0; i < RPC_HEDGE_BUCKETS; i++)
+	{
+		sum += counts[i];
+		if (sum >= p * total)
+			return __bucket_latency(i);
+	}
+
+	return __bucket_latency(RPC_HEDGE_BUCKETS - 1);
+}
+
+RPCHedge::RPCHedge(double max_ratio) :
+	ratio((long long)(max_ratio * 1000)),
+	budget(0),
+	shared(0, "")
+{
+	for (auto& slot : this->slots)
+		slot.store(NULL, std::memory_order_relaxed);
+}
+
+RPCHedge::~RPCHedge()
+{
+	for (auto& slot : this->slots)
+		delete slot.load(std::memory_order_relaxed);
+}
+
+RPCHedgeStats *RPCHedge::get_stats(uint32_t method_id,
+								   const std::string& method_name)
+{
+	RPCHedgeStats *created = NULL;
+	RPCHedgeStats *stats;
+
+	for (size_t i = 0; i < RPC_HEDGE_METHODS; i++)
+	{
+		auto& slot = this->slots[(method_id + i) % RPC_HEDGE_METHODS];
+
+		stats = slot.load(std::memory_order_acquire);
+		if (!stats)
+		{
+			if (!created)
+				created = new RPCHedgeStats(method_id, method_name);
+
+			// or stats is the one of another call now
+			if (slot.compare_exchange_strong(stats, created,
+											 std::memory_order_acq_rel))
+			{
+				return created;
+			}
+		}
+
+		if (stats->get_method_id() == method_id &&
+			stats->get_method_name() == method_name)
+		{
+			delete created;
+			return stats;
+		}
+	}
+
+	delete created;
+	return &this->shared;
+}
+
+void RPCHedge::earn()
+{
+	long long budget = this->budget.load(std::memory_order_relaxed);
+	long long next;
+
+	do
+	{
+		next = budget + this->ratio;
+		if (next > RPC_HEDGE_BURST * 1000)
+			next = RPC_HEDGE_BURST * 1000;
+
+		if (next == budget)
+			return;
+
+	} while (!this->budget.compare_exchange_weak(budget, next,
+												 std::memory_order_relaxed));
+}
+
+bool RPCHedge::spend()
+{
+	long long budget = this->budget.load(std::memory_order_relaxed);
+
+	do
+	{
+		if (budget < 1000)
+			return false;
+
+	} while (!this->budget.compare_exchange_weak(budget, budget - 1000,
+												 std::memory_order_relaxed));
+
+	return true;
+}
+
+} // namespace srpc
+
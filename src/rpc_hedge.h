@@ -0,0 +1,94 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __RPC_HEDGE_H__
+#define __RPC_HEDGE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+namespace srpc
+{
+
+// 4 buckets for every power of 2 microseconds, up to more than an hour
+static constexpr int			RPC_HEDGE_BUCKETS		=	128;
+// latencies of a method before its percentile is used
+static constexpr unsigned int	RPC_HEDGE_MIN_SAMPLES	=	64;
+// the older half of the latencies is dropped every window
+static constexpr unsigned int	RPC_HEDGE_WINDOW		=	4096;
+// hedges the budget saves at most for a burst
+static constexpr long long		RPC_HEDGE_BURST			=	10;
+// methods with their own latencies, the others share one
+static constexpr size_t			RPC_HEDGE_METHODS		=	64;
+
+/**
+ * @brief   Latencies of the replies of a method, for RPCHedgePolicy::percentile
+ * @details Buckets of atomics, a lost update when halving them does no harm
+ */
+class RPCHedgeStats
+{
+public:
+	RPCHedgeStats(uint32_t method_id, const std::string& method_name);
+
+	void add(long long latency_us);
+	// microseconds, -1 before RPC_HEDGE_MIN_SAMPLES
+	long long percentile(double p) const;
+
+	uint32_t get_method_id() const { return this->method_id; }
+	const std::string& get_method_name() const { return this->method_name; }
+
+private:
+	uint32_t method_id;
+	std::string method_name;
+	std::atomic<unsigned int> buckets[RPC_HEDGE_BUCKETS];
+	std::atomic<unsigned int> count;
+};
+
+/**
+ * @brief   What the hedged tasks of a client share
+ * @details Every hedged request earns max_ratio of a hedge, and a hedge
+ *          is only sent when a whole one is saved. So hedges stay below
+ *          max_ratio of the requests however slow the servers become.
+ *          The stats of a method are made by its first call, by
+ *          RPC_METHOD_ID(), and get_stats() takes no lock
+ */
+class RPCHedge
+{
+public:
+	RPCHedge(double max_ratio);
+	~RPCHedge();
+
+	// kept until the client is gone
+	RPCHedgeStats *get_stats(uint32_t method_id, const std::string& method_name);
+
+	void earn();
+	bool spend();
+
+private:
+	// thousandths of a hedge
+	long long ratio;
+	std::atomic<long long> budget;
+	// by open addressing, methods beyond RPC_HEDGE_METHODS share one
+	std::atomic<RPCHedgeStats *> slots[RPC_HEDGE_METHODS];
+	RPCHedgeStats shared;
+};
+
+} // namespace srpc
+
+#endif
+
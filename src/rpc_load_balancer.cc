@@ -0,0 +1,332 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include "rpc_load_balancer.h"
+
+namespace srpc
+{
+
+static constexpr size_t NO_NODE = (size_t)-1;
+
+static inline long long __steady_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// xorshift, one per thread, so that selecting shares nothing
+static inline uint64_t __random()
+{
+	static thread_local uint64_t x = ((uint64_t)(uintptr_t)&x ^
+									  (uint64_t)__steady_ns()) | 1;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return x;
+}
+
+static long long __weight_gcd(long long a, long long b)
+{
+	while (b != 0)
+	{
+		long long t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+RPCLoadBalancer::RPCLoadBalancer(int policy,
+								 const std::vector<RPCEndpoint>& endpoints) :
+	nodes(endpoints.size()),
+	cursor(0)
+{
+	std::vector<long long> current(endpoints.size(), 0);
+	long long total = 0;
+	long long gcd = 0;
+
+	this->policy = policy;
+	for (size_t i = 0; i < endpoints.size(); i++)
+	{
+		Node& node = this->nodes[i];
+
+		node.weight = endpoints[i].weight > 0 ? endpoints[i].weight : 1;
+		node.inflight = 0;
+		node.ewma_ns = 0;
+		node.fails = 0;
+		node.eject_until = 0;
+		gcd = __weight_gcd(node.weight, gcd);
+	}
+
+	for (Node& node : this->nodes)
+		total += node.weight / gcd;
+
+	for (long long i = 0; i < total; i++)
+	{
+		size_t best = 0;
+
+		for (size_t j = 0; j < this->nodes.size(); j++)
+		{
+			current[j] += this->nodes[j].weight / gcd;
+			if (current[j] > current[best])
+				best = j;
+		}
+
+		current[best] -= total;
+		this->schedule.push_back(best);
+	}
+
+	if (policy == RPCLoadBalanceConsistentHash)
+		this->init_ring(endpoints, gcd);
+}
+
+uint64_t RPCLoadBalancer::hash(const void *key, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)key;
+	uint64_t h = 14695981039346656037ULL;
+
+	// FNV-1a, then the finalizer of murmur3 to spread close keys
+	for (size_t i = 0; i < len; i++)
+	{
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// the points of an endpoint depend on itself and the weights only,
+// so that the same endpoints make the same ring in every process
+void RPCLoadBalancer::init_ring(const std::vector<RPCEndpoint>& endpoints,
+								long long gcd)
+{
+	long long total = 0;
+
+	for (const Node& node : this->nodes)
+		total += node.weight / gcd * RPC_LB_RING_POINTS;
+
+	for (size_t i = 0; i < endpoints.size(); i++)
+	{
+		std::string name = endpoints[i].host + ":" +
+						   std::to_string(endpoints[i].port) + "#";
+		size_t len = name.size();
+		long long points = this->nodes[i].weight / gcd * RPC_LB_RING_POINTS;
+
+		if (total > RPC_LB_RING_MAX)
+			points = points * RPC_LB_RING_MAX / total;
+
+		if (points < 1)
+			points = 1;
+
+		for (long long j = 0; j < points; j++)
+		{
+			name.resize(len);
+			name += std::to_string(j);
+			this->ring.emplace_back(hash(name.c_str(), name.size()), i);
+		}
+	}
+
+	std::sort(this->ring.begin(), this->ring.end());
+}
+
+// an ejected endpoint is available again for a probe once its period is over
+bool RPCLoadBalancer::available(size_t index, long long now) const
+{
+	const Node& node = this->nodes[index];
+	long long until = node.eject_until.load(std::memory_order_relaxed);
+
+	return until == 0 || now >= until;
+}
+
+size_t RPCLoadBalancer::select_round_robin(long long now)
+{
+	size_t n = this->schedule.size();
+	size_t pos = this->cursor.fetch_add(1, std::memory_order_relaxed);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		size_t index = this->schedule[(pos + i) % n];
+
+		if (this->available(index, now))
+			return index;
+	}
+
+	return this->schedule[pos % n];
+}
+
+size_t RPCLoadBalancer::random_available(long long now, size_t except)
+{
+	size_t n = this->nodes.size();
+	size_t start = __random() % n;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		size_t index = (start + i) % n;
+
+		if (index != except && this->available(index, now))
+			return index;
+	}
+
+	return NO_NODE;
+}
+
+bool RPCLoadBalancer::less_loaded(size_t a, size_t b) const
+{
+	const Node& x = this->nodes[a];
+	const Node& y = this->nodes[b];
+	double x_load = (double)x.inflight.load(std::memory_order_relaxed);
+	double y_load = (double)y.inflight.load(std::memory_order_relaxed);
+
+	if (this->policy == RPCLoadBalanceEWMALatency)
+	{
+		long long x_ewma = x.ewma_ns.load(std::memory_order_relaxed);
+		long long y_ewma = y.ewma_ns.load(std::memory_order_relaxed);
+
+		// by the requests in flight only until both have some latency
+		if (x_ewma != 0 && y_ewma != 0)
+		{
+			x_load = (x_load + 1) * x_ewma;
+			y_load = (y_load + 1) * y_ewma;
+		}
+	}
+
+	return x_load * y.weight < y_load * x.weight;
+}
+
+size_t RPCLoadBalancer::select_two_choices(long long now)
+{
+	size_t a = this->random_available(now, NO_NODE);
+	size_t b;
+
+	if (a == NO_NODE)
+		return __random() % this->nodes.size();
+
+	// a probe has to go to the ejected endpoint it is for
+	if (this->nodes[a].eject_until.load(std::memory_order_relaxed) != 0)
+		return a;
+
+	b = this->random_available(now, a);
+	if (b == NO_NODE || this->nodes[b].eject_until.load(std::memory_order_relaxed) != 0)
+		return b == NO_NODE ? a : b;
+
+	return this->less_loaded(b, a) ? b : a;
+}
+
+size_t RPCLoadBalancer::select()
+{
+	if (this->nodes.size() == 1)
+		return 0;
+
+	long long now = __steady_ns();
+
+	if (this->policy == RPCLoadBalanceWeightedRoundRobin)
+		return this->select_round_robin(now);
+
+	return this->select_two_choices(now);
+}
+
+size_t RPCLoadBalancer::select(uint64_t key_hash)
+{
+	if (this->ring.empty())
+		return this->select();
+
+	if (this->nodes.size() == 1)
+		return 0;
+
+	long long now = __steady_ns();
+	size_t n = this->ring.size();
+	size_t pos = std::lower_bound(this->ring.begin(), this->ring.end(),
+								  std::make_pair(key_hash, (size_t)0)) -
+				 this->ring.begin();
+
+	// clockwise to the first one not ejected, or the own one if none
+	for (size_t i = 0; i < n; i++)
+	{
+		size_t index = this->ring[(pos + i) % n].second;
+
+		if (this->available(index, now))
+			return index;
+	}
+
+	return this->ring[pos % n].second;
+}
+
+bool RPCLoadBalancer::claim(size_t index)
+{
+	std::atomic<long long>& eject_until = this->nodes[index].eject_until;
+	long long until = eject_until.load(std::memory_order_relaxed);
+	long long now;
+
+	if (until == 0)
+		return true;
+
+	// the others keep away for another period, unless the probe succeeds
+	now = __steady_ns();
+	return now >= until &&
+		   eject_until.compare_exchange_strong(until, now + RPC_LB_EJECT_NS);
+}
+
+long long RPCLoadBalancer::begin(size_t index)
+{
+	this->nodes[index].inflight.fetch_add(1, std::memory_order_relaxed);
+	return __steady_ns();
+}
+
+void RPCLoadBalancer::end(size_t index, long long start, bool failed)
+{
+	Node& node = this->nodes[index];
+	long long now = __steady_ns();
+
+	node.inflight.fetch_sub(1, std::memory_order_relaxed);
+	if (failed)
+	{
+		if (node.fails.fetch_add(1, std::memory_order_relaxed) + 1 >= RPC_LB_MAX_FAILS)
+			node.eject_until.store(now + RPC_LB_EJECT_NS, std::memory_order_relaxed);
+
+		return;
+	}
+
+	if (node.fails.load(std::memory_order_relaxed) != 0)
+		node.fails.store(0, std::memory_order_relaxed);
+
+	if (node.eject_until.load(std::memory_order_relaxed) != 0)
+		node.eject_until.store(0, std::memory_order_relaxed);
+
+	// decay of 1/8, a lost update between two requests does no harm
+	long long ewma = node.ewma_ns.load(std::memory_order_relaxed);
+	long long latency = now - start;
+
+	if (ewma == 0)
+		ewma = latency;
+	else
+		ewma += (latency - ewma) / 8;
+
+	node.ewma_ns.store(ewma > 0 ? ewma : 1, std::memory_order_relaxed);
+}
+
+} // namespace srpc
+
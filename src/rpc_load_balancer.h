@@ -0,0 +1,118 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __RPC_LOAD_BALANCER_H__
+#define __RPC_LOAD_BALANCER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace srpc
+{
+
+enum RPCLoadBalancePolicy
+{
+	RPCLoadBalanceWeightedRoundRobin	=	0,
+	// the one of two random endpoints with fewer requests in flight
+	RPCLoadBalancePowerOfTwoChoices		=	1,
+	// the one of two random endpoints with the lower EWMA latency * load
+	RPCLoadBalanceEWMALatency			=	2,
+	// by the key of RPCClientTask::set_route_key(), as
+	// RPCLoadBalancePowerOfTwoChoices without one
+	RPCLoadBalanceConsistentHash		=	3,
+};
+
+struct RPCEndpoint
+{
+	std::string host;
+	unsigned short port;
+	int weight;
+};
+
+// failures of an endpoint in a row to eject it
+static constexpr int		RPC_LB_MAX_FAILS	=	3;
+// one request probes an ejected endpoint every period
+static constexpr long long	RPC_LB_EJECT_NS		=	10LL * 1000 * 1000 * 1000;
+// points on the ring of consistent hash for each weight over the gcd of all
+static constexpr int		RPC_LB_RING_POINTS	=	160;
+static constexpr long long	RPC_LB_RING_MAX		=	1 << 20;
+
+/**
+ * @brief   Endpoint of each request for RPCClientParams::endpoints
+ * @details
+ * - select() and the stats of the requests are atomics without any lock
+ * - select() changes nothing of an endpoint, so its result may be dropped
+ * - Weights not larger than 0 are taken as 1
+ * - Failures are those of the network, not any RPC status of the server
+ * - If all endpoints are ejected, they are selected as if none was
+ * - With consistent hash, a key goes to the next endpoint on the ring
+ *   while its own is ejected, so only the keys of that one are moved
+ */
+class RPCLoadBalancer
+{
+public:
+	RPCLoadBalancer(int policy, const std::vector<RPCEndpoint>& endpoints);
+
+	int get_policy() const { return this->policy; }
+
+	size_t select();
+	// by a hash() of the key with RPCLoadBalanceConsistentHash
+	size_t select(uint64_t key_hash);
+
+	// the same in every process, for the ring and the keys
+	static uint64_t hash(const void *key, size_t len);
+
+	// by the request sent to the endpoint, before begin(). An ejected one
+	// takes one probe a period, false if it is taken, then select again
+	bool claim(size_t index);
+	// a request is sent to the endpoint, returns the start time for end()
+	long long begin(size_t index);
+	void end(size_t index, long long start, bool failed);
+
+private:
+	struct Node
+	{
+		long long weight;
+		std::atomic<long long> inflight;
+		std::atomic<long long> ewma_ns;
+		std::atomic<int> fails;
+		std::atomic<long long> eject_until;
+	};
+
+	bool available(size_t index, long long now) const;
+	size_t random_available(long long now, size_t except);
+	size_t select_round_robin(long long now);
+	size_t select_two_choices(long long now);
+	bool less_loaded(size_t a, size_t b) const;
+	void init_ring(const std::vector<RPCEndpoint>& endpoints, long long gcd);
+
+	int policy;
+	std::vector<Node> nodes;
+	// weighted round robin order, spread by smooth weighted round robin
+	std::vector<size_t> schedule;
+	std::atomic<size_t> cursor;
+	// points of consistent hash sorted by hash, read only after init
+	std::vector<std::pair<uint64_t, size_t>> ring;
+};
+
+} // namespace srpc
+
+#endif
+
@@ -19,12 +19,56 @@
 
 #include <list>
 #include <string>
+#include <vector>
 #include <workflow/WFServer.h>
 #include <workflow/URIParser.h>
 #include "rpc_basic.h"
+#include "rpc_load_balancer.h"
+#include "rpc_breaker.h"
 
 namespace srpc {
 
+struct RPCCompressPolicy
+{
+	size_t min_size;		//smaller bodies are sent without compressing
+	double max_ratio;		//compressed/origin above it skips a method, 0 for never
+	int resample_interval;	//compress 1 of every N skipped to check it again
+	size_t block_min_size;	//larger bodies are compressed by blocks in parallel, 0 for never
+	size_t block_size;		//origin size of each block
+};
+
+static constexpr struct RPCCompressPolicy RPC_COMPRESS_POLICY_DEFAULT =
+{
+/*	.min_size			=	*/	0,
+/*	.max_ratio			=	*/	0,
+/*	.resample_interval	=	*/	64,
+/*	.block_min_size		=	*/	0,
+/*	.block_size			=	*/	1024 * 1024
+};
+
+struct RPCHedgePolicy
+{
+	int delay;			//ms without a reply to send the request again, 0 for never
+	double percentile;	//the delay is this latency percentile of the method once known, 0 for the fixed delay
+	double max_ratio;	//hedges are at most this ratio of the requests
+};
+
+static constexpr struct RPCHedgePolicy RPC_HEDGE_POLICY_DEFAULT =
+{
+/*	.delay				=	*/	0,
+/*	.percentile			=	*/	0,
+/*	.max_ratio			=	*/	0.1
+};
+
+static constexpr struct RPCBreakerPolicy RPC_BREAKER_POLICY_DEFAULT =
+{
+/*	.error_ratio		=	*/	0,
+/*	.slow_ms			=	*/	0,
+/*	.min_requests		=	*/	20,
+/*	.window_ms			=	*/	10 * 1000,
+/*	.open_ms			=	*/	5 * 1000
+};
+
 struct RPCTaskParams
 {
 	int send_timeout;
@@ -34,6 +78,12 @@ struct RPCTaskParams
 	int retry_max;
 	int compress_type;	//RPCCompressType
 	int data_type;		//RPCDataType
+	bool use_arena;		//protobuf response on an Arena
+	struct RPCCompressPolicy compress_policy;
+	size_t offload_size;	//compress requests from this size on compute threads, 0 for never
+	bool method_id_only;	//no service and method names in SRPC meta, the server must know the ID
+	int meta_version;		//SRPC_META_V2 for the compact SRPC meta once the server has shown it
+	struct RPCHedgePolicy hedge_policy;	//one more request to another endpoint if no reply in time
 };
 
 struct RPCClientParams
@@ -48,6 +98,11 @@ struct RPCClientParams
 	std::string url;
 	int callee_timeout;
 	std::string caller;
+//or several endpoints instead of host + port
+	std::vector<RPCEndpoint> endpoints;
+	int load_balance;	//RPCLoadBalancePolicy of endpoints
+	struct RPCBreakerPolicy breaker_policy;	//of each endpoint and method, shared by the tasks
+	double retry_ratio;	//retries of all the tasks are at most this ratio of the requests, 0 for no limit
 };
 
 struct RPCServerParams : public WFServerParams
@@ -55,7 +110,14 @@ struct RPCServerParams : public WFServerParams
 	RPCServerParams() : WFServerParams(SERVER_PARAMS_DEFAULT)
 	{
 		this->request_size_limit = RPC_BODY_SIZE_LIMIT;
+		this->use_arena = false;
+		this->compress_policy = RPC_COMPRESS_POLICY_DEFAULT;
+		this->offload_size = 0;
 	}
+
+	bool use_arena;		//protobuf request and response on an Arena
+	struct RPCCompressPolicy compress_policy;	//of the responses
+	size_t offload_size;	//serialize and compress responses from this size on compute threads, 0 for never
 };
 
 static constexpr struct RPCTaskParams RPC_TASK_PARAMS_DEFAULT =
@@ -66,7 +128,13 @@ static constexpr struct RPCTaskParams RPC_TASK_PARAMS_DEFAULT =
 /*	.keep_alive_timeout	=	*/	30 * 1000,
 /*	.retry_max			=	*/	0,
 /*	.compress_type		=	*/	RPCCompressNone,
-/*	.data_type			=	*/	RPCDataUndefined
+/*	.data_type			=	*/	RPCDataUndefined,
+/*	.use_arena			=	*/	false,
+/*	.compress_policy	=	*/	RPC_COMPRESS_POLICY_DEFAULT,
+/*	.offload_size		=	*/	0,
+/*	.method_id_only		=	*/	false,
+/*	.meta_version		=	*/	SRPC_META_V1,
+/*	.hedge_policy		=	*/	RPC_HEDGE_POLICY_DEFAULT
 };
 
 static const struct RPCClientParams RPC_CLIENT_PARAMS_DEFAULT =
@@ -78,7 +146,11 @@ static const struct RPCClientParams RPC_CLIENT_PARAMS_DEFAULT =
 /*	.is_ssl				=	*/	false,
 /*	.url				=	*/	"",
 /*	.callee_timeout		=	*/	-1,
-/*	.caller				=	*/	""
+/*	.caller				=	*/	"",
+/*	.endpoints			=	*/	{},
+/*	.load_balance		=	*/	RPCLoadBalanceWeightedRoundRobin,
+/*	.breaker_policy		=	*/	RPC_BREAKER_POLICY_DEFAULT,
+/*	.retry_ratio		=	*/	0
 };
 
 static const RPCServerParams RPC_SERVER_PARAMS_DEFAULT;
@@ -60,9 +60,20 @@ protected:
 	void server_process(NETWORKTASK *task) const;
 
 private:
+	// by the method ID of req if any, then by the names.
+	// *service is NULL if there is no such service
+	const RPCService::rpc_method_t *
+	find_method(REQTYPE *req, const RPCService **service, bool *use_arena,
+				const RPCCompressPolicy **compress_policy,
+				uint32_t *method_id) const;
+
 	std::mutex mutex;
 	std::map<std::string, RPCService *> service_map;
+	RPCMethodTable methods;
 	RPCModule *modules[SRPC_MODULE_MAX] = { NULL };
+	bool use_arena;
+	struct RPCCompressPolicy compress_policy;
+	size_t offload_size;
 };
 
 ////////
@@ -72,20 +83,29 @@ template<class RPCTYPE>
 inline RPCServer<RPCTYPE>::RPCServer():
 	WFServer<REQTYPE, RESPTYPE>(&RPC_SERVER_PARAMS_DEFAULT,
 								std::bind(&RPCServer::server_process,
-								this, std::placeholders::_1))
+								this, std::placeholders::_1)),
+	use_arena(RPC_SERVER_PARAMS_DEFAULT.use_arena),
+	compress_policy(RPC_SERVER_PARAMS_DEFAULT.compress_policy),
+	offload_size(RPC_SERVER_PARAMS_DEFAULT.offload_size)
 {}
 
 template<class RPCTYPE>
 inline RPCServer<RPCTYPE>::RPCServer(const struct RPCServerParams *params):
 	WFServer<REQTYPE, RESPTYPE>(params,
 								std::bind(&RPCServer::server_process,
-								this, std::placeholders::_1))
+								this, std::placeholders::_1)),
+	use_arena(params->use_arena),
+	compress_policy(params->compress_policy),
+	offload_size(params->offload_size)
 {}
 
 template<class RPCTYPE>
 inline RPCServer<RPCTYPE>::RPCServer(const struct RPCServerParams *params,
 							std::function<void (NETWORKTASK *)>&& process):
-	WFServer<REQTYPE, RESPTYPE>(&params, std::move(process))
+	WFServer<REQTYPE, RESPTYPE>(&params, std::move(process)),
+	use_arena(params->use_arena),
+	compress_policy(params->compress_policy),
+	offload_size(params->offload_size)
 {}
 
 template<class RPCTYPE>
@@ -99,6 +119,7 @@ inline int RPCServer<RPCTYPE>::add_service(RPCService* service)
 		return -1;
 	}
 
+	this->methods.add_service(service);
 	return 0;
 }
 
@@ -118,6 +139,7 @@ inline int RPCServer<RPCTYPESRPC>::add_service(RPCService* service)
 	if (pos != std::string::npos)
 		this->service_map.emplace(name.substr(pos + 1), service);
 
+	this->methods.add_service(service);
 	return 0;
 }
 
@@ -137,6 +159,7 @@ inline int RPCServer<RPCTYPESRPCHttp>::add_service(RPCService* service)
 	if (pos != std::string::npos)
 		this->service_map.emplace(name.substr(pos + 1), service);
 
+	this->methods.add_service(service);
 	return 0;
 }
 
@@ -194,6 +217,43 @@ RPCServer<RPCTYPE>::find_service(const std::string& name) const
 	return NULL;
 }
 
+template<class RPCTYPE>
+const RPCService::rpc_method_t *
+RPCServer<RPCTYPE>::find_method(REQTYPE *req, const RPCService **service,
+								bool *use_arena,
+								const RPCCompressPolicy **compress_policy,
+								uint32_t *entry_id) const
+{
+	const std::string *method_name;
+	bool arena = *use_arena;
+	const RPCCompressPolicy *policy = *compress_policy;
+	auto *rpc = this->methods.find(req->get_method_id(), service, &method_name,
+								   &arena, &policy, entry_id);
+
+	// the names are left out by the client, or they must agree
+	if (rpc && req->get_method_name().empty())
+	{
+		req->set_service_name((*service)->get_name());
+		req->set_method_name(*method_name);
+	}
+	else if (rpc && req->get_method_name() != *method_name)
+		rpc = NULL;
+
+	if (rpc)
+	{
+		*use_arena = arena;
+		*compress_policy = policy;
+		return rpc;
+	}
+
+	*service = this->find_service(req->get_service_name());
+	if (!*service)
+		return NULL;
+
+	return (*service)->find_method(req->get_method_name(), use_arena,
+								   compress_policy, entry_id);
+}
+
 template<class RPCTYPE>
 inline CommSession *RPCServer<RPCTYPE>::new_session(long long seq,
 													CommConnection *conn)
@@ -229,16 +289,21 @@ void RPCServer<RPCTYPE>::server_process(NETWORKTASK *task) const
 			break;
 		}
 
-		RPCTYPE::server_reply_init(req, resp);
+		bool use_arena = this->use_arena;
+		const RPCCompressPolicy *compress_policy = &this->compress_policy;
+		const RPCService *service;
+		uint32_t method_id;
+		// before server_reply_init(), which may need the names
+		auto *rpc = this->find_method(req, &service, &use_arena,
+									  &compress_policy, &method_id);
 
-		auto *service = this->find_service(req->get_service_name());
+		RPCTYPE::server_reply_init(req, resp);
 		if (!service)
 		{
 			status_code = RPCStatusServiceNotFound;
 			break;
 		}
 
-		auto *rpc = service->find_method(req->get_method_name());
 		if (!rpc)
 		{
 			status_code = RPCStatusMethodNotFound;
@@ -250,6 +315,9 @@ void RPCServer<RPCTYPE>::server_process(NETWORKTASK *task) const
 			break;
 
 		auto *server_task = static_cast<TASK *>(task);
+		server_task->set_compress_policy(compress_policy, method_id);
+		server_task->set_offload_size(this->offload_size);
+
 		RPCModuleData *task_data = server_task->mutable_module_data();
 		req->get_meta_module_data(*task_data);
 
@@ -263,7 +331,12 @@ void RPCServer<RPCTYPE>::server_process(NETWORKTASK *task) const
 		}
 
 		if (status_code == RPCStatusOK)
+		{
+			if (use_arena)
+				server_task->worker.enable_arena(req->get_message_len());
+
 			status_code = (*rpc)(server_task->worker);
+		}
 
 		SERIES *series = static_cast<SERIES *>(series_of(task));
 		series->set_module_data(task_data);
@@ -18,8 +18,11 @@
 #define __RPC_SERVICE_H__
 
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <unordered_map>
 #include <functional>
+#include <type_traits>
 #include "rpc_context.h"
 #include "rpc_options.h"
 
@@ -28,10 +31,9 @@ namespace srpc
 
 class RPCService
 {
-protected:
+public:
 	using rpc_method_t = std::function<int (RPCWorker&)>;
 
-public:
 	RPCService(const std::string& name) : name_(name) { }
 	RPCService(RPCService&& move) = delete;
 	RPCService& operator=(RPCService&& move) = delete;
@@ -41,34 +43,158 @@ public:
 
 	const std::string& get_name() const { return name_; }
 	const rpc_method_t *find_method(const std::string& method_name) const;
+	// *use_arena and *compress_policy are left as they are
+	// if the method follows the server. *method_id is the ID of
+	// the full service name, the same for all the names of the method
+	const rpc_method_t *find_method(const std::string& method_name,
+									bool *use_arena,
+									const RPCCompressPolicy **compress_policy,
+									uint32_t *method_id) const;
+
+	// protobuf request and response of this method on an Arena,
+	// overrides RPCServerParams::use_arena. Return -1 if no such method
+	int set_method_arena(const std::string& method_name, bool on);
+
+	// for the responses of this method, overrides
+	// RPCServerParams::compress_policy. Return -1 if no such method
+	int set_method_compress_policy(const std::string& method_name,
+								   const RPCCompressPolicy& policy);
 
 protected:
 	void add_method(const std::string& method_name, rpc_method_t&& method);
 
 private:
-	std::unordered_map<std::string, rpc_method_t> methods_;
+	struct method_entry_t
+	{
+		rpc_method_t method;
+		uint32_t id;	// of the full service name
+		int arena;	// -1 : follow the server
+		bool has_compress_policy;
+		RPCCompressPolicy compress_policy;
+	};
+
+	struct method_id_t
+	{
+		uint32_t id;
+		const std::string *name;	// NULL if the names of two methods collide
+		const method_entry_t *entry;
+	};
+
+	const rpc_method_t *get_method(const method_entry_t& entry,
+								   bool *use_arena,
+								   const RPCCompressPolicy **compress_policy,
+								   uint32_t *method_id) const;
+	void add_method_id(uint32_t id, const std::string *name,
+					   const method_entry_t *entry);
+
+	std::unordered_map<std::string, method_entry_t> methods_;
+	// sorted by id, the entries of an unordered_map never move
+	std::vector<method_id_t> method_ids_;
 	std::string name_;
+
+	friend class RPCMethodTable;
+};
+
+/**
+ * @brief   Methods of the services of a server by RPC_METHOD_ID()
+ * @details
+ * - Open addressing in a flat array, one probe for most IDs
+ * - An ID of more than one method finds nothing, the request goes
+ *   by the names instead. So does an ID that is not known
+ * - Filled by add_service() before the server starts, read-only after
+ */
+class RPCMethodTable
+{
+public:
+	using rpc_method_t = RPCService::rpc_method_t;
+
+	void add_service(const RPCService *service);
+
+	// *service and *method_name are set if found, the rest are the same
+	// as RPCService::find_method()
+	const rpc_method_t *find(uint32_t method_id, const RPCService **service,
+							 const std::string **method_name, bool *use_arena,
+							 const RPCCompressPolicy **compress_policy,
+							 uint32_t *entry_id) const;
+
+private:
+	struct slot_t
+	{
+		uint32_t id;	// 0 for an empty slot
+		const RPCService *service;	// NULL if two methods have the id
+		const RPCService::method_id_t *method;
+	};
+
+	void insert(uint32_t id, const RPCService *service,
+				const RPCService::method_id_t *method);
+
+	// a power of 2 in size, at most half full
+	std::vector<slot_t> slots_;
+	size_t count_ = 0;
 };
 
 ////////
 // inl
 
+// protobuf on the worker's arena if it has one, which owns it
+template<class INPUT>
+static inline INPUT *__new_server_input(RPCWorker& worker, std::true_type)
+{
+	INPUT *in = worker.arena_create<INPUT>();
+
+	if (!in)
+		in = new INPUT;
+
+	worker.set_server_input(in);
+	return in;
+}
+
+// thrift from the pool of this method, given back when the task is done
+template<class INPUT>
+static inline INPUT *__new_server_input(RPCWorker& worker, std::false_type)
+{
+	INPUT *in = ThriftIDLPool<INPUT>::get();
+
+	worker.set_server_input(in, &ThriftIDLPool<INPUT>::put);
+	return in;
+}
+
+template<class OUTPUT>
+static inline OUTPUT *__new_server_output(RPCWorker& worker, std::true_type)
+{
+	OUTPUT *out = worker.arena_create<OUTPUT>();
+
+	if (!out)
+		out = new OUTPUT;
+
+	worker.set_server_output(out);
+	return out;
+}
+
+template<class OUTPUT>
+static inline OUTPUT *__new_server_output(RPCWorker& worker, std::false_type)
+{
+	OUTPUT *out = ThriftIDLPool<OUTPUT>::get();
+
+	worker.set_server_output(out, &ThriftIDLPool<OUTPUT>::put);
+	return out;
+}
+
 template<class INPUT, class OUTPUT, class SERVICE>
 static inline int
 ServiceRPCCallImpl(SERVICE *service,
 				   RPCWorker& worker,
 				   void (SERVICE::*rpc)(INPUT *, OUTPUT *, RPCContext *))
 {
-	auto *in = new INPUT;
-
-	worker.set_server_input(in);
+	auto *in = __new_server_input<INPUT>(worker,
+						std::is_base_of<ProtobufIDLMessage, INPUT>());
 	int status_code = worker.req->deserialize(in);
 
 	if (status_code == RPCStatusOK)
 	{
-		auto *out = new OUTPUT;
+		auto *out = __new_server_output<OUTPUT>(worker,
+						std::is_base_of<ProtobufIDLMessage, OUTPUT>());
 
-		worker.set_server_output(out);
 		(service->*rpc)(in, out, worker.ctx);
 	}
 
@@ -77,7 +203,54 @@ ServiceRPCCallImpl(SERVICE *service,
 
 inline void RPCService::add_method(const std::string& method_name, rpc_method_t&& method)
 {
-	methods_.emplace(method_name, std::move(method));
+	uint32_t id = RPC_METHOD_ID(name_.c_str(), method_name.c_str());
+	auto it = methods_.emplace(method_name, method_entry_t{std::move(method), id,
+														   -1, false,
+														   RPC_COMPRESS_POLICY_DEFAULT});
+
+	if (!it.second)
+		return;
+
+	const std::string *name = &it.first->first;
+	size_t pos = name_.find_last_of('.');
+
+	// a SRPC client may call with the short service name too
+	add_method_id(id, name, &it.first->second);
+	if (pos != std::string::npos)
+	{
+		add_method_id(RPC_METHOD_ID(name_.c_str() + pos + 1, name->c_str()),
+					  name, &it.first->second);
+	}
+}
+
+inline void RPCService::add_method_id(uint32_t id, const std::string *name,
+									  const method_entry_t *entry)
+{
+	auto it = std::lower_bound(method_ids_.begin(), method_ids_.end(), id,
+							   [](const method_id_t& m, uint32_t id) {
+		return m.id < id;
+	});
+
+	// neither of them is found by the id, the names still work
+	if (it != method_ids_.end() && it->id == id)
+		it->name = NULL;
+	else
+		method_ids_.insert(it, method_id_t{id, name, entry});
+}
+
+inline const RPCService::rpc_method_t *RPCService::get_method(const method_entry_t& entry,
+															  bool *use_arena,
+								const RPCCompressPolicy **compress_policy,
+								uint32_t *method_id) const
+{
+	*method_id = entry.id;
+	if (entry.arena >= 0)
+		*use_arena = entry.arena;
+
+	if (entry.has_compress_policy)
+		*compress_policy = &entry.compress_policy;
+
+	return &entry.method;
 }
 
 inline const RPCService::rpc_method_t *RPCService::find_method(const std::string& method_name) const
@@ -85,11 +258,123 @@ inline const RPCService::rpc_method_t *RPCService::find_method(const std::string
 	const auto it = methods_.find(method_name);
 
 	if (it != methods_.cend())
-		return &it->second;
+		return &it->second.method;
 
 	return NULL;
 }
 
+inline const RPCService::rpc_method_t *RPCService::find_method(const std::string& method_name,
+															   bool *use_arena,
+								const RPCCompressPolicy **compress_policy,
+								uint32_t *method_id) const
+{
+	const auto it = methods_.find(method_name);
+
+	if (it == methods_.cend())
+		return NULL;
+
+	return get_method(it->second, use_arena, compress_policy, method_id);
+}
+
+inline int RPCService::set_method_arena(const std::string& method_name, bool on)
+{
+	auto it = methods_.find(method_name);
+
+	if (it == methods_.end())
+		return -1;
+
+	it->second.arena = on ? 1 : 0;
+	return 0;
+}
+
+inline int RPCService::set_method_compress_policy(const std::string& method_name,
+												  const RPCCompressPolicy& policy)
+{
+	auto it = methods_.find(method_name);
+
+	if (it == methods_.end())
+		return -1;
+
+	it->second.has_compress_policy = true;
+	it->second.compress_policy = policy;
+	return 0;
+}
+
+inline void RPCMethodTable::add_service(const RPCService *service)
+{
+	for (const auto& m : service->method_ids_)
+		this->insert(m.id, m.name ? service : NULL, &m);
+}
+
+inline void RPCMethodTable::insert(uint32_t id, const RPCService *service,
+								   const RPCService::method_id_t *method)
+{
+	if ((this->count_ + 1) * 2 > this->slots_.size())
+	{
+		std::vector<slot_t> old(this->slots_.empty() ? 16
+								: this->slots_.size() * 2, slot_t{0, NULL, NULL});
+
+		old.swap(this->slots_);
+		this->count_ = 0;
+		for (const slot_t& slot : old)
+		{
+			if (slot.id != 0)
+				this->insert(slot.id, slot.service, slot.method);
+		}
+	}
+
+	size_t mask = this->slots_.size() - 1;
+	size_t i = id & mask;
+
+	while (this->slots_[i].id != 0)
+	{
+		// the same id by the full and the short service name is fine
+		if (this->slots_[i].id == id)
+		{
+			if (this->slots_[i].method->entry != method->entry)
+				this->slots_[i].service = NULL;
+
+			return;
+		}
+
+		i = (i + 1) & mask;
+	}
+
+	this->slots_[i] = slot_t{id, service, method};
+	this->count_++;
+}
+
+inline const RPCMethodTable::rpc_method_t *
+RPCMethodTable::find(uint32_t method_id, const RPCService **service,
+					 const std::string **method_name, bool *use_arena,
+					 const RPCCompressPolicy **compress_policy,
+					 uint32_t *entry_id) const
+{
+	if (method_id == 0 || this->slots_.empty())
+		return NULL;
+
+	size_t mask = this->slots_.size() - 1;
+	size_t i = method_id & mask;
+
+	while (this->slots_[i].id != method_id)
+	{
+		if (this->slots_[i].id == 0)
+			return NULL;
+
+		i = (i + 1) & mask;
+	}
+
+	const slot_t& slot = this->slots_[i];
+
+	if (!slot.service)
+		return NULL;
+
+	*service = slot.service;
+	*method_name = slot.method->name;
+	return slot.service->get_method(*slot.method->entry, use_arena,
+									compress_policy, entry_id);
+}
+
 } // namespace srpc
 
 #endif
@@ -14,10 +14,16 @@
   limitations under the License.
 */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
+#include <mutex>
+#include <atomic>
+#include <memory>
 #include <functional>
+#include <type_traits>
+#include <google/protobuf/arena.h>
 #include <workflow/WFGlobal.h>
 #include <workflow/WFTask.h>
 #include <workflow/WFTaskFactory.h>
@@ -26,10 +32,24 @@
 #include "rpc_message.h"
 #include "rpc_options.h"
 #include "rpc_global.h"
+#include "rpc_compress.h"
+#include "rpc_hedge.h"
+#include "rpc_breaker.h"
 
 namespace srpc
 {
 
+// compute queue of the messages larger than offload_size
+static constexpr const char *SRPC_OFFLOAD_QUEUE = "srpc_offload";
+// named timer of a hedge, with the address of the call after it
+static constexpr const char *SRPC_HEDGE_TIMER = "srpc_hedge_";
+
+// what a target is known to receive, none if it is not
+static inline uint32_t __features(const std::atomic<uint32_t> *features)
+{
+	return features ? features->load(std::memory_order_relaxed) : 0;
+}
+
 class RPCWorker
 {
 public:
@@ -44,10 +64,41 @@ public:
 	~RPCWorker()
 	{
 		delete this->ctx;
-		delete this->pb_input;
-		delete this->pb_output;
-		delete this->thrift_intput;
-		delete this->thrift_output;
+		// protobuf messages created on the arena go away with it
+		if (!this->arena)
+		{
+			delete this->pb_input;
+			delete this->pb_output;
+		}
+
+		if (this->thrift_input_release)
+			this->thrift_input_release(this->thrift_intput, this->req->get_message_len());
+		else
+			delete this->thrift_intput;
+
+		if (this->thrift_output_release)
+			this->thrift_output_release(this->thrift_output, this->resp->get_message_len());
+		else
+			delete this->thrift_output;
+
+		delete this->arena;
+	}
+
+	// body_len is the incoming message, used to size the first arena block
+	void enable_arena(size_t body_len)
+	{
+		this->arena_enabled = true;
+		this->arena_hint = body_len;
+	}
+
+	// NULL if not enabled, otherwise created on first use
+	google::protobuf::Arena *get_arena();
+
+	// a protobuf IDL on the arena, or NULL if there is no arena or IDL is thrift
+	template<class IDL>
+	IDL *arena_create()
+	{
+		return this->__arena_create<IDL>(std::is_base_of<ProtobufIDLMessage, IDL>());
 	}
 
 	void set_server_input(ProtobufIDLMessage *input)
@@ -55,9 +106,12 @@ public:
 		this->pb_input = input;
 	}
 
-	void set_server_input(ThriftIDLMessage *input)
+	// release is called instead of delete, with the request body length
+	void set_server_input(ThriftIDLMessage *input,
+						  ThriftIDLRelease release = NULL)
 	{
 		this->thrift_intput = input;
+		this->thrift_input_release = release;
 	}
 
 	void set_server_output(ProtobufIDLMessage *output)
@@ -66,9 +120,12 @@ public:
 		this->__server_serialize = &RPCWorker::resp_serialize_pb;
 	}
 
-	void set_server_output(ThriftIDLMessage *output)
+	// release is called instead of delete, with the response body length
+	void set_server_output(ThriftIDLMessage *output,
+						   ThriftIDLRelease release = NULL)
 	{
 		this->thrift_output = output;
+		this->thrift_output_release = release;
 		this->__server_serialize = &RPCWorker::resp_serialize_thrift;
 	}
 
@@ -80,6 +137,15 @@ public:
 		return (this->*__server_serialize)();
 	}
 
+	// 0 if the size is only known after serializing
+	size_t server_output_size() const
+	{
+		return this->pb_output ? this->pb_output->ByteSizeLong() : 0;
+	}
+
+	// false for thrift, which knows its size only after serializing
+	bool server_output_sized() const { return !this->thrift_output; }
+
 public:
 	RPCContext *ctx;
 	RPCMessage *req;
@@ -96,22 +162,120 @@ private:
 		return this->resp->serialize(this->thrift_output);
 	}
 
+	template<class IDL>
+	IDL *__arena_create(std::true_type)
+	{
+		google::protobuf::Arena *arena = this->get_arena();
+
+		if (!arena)
+			return NULL;
+
+		return google::protobuf::Arena::CreateMessage<IDL>(arena);
+	}
+
+	template<class IDL>
+	IDL *__arena_create(std::false_type)
+	{
+		return NULL;
+	}
+
+	static void *arena_block_alloc(size_t size)
+	{
+		return RPCBufferPool::get(&size);
+	}
+
+	static void arena_block_dealloc(void *block, size_t size)
+	{
+		RPCBufferPool::put(block, size);
+	}
+
 	int (RPCWorker::*__server_serialize)();
 	ProtobufIDLMessage *pb_input = NULL;
 	ProtobufIDLMessage *pb_output = NULL;
 	ThriftIDLMessage *thrift_intput = NULL;
 	ThriftIDLMessage *thrift_output = NULL;
+	ThriftIDLRelease thrift_input_release = NULL;
+	ThriftIDLRelease thrift_output_release = NULL;
+	google::protobuf::Arena *arena = NULL;
+	size_t arena_hint = 0;
+	bool arena_enabled = false;
 };
 
+inline google::protobuf::Arena *RPCWorker::get_arena()
+{
+	if (!this->arena && this->arena_enabled)
+	{
+		google::protobuf::ArenaOptions options;
+		size_t size = BUFFER_PIECE_MIN_SIZE;
+
+		// parsed messages are about the size of the body, keep every
+		// block a RPCBufferPool class so that they are recycled
+		while (size < this->arena_hint && size < BUFFER_PIECE_MAX_SIZE)
+			size <<= 1;
+
+		options.start_block_size = size;
+		options.max_block_size = BUFFER_PIECE_MAX_SIZE;
+		options.block_alloc = &RPCWorker::arena_block_alloc;
+		options.block_dealloc = &RPCWorker::arena_block_dealloc;
+		this->arena = new google::protobuf::Arena(options);
+	}
+
+	return this->arena;
+}
+
 template<class RPCREQ, class RPCRESP>
 class RPCClientTask : public WFComplexClientTask<RPCREQ, RPCRESP>
 {
 public:
+	// a hedge of the task, or a probe of the features
+	using attempt_task_t = WFComplexClientTask<RPCREQ, RPCRESP>;
+	// inits an attempt with the endpoint of index, returns what it receives
+	using attempt_init_t =
+		std::function<std::atomic<uint32_t> *(attempt_task_t *, size_t)>;
+
 	// before rpc call
 	void set_data_type(RPCDataType type);
 	void set_compress_type(RPCCompressType type);
+	// overrides RPCTaskParams::compress_policy
+	void set_compress_policy(const RPCCompressPolicy& policy);
+	// overrides RPCTaskParams::offload_size
+	void set_offload_size(size_t size);
+	// inits the task with the endpoint of index
+	using lb_init_t = std::function<void (RPCClientTask *, size_t)>;
+
+	// RPCClientParams::endpoints, the endpoint of index the task is init with
+	void set_load_balancer(RPCLoadBalancer *lb, size_t index, lb_init_t&& init)
+	{
+		load_balancer_ = lb;
+		lb_index_ = index;
+		lb_init_ = std::move(init);
+	}
+	// RPCClientParams::breaker_policy and retry_ratio, they may be NULL
+	void set_breaker(RPCBreaker *breaker, RPCRetryBudget *retry_budget)
+	{
+		breaker_ = breaker;
+		retry_budget_ = retry_budget;
+	}
+	// RPCLoadBalanceConsistentHash, the same key goes to the same endpoint
+	void set_route_key(const void *key, size_t len);
+	void set_route_key(const std::string& key)
+	{
+		this->set_route_key(key.c_str(), key.size());
+	}
+	// RPCTaskParams::hedge_policy, hedge must live longer than the task
+	void set_hedge(RPCHedge *hedge) { hedge_ = hedge; }
+	// for the attempts of a hedged task and the probe of the peer features
+	void set_attempt_init(attempt_init_t&& init) { attempt_init_ = std::move(init); }
+	// what the target can receive, learned from the replies, never freed
+	void set_peer_features(std::atomic<uint32_t> *features)
+	{
+		peer_features_ = features;
+	}
 	void set_retry_max(int retry_max);
+	// protobuf response parsed on an Arena, valid until the callback returns
+	void set_use_arena(bool on);
 	void set_attachment_nocopy(const char *attachment, size_t len);
+	void set_attachment_compress_type(RPCCompressType type);
 	int set_uri_fragment(const std::string& fragment);
 	int serialize_input(const ProtobufIDLMessage *in);
 	int serialize_input(const ThriftIDLMessage *in);
@@ -140,31 +304,102 @@ protected:
 	using WFComplexClientTask<RPCREQ, RPCRESP>::set_callback;
 
 	void init_failed() override;
+	void dispatch() override;
+	SubTask *done() override;
 	bool check_request() override;
 	CommMessageOut *message_out() override;
 	bool finish_once() override;
 	void rpc_callback(WFNetworkTask<RPCREQ, RPCRESP> *task);
 	int first_timeout() override { return watch_timeout_; }
 
+	using hedge_net_task_t = WFNetworkTask<RPCREQ, RPCRESP>;
+
+	// the reply of an attempt, from the endpoint of features
+	void hedge_done(hedge_net_task_t *task, int attempt,
+					std::atomic<uint32_t> *features);
+
 public:
+	// method_id is RPC_METHOD_ID() of the names, 0 to have it computed
 	RPCClientTask(const std::string& service_name,
 				  const std::string& method_name,
+				  uint32_t method_id,
 				  const RPCTaskParams *params,
 				  std::list<RPCModule *>&& modules,
 				  user_done_t&& user_done);
 
 	bool get_remote(std::string& ip, unsigned short *port) const;
+	// of the attempt with the reply if the task is hedged
+	int get_peer_addr(struct sockaddr *addr, socklen_t *addrlen) const;
+	// 0 if the reply is from the first request, 1 if from the hedge
+	int get_attempt() const { return hedge_attempt_; }
 
 	RPCModuleData *mutable_module_data() { return &module_data_; }
 	void set_module_data(RPCModuleData data) { module_data_ = std::move(data); }
 
 private:
+	struct HedgeCall
+	{
+		std::mutex mutex;
+		RPCClientTask *task;	// NULL once it is done
+		std::string timer_name;
+		int attempts;			// in flight
+	};
+
 	template<class IDL>
 	int __serialize_input(const IDL *in);
+	int prepare_out();
+	void dispatch_out();
+	// the endpoint of index instead, before the task is dispatched
+	void init_endpoint(size_t index);
+	// another one than lb_index_ if there is any available
+	size_t another_endpoint() const;
+	// the endpoint of the try, another one if its probe is taken
+	void claim_endpoint();
+	// RPC_METHOD_ID() of the names if it is not given
+	uint32_t get_method_id();
+	void hedge_dispatch();
+	attempt_task_t *create_attempt(const std::shared_ptr<HedgeCall>& call,
+								 int attempt);
+	// parses the meta of a reply, features are learned from it
+	void reply_meta(std::atomic<uint32_t> *features);
+	void probe_dispatch();
+	void probe_done(hedge_net_task_t *task);
+	static void hedge_timeout(const std::shared_ptr<HedgeCall>& call);
+	static void hedge_callback(const std::shared_ptr<HedgeCall>& call,
+							   hedge_net_task_t *task, int attempt,
+							   std::atomic<uint32_t> *features);
 
 	user_done_t user_done_;
 	bool init_failed_;
+	bool use_arena_;
 	int watch_timeout_;
+	RPCCompressPolicy compress_policy_;
+	uint32_t method_id_;
+	size_t offload_size_;
+	bool out_prepared_;
+	int out_status_;
+	RPCModuleData out_data_;
+	RPCLoadBalancer *load_balancer_;
+	size_t lb_index_;
+	bool lb_claimed_;
+	long long lb_start_;
+	lb_init_t lb_init_;
+	uint64_t route_hash_;
+	bool has_route_key_;
+	RPCBreaker *breaker_;
+	RPCCircuitBreaker *circuit_;
+	long long breaker_start_;
+	int breaker_changed_;
+	RPCRetryBudget *retry_budget_;
+	RPCHedge *hedge_;
+	RPCHedgeStats *hedge_stats_;
+	RPCHedgePolicy hedge_policy_;
+	int hedge_attempt_;
+	struct sockaddr_storage hedge_addr_;
+	socklen_t hedge_addrlen_;
+	attempt_init_t attempt_init_;
+	std::atomic<uint32_t> *peer_features_;
+	bool probed_;
 
 	RPCModuleData module_data_;
 	std::list<RPCModule *> modules_;
@@ -180,6 +415,12 @@ public:
 		WFServerTask<RPCREQ, RPCRESP>(service, WFGlobal::get_scheduler(), process),
 		worker(new RPCContextImpl<RPCREQ, RPCRESP>(this, &module_data_),
 			   &this->req, &this->resp),
+		compress_policy_(NULL),
+		method_id_(0),
+		offload_size_(0),
+		out_serialized_(false),
+		out_compressed_(false),
+		out_status_(RPCStatusOK),
 		modules_(std::move(modules))
 	{
 	}
@@ -208,6 +449,7 @@ public:
 	};
 
 protected:
+	void dispatch() override;
 	CommMessageOut *message_out() override;
 	void handle(int state, int error) override;
 
@@ -215,11 +457,28 @@ public:
 	bool get_remote(std::string& ip, unsigned short *port) const;
 	RPCModuleData *mutable_module_data() { return &module_data_; }
 	void set_module_data(RPCModuleData data) { module_data_ = std::move(data); }
+	// kept by the server or the service, method_id keys what it learns
+	void set_compress_policy(const RPCCompressPolicy *policy,
+							 uint32_t method_id)
+	{
+		compress_policy_ = policy;
+		method_id_ = method_id;
+	}
+
+	void set_offload_size(size_t size) { offload_size_ = size; }
 
 public:
 	RPCWorker worker;
 
 private:
+	int prepare_out();
+
+	const RPCCompressPolicy *compress_policy_;
+	uint32_t method_id_;
+	size_t offload_size_;
+	bool out_serialized_;
+	bool out_compressed_;
+	int out_status_;
 	RPCModuleData module_data_;
 	std::list<RPCModule *> modules_;
 };
@@ -238,6 +497,7 @@ static void RPCAsyncFutureCallback(OUTPUT *output, srpc::RPCContext *ctx)
 	res.second.error = ctx->get_error();
 	res.second.success = ctx->success();
 	res.second.timeout_reason = ctx->get_timeout_reason();
+	res.second.attempt = ctx->get_attempt();
 	if (res.second.success)
 		res.first = std::move(*output);
 
@@ -257,6 +517,7 @@ static void ThriftSendCallback(OUTPUT *output, srpc::RPCContext *ctx)
 	receiver->ctx.status_code = ctx->get_status_code();
 	receiver->ctx.error = ctx->get_error();
 	receiver->ctx.success = ctx->success();
+	receiver->ctx.attempt = ctx->get_attempt();
 	if (receiver->ctx.success)
 		receiver->output = std::move(*output);
 
@@ -265,6 +526,19 @@ static void ThriftSendCallback(OUTPUT *output, srpc::RPCContext *ctx)
 	receiver->mutex.unlock();
 }
 
+template<class OUTPUT>
+static inline int
+__client_rpc_done(OUTPUT *out, RPCWorker& worker,
+				  const std::function<void (OUTPUT *, RPCContext *)>& rpc_done)
+{
+	int status_code = worker.resp->deserialize(out);
+
+	if (status_code == RPCStatusOK)
+		rpc_done(out, worker.ctx);
+
+	return status_code;
+}
+
 template<class OUTPUT>
 static inline int
 ClientRPCDoneImpl(int status_code,
@@ -273,26 +547,174 @@ ClientRPCDoneImpl(int status_code,
 {
 	if (status_code == RPCStatusOK)
 	{
-		OUTPUT out;
+		OUTPUT *out = worker.arena_create<OUTPUT>();
 
-		status_code = worker.resp->deserialize(&out);
-		if (status_code == RPCStatusOK)
-			rpc_done(&out, worker.ctx);
+		if (out)
+			return __client_rpc_done(out, worker, rpc_done);
 
-		return status_code;
+		OUTPUT local_out;
+
+		return __client_rpc_done(&local_out, worker, rpc_done);
 	}
 
 	rpc_done(NULL, worker.ctx);
 	return status_code;
 }
 
+// into the output of the sync caller, which is woken up by the last call
+template<class OUTPUT>
+static inline int
+ClientRPCSyncDoneImpl(int status_code,
+					  RPCWorker& worker,
+					  RPCSyncReceiver *receiver)
+{
+	if (status_code == RPCStatusOK)
+	{
+		OUTPUT *out = static_cast<OUTPUT *>(receiver->get_output());
+
+		if (out)
+			status_code = worker.resp->deserialize(out);
+		else
+		{
+			OUTPUT local_out;
+
+			status_code = worker.resp->deserialize(&local_out);
+		}
+
+		if (status_code != RPCStatusOK)
+			return status_code;
+	}
+
+	receiver->done(worker.ctx);
+	return status_code;
+}
+
+// compress() by RPCCompressPolicy, the decision is put into data for filters
+template<class MESSAGE>
+static int __compress_by_policy(MESSAGE *msg, const RPCCompressPolicy *policy,
+								bool is_resp, uint32_t method_id,
+								RPCModuleData *data)
+{
+	if (msg->get_compress_type() == RPCCompressNone ||
+		!RPCCompressEstimator::enabled(policy))
+	{
+		return msg->compress();
+	}
+
+	RPCCompressEstimator estimator(policy);
+	size_t origin_size = msg->get_message_len();
+	int decision = estimator.decide(is_resp, method_id, origin_size);
+
+	if (RPCCompressEstimator::skipped(decision))
+		msg->set_compress_type(RPCCompressNone);
+	else if (policy->block_min_size > 0 && origin_size >= policy->block_min_size)
+		msg->set_compress_block_size(policy->block_size);
+
+	int status_code = msg->compress();
+
+	if (status_code != RPCStatusOK)
+		return status_code;
+
+	size_t compressed_size = msg->get_message_len();
+
+	estimator.learn(decision, origin_size, compressed_size);
+	if (data)
+	{
+		(*data)[SRPC_COMPRESS_DECISION] =
+				RPCCompressEstimator::decision_string(decision);
+		(*data)[SRPC_COMPRESS_SAVED_BYTES] =
+				std::to_string((long long)origin_size - (long long)compressed_size);
+	}
+
+	return status_code;
+}
+
+enum
+{
+	RPCOffloadUnknown	=	0,
+	RPCOffloadNo		=	1,
+	RPCOffloadYes		=	2,
+};
+
+// by the method ID, whether the last thrift response of the method was
+// large enough for the compute threads. A collision only costs a guess
+static inline std::atomic<int>& __offload_hint(uint32_t method_id)
+{
+	static std::atomic<int> hints[1024];
+
+	return hints[method_id % 1024];
+}
+
+// serialize and compress the response, what is already done is skipped
+template<class RPCREQ, class RPCRESP>
+int RPCServerTask<RPCREQ, RPCRESP>::prepare_out()
+{
+	if (!out_serialized_)
+	{
+		out_status_ = this->worker.server_serialize();
+		out_serialized_ = true;
+
+		// the size is known now, for the next response of the method
+		if (offload_size_ > 0 && !this->worker.server_output_sized() &&
+			out_status_ == RPCStatusOK)
+		{
+			__offload_hint(method_id_) =
+				this->resp.get_message_len() >= offload_size_ ? RPCOffloadYes
+															  : RPCOffloadNo;
+		}
+	}
+
+	if (out_status_ == RPCStatusOK && !out_compressed_)
+	{
+		out_status_ = __compress_by_policy(&this->resp, compress_policy_, true,
+										   method_id_,
+										   modules_.empty() ? NULL
+												: this->mutable_module_data());
+		out_compressed_ = true;
+	}
+
+	return out_status_;
+}
+
+template<class RPCREQ, class RPCRESP>
+void RPCServerTask<RPCREQ, RPCRESP>::dispatch()
+{
+	if (this->state == WFT_STATE_TOREPLY && offload_size_ > 0 && !out_compressed_)
+	{
+		bool offload;
+
+		// thrift is guessed by the last response of the method,
+		// and serialized on a compute thread too unless it was small
+		if (!this->worker.server_output_sized())
+			offload = __offload_hint(method_id_) != RPCOffloadNo;
+		else
+			offload = this->worker.server_output_size() >= offload_size_;
+
+		if (offload)
+		{
+			auto *task = WFTaskFactory::create_go_task(SRPC_OFFLOAD_QUEUE,
+											&RPCServerTask::prepare_out, this);
+
+			task->set_callback([this](WFGoTask *) {
+				this->WFServerTask<RPCREQ, RPCRESP>::dispatch();
+			});
+			task->start();
+			return;
+		}
+	}
+
+	this->WFServerTask<RPCREQ, RPCRESP>::dispatch();
+}
+
 template<class RPCREQ, class RPCRESP>
 CommMessageOut *RPCServerTask<RPCREQ, RPCRESP>::message_out()
 {
-	int status_code = this->worker.server_serialize();
+	// an attachment only to a client which can receive it
+	this->resp.set_peer_features(this->req.get_peer_features());
 
-	if (status_code == RPCStatusOK)
-		status_code = this->resp.compress();
+	int status_code = this->prepare_out();
+	// for server, this is the where series->module_data stored
+	RPCModuleData *data = this->mutable_module_data();
 
 	if (status_code == RPCStatusOK)
 	{
@@ -303,9 +725,6 @@ CommMessageOut *RPCServerTask<RPCREQ, RPCRESP>::message_out()
 	if (this->resp.get_status_code() == RPCStatusOK)
 		this->resp.set_status_code(status_code);
 
-	// for server, this is the where series->module_data stored
-	RPCModuleData *data = this->mutable_module_data();
-
 	for (auto *module : modules_)
 	{
 		if (!module->server_task_end(this, *data))
@@ -315,6 +734,10 @@ CommMessageOut *RPCServerTask<RPCREQ, RPCRESP>::message_out()
 		}
 	}
 
+	// only for the filters of this side
+	data->erase(SRPC_COMPRESS_DECISION);
+	data->erase(SRPC_COMPRESS_SAVED_BYTES);
+
 	if (status_code == RPCStatusOK)
 	{
 		this->resp.set_meta_module_data(*data);
@@ -349,6 +772,18 @@ inline void RPCClientTask<RPCREQ, RPCRESP>::set_compress_type(RPCCompressType ty
 	this->req.set_compress_type(type);
 }
 
+template<class RPCREQ, class RPCRESP>
+inline void RPCClientTask<RPCREQ, RPCRESP>::set_compress_policy(const RPCCompressPolicy& policy)
+{
+	compress_policy_ = policy;
+}
+
+template<class RPCREQ, class RPCRESP>
+inline void RPCClientTask<RPCREQ, RPCRESP>::set_offload_size(size_t size)
+{
+	offload_size_ = size;
+}
+
 template<class RPCREQ, class RPCRESP>
 inline void RPCClientTask<RPCREQ, RPCRESP>::set_attachment_nocopy(const char *attachment,
 																  size_t len)
@@ -356,6 +791,12 @@ inline void RPCClientTask<RPCREQ, RPCRESP>::set_attachment_nocopy(const char *at
 	this->req.set_attachment_nocopy(attachment, len);
 }
 
+template<class RPCREQ, class RPCRESP>
+inline void RPCClientTask<RPCREQ, RPCRESP>::set_attachment_compress_type(RPCCompressType type)
+{
+	this->req.set_attachment_compress_type(type);
+}
+
 template<class RPCREQ, class RPCRESP>
 int RPCClientTask<RPCREQ, RPCRESP>::set_uri_fragment(const std::string& fragment)
 {
@@ -377,6 +818,79 @@ inline void RPCClientTask<RPCREQ, RPCRESP>::set_retry_max(int retry_max)
 	this->retry_max_ = retry_max;
 }
 
+template<class RPCREQ, class RPCRESP>
+void RPCClientTask<RPCREQ, RPCRESP>::set_route_key(const void *key, size_t len)
+{
+	if (!load_balancer_ ||
+		load_balancer_->get_policy() != RPCLoadBalanceConsistentHash)
+		return;
+
+	route_hash_ = RPCLoadBalancer::hash(key, len);
+	has_route_key_ = true;
+
+	size_t index = load_balancer_->select(route_hash_);
+
+	if (index != lb_index_)
+		this->init_endpoint(index);
+}
+
+template<class RPCREQ, class RPCRESP>
+void RPCClientTask<RPCREQ, RPCRESP>::init_endpoint(size_t index)
+{
+	lb_index_ = index;
+	circuit_ = NULL;
+	// the last one may be routed already, the new one may be a uri
+	this->route_result_.clear();
+	lb_init_(this, index);
+}
+
+template<class RPCREQ, class RPCRESP>
+size_t RPCClientTask<RPCREQ, RPCRESP>::another_endpoint() const
+{
+	size_t index = lb_index_;
+
+	for (int i = 0; i < 3 && index == lb_index_; i++)
+		index = load_balancer_->select();
+
+	return index;
+}
+
+// selecting changes nothing, only the endpoint a try is sent to is claimed
+template<class RPCREQ, class RPCRESP>
+void RPCClientTask<RPCREQ, RPCRESP>::claim_endpoint()
+{
+	if (load_balancer_->claim(lb_index_))
+		return;
+
+	size_t index = has_route_key_ ? load_balancer_->select(route_hash_)
+								  : this->another_endpoint();
+
+	// or none is available, then it goes anyway
+	if (index != lb_index_)
+	{
+		this->init_endpoint(index);
+		load_balancer_->claim(index);
+	}
+}
+
+template<class RPCREQ, class RPCRESP>
+uint32_t RPCClientTask<RPCREQ, RPCRESP>::get_method_id()
+{
+	if (method_id_ == 0)
+	{
+		method_id_ = RPC_METHOD_ID(this->req.get_service_name().c_str(),
+								   this->req.get_method_name().c_str());
+	}
+
+	return method_id_;
+}
+
+template<class RPCREQ, class RPCRESP>
+inline void RPCClientTask<RPCREQ, RPCRESP>::set_use_arena(bool on)
+{
+	use_arena_ = on;
+}
+
 template<class RPCREQ, class RPCRESP>
 inline int RPCClientTask<RPCREQ, RPCRESP>::serialize_input(const ProtobufIDLMessage *in)
 {
@@ -409,12 +923,32 @@ template<class RPCREQ, class RPCRESP>
 inline RPCClientTask<RPCREQ, RPCRESP>::RPCClientTask(
 					const std::string& service_name,
 					const std::string& method_name,
+					uint32_t method_id,
 					const RPCTaskParams *params,
 					std::list<RPCModule *>&& modules,
 					user_done_t&& user_done):
 	WFComplexClientTask<RPCREQ, RPCRESP>(0, nullptr),
 	user_done_(std::move(user_done)),
 	init_failed_(false),
+	method_id_(method_id),
+	load_balancer_(NULL),
+	lb_index_(0),
+	lb_claimed_(false),
+	lb_start_(0),
+	route_hash_(0),
+	has_route_key_(false),
+	breaker_(NULL),
+	circuit_(NULL),
+	breaker_start_(0),
+	breaker_changed_(-1),
+	retry_budget_(NULL),
+	hedge_(NULL),
+	hedge_stats_(NULL),
+	hedge_policy_(params->hedge_policy),
+	hedge_attempt_(0),
+	hedge_addrlen_(0),
+	peer_features_(NULL),
+	probed_(false),
 	modules_(std::move(modules))
 {
 	if (user_done_)
@@ -424,6 +958,11 @@ inline RPCClientTask<RPCREQ, RPCRESP>::RPCClientTask(
 	this->set_send_timeout(params->send_timeout);
 	this->set_receive_timeout(params->receive_timeout);
 	watch_timeout_ = params->watch_timeout;
+	use_arena_ = params->use_arena;
+	compress_policy_ = params->compress_policy;
+	offload_size_ = params->offload_size;
+	out_prepared_ = false;
+	out_status_ = RPCStatusOK;
 	this->set_keep_alive(params->keep_alive_timeout);
 	this->set_retry_max(params->retry_max);
 
@@ -435,6 +974,13 @@ inline RPCClientTask<RPCREQ, RPCRESP>::RPCClientTask(
 
 	this->req.set_service_name(service_name);
 	this->req.set_method_name(method_name);
+	// the generated clients have it as a constant
+	if (method_id_ == 0 && params->method_id_only)
+		method_id_ = RPC_METHOD_ID(service_name.c_str(), method_name.c_str());
+
+	this->req.set_method_id(method_id_);
+	this->req.set_method_id_only(params->method_id_only);
+	this->req.set_meta_version(params->meta_version);
 }
 
 template<class RPCREQ, class RPCRESP>
@@ -471,12 +1017,449 @@ bool RPCClientTask<RPCREQ, RPCRESP>::check_request()
 	return true;
 }
 
+// compress once for every retry, the decision is kept in out_data_
+// because check_request() resets the module data
+template<class RPCREQ, class RPCRESP>
+int RPCClientTask<RPCREQ, RPCRESP>::prepare_out()
+{
+	if (!out_prepared_)
+	{
+		if (method_id_ == 0 && RPCCompressEstimator::enabled(&compress_policy_))
+		{
+			method_id_ = RPC_METHOD_ID(this->req.get_service_name().c_str(),
+									   this->req.get_method_name().c_str());
+		}
+
+		out_status_ = __compress_by_policy(&this->req, &compress_policy_, false,
+										   method_id_,
+										   modules_.empty() ? NULL : &out_data_);
+		out_prepared_ = true;
+	}
+
+	return out_status_;
+}
+
+template<class RPCREQ, class RPCRESP>
+void RPCClientTask<RPCREQ, RPCRESP>::dispatch()
+{
+	// before the breaker, which is of the endpoint
+	if (load_balancer_ && !lb_claimed_ && this->state == WFT_STATE_UNDEFINED)
+	{
+		this->claim_endpoint();
+		lb_claimed_ = true;
+	}
+
+	// every try asks the breaker once, a short circuit never waits for a slot
+	if (breaker_ && breaker_start_ == 0 && this->state == WFT_STATE_UNDEFINED)
+	{
+		long long now = GET_CURRENT_US_STEADY();
+		bool allowed;
+		int changed;
+
+		if (!circuit_)
+		{
+			circuit_ = breaker_->get(lb_index_, this->get_method_id(),
+									 this->req.get_method_name());
+		}
+
+		allowed = circuit_->allow(now, &changed);
+		if (changed >= 0)
+			breaker_changed_ = changed;
+
+		if (!allowed)
+		{
+			this->resp.set_status_code(RPCStatusCircuitBreakerOpen);
+			this->disable_retry();
+			this->subtask_done();
+			return;
+		}
+
+		breaker_start_ = now;
+	}
+
+	// the attempts of a hedged task are counted instead
+	if (load_balancer_ && !hedge_ && lb_start_ == 0 &&
+		this->state == WFT_STATE_UNDEFINED)
+	{
+		lb_start_ = load_balancer_->begin(lb_index_);
+	}
+
+	if (this->state == WFT_STATE_UNDEFINED && offload_size_ > 0 &&
+		!out_prepared_ && this->req.get_compress_type() != RPCCompressNone &&
+		this->req.get_message_len() >= offload_size_)
+	{
+		auto *task = WFTaskFactory::create_go_task(SRPC_OFFLOAD_QUEUE,
+										&RPCClientTask::prepare_out, this);
+
+		task->set_callback([this](WFGoTask *) { this->dispatch_out(); });
+		task->start();
+		return;
+	}
+
+	this->dispatch_out();
+}
+
+template<class RPCREQ, class RPCRESP>
+void RPCClientTask<RPCREQ, RPCRESP>::dispatch_out()
+{
+	if (peer_features_ && !probed_ && this->state == WFT_STATE_UNDEFINED &&
+		peer_features_->load(std::memory_order_relaxed) == 0 &&
+		!this->req.set_peer_features(0))
+	{
+		this->probe_dispatch();
+	}
+	else if (hedge_ && this->state == WFT_STATE_UNDEFINED)
+		this->hedge_dispatch();
+	else
+		this->WFComplexClientTask<RPCREQ, RPCRESP>::dispatch();
+}
+
+/*
+ * An old peer takes an attachment for the next message, so it is not sent
+ * before the target tells it can receive one. The probe is a request to no
+ * service, any server replies RPCStatusServiceNotFound, but only a new one
+ * has its features in the reply. Then the task goes on with what is known
+ */
+template<class RPCREQ, class RPCRESP>
+void RPCClientTask<RPCREQ, RPCRESP>::probe_dispatch()
+{
+	auto *task = new attempt_task_t(0, [this](hedge_net_task_t *task) {
+		this->probe_done(task);
+	});
+
+	attempt_init_(task, lb_index_);
+	if (!task->get_req()->serialize_meta())
+	{
+		task->dismiss();
+		this->state = WFT_STATE_SYS_ERROR;
+		this->error = EBADMSG;
+		this->subtask_done();
+		return;
+	}
+
+	task->set_send_timeout(this->send_timeo);
+	task->set_receive_timeout(this->receive_timeo);
+	task->set_keep_alive(this->keep_alive_timeo);
+	task->start();
+}
+
+template<class RPCREQ, class RPCRESP>
+void RPCClientTask<RPCREQ, RPCRESP>::probe_done(hedge_net_task_t *task)
+{
+	if (task->get_state() != WFT_STATE_SUCCESS)
+	{
+		// a retry probes again
+		this->state = task->get_state();
+		this->error = task->get_error();
+		this->timeout_reason = task->get_timeout_reason();
+		this->subtask_done();
+		return;
+	}
+
+	RPCRESP *resp = task->get_resp();
+
+	if (resp->deserialize_meta())
+	{
+		peer_features_->store(resp->get_peer_features(),
+							  std::memory_order_relaxed);
+	}
+
+	// message_out() fails it if still unknown
+	probed_ = true;
+	this->dispatch_out();
+}
+
+/*
+ * A hedged task is not on the network itself. The request is serialized
+ * once, each attempt shares its body and sends it, another one is sent if
+ * there is no reply after the delay. The first reply is moved into the task
+ * and the timer is cancelled, the other reply is left alone. A failure ends
+ * the task when no other attempt is in flight, and retry_max of the task is
+ * for the whole of it
+ */
+template<class RPCREQ, class RPCRESP>
+void RPCClientTask<RPCREQ, RPCRESP>::hedge_dispatch()
+{
+	std::shared_ptr<HedgeCall> call;
+	WFTimerTask *timer;
+	attempt_task_t *task;
+	long long delay;
+
+	if (!this->check_request())
+	{
+		this->subtask_done();
+		return;
+	}
+
+	if (!this->message_out())
+	{
+		this->state = WFT_STATE_SYS_ERROR;
+		this->error = errno;
+		this->subtask_done();
+		return;
+	}
+
+	if (!hedge_stats_)
+	{
+		hedge_stats_ = hedge_->get_stats(this->get_method_id(),
+										 this->req.get_method_name());
+	}
+
+	call = std::make_shared<HedgeCall>();
+	call->task = this;
+	call->timer_name = SRPC_HEDGE_TIMER;
+	call->timer_name += std::to_string((uintptr_t)call.get());
+	call->attempts = 0;
+	hedge_attempt_ = 0;
+	hedge_addrlen_ = 0;
+
+	task = this->create_attempt(call, 0);
+	if (!task)
+	{
+		this->state = WFT_STATE_SYS_ERROR;
+		this->error = ENOMEM;
+		this->subtask_done();
+		return;
+	}
+
+	hedge_->earn();
+	delay = (long long)hedge_policy_.delay * 1000;
+	if (hedge_policy_.percentile > 0)
+	{
+		long long latency = hedge_stats_->percentile(hedge_policy_.percentile);
+
+		if (latency >= 0)
+			delay = latency;
+	}
+
+	timer = WFTaskFactory::create_timer_task(call->timer_name,
+											 (time_t)(delay / 1000000),
+											 (long)(delay % 1000000 * 1000),
+		[call](WFTimerTask *) { RPCClientTask::hedge_timeout(call); });
+
+	// the task may be done as soon as they start
+	timer->start();
+	task->start();
+}
+
+// NULL if the request can not be shared
+template<class RPCREQ, class RPCRESP>
+typename RPCClientTask<RPCREQ, RPCRESP>::attempt_task_t *
+RPCClientTask<RPCREQ, RPCRESP>::create_attempt(
+					const std::shared_ptr<HedgeCall>& call, int attempt)
+{
+	RPCLoadBalancer *lb = load_balancer_;
+	RPCHedgeStats *stats = hedge_stats_;
+	// the hedge goes to another endpoint if there is one
+	size_t index = attempt > 0 && lb ? this->another_endpoint() : lb_index_;
+	std::atomic<uint32_t> *features;
+	attempt_task_t *task;
+	long long lb_start;
+	long long start;
+	bool shared;
+
+	task = new attempt_task_t(0, nullptr);
+	features = attempt_init_(task, index);
+	shared = this->req.share_to(task->get_req(), __features(features));
+
+	// an older server than the first one, or another request probes it.
+	// Then it goes to the same, which dispatch() has claimed
+	if (index != lb_index_ && (!shared || !lb->claim(index)))
+	{
+		index = lb_index_;
+		features = attempt_init_(task, index);
+		shared = this->req.share_to(task->get_req(), __features(features));
+	}
+
+	if (!shared)
+	{
+		task->dismiss();
+		return NULL;
+	}
+
+	lb_start = lb ? lb->begin(index) : 0;
+	start = GET_CURRENT_US_STEADY();
+	task->set_callback(
+		[call, attempt, lb, index, lb_start, stats, start,
+		 features](hedge_net_task_t *task)
+	{
+		int state = task->get_state();
+
+		if (lb)
+		{
+			lb->end(index, lb_start, state == WFT_STATE_SYS_ERROR ||
+									 state == WFT_STATE_SSL_ERROR ||
+									 state == WFT_STATE_DNS_ERROR);
+		}
+
+		// also the late replies, they are what the percentile is about
+		if (state == WFT_STATE_SUCCESS)
+			stats->add(GET_CURRENT_US_STEADY() - start);
+
+		RPCClientTask::hedge_callback(call, task, attempt, features);
+	});
+
+	task->set_send_timeout(this->send_timeo);
+	task->set_receive_timeout(this->receive_timeo);
+	task->set_keep_alive(this->keep_alive_timeo);
+	call->attempts++;
+	return task;
+}
+
+template<class RPCREQ, class RPCRESP>
+void RPCClientTask<RPCREQ, RPCRESP>::hedge_timeout(
+					const std::shared_ptr<HedgeCall>& call)
+{
+	attempt_task_t *task = NULL;
+
+	// also after a cancel, then the task is done already
+	call->mutex.lock();
+	if (call->task && call->task->hedge_->spend())
+		task = call->task->create_attempt(call, 1);
+
+	call->mutex.unlock();
+	if (task)
+		task->start();
+}
+
+template<class RPCREQ, class RPCRESP>
+void RPCClientTask<RPCREQ, RPCRESP>::hedge_callback(
+					const std::shared_ptr<HedgeCall>& call,
+					hedge_net_task_t *task, int attempt,
+					std::atomic<uint32_t> *features)
+{
+	RPCClientTask *self;
+
+	call->mutex.lock();
+	self = call->task;
+	call->attempts--;
+	// the first reply, or the last failure
+	if (self && (task->get_state() == WFT_STATE_SUCCESS || call->attempts == 0))
+		call->task = NULL;
+	else
+		self = NULL;
+
+	call->mutex.unlock();
+	if (self)
+	{
+		WFTaskFactory::cancel_by_name(call->timer_name);
+		self->hedge_done(task, attempt, features);
+	}
+}
+
+template<class RPCREQ, class RPCRESP>
+void RPCClientTask<RPCREQ, RPCRESP>::hedge_done(hedge_net_task_t *task,
+												int attempt,
+												std::atomic<uint32_t> *features)
+{
+	this->state = task->get_state();
+	this->error = task->get_error();
+	this->timeout_reason = task->get_timeout_reason();
+	if (this->state == WFT_STATE_SUCCESS)
+	{
+		hedge_attempt_ = attempt;
+		hedge_addrlen_ = sizeof (hedge_addr_);
+		if (task->get_peer_addr((struct sockaddr *)&hedge_addr_,
+								&hedge_addrlen_) < 0)
+		{
+			hedge_addrlen_ = 0;
+		}
+
+		this->resp = std::move(*task->get_resp());
+		// the attempt is a plain task, finish_once() of it is not this one
+		this->reply_meta(features);
+	}
+
+	this->subtask_done();
+}
+
+// before a retry or the callback
+template<class RPCREQ, class RPCRESP>
+SubTask *RPCClientTask<RPCREQ, RPCRESP>::done()
+{
+	int status_code = this->resp.get_status_code();
+
+	// also called before routing a uri, then the task is dispatched again.
+	// A failed check_request() or an open breaker is the other case of it
+	if (this->state == WFT_STATE_UNDEFINED &&
+		(status_code == RPCStatusOK || status_code == RPCStatusUndefined))
+	{
+		return this->WFComplexClientTask<RPCREQ, RPCRESP>::done();
+	}
+
+	// a retry claims its endpoint again
+	lb_claimed_ = false;
+
+	// only the network fails the endpoint, not any reply of the server
+	if (lb_start_ != 0)
+	{
+		load_balancer_->end(lb_index_, lb_start_,
+							this->state == WFT_STATE_SYS_ERROR ||
+							this->state == WFT_STATE_SSL_ERROR ||
+							this->state == WFT_STATE_DNS_ERROR);
+		lb_start_ = 0;
+	}
+
+	if (breaker_start_ != 0)
+	{
+		int changed = circuit_->end(breaker_start_, GET_CURRENT_US_STEADY(),
+									this->state == WFT_STATE_SYS_ERROR ||
+									this->state == WFT_STATE_SSL_ERROR ||
+									this->state == WFT_STATE_DNS_ERROR);
+
+		if (changed >= 0)
+			breaker_changed_ = changed;
+
+		breaker_start_ = 0;
+	}
+
+	// a retry spends a whole one the requests have saved, or there is none
+	if (retry_budget_)
+	{
+		if (this->retry_times_ == 0)
+			retry_budget_->earn();
+
+		if (this->state == WFT_STATE_SYS_ERROR &&
+			this->retry_times_ < this->retry_max_ && !retry_budget_->spend())
+		{
+			this->retry_max_ = this->retry_times_;
+		}
+	}
+
+	bool retry = this->state == WFT_STATE_SYS_ERROR &&
+				 this->retry_times_ < this->retry_max_;
+	SubTask *next = this->WFComplexClientTask<RPCREQ, RPCRESP>::done();
+
+	// back in the series, not dispatched yet. The failure is reported to
+	// the route of the last endpoint, the retry goes to another one
+	if (retry && load_balancer_)
+	{
+		size_t index = has_route_key_ ? load_balancer_->select(route_hash_)
+									  : this->another_endpoint();
+
+		if (index != lb_index_)
+			this->init_endpoint(index);
+	}
+
+	return next;
+}
+
 template<class RPCREQ, class RPCRESP>
 CommMessageOut *RPCClientTask<RPCREQ, RPCRESP>::message_out()
 {
 	this->req.set_seqid(this->get_task_seq());
 
-	int status_code = this->req.compress();
+	int status_code = this->prepare_out();
+	RPCModuleData *data = this->mutable_module_data();
+
+	for (const auto& kv : out_data_)
+		(*data)[kv.first] = kv.second;
+
+	if (status_code == RPCStatusOK &&
+		!this->req.set_peer_features(__features(peer_features_)))
+	{
+		status_code = RPCStatusAttachmentNotSupported;
+	}
 
 	if (status_code == RPCStatusOK)
 	{
@@ -495,6 +1478,16 @@ CommMessageOut *RPCClientTask<RPCREQ, RPCRESP>::message_out()
 
 template<class RPCREQ, class RPCRESP>
 bool RPCClientTask<RPCREQ, RPCRESP>::finish_once()
+{
+	// a hedged task has it done by hedge_done()
+	if (!hedge_)
+		this->reply_meta(peer_features_);
+
+	return true;
+}
+
+template<class RPCREQ, class RPCRESP>
+void RPCClientTask<RPCREQ, RPCRESP>::reply_meta(std::atomic<uint32_t> *features)
 {
 	int status_code = this->resp.get_status_code();
 
@@ -503,19 +1496,34 @@ bool RPCClientTask<RPCREQ, RPCRESP>::finish_once()
 	{
 		if (this->resp.deserialize_meta() == false)
 			this->resp.set_status_code(RPCStatusMetaError);
-	}
+		else if (features)
+		{
+			uint32_t peer = this->resp.get_peer_features();
 
-	return true;
+			// mostly the same, so it is only read
+			if (peer != 0 && peer != features->load(std::memory_order_relaxed))
+				features->store(peer, std::memory_order_relaxed);
+		}
+	}
 }
 
 template<class RPCREQ, class RPCRESP>
 void RPCClientTask<RPCREQ, RPCRESP>::rpc_callback(WFNetworkTask<RPCREQ, RPCRESP> *task)
 {
-	RPCWorker worker(new RPCContextImpl<RPCREQ, RPCRESP>(this, &module_data_),
-					 &this->req, &this->resp);
+	auto *ctx = new RPCContextImpl<RPCREQ, RPCRESP>(this, &module_data_);
 
+	if (hedge_addrlen_ != 0)
+	{
+		ctx->set_attempt(hedge_attempt_, (struct sockaddr *)&hedge_addr_,
+						 hedge_addrlen_);
+	}
+
+	RPCWorker worker(ctx, &this->req, &this->resp);
 	int status_code = this->resp.get_status_code();
 
+	if (use_arena_)
+		worker.enable_arena(this->resp.get_message_len());
+
 	if (status_code != RPCStatusOK && status_code != RPCStatusUndefined)
 	{
 		this->state = WFT_STATE_TASK_ERROR;
@@ -592,6 +1600,14 @@ void RPCClientTask<RPCREQ, RPCRESP>::rpc_callback(WFNetworkTask<RPCREQ, RPCRESP>
 //		else
 //			this->resp.get_meta_module_data(resp_data);
 
+		// the last state of the breaker changed by this task
+		if (breaker_changed_ >= 0)
+		{
+			(*resp_data)[SRPC_BREAKER_STATE] =
+					RPCCircuitBreaker::state_string(breaker_changed_);
+			(*resp_data)[SRPC_BREAKER_ENDPOINT] = circuit_->get_endpoint();
+		}
+
 		for (auto *module : modules_)
 		{
 			// do not affect status_code, which is important for user_done_
@@ -624,6 +1640,27 @@ bool RPCClientTask<RPCREQ, RPCRESP>::get_remote(std::string& ip,
 	return false;
 }
 
+template<class RPCREQ, class RPCRESP>
+int RPCClientTask<RPCREQ, RPCRESP>::get_peer_addr(struct sockaddr *addr,
+												  socklen_t *addrlen) const
+{
+	if (hedge_addrlen_ == 0)
+	{
+		return this->WFComplexClientTask<RPCREQ, RPCRESP>::get_peer_addr(addr,
+																		 addrlen);
+	}
+
+	if (*addrlen < hedge_addrlen_)
+	{
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	memcpy(addr, &hedge_addr_, hedge_addrlen_);
+	*addrlen = hedge_addrlen_;
+	return 0;
+}
+
 template<class RPCREQ, class RPCRESP>
 bool RPCServerTask<RPCREQ, RPCRESP>::get_remote(std::string& ip,
 												unsigned short *port) const
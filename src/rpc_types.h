@@ -36,6 +36,12 @@ struct RPCTYPESRPC
 	static inline void server_reply_init(const REQ *req, RESP *resp)
 	{
 		resp->set_data_type(req->get_data_type());
+		// the compress type is set by the method, the lookup waits for it
+		resp->set_dictionary_names(&req->get_service_name(),
+								   &req->get_method_name());
+		// a client only knows the version it has sent
+		resp->set_meta_version(req->get_meta_version());
+		resp->set_seqid(req->get_seqid());
 	}
 };
 
@@ -48,6 +54,9 @@ struct RPCTYPESRPCHttp
 	static inline void server_reply_init(const REQ *req, RESP *resp)
 	{
 		resp->set_data_type(req->get_data_type());
+		// the compress type is set by the method, the lookup waits for it
+		resp->set_dictionary_names(&req->get_service_name(),
+								   &req->get_method_name());
 	}
 };
 
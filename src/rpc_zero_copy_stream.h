@@ -18,6 +18,7 @@
 #define __RPC_ZERO_COPY_STREAM_H__
 
 #include <google/protobuf/io/zero_copy_stream.h>
+#include "rpc_compress.h"
 
 namespace srpc
 {
@@ -48,6 +49,23 @@ private:
 	RPCBuffer *buf;
 };
 
+// inflate the compressed body window by window while parsing
+class RPCDecompressInputStream : public google::protobuf::io::ZeroCopyInputStream
+{
+public:
+	RPCDecompressInputStream(RPCDecompressStream *stream);
+	bool Next(const void **data, int *size) override;
+	void BackUp(int count) override;
+	bool Skip(int count) override;
+	int64_t ByteCount() const override;
+
+private:
+	RPCDecompressStream *stream;
+	const void *window;
+	int window_len;
+	int backup;
+};
+
 inline RPCOutputStream::RPCOutputStream(RPCBuffer *buf, size_t size)
 {
 	this->buf = buf;
@@ -122,6 +140,68 @@ inline int64_t RPCInputStream::ByteCount() const
 	return (int64_t)this->buf->size();
 }
 
+inline RPCDecompressInputStream::RPCDecompressInputStream(RPCDecompressStream *stream)
+{
+	this->stream = stream;
+	this->window = NULL;
+	this->window_len = 0;
+	this->backup = 0;
+}
+
+inline bool RPCDecompressInputStream::Next(const void **data, int *size)
+{
+	if (this->backup > 0)
+	{
+		*data = (const char *)this->window + this->window_len - this->backup;
+		*size = this->backup;
+		this->backup = 0;
+		return true;
+	}
+
+	int ret = this->stream->next(&this->window);
+
+	if (ret <= 0)
+	{
+		this->window_len = 0;
+		return false;
+	}
+
+	this->window_len = ret;
+	*data = this->window;
+	*size = ret;
+	return true;
+}
+
+inline void RPCDecompressInputStream::BackUp(int count)
+{
+	// only the last Next() can be backed up
+	this->backup += count;
+}
+
+inline bool RPCDecompressInputStream::Skip(int count)
+{
+	const void *data;
+	int size;
+
+	while (count > 0 && this->Next(&data, &size))
+	{
+		if (size > count)
+		{
+			this->BackUp(size - count);
+			return true;
+		}
+
+		count -= size;
+	}
+
+	return count == 0;
+}
+
+inline int64_t RPCDecompressInputStream::ByteCount() const
+{
+	return (int64_t)this->stream->byte_count() - this->backup;
+}
+
 } // namespace srpc
 
 #endif
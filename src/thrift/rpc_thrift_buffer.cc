@@ -14,20 +14,100 @@
   limitations under the License.
 */
 
+#include <algorithm>
 #include "rpc_thrift_buffer.h"
 #include "rpc_basic.h"
+#include "rpc_compress.h"
 
 namespace srpc
 {
 
+bool ThriftBuffer::next_window()
+{
+	int ret = this->stream->next(&this->window);
+
+	this->window_pos = 0;
+	this->window_len = ret > 0 ? ret : 0;
+	return ret > 0;
+}
+
+size_t ThriftBuffer::peek(const void **buf)
+{
+	if (!this->stream)
+		return this->buffer->peek(buf);
+
+	if (this->window_pos == this->window_len && !this->next_window())
+	{
+		*buf = NULL;
+		return 0;
+	}
+
+	*buf = (const char *)this->window + this->window_pos;
+	return this->window_len - this->window_pos;
+}
+
+long ThriftBuffer::seek(long offset)
+{
+	if (!this->stream)
+		return this->buffer->seek(offset);
+
+	if (offset < 0)
+	{
+		if ((size_t)-offset > this->window_pos)
+			offset = -(long)this->window_pos;
+
+		this->window_pos += offset;
+		return offset;
+	}
+
+	long moved = 0;
+
+	while (moved < offset)
+	{
+		if (this->window_pos == this->window_len && !this->next_window())
+			break;
+
+		size_t len = std::min((size_t)(offset - moved),
+							  this->window_len - this->window_pos);
+
+		this->window_pos += len;
+		moved += len;
+	}
+
+	return moved;
+}
+
+bool ThriftBuffer::read(void *buf, size_t len)
+{
+	if (!this->stream)
+		return this->buffer->read(buf, len);
+
+	char *p = (char *)buf;
+
+	while (len > 0)
+	{
+		if (this->window_pos == this->window_len && !this->next_window())
+			return false;
+
+		size_t n = std::min(len, this->window_len - this->window_pos);
+
+		memcpy(p, (const char *)this->window + this->window_pos, n);
+		this->window_pos += n;
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
 bool ThriftBuffer::readI08(int8_t& val)
 {
-	return this->buffer->read((char *)&val, 1);
+	return this->read((char *)&val, 1);
 }
 
 bool ThriftBuffer::readI16(int16_t& val)
 {
-	if (!this->buffer->read((char *)&val, 2))
+	if (!this->read((char *)&val, 2))
 		return false;
 
 	val = ntohs(val);
@@ -36,7 +116,7 @@ bool ThriftBuffer::readI16(int16_t& val)
 
 bool ThriftBuffer::readI32(int32_t& val)
 {
-	if (!this->buffer->read((char *)&val, 4))
+	if (!this->read((char *)&val, 4))
 		return false;
 
 	val = ntohl(val);
@@ -45,7 +125,7 @@ bool ThriftBuffer::readI32(int32_t& val)
 
 bool ThriftBuffer::readI64(int64_t& val)
 {
-	if (!this->buffer->read((char *)&val, 8))
+	if (!this->read((char *)&val, 8))
 		return false;
 
 	val = ntohll(val);
@@ -54,7 +134,7 @@ bool ThriftBuffer::readI64(int64_t& val)
 
 bool ThriftBuffer::readU64(uint64_t& val)
 {
-	if (!this->buffer->read((char *)&val, 8))
+	if (!this->read((char *)&val, 8))
 		return false;
 
 	val = ntohll(val);
@@ -93,7 +173,7 @@ bool ThriftBuffer::readStringBody(std::string& str, int32_t slen)
 		return false;
 
 	str.resize(slen);
-	return this->buffer->read(const_cast<char *>(str.c_str()), slen);
+	return this->read(const_cast<char *>(str.c_str()), slen);
 }
 
 bool ThriftBuffer::writeFieldStop()
@@ -256,18 +336,18 @@ bool ThriftBuffer::skip(int8_t field_type)
 	{
 	case TDT_I08:
 	case TDT_BOOL:
-		return this->buffer->seek(1) == 1;
+		return this->seek(1) == 1;
 
 	case TDT_I16:
-		return this->buffer->seek(2) == 2;
+		return this->seek(2) == 2;
 
 	case TDT_I32:
-		return this->buffer->seek(4) == 4;
+		return this->seek(4) == 4;
 
 	case TDT_I64:
 	case TDT_U64:
 	case TDT_DOUBLE:
-		return this->buffer->seek(8) == 8;
+		return this->seek(8) == 8;
 
 	case TDT_STRING:
 	case TDT_UTF8:
@@ -278,7 +358,7 @@ bool ThriftBuffer::skip(int8_t field_type)
 		if (!readI32(slen) || slen < 0)
 			return false;
 
-		return this->buffer->seek(slen) == slen;
+		return this->seek(slen) == slen;
 	}
 	case TDT_STRUCT:
 	{
@@ -26,6 +26,8 @@
 namespace srpc
 {
 
+class RPCDecompressStream;
+
 static constexpr int32_t THRIFT_VERSION_MASK	=	((int32_t)0xffff0000);
 static constexpr int32_t THRIFT_VERSION_1		=	((int32_t)0x80010000);
 
@@ -66,6 +68,8 @@ public:
 	size_t framesize_read_byte = 0;
 	int32_t framesize = 0;
 	int status = THRIFT_GET_FRAME_SIZE;
+	// inflate while reading instead of buffer if not NULL
+	RPCDecompressStream *stream = NULL;
 
 public:
 	ThriftBuffer(RPCBuffer *buf): buffer(buf) { }
@@ -76,6 +80,11 @@ public:
 	ThriftBuffer& operator= (ThriftBuffer &&move) = delete;
 
 public:
+	// same as RPCBuffer, seek back is only inside the last window of stream
+	size_t peek(const void **buf);
+	long seek(long offset);
+	bool read(void *buf, size_t len);
+
 	bool readMessageBegin();
 	bool readFieldBegin(int8_t& field_type, int16_t& field_id);
 	bool readI08(int8_t& val);
@@ -97,6 +106,13 @@ public:
 	bool writeU64(uint64_t val);
 	bool writeString(const std::string& str);
 	bool writeStringBody(const std::string& str);
+
+private:
+	bool next_window();
+
+	const void *window = NULL;
+	size_t window_len = 0;
+	size_t window_pos = 0;
 };
 
 } // end namespace srpc
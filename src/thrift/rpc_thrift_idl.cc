@@ -48,7 +48,7 @@ bool ThriftJsonUtil::skip_whitespace(ThriftBuffer *buffer)
 	const void *buf;
 	size_t buflen;
 
-	while (buflen = buffer->buffer->peek(&buf), buf && buflen > 0)
+	while (buflen = buffer->peek(&buf), buf && buflen > 0)
 	{
 		char *base = (char *)buf;
 
@@ -56,12 +56,12 @@ bool ThriftJsonUtil::skip_whitespace(ThriftBuffer *buffer)
 		{
 			if (!isspace(base[i]))
 			{
-				buffer->buffer->seek(i);
+				buffer->seek(i);
 				return true;
 			}
 		}
 
-		buffer->buffer->seek(buflen);
+		buffer->seek(buflen);
 	}
 
 	return false;
@@ -73,7 +73,7 @@ bool ThriftJsonUtil::peek_first_meaningful_char(ThriftBuffer *buffer, char& ch)
 		return false;
 
 	const void *buf;
-	size_t buflen = buffer->buffer->peek(&buf);
+	size_t buflen = buffer->peek(&buf);
 
 	if (buf && buflen > 0)
 	{
@@ -91,7 +91,7 @@ bool ThriftJsonUtil::skip_character(ThriftBuffer *buffer, char ch)
 	if (!peek_first_meaningful_char(buffer, mchar))
 		return false;
 
-	buffer->buffer->seek(1);
+	buffer->seek(1);
 	return mchar == ch;
 }
 
@@ -104,7 +104,7 @@ bool ThriftJsonUtil::skip_simple_string(ThriftBuffer *buffer, const std::string&
 	const void *buf;
 	size_t buflen;
 
-	while (cur < str.size() && (buflen = buffer->buffer->peek(&buf), buf && buflen > 0))
+	while (cur < str.size() && (buflen = buffer->peek(&buf), buf && buflen > 0))
 	{
 		size_t i = 0;
 		char *base = (char *)buf;
@@ -115,7 +115,7 @@ bool ThriftJsonUtil::skip_simple_string(ThriftBuffer *buffer, const std::string&
 				return false;
 		}
 
-		buffer->buffer->seek(i);
+		buffer->seek(i);
 	}
 
 	return cur == str.size();
@@ -135,11 +135,11 @@ bool ThriftJsonUtil::read_int64(ThriftBuffer *buffer, int64_t& intv)
 	if (ch == '-')
 	{
 		is_negative = true;
-		buffer->buffer->seek(1);
+		buffer->seek(1);
 	}
 
 	intv = 0;
-	while (buflen = buffer->buffer->peek(&buf), buf && buflen > 0)
+	while (buflen = buffer->peek(&buf), buf && buflen > 0)
 	{
 		size_t i = 0;
 		char *base = (char *)buf;
@@ -156,7 +156,7 @@ bool ThriftJsonUtil::read_int64(ThriftBuffer *buffer, int64_t& intv)
 
 			if (!isdigit(base[i]))
 			{
-				buffer->buffer->seek(i);
+				buffer->seek(i);
 				if (is_negative)
 					intv *= -1;
 
@@ -167,7 +167,7 @@ bool ThriftJsonUtil::read_int64(ThriftBuffer *buffer, int64_t& intv)
 			intv += base[i] - '0';
 		}
 
-		buffer->buffer->seek(buflen);
+		buffer->seek(buflen);
 	}
 
 	if (!first_digit)
@@ -193,7 +193,7 @@ bool ThriftJsonUtil::read_uint64(ThriftBuffer *buffer, uint64_t& intv)
 		return false;
 
 	intv = 0;
-	while (buflen = buffer->buffer->peek(&buf), buf && buflen > 0)
+	while (buflen = buffer->peek(&buf), buf && buflen > 0)
 	{
 		size_t i = 0;
 		char *base = (char *)buf;
@@ -210,7 +210,7 @@ bool ThriftJsonUtil::read_uint64(ThriftBuffer *buffer, uint64_t& intv)
 
 			if (!isdigit(base[i]))
 			{
-				buffer->buffer->seek(i);
+				buffer->seek(i);
 				return true;
 			}
 
@@ -218,7 +218,7 @@ bool ThriftJsonUtil::read_uint64(ThriftBuffer *buffer, uint64_t& intv)
 			intv += base[i] - '0';
 		}
 
-		buffer->buffer->seek(buflen);
+		buffer->seek(buflen);
 	}
 
 	if (!first_digit)
@@ -236,7 +236,7 @@ bool ThriftJsonUtil::read_double(ThriftBuffer *buffer, double& d)
 	size_t buflen;
 	std::string str;
 
-	while (buflen = buffer->buffer->peek(&buf), buf && buflen > 0)
+	while (buflen = buffer->peek(&buf), buf && buflen > 0)
 	{
 		size_t i = 0;
 		char *base = (char *)buf;
@@ -253,7 +253,7 @@ bool ThriftJsonUtil::read_double(ThriftBuffer *buffer, double& d)
 		if (i < buflen)
 			break;
 
-		buffer->buffer->seek(buflen);
+		buffer->seek(buflen);
 	}
 
 	if (str.empty())
@@ -271,7 +271,7 @@ bool ThriftJsonUtil::read_double(ThriftBuffer *buffer, double& d)
 		 || end > str.c_str() + str.size())	// should never happend
 		return false;
 
-	buffer->buffer->seek(str.c_str() + str.size() - end);
+	buffer->seek(str.c_str() + str.size() - end);
 	return true;
 }
 
@@ -295,7 +295,7 @@ bool ThriftJsonUtil::read_string(ThriftBuffer *buffer, std::string *str)
 	if (str)
 		str->clear();
 
-	while (buflen = buffer->buffer->peek(&buf), buf && buflen > 0)
+	while (buflen = buffer->peek(&buf), buf && buflen > 0)
 	{
 		size_t i = 0;
 		char *base = (char *)buf;
@@ -314,7 +314,7 @@ bool ThriftJsonUtil::read_string(ThriftBuffer *buffer, std::string *str)
 							str->append(base, base + i - 1);
 					}
 
-					buffer->buffer->seek(i);
+					buffer->seek(i);
 					return true;
 				}
 				else if (ch == '\\')
@@ -430,7 +430,7 @@ bool ThriftJsonUtil::read_string(ThriftBuffer *buffer, std::string *str)
 		if (str)
 			str->append(base, base + buflen);
 
-		buffer->buffer->seek(buflen);
+		buffer->seek(buflen);
 	}
 
 	return false;
@@ -447,7 +447,7 @@ bool ThriftJsonUtil::skip_one_element(ThriftBuffer *buffer)
 	{
 		while (ch != '}')
 		{
-			buffer->buffer->seek(1);
+			buffer->seek(1);
 			if (!read_string(buffer, nullptr))
 				return false;
 
@@ -470,7 +470,7 @@ bool ThriftJsonUtil::skip_one_element(ThriftBuffer *buffer)
 	{
 		while (ch != ']')
 		{
-			buffer->buffer->seek(1);
+			buffer->seek(1);
 			if (!skip_one_element(buffer))
 				return false;
 
@@ -22,6 +22,7 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <atomic>
 #include "rpc_thrift_buffer.h"
 
 namespace srpc
@@ -102,6 +103,108 @@ public:
 	virtual ~ThriftIDLMessage() { }
 };
 
+static constexpr size_t	THRIFT_POOL_MAX_CACHED		= 8;
+static constexpr size_t	THRIFT_POOL_HIGH_WATER		= 256 * 1024;
+
+// give a struct back with the size it had on the wire
+using ThriftIDLRelease = void (*)(ThriftIDLMessage *, size_t);
+
+/**
+ * @brief   Per-thread free list of one generated struct
+ * @details
+ * - Each thrift method has its own request and response struct,
+ *   so this is a pool per method
+ * - put() resets the struct by copying a default one into it,
+ *   strings and vectors keep their capacity for the next get()
+ * - At most get_max_cached() structs are kept by each thread, and a struct
+ *   more than get_high_water() bytes on the wire is freed instead
+ */
+template<class T>
+class ThriftIDLPool
+{
+public:
+	static T *get();
+	static void put(ThriftIDLMessage *msg, size_t wire_size);
+
+	/**
+	 * @brief      0 means never keep any. Default is THRIFT_POOL_MAX_CACHED
+	 */
+	static void set_max_cached(size_t n) { max_cached_ = n; }
+	static size_t get_max_cached() { return max_cached_; }
+
+	/**
+	 * @brief      Default is THRIFT_POOL_HIGH_WATER
+	 */
+	static void set_high_water(size_t bytes) { high_water_ = bytes; }
+	static size_t get_high_water() { return high_water_; }
+
+private:
+	struct cache_t
+	{
+		std::vector<T *> free_list;
+
+		~cache_t()
+		{
+			for (T *st : free_list)
+				delete st;
+		}
+	};
+
+	static cache_t *local_cache()
+	{
+		static thread_local cache_t cache;
+
+		return &cache;
+	}
+
+	static const T& default_instance()
+	{
+		static const T kDefault;
+
+		return kDefault;
+	}
+
+	static std::atomic<size_t> max_cached_;
+	static std::atomic<size_t> high_water_;
+};
+
+template<class T>
+std::atomic<size_t> ThriftIDLPool<T>::max_cached_(THRIFT_POOL_MAX_CACHED);
+
+template<class T>
+std::atomic<size_t> ThriftIDLPool<T>::high_water_(THRIFT_POOL_HIGH_WATER);
+
+template<class T>
+inline T *ThriftIDLPool<T>::get()
+{
+	cache_t *cache = local_cache();
+
+	if (cache->free_list.empty())
+		return new T;
+
+	T *st = cache->free_list.back();
+
+	cache->free_list.pop_back();
+	return st;
+}
+
+template<class T>
+inline void ThriftIDLPool<T>::put(ThriftIDLMessage *msg, size_t wire_size)
+{
+	T *st = static_cast<T *>(msg);
+	cache_t *cache = local_cache();
+
+	if (wire_size > high_water_.load(std::memory_order_relaxed) ||
+		cache->free_list.size() >= max_cached_.load(std::memory_order_relaxed))
+	{
+		delete st;
+		return;
+	}
+
+	*st = default_instance();
+	cache->free_list.push_back(st);
+}
+
 } // end namespace srpc
 
 #include "rpc_thrift_idl.inl"
@@ -133,7 +133,7 @@ public:
 		{
 			if (ch == ']')
 			{
-				buffer->buffer->seek(1);
+				buffer->seek(1);
 				return true;
 			}
 
@@ -141,7 +141,7 @@ public:
 				is_first = false;
 			else
 			{
-				buffer->buffer->seek(1);
+				buffer->seek(1);
 				if (ch != ',')
 					break;
 			}
@@ -265,7 +265,7 @@ public:
 		{
 			if (ch == ']')
 			{
-				buffer->buffer->seek(1);
+				buffer->seek(1);
 				return true;
 			}
 
@@ -273,7 +273,7 @@ public:
 				is_first = false;
 			else
 			{
-				buffer->buffer->seek(1);
+				buffer->seek(1);
 				if (ch != ',')
 					break;
 			}
@@ -394,7 +394,7 @@ public:
 		{
 			if (ch == ']')
 			{
-				buffer->buffer->seek(1);
+				buffer->seek(1);
 				return true;
 			}
 
@@ -402,7 +402,7 @@ public:
 				is_first = false;
 			else
 			{
-				buffer->buffer->seek(1);
+				buffer->seek(1);
 				if (ch != ',')
 					break;
 			}
@@ -543,7 +543,7 @@ public:
 		{
 			if (ch == ']')
 			{
-				buffer->buffer->seek(1);
+				buffer->seek(1);
 				return true;
 			}
 
@@ -551,7 +551,7 @@ public:
 				is_first = false;
 			else
 			{
-				buffer->buffer->seek(1);
+				buffer->seek(1);
 				if (ch != ',')
 					break;
 			}
@@ -724,7 +724,7 @@ public:
 		{
 			if (ch == '}')
 			{
-				buffer->buffer->seek(1);
+				buffer->seek(1);
 				return true;
 			}
 
@@ -732,7 +732,7 @@ public:
 				is_first = false;
 			else
 			{
-				buffer->buffer->seek(1);
+				buffer->seek(1);
 				if (ch != ',')
 					break;
 			}
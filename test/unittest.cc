@@ -20,11 +20,19 @@
 #include <fcntl.h>
 #include <string.h>
 #include <string>
+#include <thread>
 #include <gtest/gtest.h>
+#include <google/protobuf/util/json_util.h>
+#include <google/protobuf/util/message_differencer.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include "workflow/WFOperator.h"
 #include "workflow/WFFacilities.h"
 #include "test_pb.srpc.h"
 #include "test_thrift.srpc.h"
+#include "srpc/rpc_pb_json.h"
+#include "srpc/rpc_compress.h"
+#include "srpc/rpc_load_balancer.h"
+#include "srpc/rpc_breaker.h"
 
 using namespace srpc;
 using namespace unit;
@@ -273,3 +281,1483 @@ TEST(SRPC_COMPRESS, unittest)
 	server.stop();
 }
 
+
+static std::string buffer_string(RPCBuffer *buf)
+{
+	std::string str;
+	const void *p;
+	size_t size;
+
+	buf->rewind();
+	while ((size = buf->fetch(&p)) > 0)
+		str.append((const char *)p, size);
+
+	return str;
+}
+
+TEST(SRPC_COMPRESS, blocks)
+{
+	RPCCompressor *compressor = RPCCompressor::get_instance();
+	const size_t block_size = 16 * 1024;
+	std::string origin;
+
+	for (int i = 0; origin.size() < 5 * block_size + 100; i++)
+		origin += "block " + std::to_string(i % 1000) + ", ";
+
+	for (int type : { RPCCompressGzip, RPCCompressZlib, RPCCompressLz4 })
+	{
+		RPCBuffer src;
+		RPCBuffer blocks;
+		RPCBuffer dest;
+
+		src.append(origin.data(), origin.size(), BUFFER_MODE_NOCOPY);
+		int ret = compressor->serialize_to_compressed_blocks(&src, &blocks,
+															 type, block_size);
+		ASSERT_GT(ret, 0);
+		EXPECT_EQ((size_t)ret, blocks.size());
+
+		ret = compressor->parse_from_compressed_blocks(&blocks, &dest, type,
+													   block_size);
+		EXPECT_EQ((size_t)ret, origin.size());
+		EXPECT_EQ(buffer_string(&dest), origin);
+
+		// the blocks of the peer inflate beyond its block_size
+		RPCBuffer small;
+
+		ret = compressor->parse_from_compressed_blocks(&blocks, &small, type,
+													   block_size / 2);
+		EXPECT_EQ(ret, -1);
+
+		// a block shorter than block_size but the last
+		RPCBuffer large;
+
+		ret = compressor->parse_from_compressed_blocks(&blocks, &large, type,
+													   block_size * 2);
+		EXPECT_EQ(ret, -1);
+
+		std::string frame = buffer_string(&blocks);
+		std::vector<std::string> corrupt;
+
+		// truncated
+		corrupt.push_back(frame.substr(0, frame.size() - 1));
+		corrupt.push_back(frame.substr(0, 2));
+		// a zero size
+		corrupt.push_back(std::string(4, '\0') + frame);
+		// a size beyond the frame
+		corrupt.push_back(frame);
+		corrupt.back()[0] = '\x7f';
+		// garbage in the data of the first block
+		corrupt.push_back(frame);
+		for (size_t i = 4; i < 40 && i < frame.size(); i++)
+			corrupt.back()[i] = (char)~corrupt.back()[i];
+
+		for (const std::string& bad : corrupt)
+		{
+			RPCBuffer in;
+			RPCBuffer out;
+
+			in.append(bad.data(), bad.size(), BUFFER_MODE_NOCOPY);
+			ret = compressor->parse_from_compressed_blocks(&in, &out, type,
+														   block_size);
+			EXPECT_LT(ret, 0) << "type " << type;
+		}
+	}
+
+	// one small block of zeros inflates to far more than its block_size
+	std::string zeros(4 * 1024 * 1024, '\0');
+	RPCBuffer src;
+	RPCBuffer bomb;
+	RPCBuffer dest;
+
+	src.append(zeros.data(), zeros.size(), BUFFER_MODE_NOCOPY);
+	ASSERT_GT(compressor->serialize_to_compressed_blocks(&src, &bomb,
+							RPCCompressGzip, zeros.size()), 0);
+	EXPECT_LT(bomb.size(), (size_t)64 * 1024);
+	EXPECT_EQ(compressor->parse_from_compressed_blocks(&bomb, &dest,
+										RPCCompressGzip, 1024), -1);
+
+	// what a block is decompressed by, it stops right after 1024 bytes
+	RPCBuffer block;
+	RPCDecompressStream *stream;
+
+	bomb.share(4, bomb.size() - 4, &block);
+	stream = compressor->new_decompress_stream(&block, RPCCompressGzip, 0);
+	ASSERT_TRUE(stream != NULL);
+	EXPECT_EQ(stream->read_all(&dest, 1024), -1);
+	EXPECT_LE(dest.size(), (size_t)1025);
+	delete stream;
+}
+
+
+TEST(RPCBufferPool, reuse)
+{
+	RPCBufferPoolStats st1, st2;
+	size_t size = 3000;
+	void *p1;
+	void *p2;
+
+	RPCBufferPool::get_stats(&st1);
+	p1 = RPCBufferPool::get(&size);
+	EXPECT_EQ(size, 4096);
+	RPCBufferPool::put(p1, size);
+	p2 = RPCBufferPool::get(&size);
+	EXPECT_EQ(p1, p2);
+	RPCBufferPool::get_stats(&st2);
+	EXPECT_EQ(st2.hit - st1.hit, 1);
+	EXPECT_EQ(st2.miss - st1.miss, 1);
+	RPCBufferPool::put(p2, size);
+
+	// larger than the max class goes to malloc, not counted
+	size = BUFFER_PIECE_MAX_SIZE + 1;
+	p1 = RPCBufferPool::get(&size);
+	EXPECT_EQ(size, BUFFER_PIECE_MAX_SIZE + 1);
+	RPCBufferPool::put(p1, size);
+
+	// the total cap also bounds pieces put back by this thread
+	size_t total = RPCBufferPool::get_max_retained_total();
+
+	size = 2048;
+	p1 = RPCBufferPool::get(&size);
+	RPCBufferPool::get_stats(&st1);
+	RPCBufferPool::set_max_retained_total(st1.retained_bytes);
+	RPCBufferPool::put(p1, size);
+	RPCBufferPool::get_stats(&st2);
+	EXPECT_EQ(st2.retained_bytes, st1.retained_bytes);
+	RPCBufferPool::set_max_retained_total(total);
+
+	// off, the pieces kept are freed and nothing is kept any more
+	RPCBufferPool::set_enabled(false);
+	EXPECT_FALSE(RPCBufferPool::get_enabled());
+	size = 2048;
+	p1 = RPCBufferPool::get(&size);
+	RPCBufferPool::put(p1, size);
+	RPCBufferPool::get_stats(&st1);
+	EXPECT_EQ(st1.retained_bytes, 0);
+	RPCBufferPool::set_enabled(true);
+}
+
+static std::string iov_to_string(const struct iovec *iov, int n)
+{
+	std::string str;
+
+	for (int i = 0; i < n; i++)
+		str.append((const char *)iov[i].iov_base, iov[i].iov_len);
+
+	return str;
+}
+
+TEST(RPCBuffer, coalesce)
+{
+	std::string big(64 * 1024, 'b');
+	std::string expect;
+	RPCBuffer buf;
+	struct iovec iov[8];
+	int n;
+
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 10; j++)
+		{
+			std::string small(100, 'a' + j);
+
+			buf.append(small.data(), small.size(), BUFFER_MODE_COPY);
+			buf.append(big.data(), 16, BUFFER_MODE_NOCOPY);
+			expect += small + big.substr(0, 16);
+		}
+
+		buf.append(big.data(), big.size(), BUFFER_MODE_NOCOPY);
+		expect += big;
+	}
+
+	n = buf.encode(iov, 8);
+	EXPECT_GT(n, 0);
+	EXPECT_LE(n, 8);
+	EXPECT_EQ(iov_to_string(iov, n), expect);
+
+	// large pieces are never copied
+	int big_kept = 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		if (iov[i].iov_base == big.data() && iov[i].iov_len == big.size())
+			big_kept++;
+	}
+
+	EXPECT_EQ(big_kept, 3);
+
+	// encode again gives the same bytes
+	n = buf.encode(iov, 8);
+	EXPECT_EQ(iov_to_string(iov, n), expect);
+
+	n = buf.encode(iov, 1);
+	EXPECT_EQ(n, 1);
+	EXPECT_EQ(iov_to_string(iov, n), expect);
+	EXPECT_EQ(buf.size(), expect.size());
+}
+
+static std::string buffer_to_string(RPCBuffer *buf)
+{
+	std::string str;
+	const void *p;
+	size_t n;
+
+	buf->rewind();
+	while ((n = buf->fetch(&p)) > 0)
+		str.append((const char *)p, n);
+
+	return str;
+}
+
+TEST(RPCBuffer, share_cut)
+{
+	std::string nocopy(3000, 'n');
+	std::string expect;
+	RPCBuffer *buf = new RPCBuffer();
+	RPCBuffer head;
+	RPCBuffer tail;
+	RPCBuffer part;
+
+	for (int i = 0; i < 4; i++)
+	{
+		std::string piece(5000, 'a' + i);
+
+		buf->write(piece.data(), piece.size());
+		buf->append(nocopy.data(), nocopy.size(), BUFFER_MODE_NOCOPY);
+		expect += piece + nocopy;
+	}
+
+	EXPECT_EQ(buffer_to_string(buf), expect);
+
+	// across pieces, inside a piece at both ends
+	EXPECT_EQ(buf->share(4000, 10000, &part), 10000);
+	EXPECT_EQ(buffer_to_string(&part), expect.substr(4000, 10000));
+	EXPECT_EQ(buf->share(expect.size() - 10, 100, &part), 10);
+	EXPECT_EQ(part.size(), 10010);
+
+	// the piece across offset is shared by both sides
+	EXPECT_EQ(buf->cut(9000, &tail), expect.size() - 9000);
+	EXPECT_EQ(buf->size(), 9000);
+	EXPECT_EQ(buffer_to_string(buf), expect.substr(0, 9000));
+	EXPECT_EQ(buffer_to_string(&tail), expect.substr(9000));
+
+	// cut at a piece border moves whole pieces
+	EXPECT_EQ(buf->cut(8000, &head), 1000);
+	EXPECT_EQ(buffer_to_string(&head), expect.substr(8000, 1000));
+
+	// pieces live until the last owner is gone
+	delete buf;
+	EXPECT_EQ(buffer_to_string(&part).substr(0, 10000),
+			  expect.substr(4000, 10000));
+	EXPECT_EQ(buffer_to_string(&tail), expect.substr(9000));
+
+	// the shared tail may not be acquired into
+	void *p;
+	size_t size = 100;
+
+	EXPECT_TRUE(head.acquire(&p, &size));
+	memset(p, 'x', size);
+	EXPECT_EQ(buffer_to_string(&tail), expect.substr(9000));
+}
+
+// what the network does between encode() and append()
+template<class MSG>
+static int transfer(MSG *req, MSG *peer, int max)
+{
+	struct iovec vectors[64];
+	int cnt = req->encode(vectors, max);
+	int ret = 0;
+
+	for (int i = 0; i < cnt && ret == 0; i++)
+	{
+		size_t size = vectors[i].iov_len;
+
+		ret = peer->append(vectors[i].iov_base, &size);
+	}
+
+	return ret == 1 ? cnt : -1;
+}
+
+TEST(SRPCAttachment, unittest)
+{
+	std::string body_pieces[3] = { std::string(3000, 'x'),
+								   std::string(3000, 'y'),
+								   std::string(3000, 'z') };
+	std::string att_pieces[3] = { std::string(5000, 'a'),
+								  std::string(5000, 'b'),
+								  std::string(5000, 'c') };
+	std::string att = att_pieces[0] + att_pieces[1] + att_pieces[2];
+	SRPCStdRequest req;
+	SRPCStdRequest peer;
+	SubstrRequest msg;
+	SubstrRequest out;
+	const char *p;
+	size_t len;
+
+	msg.set_str(body_pieces[0] + body_pieces[1] + body_pieces[2]);
+	msg.set_idx(0);
+	req.set_service_name("TestPB");
+	req.set_method_name("Substr");
+	req.set_data_type(RPCDataProtobuf);
+	EXPECT_EQ(req.serialize(&msg), RPCStatusOK);
+	for (const auto& piece : att_pieces)
+		req.set_attachment_nocopy(piece.data(), piece.size());
+
+	// unknown or an old peer, it is never sent
+	EXPECT_FALSE(req.set_peer_features(0));
+	EXPECT_FALSE(req.set_peer_features(SRPC_FEATURE_KNOWN));
+	EXPECT_TRUE(req.serialize_meta());
+	EXPECT_GT(transfer(&req, &peer, 64), 0);
+	EXPECT_TRUE(peer.deserialize_meta());
+	EXPECT_FALSE(peer.get_attachment_nocopy(&p, &len));
+	EXPECT_EQ(peer.deserialize(&out), RPCStatusOK);
+	EXPECT_EQ(out.str(), msg.str());
+	// and a new one says it can receive
+	EXPECT_EQ(peer.get_peer_features(),
+			  SRPC_FEATURE_KNOWN | SRPC_FEATURE_ATTACHMENT |
+			  SRPC_FEATURE_META_V2);
+
+	// fewer vectors than pieces, both sides get some, all bytes are there
+	for (int max : { 64, 6, 4 })
+	{
+		SRPCStdRequest peer;
+
+		EXPECT_TRUE(req.set_peer_features(SRPC_FEATURE_KNOWN |
+										  SRPC_FEATURE_ATTACHMENT));
+		EXPECT_TRUE(req.serialize_meta());
+		EXPECT_GT(transfer(&req, &peer, max), 0);
+		EXPECT_TRUE(peer.deserialize_meta());
+		EXPECT_TRUE(peer.get_attachment_nocopy(&p, &len));
+		EXPECT_EQ(std::string(p, len), att);
+		EXPECT_EQ(peer.deserialize(&out), RPCStatusOK);
+		EXPECT_EQ(out.str(), msg.str());
+	}
+
+	// compressed attachment
+	SRPCStdRequest zreq;
+	SRPCStdRequest zpeer;
+
+	zreq.set_data_type(RPCDataProtobuf);
+	EXPECT_EQ(zreq.serialize(&msg), RPCStatusOK);
+	zreq.set_attachment_nocopy(att.data(), att.size());
+	zreq.set_attachment_compress_type(RPCCompressGzip);
+	EXPECT_EQ(zreq.compress(), RPCStatusOK);
+	EXPECT_TRUE(zreq.set_peer_features(SRPC_FEATURE_KNOWN |
+									   SRPC_FEATURE_ATTACHMENT));
+	EXPECT_TRUE(zreq.serialize_meta());
+	EXPECT_GT(transfer(&zreq, &zpeer, 64), 0);
+	EXPECT_TRUE(zpeer.deserialize_meta());
+	EXPECT_EQ(zpeer.decompress(), RPCStatusOK);
+	EXPECT_TRUE(zpeer.get_attachment_nocopy(&p, &len));
+	EXPECT_EQ(std::string(p, len), att);
+}
+
+class AttachmentPeer : public SRPCStdRequest
+{
+public:
+	// bytes allocated but not received yet, the next acquire() gives them
+	size_t attachment_reserved() const
+	{
+		void *p;
+
+		return this->attachment ? this->attachment->acquire(&p) : 0;
+	}
+};
+
+TEST(SRPCAttachment, oversized_header)
+{
+	char packet[SRPC_HEADER_SIZE + 1];
+	AttachmentPeer peer;
+	size_t size = sizeof packet;
+
+	// no meta, no message, and an attachment of nearly 1GB is claimed
+	memcpy(packet, "SRPC", 4);
+	*(uint32_t *)(packet + 4) = htonl(0);
+	*(uint32_t *)(packet + 8) = htonl(0);
+	*(uint32_t *)(packet + 12) = htonl(0x3FFFFFFF);
+	packet[SRPC_HEADER_SIZE] = 'a';
+
+	EXPECT_EQ(peer.append(packet, &size), 0);
+	EXPECT_EQ(size, sizeof packet);
+	// allocated as the bytes come, never by the header
+	size = peer.attachment_reserved();
+	EXPECT_GT(size, 0U);
+	EXPECT_LE(size, (size_t)BUFFER_PIECE_MAX_SIZE);
+}
+
+static std::string codec_print(const JsonTypes& msg, uint32_t options)
+{
+	std::string out;
+	google::protobuf::io::StringOutputStream stream(&out);
+
+	EXPECT_TRUE(ProtobufJsonCodec::serialize(&msg, options, &stream));
+	return out;
+}
+
+static std::string protobuf_print(const JsonTypes& msg, uint32_t options)
+{
+	google::protobuf::util::JsonPrintOptions print_options;
+	std::string out;
+
+	print_options.add_whitespace = options & SRPC_JSON_OPTION_ADD_WHITESPACE;
+	print_options.always_print_enums_as_ints = options & SRPC_JSON_OPTION_ENUM_AS_INITS;
+	print_options.preserve_proto_field_names = options & SRPC_JSON_OPTION_PRESERVE_NAMES;
+	EXPECT_TRUE(google::protobuf::util::MessageToJsonString(msg, &out,
+															print_options).ok());
+	return out;
+}
+
+// map entries are one each, the order of several ones is up to the map
+static void fill_json_types(JsonTypes *msg)
+{
+	msg->set_int32_field(-123);
+	msg->set_int64_field(-9007199254740993LL);
+	msg->set_uint32_field(4294967295U);
+	msg->set_uint64_field(18446744073709551615ULL);
+	msg->set_sint32_field(-7);
+	msg->set_fixed64_field(42);
+	msg->set_double_field(0.1);
+	msg->set_float_field(3.14159f);
+	msg->set_bool_field(true);
+	msg->set_string_field("quote\" back\\ <tag> \n\t\x01 \xe4\xb8\xad \xe2\x80\xa8");
+	msg->set_bytes_field(std::string("\x00\xff\x10 bytes", 9));
+	msg->set_enum_field(JSON_TWO);
+	msg->mutable_nested_field()->set_id(1);
+	msg->mutable_nested_field()->set_name("nested");
+	msg->add_repeated_int32(1);
+	msg->add_repeated_int32(-2);
+	msg->add_repeated_string("a");
+	msg->add_repeated_string("");
+	msg->add_repeated_nested()->set_id(3);
+	msg->add_repeated_nested();
+	(*msg->mutable_string_map())["key"] = 1LL << 60;
+	(*msg->mutable_int_map())[-5].set_name("five");
+	msg->set_choice_int(0);
+	msg->add_repeated_enum(JSON_ONE);
+	(*msg->mutable_bool_map())[true] = "yes";
+}
+
+TEST(ProtobufJsonCodec, print)
+{
+	const uint32_t flags[] = {
+		SRPC_JSON_OPTION_ADD_WHITESPACE,
+		SRPC_JSON_OPTION_ENUM_AS_INITS,
+		SRPC_JSON_OPTION_PRESERVE_NAMES,
+	};
+	JsonTypes full;
+	JsonTypes empty;
+	JsonTypes special;
+
+	fill_json_types(&full);
+	special.set_double_field(NAN);
+	special.set_float_field(-INFINITY);
+	special.set_int64_field(0);
+	special.set_string_field("");
+	special.mutable_nested_field();
+	special.set_choice_str("s");
+	special.add_repeated_int32(0);
+
+	for (uint32_t mask = 0; mask < (1U << 3); mask++)
+	{
+		uint32_t options = 0;
+
+		for (int i = 0; i < 3; i++)
+		{
+			if (mask & (1U << i))
+				options |= flags[i];
+		}
+
+		for (const JsonTypes *msg : { &full, &empty, &special })
+		{
+			EXPECT_TRUE(ProtobufJsonCodec::supported(msg, options));
+			EXPECT_EQ(codec_print(*msg, options), protobuf_print(*msg, options))
+				<< "options " << options;
+		}
+	}
+
+	for (float f : { 0.1f, 1e-40f, 3.4028235e38f, 16777217.0f, -0.0f })
+	{
+		JsonTypes msg;
+
+		msg.set_float_field(f);
+		msg.set_double_field(f);
+		EXPECT_EQ(codec_print(msg, 0), protobuf_print(msg, 0));
+	}
+
+	// google::protobuf::util adds the fields in an order of its own version
+	EXPECT_FALSE(ProtobufJsonCodec::supported(&full,
+								SRPC_JSON_OPTION_FIELDS_NO_PRECENCE));
+}
+
+// both accept or both reject, into the same message
+static void expect_parse_as_protobuf(const std::string& json)
+{
+	google::protobuf::util::JsonParseOptions options;
+	google::protobuf::io::ArrayInputStream stream(json.data(), (int)json.size());
+	JsonTypes codec_msg;
+	JsonTypes pb_msg;
+	bool codec_ok = ProtobufJsonCodec::deserialize(&stream, &codec_msg);
+
+	options.ignore_unknown_fields = true;
+	bool pb_ok = google::protobuf::util::JsonStringToMessage(json, &pb_msg,
+															options).ok();
+
+	EXPECT_EQ(codec_ok, pb_ok) << json;
+	if (codec_ok && pb_ok)
+	{
+		EXPECT_TRUE(google::protobuf::util::MessageDifferencer::Equals(codec_msg,
+																	  pb_msg))
+			<< json;
+	}
+}
+
+TEST(ProtobufJsonCodec, parse)
+{
+	JsonTypes full;
+
+	fill_json_types(&full);
+	(*full.mutable_string_map())["second"] = -1;
+	(*full.mutable_int_map())[7].set_id(7);
+
+	for (uint32_t options : { 0, SRPC_JSON_OPTION_ADD_WHITESPACE,
+							  SRPC_JSON_OPTION_ENUM_AS_INITS |
+							  SRPC_JSON_OPTION_PRESERVE_NAMES })
+	{
+		expect_parse_as_protobuf(codec_print(full, options));
+	}
+
+	const char *inputs[] = {
+		// lenient
+		"{}",
+		" \n{ } \t",
+		"{\"int32Field\":\"12\",\"int64Field\":34,\"uint64Field\":1e3}",
+		"{\"int32_field\":1.0,\"doubleField\":\"Infinity\",\"floatField\":\"-Infinity\"}",
+		"{\"doubleField\":\"1.5\",\"floatField\":1e10}",
+		"{\"enumField\":\"JSON_ONE\",\"repeatedEnum\":[1,\"JSON_TWO\"]}",
+		"{\"enumField\":\"NO_SUCH_VALUE\"}",
+		"{\"bytesField\":\"AP8Q\",\"repeatedString\":[\"x\"]}",
+		"{\"bytesField\":\"_-8\"}",
+		"{\"stringField\":null,\"nestedField\":null,\"repeatedInt32\":null}",
+		"{\"stringField\":\"\\u4e2d\\ud83d\\ude00\\/\"}",
+		"{\"stringMap\":{\"a\":\"1\",\"b\":2},\"intMap\":{\"-1\":{\"id\":1}}}",
+		"{\"boolMap\":{\"false\":\"no\"}}",
+		"{\"choiceStr\":\"s\"}",
+		"{\"repeatedNested\":[{},{\"name\":\"n\"}]}",
+		// unknown fields
+		"{\"unknown\":1,\"int32Field\":5}",
+		"{\"unknown\":{\"a\":[1,{\"b\":null}],\"c\":\"d\"},\"boolField\":true}",
+		"{\"unknown\":[[[]]],\"unknown2\":false}",
+		// malformed
+		"",
+		"{",
+		"[]",
+		"{\"int32Field\":}",
+		"{\"int32Field\":1,}",
+		"{\"int32Field\":1 \"int64Field\":2}",
+		"{\"int32Field\":2147483648}",
+		"{\"int32Field\":1.5}",
+		"{\"uint32Field\":-1}",
+		"{\"boolField\":\"true\"}",
+		"{\"boolField\":1}",
+		"{\"stringField\":1}",
+		"{\"stringField\":\"\\ud800\"}",
+		"{\"bytesField\":\"A\"}",
+		"{\"bytesField\":\"!!!!\"}",
+		"{\"floatField\":1e39}",
+		"{\"doubleField\":\"Inf\"}",
+		"{\"repeatedInt32\":[1,]}",
+		"{\"nestedField\":[]}",
+		"{\"uint64Field\":\"1e3\"}",
+		"{\"uint64Field\":1.8446744073709552e19}",
+		"{\"int64Field\":9.2233720368547758e18}",
+		"{\"intMap\":{\"x\":{}}}",
+		"{} {}",
+		"{\"unknown\":[1,}",
+	};
+
+	for (const char *json : inputs)
+		expect_parse_as_protobuf(json);
+
+	// protobuf before 22.0 takes these, its later versions refuse them
+	const char *strict[] = {
+		"{int32Field:1}",
+		"{'int32Field':1}",
+		"{\"stringField\":\"\\x\"}",
+		"{\"stringField\":\"raw\ncontrol\"}",
+		"{\"repeatedInt32\":1}",
+		"{\"boolMap\":{\"yes\":\"no\"}}",
+	};
+
+	for (const char *json : strict)
+	{
+		google::protobuf::io::ArrayInputStream stream(json, (int)strlen(json));
+		JsonTypes msg;
+
+		EXPECT_FALSE(ProtobufJsonCodec::deserialize(&stream, &msg)) << json;
+	}
+
+	// NaN is never equal to itself for MessageDifferencer
+	const char *nan = "{\"doubleField\":\"NaN\",\"floatField\":\"NaN\"}";
+	google::protobuf::io::ArrayInputStream nan_stream(nan, (int)strlen(nan));
+	JsonTypes nan_msg;
+
+	EXPECT_TRUE(ProtobufJsonCodec::deserialize(&nan_stream, &nan_msg));
+	EXPECT_TRUE(std::isnan(nan_msg.double_field()));
+	EXPECT_TRUE(std::isnan(nan_msg.float_field()));
+
+	// deeper than JSON_MAX_DEPTH
+	std::string deep = "{\"unknown\":";
+
+	for (int i = 0; i < 200; i++)
+		deep += "[";
+	for (int i = 0; i < 200; i++)
+		deep += "]";
+	deep += "}";
+
+	google::protobuf::io::ArrayInputStream stream(deep.data(), (int)deep.size());
+	JsonTypes msg;
+
+	EXPECT_FALSE(ProtobufJsonCodec::deserialize(&stream, &msg));
+}
+
+TEST(ProtobufResolverCache, lru)
+{
+	using google::protobuf::DescriptorPool;
+	const DescriptorPool *generated = DescriptorPool::generated_pool();
+	DescriptorPool pool0(generated);
+	DescriptorPool pool1(generated);
+	DescriptorPool pool2(generated);
+	const DescriptorPool *pools[3] = { &pool0, &pool1, &pool2 };
+	size_t misses = ProtobufResolverCache::get_misses();
+	size_t hits = ProtobufResolverCache::get_hits();
+
+	// not registered, never kept
+	ProtobufResolverCache::get(pools[0]);
+	ProtobufResolverCache::get(pools[0]);
+	EXPECT_EQ(ProtobufResolverCache::get_misses(), misses + 2);
+	EXPECT_EQ(ProtobufResolverCache::get_hits(), hits);
+
+	ProtobufResolverCache::set_max_size(2);
+	{
+		ProtobufResolverCache::Registration r0(pools[0]);
+		ProtobufResolverCache::Registration r1(pools[1]);
+		ProtobufResolverCache::Registration r2(pools[2]);
+
+		misses = ProtobufResolverCache::get_misses();
+		hits = ProtobufResolverCache::get_hits();
+		auto resolver = ProtobufResolverCache::get(pools[0]);
+
+		EXPECT_EQ(ProtobufResolverCache::get(pools[0]), resolver);
+		ProtobufResolverCache::get(pools[1]);
+		// pools[0] is the least recently used one
+		ProtobufResolverCache::get(pools[2]);
+		EXPECT_EQ(ProtobufResolverCache::get_misses(), misses + 3);
+		EXPECT_EQ(ProtobufResolverCache::get_hits(), hits + 1);
+
+		EXPECT_NE(ProtobufResolverCache::get(pools[0]), resolver);
+		ProtobufResolverCache::get(pools[2]);
+		EXPECT_EQ(ProtobufResolverCache::get_misses(), misses + 4);
+		EXPECT_EQ(ProtobufResolverCache::get_hits(), hits + 2);
+
+		// a resolver stays usable after it is dropped
+		std::string url = "type.googleapis.com/unit.JsonTypes";
+		google::protobuf::Type type;
+
+		EXPECT_TRUE(resolver->ResolveMessageType(url, &type).ok());
+	}
+
+	// invalidated with the registrations
+	misses = ProtobufResolverCache::get_misses();
+	ProtobufResolverCache::get(pools[2]);
+	EXPECT_EQ(ProtobufResolverCache::get_misses(), misses + 1);
+
+	// always kept
+	EXPECT_EQ(ProtobufResolverCache::get(generated),
+			  ProtobufResolverCache::get(generated));
+	ProtobufResolverCache::set_max_size(64);
+}
+
+class MethodIDService : public RPCService
+{
+public:
+	MethodIDService(const std::string& name,
+					const std::vector<std::string>& methods) :
+		RPCService(name)
+	{
+		for (const auto& method : methods)
+			this->add_method(method, [](RPCWorker&) { return 0; });
+	}
+};
+
+TEST(RPCMethodTable, collision)
+{
+	static_assert(unit::TestPB::METHOD_ID_Add ==
+				  RPC_METHOD_ID("unit.TestPB", "Add"), "generated");
+
+	// the two methods of unit.Collide have the same ID
+	uint32_t collide = RPC_METHOD_ID("unit.Collide", "M32889");
+
+	ASSERT_EQ(collide, RPC_METHOD_ID("unit.Collide", "M1059454"));
+
+	std::vector<std::string> many;
+
+	for (int i = 0; i < 100; i++)
+		many.push_back("Method" + std::to_string(i));
+
+	MethodIDService a("unit.Collide", { "M32889", "M1059454", "Echo" });
+	MethodIDService b("other.Collide", { "Echo" });
+	MethodIDService c("unit.Many", many);
+	RPCMethodTable table;
+	const RPCService *service;
+	const std::string *method_name;
+	const RPCCompressPolicy *policy = NULL;
+	bool use_arena = false;
+	uint32_t entry_id;
+
+	table.add_service(&a);
+	table.add_service(&b);
+	table.add_service(&c);
+
+	// by the names instead
+	EXPECT_EQ(table.find(collide, &service, &method_name, &use_arena,
+						 &policy, &entry_id), nullptr);
+	EXPECT_NE(a.find_method("M32889", &use_arena, &policy, &entry_id),
+			  nullptr);
+	EXPECT_EQ(entry_id, collide);
+
+	// "Collide.Echo" is a method of both
+	EXPECT_EQ(table.find(RPC_METHOD_ID("Collide", "Echo"), &service,
+						 &method_name, &use_arena, &policy, &entry_id),
+			  nullptr);
+
+	ASSERT_NE(table.find(RPC_METHOD_ID("unit.Collide", "Echo"), &service,
+						 &method_name, &use_arena, &policy, &entry_id),
+			  nullptr);
+	EXPECT_EQ(service, &a);
+	EXPECT_EQ(*method_name, "Echo");
+	EXPECT_EQ(entry_id, RPC_METHOD_ID("unit.Collide", "Echo"));
+
+	ASSERT_NE(table.find(RPC_METHOD_ID("other.Collide", "Echo"), &service,
+						 &method_name, &use_arena, &policy, &entry_id),
+			  nullptr);
+	EXPECT_EQ(service, &b);
+
+	for (const auto& method : many)
+	{
+		// the short name finds the entry of the full name
+		ASSERT_NE(table.find(RPC_METHOD_ID("Many", method.c_str()), &service,
+							 &method_name, &use_arena, &policy, &entry_id),
+				  nullptr);
+		EXPECT_EQ(service, &c);
+		EXPECT_EQ(*method_name, method);
+		EXPECT_EQ(entry_id, RPC_METHOD_ID("unit.Many", method.c_str()));
+	}
+
+	EXPECT_EQ(table.find(RPC_METHOD_ID("unit.Many", "Unknown"), &service,
+						 &method_name, &use_arena, &policy, &entry_id),
+			  nullptr);
+	EXPECT_EQ(table.find(0, &service, &method_name, &use_arena,
+						 &policy, &entry_id), nullptr);
+}
+
+TEST(SRPCRequest, method_id_only)
+{
+	SRPCStdRequest req;
+	SRPCStdRequest peer;
+	uint32_t id = unit::TestPB::METHOD_ID_Add;
+
+	req.set_service_name("unit.TestPB");
+	req.set_method_name("Add");
+	req.set_data_type(RPCDataProtobuf);
+	req.set_method_id(id);
+
+	// the names only
+	EXPECT_TRUE(req.serialize_meta());
+	ASSERT_GT(transfer(&req, &peer, 64), 0);
+	ASSERT_TRUE(peer.deserialize_meta());
+	EXPECT_EQ(peer.get_method_id(), 0);
+	EXPECT_EQ(peer.get_method_name(), "Add");
+
+	// the id only
+	SRPCStdRequest req2;
+	SRPCStdRequest peer2;
+
+	req2.set_service_name("unit.TestPB");
+	req2.set_method_name("Add");
+	req2.set_data_type(RPCDataProtobuf);
+	req2.set_method_id(id);
+	req2.set_method_id_only(true);
+	EXPECT_TRUE(req2.serialize_meta());
+	ASSERT_GT(transfer(&req2, &peer2, 64), 0);
+	ASSERT_TRUE(peer2.deserialize_meta());
+	EXPECT_EQ(peer2.get_method_id(), id);
+	EXPECT_TRUE(peer2.get_method_name().empty());
+	EXPECT_TRUE(peer2.get_service_name().empty());
+}
+
+// a header of SRPC_META_V2 and the meta, no body
+static bool parse_meta_v2(const std::string& meta)
+{
+	SRPCStdRequest req;
+	char header[SRPC_HEADER_SIZE] = { 'S', 'R', 'P', '2' };
+	size_t size = SRPC_HEADER_SIZE;
+
+	*(uint32_t *)(header + 4) = htonl((uint32_t)meta.size());
+	if (req.append(header, &size) != (meta.empty() ? 1 : 0))
+		return false;
+
+	size = meta.size();
+	if (!meta.empty() && req.append(meta.data(), &size) != 1)
+		return false;
+
+	return req.deserialize_meta();
+}
+
+TEST(SRPCMetaV2, round_trip)
+{
+	std::string trace_id(SRPC_TRACEID_SIZE, 't');
+	std::string span_id(SRPC_SPANID_SIZE, 's');
+	RPCModuleData data = { { SRPC_TRACE_ID, trace_id },
+						   { SRPC_SPAN_ID, span_id },
+						   { "key", "value" } };
+	RPCModuleData out;
+	SRPCStdRequest req;
+	SRPCStdRequest peer;
+
+	req.set_service_name("unit.TestPB");
+	req.set_method_name("Add");
+	req.set_data_type(RPCDataProtobuf);
+	req.set_compress_type(RPCCompressGzip);
+	req.set_meta_version(SRPC_META_V2);
+	req.set_seqid(7);
+	req.set_meta_module_data(data);
+
+	// V1 until the peer has shown it can receive V2
+	EXPECT_TRUE(req.set_peer_features(SRPC_FEATURE_KNOWN));
+	EXPECT_TRUE(req.serialize_meta());
+	ASSERT_GT(transfer(&req, &peer, 64), 0);
+	ASSERT_TRUE(peer.deserialize_meta());
+	EXPECT_EQ(peer.get_meta_version(), SRPC_META_V1);
+	EXPECT_EQ(peer.get_peer_features() & SRPC_FEATURE_META_V2,
+			  SRPC_FEATURE_META_V2);
+
+	SRPCStdRequest peer2;
+
+	EXPECT_TRUE(req.set_peer_features(peer.get_peer_features()));
+	EXPECT_TRUE(req.serialize_meta());
+	ASSERT_GT(transfer(&req, &peer2, 64), 0);
+	ASSERT_TRUE(peer2.deserialize_meta());
+	EXPECT_EQ(peer2.get_meta_version(), SRPC_META_V2);
+	EXPECT_EQ(peer2.get_service_name(), "unit.TestPB");
+	EXPECT_EQ(peer2.get_method_name(), "Add");
+	EXPECT_EQ(peer2.get_data_type(), RPCDataProtobuf);
+	EXPECT_EQ(peer2.get_compress_type(), RPCCompressGzip);
+	EXPECT_EQ(peer2.get_seqid(), 7);
+	EXPECT_EQ(peer2.get_peer_features(), peer.get_peer_features());
+	EXPECT_TRUE(peer2.get_meta_module_data(out));
+	EXPECT_EQ(out[SRPC_TRACE_ID], trace_id);
+	EXPECT_EQ(out[SRPC_SPAN_ID], span_id);
+	EXPECT_EQ(out["key"], "value");
+
+	SRPCStdResponse resp;
+	SRPCStdResponse peer_resp;
+
+	resp.set_meta_version(SRPC_META_V2);
+	resp.set_seqid(7);
+	resp.set_status_code(RPCStatusMethodNotFound);
+	resp.set_error(EINVAL);
+	EXPECT_TRUE(resp.set_peer_features(peer2.get_peer_features()));
+	EXPECT_TRUE(resp.serialize_meta());
+	ASSERT_GT(transfer(&resp, &peer_resp, 64), 0);
+	ASSERT_TRUE(peer_resp.deserialize_meta());
+	EXPECT_EQ(peer_resp.get_meta_version(), SRPC_META_V2);
+	EXPECT_EQ(peer_resp.get_seqid(), 7);
+	EXPECT_EQ(peer_resp.get_status_code(), RPCStatusMethodNotFound);
+	EXPECT_EQ(peer_resp.get_error(), EINVAL);
+}
+
+TEST(SRPCMetaV2, malformed)
+{
+	SRPCStdRequest req;
+	std::string trace_id(SRPC_TRACEID_SIZE, 't');
+	RPCModuleData data = { { SRPC_TRACE_ID, trace_id }, { "key", "value" } };
+	struct iovec vectors[8];
+	std::string meta;
+
+	req.set_service_name("unit.TestPB");
+	req.set_method_name("Add");
+	req.set_meta_version(SRPC_META_V2);
+	req.set_meta_module_data(data);
+	req.set_peer_features(SRPC_FEATURE_KNOWN | SRPC_FEATURE_META_V2);
+	ASSERT_TRUE(req.serialize_meta());
+	ASSERT_EQ(req.encode(vectors, 8), 2);
+	meta.assign((const char *)vectors[1].iov_base, vectors[1].iov_len);
+	ASSERT_TRUE(parse_meta_v2(meta));
+
+	// the fixed fields, the trace id and the names at least
+	size_t min = SRPC_META_V2_SIZE + SRPC_TRACEID_SIZE + strlen("unit.TestPB") +
+				 strlen("Add");
+
+	for (size_t n = 0; n < meta.size(); n++)
+	{
+		bool ret = parse_meta_v2(meta.substr(0, n));
+
+		if (n < min)
+		{
+			EXPECT_FALSE(ret) << n;
+		}
+	}
+
+	std::string bad = meta;
+
+	// unknown flags
+	bad[0] = 8;
+	EXPECT_FALSE(parse_meta_v2(bad));
+
+	// names longer than the meta
+	bad = meta;
+	*(uint16_t *)&bad[40] = htons(0xFFFF);
+	EXPECT_FALSE(parse_meta_v2(bad));
+
+	bad = meta;
+	*(uint16_t *)&bad[42] = htons((uint16_t)(meta.size() - min + 4));
+	EXPECT_FALSE(parse_meta_v2(bad));
+
+	// not protobuf after the names
+	bad = meta.substr(0, min) + std::string(4, '\xFF');
+	EXPECT_FALSE(parse_meta_v2(bad));
+}
+
+static void eject(RPCLoadBalancer *lb, size_t index)
+{
+	for (int i = 0; i < RPC_LB_MAX_FAILS; i++)
+		lb->end(index, lb->begin(index), true);
+}
+
+TEST(RPCLoadBalancer, weighted_round_robin)
+{
+	std::vector<RPCEndpoint> endpoints = { { "127.0.0.1", 1412, 1 },
+										   { "127.0.0.1", 1413, 2 },
+										   { "127.0.0.1", 1414, 0 } };
+	RPCLoadBalancer lb(RPCLoadBalanceWeightedRoundRobin, endpoints);
+	size_t counts[3] = { 0 };
+
+	// a weight of 0 is taken as 1
+	for (int i = 0; i < 400; i++)
+		counts[lb.select()]++;
+
+	EXPECT_EQ(counts[0], 100);
+	EXPECT_EQ(counts[1], 200);
+	EXPECT_EQ(counts[2], 100);
+
+	eject(&lb, 1);
+	for (int i = 0; i < 400; i++)
+		EXPECT_NE(lb.select(), 1);
+
+	// back by a request that succeeds
+	lb.end(1, lb.begin(1), false);
+	counts[1] = 0;
+	for (int i = 0; i < 400; i++)
+		counts[lb.select()]++;
+
+	EXPECT_EQ(counts[1], 200);
+
+	// all ejected, as if none was
+	for (size_t i = 0; i < endpoints.size(); i++)
+		eject(&lb, i);
+
+	for (int i = 0; i < 400; i++)
+		EXPECT_LT(lb.select(), 3);
+}
+
+TEST(RPCLoadBalancer, two_choices)
+{
+	std::vector<RPCEndpoint> endpoints = { { "127.0.0.1", 1412, 1 },
+										   { "127.0.0.1", 1413, 1 } };
+	RPCLoadBalancer lb(RPCLoadBalancePowerOfTwoChoices, endpoints);
+	long long start = lb.begin(0);
+
+	// the two choices are always both of them
+	for (int i = 0; i < 100; i++)
+		EXPECT_EQ(lb.select(), 1);
+
+	lb.end(0, start, false);
+	eject(&lb, 1);
+	for (int i = 0; i < 100; i++)
+		EXPECT_EQ(lb.select(), 0);
+
+	// consistent hash without a key is the same
+	RPCLoadBalancer hash_lb(RPCLoadBalanceConsistentHash, endpoints);
+
+	start = hash_lb.begin(1);
+	for (int i = 0; i < 100; i++)
+		EXPECT_EQ(hash_lb.select(), 0);
+
+	hash_lb.end(1, start, false);
+}
+
+TEST(RPCLoadBalancer, claim)
+{
+	std::vector<RPCEndpoint> endpoints = { { "127.0.0.1", 1412, 1 },
+										   { "127.0.0.1", 1413, 1 } };
+	RPCLoadBalancer lb(RPCLoadBalanceWeightedRoundRobin, endpoints);
+
+	EXPECT_TRUE(lb.claim(0));
+	EXPECT_TRUE(lb.claim(0));
+
+	// no probe before the period is over, selecting it takes none either
+	eject(&lb, 1);
+	for (int i = 0; i < 100; i++)
+		EXPECT_EQ(lb.select(), 0);
+
+	EXPECT_FALSE(lb.claim(1));
+	EXPECT_TRUE(lb.claim(0));
+
+	// all ejected, selected as if none was, but none is claimed
+	eject(&lb, 0);
+	EXPECT_LT(lb.select(), 2);
+	EXPECT_FALSE(lb.claim(0));
+
+	// back by a request that succeeds
+	lb.end(1, lb.begin(1), false);
+	EXPECT_TRUE(lb.claim(1));
+	EXPECT_EQ(lb.select(), 1);
+}
+
+TEST(RPCLoadBalancer, ring)
+{
+	std::vector<RPCEndpoint> endpoints = { { "10.0.0.1", 1412, 1 },
+										   { "10.0.0.2", 1412, 1 },
+										   { "10.0.0.3", 1412, 2 } };
+	RPCLoadBalancer lb(RPCLoadBalanceConsistentHash, endpoints);
+	RPCLoadBalancer same(RPCLoadBalanceConsistentHash, endpoints);
+	std::vector<RPCEndpoint> fewer(endpoints.begin(), endpoints.begin() + 2);
+	RPCLoadBalancer lb2(RPCLoadBalanceConsistentHash, fewer);
+	std::vector<size_t> owners;
+	size_t counts[3] = { 0 };
+
+	for (int i = 0; i < 4000; i++)
+	{
+		std::string key = "key" + std::to_string(i);
+		uint64_t h = RPCLoadBalancer::hash(key.data(), key.size());
+		size_t index = lb.select(h);
+
+		// the same ring in every process
+		EXPECT_EQ(same.select(h), index);
+		EXPECT_EQ(lb.select(h), index);
+		// only the keys of the removed one move
+		if (index != 2)
+		{
+			EXPECT_EQ(lb2.select(h), index);
+		}
+
+		owners.push_back(index);
+		counts[index]++;
+	}
+
+	// by the weights, roughly
+	EXPECT_GT(counts[0], 600);
+	EXPECT_GT(counts[1], 600);
+	EXPECT_GT(counts[2], 1400);
+
+	// the keys of an ejected one go to the next on the ring, the rest stay
+	eject(&lb, 0);
+	for (int i = 0; i < 4000; i++)
+	{
+		std::string key = "key" + std::to_string(i);
+		size_t index = lb.select(RPCLoadBalancer::hash(key.data(), key.size()));
+
+		if (owners[i] == 0)
+		{
+			EXPECT_NE(index, 0);
+		}
+		else
+		{
+			EXPECT_EQ(index, owners[i]);
+		}
+	}
+}
+
+TEST(RPCCircuitBreaker, states)
+{
+	RPCBreakerPolicy policy = { 0.5, 100, 4, 1000, 50 };
+	RPCCircuitBreaker breaker(policy, "127.0.0.1:1412", 1, "Echo");
+	long long now = 1000000;
+	int changed;
+
+	// not before min_requests
+	EXPECT_EQ(breaker.end(now, now, true), -1);
+	EXPECT_EQ(breaker.end(now, now, true), -1);
+	EXPECT_EQ(breaker.end(now, now, false), -1);
+	EXPECT_TRUE(breaker.allow(now, &changed));
+	EXPECT_EQ(breaker.end(now, now, true), RPCBreakerOpen);
+	EXPECT_EQ(breaker.get_state(), RPCBreakerOpen);
+
+	EXPECT_FALSE(breaker.allow(now + 49000, &changed));
+
+	// one probe at a time, open again by a failure
+	EXPECT_TRUE(breaker.allow(now + 50000, &changed));
+	EXPECT_EQ(changed, RPCBreakerHalfOpen);
+	EXPECT_FALSE(breaker.allow(now + 50000, &changed));
+	EXPECT_EQ(breaker.end(now + 50000, now + 51000, true), RPCBreakerOpen);
+	EXPECT_FALSE(breaker.allow(now + 60000, &changed));
+
+	// a probe gone for open_ms lets another one through
+	now += 101000;
+	EXPECT_TRUE(breaker.allow(now, &changed));
+	EXPECT_FALSE(breaker.allow(now + 49000, &changed));
+	EXPECT_TRUE(breaker.allow(now + 50000, &changed));
+	EXPECT_EQ(changed, -1);
+
+	// closed by a success, with a new window
+	EXPECT_EQ(breaker.end(now + 50000, now + 51000, false), RPCBreakerClosed);
+	EXPECT_TRUE(breaker.allow(now + 52000, &changed));
+	EXPECT_EQ(breaker.end(now, now + 52000, true), -1);
+
+	// slower than slow_ms is a failure
+	now += 2000000;
+	EXPECT_EQ(breaker.end(now, now + 1000, false), -1);
+	EXPECT_EQ(breaker.end(now, now + 101000, false), -1);
+	EXPECT_EQ(breaker.end(now, now + 101000, false), -1);
+	EXPECT_EQ(breaker.end(now, now + 101000, false), RPCBreakerOpen);
+}
+
+TEST(RPCBreaker, get)
+{
+	RPCBreakerPolicy policy = { 0.5, 0, 4, 1000, 50 };
+	RPCBreaker breaker(policy, { "127.0.0.1:1412", "127.0.0.1:1413" });
+	uint32_t id = RPC_METHOD_ID("unit.Collide", "M32889");
+	RPCCircuitBreaker *a = breaker.get(0, id, "M32889");
+
+	EXPECT_EQ(breaker.get(0, id, "M32889"), a);
+	EXPECT_EQ(a->get_endpoint(), "127.0.0.1:1412");
+	EXPECT_EQ(a->get_method_name(), "M32889");
+
+	// the same id of another method, or another endpoint
+	RPCCircuitBreaker *b = breaker.get(0, id, "M1059454");
+	RPCCircuitBreaker *c = breaker.get(1, id, "M32889");
+
+	EXPECT_NE(b, a);
+	EXPECT_EQ(breaker.get(0, id, "M1059454"), b);
+	EXPECT_NE(c, a);
+	EXPECT_EQ(c->get_endpoint(), "127.0.0.1:1413");
+
+	// the methods beyond the slots share one
+	std::vector<RPCCircuitBreaker *> breakers;
+	std::vector<std::string> names;
+
+	for (size_t i = 0; i < RPC_BREAKER_METHODS; i++)
+		names.push_back("Method" + std::to_string(i));
+
+	for (const auto& name : names)
+		breakers.push_back(breaker.get(1, RPC_METHOD_ID("unit.Many",
+														name.c_str()), name));
+
+	EXPECT_EQ(breakers.back(), breaker.get(1, 0, "Other"));
+	EXPECT_EQ(breaker.get(1, id, "M32889"), c);
+	for (size_t i = 0; i < names.size() - 2; i++)
+	{
+		EXPECT_EQ(breakers[i]->get_method_name(), names[i]);
+		EXPECT_EQ(breaker.get(1, RPC_METHOD_ID("unit.Many", names[i].c_str()),
+							  names[i]), breakers[i]);
+	}
+
+	// one for a method, whichever call makes it
+	std::vector<RPCCircuitBreaker *> got(8);
+	std::vector<std::thread> threads;
+
+	for (size_t i = 0; i < got.size(); i++)
+	{
+		threads.emplace_back([&breaker, &got, i]() {
+			got[i] = breaker.get(0, 7, "Concurrent");
+		});
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+
+	for (auto *p : got)
+		EXPECT_EQ(p, got[0]);
+}
+
+TEST(RPCRetryBudget, ratio)
+{
+	RPCRetryBudget budget(0.1);
+
+	// the burst it starts with
+	for (int i = 0; i < RPC_RETRY_BURST; i++)
+		EXPECT_TRUE(budget.spend());
+
+	EXPECT_FALSE(budget.spend());
+
+	// a whole one for every ten requests
+	for (int i = 0; i < 9; i++)
+		budget.earn();
+
+	EXPECT_FALSE(budget.spend());
+	budget.earn();
+	EXPECT_TRUE(budget.spend());
+	EXPECT_FALSE(budget.spend());
+
+	// saved up to the burst at most
+	for (int i = 0; i < 1000; i++)
+		budget.earn();
+
+	for (int i = 0; i < RPC_RETRY_BURST; i++)
+		EXPECT_TRUE(budget.spend());
+
+	EXPECT_FALSE(budget.spend());
+}
+
+TEST(RPCHedge, get_stats)
+{
+	RPCHedge hedge(0.1);
+	uint32_t id = RPC_METHOD_ID("unit.Collide", "M32889");
+	RPCHedgeStats *a = hedge.get_stats(id, "M32889");
+
+	EXPECT_EQ(hedge.get_stats(id, "M32889"), a);
+	EXPECT_EQ(a->get_method_name(), "M32889");
+
+	// the same id of another method
+	RPCHedgeStats *b = hedge.get_stats(id, "M1059454");
+
+	EXPECT_NE(b, a);
+	EXPECT_EQ(hedge.get_stats(id, "M1059454"), b);
+
+	// the methods beyond the slots share one
+	std::vector<RPCHedgeStats *> stats;
+
+	for (size_t i = 0; i < RPC_HEDGE_METHODS; i++)
+	{
+		std::string name = "Method" + std::to_string(i);
+
+		stats.push_back(hedge.get_stats(RPC_METHOD_ID("unit.Many", name.c_str()),
+										name));
+	}
+
+	EXPECT_EQ(stats.back(), hedge.get_stats(0, "Other"));
+	EXPECT_EQ(stats.back()->get_method_name(), "");
+	EXPECT_EQ(hedge.get_stats(id, "M32889"), a);
+}
+
+// the bytes encode() sends
+template<class MSG>
+static std::string encoded(MSG *msg)
+{
+	struct iovec vectors[64];
+	int cnt = msg->encode(vectors, 64);
+
+	return cnt < 0 ? std::string() : iov_to_string(vectors, cnt);
+}
+
+template<class REQ>
+static void expect_shared(REQ *req)
+{
+	REQ hedge;
+	std::string bytes;
+
+	ASSERT_TRUE(req->serialize_meta());
+	ASSERT_TRUE(req->share_to(&hedge, 0));
+	bytes = encoded(req);
+	EXPECT_FALSE(bytes.empty());
+	EXPECT_EQ(encoded(&hedge), bytes);
+}
+
+TEST(RPCHedge, share_request)
+{
+	std::string att(5000, 'a');
+	SubstrRequest msg;
+	TestThrift::substrRequest thrift_msg;
+	SRPCStdRequest sreq;
+	SRPCStdRequest shedge;
+	BRPCStdRequest breq;
+	TRPCStdRequest treq;
+	ThriftStdRequest threq;
+	const void *body;
+	const void *shared;
+
+	msg.set_str(std::string(10000, 'x'));
+	msg.set_idx(0);
+	sreq.set_service_name("TestPB");
+	sreq.set_method_name("Substr");
+	sreq.set_data_type(RPCDataProtobuf);
+	ASSERT_EQ(sreq.serialize(&msg), RPCStatusOK);
+	sreq.set_attachment_nocopy(att.data(), att.size());
+	ASSERT_TRUE(sreq.set_peer_features(SRPC_FEATURE_KNOWN |
+									   SRPC_FEATURE_ATTACHMENT));
+	ASSERT_TRUE(sreq.serialize_meta());
+	ASSERT_TRUE(sreq.share_to(&shedge, SRPC_FEATURE_KNOWN |
+										SRPC_FEATURE_ATTACHMENT));
+
+	// the body is not copied
+	EXPECT_GT(sreq.get_buffer()->peek(&body), 0u);
+	EXPECT_GT(shedge.get_buffer()->peek(&shared), 0u);
+	EXPECT_EQ(body, shared);
+
+	// but the attachment is, the user may free it before a late attempt
+	std::string bytes = encoded(&sreq);
+
+	att.assign(att.size(), 'b');
+	EXPECT_FALSE(bytes.empty());
+	EXPECT_EQ(encoded(&shedge), bytes);
+
+	// an older endpoint can not receive the attachment
+	SRPCStdRequest old;
+
+	EXPECT_FALSE(sreq.share_to(&old, SRPC_FEATURE_KNOWN));
+
+	breq.set_service_name("TestPB");
+	breq.set_method_name("Substr");
+	ASSERT_EQ(breq.serialize(&msg), RPCStatusOK);
+	expect_shared(&breq);
+
+	treq.set_service_name("TestPB");
+	treq.set_method_name("Substr");
+	ASSERT_EQ(treq.serialize(&msg), RPCStatusOK);
+	expect_shared(&treq);
+
+	thrift_msg.str = std::string(10000, 'x');
+	threq.set_method_name("substr");
+	ASSERT_EQ(threq.serialize(&thrift_msg), RPCStatusOK);
+	expect_shared(&threq);
+}
+
+TEST(RPCHedge, share_meta_version)
+{
+	SubstrRequest msg;
+	SubstrRequest in;
+	SRPCStdRequest req;
+	SRPCStdRequest old;
+	SRPCStdRequest old_peer;
+	SRPCStdRequest v2;
+	SRPCStdRequest v2_peer;
+	uint32_t v2_features = SRPC_FEATURE_KNOWN | SRPC_FEATURE_ATTACHMENT |
+						   SRPC_FEATURE_META_V2;
+
+	msg.set_str(std::string(100, 'x'));
+	msg.set_idx(0);
+	req.set_service_name("TestPB");
+	req.set_method_name("Substr");
+	req.set_data_type(RPCDataProtobuf);
+	req.set_method_id(7);
+	req.set_method_id_only(true);
+	req.set_meta_version(SRPC_META_V2);
+	req.set_seqid(3);
+	ASSERT_EQ(req.serialize(&msg), RPCStatusOK);
+	ASSERT_TRUE(req.set_peer_features(v2_features));
+	ASSERT_TRUE(req.serialize_meta());
+
+	// SRPC_META_V2 goes only to the endpoints that can receive it
+	ASSERT_TRUE(req.share_to(&old, SRPC_FEATURE_KNOWN));
+	ASSERT_GT(transfer(&old, &old_peer, 64), 0);
+	ASSERT_TRUE(old_peer.deserialize_meta());
+	EXPECT_EQ(old_peer.get_meta_version(), SRPC_META_V1);
+	EXPECT_EQ(old_peer.get_method_id(), 7u);
+	EXPECT_EQ(old_peer.deserialize(&in), RPCStatusOK);
+	EXPECT_EQ(in.str(), msg.str());
+
+	// and the other way around
+	ASSERT_TRUE(old.share_to(&v2, v2_features));
+	ASSERT_GT(transfer(&v2, &v2_peer, 64), 0);
+	ASSERT_TRUE(v2_peer.deserialize_meta());
+	EXPECT_EQ(v2_peer.get_meta_version(), SRPC_META_V2);
+	EXPECT_EQ(v2_peer.get_method_id(), 7u);
+	EXPECT_EQ(v2_peer.get_seqid(), 3u);
+}
+
+// a hedged task with the reply of an attempt given to it
+template<class REQ, class RESP>
+class HedgeTask : public RPCClientTask<REQ, RESP>
+{
+public:
+	class Attempt : public RPCClientTask<REQ, RESP>::attempt_task_t
+	{
+	public:
+		Attempt() : RPCClientTask<REQ, RESP>::attempt_task_t(0, nullptr) { }
+		void set_state(int state) { this->state = state; }
+	};
+
+	HedgeTask() :
+		RPCClientTask<REQ, RESP>("TestPB", "Substr", 0, &RPC_TASK_PARAMS_DEFAULT,
+								 std::list<RPCModule *>(), nullptr)
+	{
+	}
+
+	void reply(Attempt *attempt, std::atomic<uint32_t> *features)
+	{
+		this->hedge_done(attempt, 1, features);
+	}
+};
+
+// a reply received by an attempt and given to the task, as the server sends it
+template<class REQ, class RESP, class IDL>
+static void expect_moved(RESP *resp, const IDL *out, IDL *in,
+						 int compress_type, int status_code,
+						 std::atomic<uint32_t> *features)
+{
+	HedgeTask<REQ, RESP> task;
+	typename HedgeTask<REQ, RESP>::Attempt attempt;
+
+	resp->set_status_code(status_code);
+	resp->set_compress_type(compress_type);
+	ASSERT_EQ(resp->serialize(out), RPCStatusOK);
+	ASSERT_EQ(resp->compress(), RPCStatusOK);
+	ASSERT_TRUE(resp->serialize_meta());
+	ASSERT_GT(transfer(resp, attempt.get_resp(), 64), 0);
+	attempt.set_state(WFT_STATE_SUCCESS);
+	task.reply(&attempt, features);
+
+	RESP *task_resp = task.get_resp();
+
+	EXPECT_EQ(task.get_state(), WFT_STATE_SUCCESS);
+	EXPECT_EQ(task.get_attempt(), 1);
+	EXPECT_EQ(task_resp->get_status_code(), status_code);
+	EXPECT_EQ(task_resp->get_compress_type(), compress_type);
+	EXPECT_EQ(task_resp->decompress(), RPCStatusOK);
+	EXPECT_EQ(task_resp->deserialize(in), RPCStatusOK);
+}
+
+TEST(RPCHedge, move_response)
+{
+	SubstrResponse out;
+	SubstrResponse in;
+	TestThrift::substrResponse thrift_out;
+	TestThrift::substrResponse thrift_in;
+	SRPCStdResponse sresp;
+	SRPCStdResponse snotfound;
+	BRPCStdResponse bresp;
+	TRPCStdResponse tresp;
+	ThriftStdResponse thresp;
+	std::atomic<uint32_t> features(0);
+
+	out.set_str(std::string(10000, 'x'));
+	sresp.set_data_type(RPCDataProtobuf);
+	expect_moved<SRPCStdRequest>(&sresp, &out, &in, RPCCompressGzip,
+								 RPCStatusOK, &features);
+	EXPECT_EQ(in.str(), out.str());
+	// of the endpoint the reply is from
+	EXPECT_EQ(features.load(), SRPC_FEATURE_KNOWN | SRPC_FEATURE_ATTACHMENT |
+							   SRPC_FEATURE_META_V2);
+
+	// an error of the server is kept, the features are still learned
+	in.Clear();
+	features = 0;
+	snotfound.set_data_type(RPCDataProtobuf);
+	expect_moved<SRPCStdRequest>(&snotfound, &out, &in, RPCCompressNone,
+								 RPCStatusMethodNotFound, &features);
+	EXPECT_NE(features.load(), 0u);
+
+	in.Clear();
+	expect_moved<BRPCStdRequest>(&bresp, &out, &in, RPCCompressGzip,
+								 RPCStatusOK, NULL);
+	EXPECT_EQ(in.str(), out.str());
+
+	in.Clear();
+	expect_moved<TRPCStdRequest>(&tresp, &out, &in, RPCCompressGzip,
+								 RPCStatusOK, NULL);
+	EXPECT_EQ(in.str(), out.str());
+
+	thrift_out.result = std::string(10000, 'x');
+	expect_moved<ThriftStdRequest>(&thresp, &thrift_out, &thrift_in,
+								   RPCCompressNone, RPCStatusOK, NULL);
+	EXPECT_EQ(thrift_in.result, thrift_out.result);
+}